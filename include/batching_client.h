@@ -0,0 +1,52 @@
+#ifndef BATCHING_CLIENT_H
+#define BATCHING_CLIENT_H
+
+#include <Arduino.h>
+#include <Client.h>
+
+// Client wrapper that can hold writes back and hand them to the wrapped
+// client in one call. Sits between PubSubClient and SSLClient so a burst of
+// PUBLISH packets becomes one TLS record (one AT+CIPSEND) instead of one per
+// message. Outside a batch every call passes straight through.
+class BatchingClient : public Client {
+public:
+    static const size_t BUFFER_SIZE = 2048;  // Held bytes are flushed early at this size
+
+    explicit BatchingClient(Client& inner);
+    ~BatchingClient();
+
+    // Start holding writes
+    void beginBatch();
+
+    // Write everything held and stop holding (false if any inner write failed)
+    bool endBatch();
+
+    // Number of successful inner writes so far (lets callers see early flushes)
+    uint32_t getFlushCount() const { return _flushCount; }
+
+    // Client
+    int connect(IPAddress ip, uint16_t port) override { return _inner.connect(ip, port); }
+    int connect(const char* host, uint16_t port) override { return _inner.connect(host, port); }
+    size_t write(uint8_t b) override { return write(&b, 1); }
+    size_t write(const uint8_t* buf, size_t size) override;
+    int available() override { return _inner.available(); }
+    int read() override { return _inner.read(); }
+    int read(uint8_t* buf, size_t size) override { return _inner.read(buf, size); }
+    int peek() override { return _inner.peek(); }
+    void flush() override;
+    void stop() override;
+    uint8_t connected() override { return _inner.connected(); }
+    operator bool() override { return (bool)_inner; }
+
+private:
+    bool flushHeld();
+
+    Client& _inner;
+    uint8_t* _buffer;
+    size_t _length;
+    bool _batching;
+    bool _failed;
+    uint32_t _flushCount;
+};
+
+#endif // BATCHING_CLIENT_H
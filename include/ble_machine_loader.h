@@ -6,16 +6,22 @@
 #include <BLEServer.h>
 #include <BLEUtils.h>
 #include <BLE2902.h>
+#include <mbedtls/sha256.h>
 #include "logger.h"
+#include "constants.h"
+#include "domain.h"
+#include "trace.h"
 
 // BLE Service UUID for Machine Loading
 #define MACHINE_LOAD_SERVICE_UUID      "6e400001-b5a3-f393-e0a9-e50e24dcca9e"
 #define USER_ID_CHAR_UUID              "6e400002-b5a3-f393-e0a9-e50e24dcca9e"
 #define USER_NAME_CHAR_UUID            "6e400003-b5a3-f393-e0a9-e50e24dcca9e"
 #define TOKENS_CHAR_UUID               "6e400004-b5a3-f393-e0a9-e50e24dcca9e"
-#define LOAD_COMMAND_CHAR_UUID         "6e400005-b5a3-f393-e0a9-e50e24dcca9e"  // Format: "LOAD|authToken"
+#define LOAD_COMMAND_CHAR_UUID         "6e400005-b5a3-f393-e0a9-e50e24dcca9e"  // Format: "LOAD[bay]|authToken"
 #define LOAD_STATUS_CHAR_UUID          "6e400006-b5a3-f393-e0a9-e50e24dcca9e"
 #define MACHINE_STATE_CHAR_UUID        "6e400007-b5a3-f393-e0a9-e50e24dcca9e"
+#define MACHINE_STATUS_CHAR_UUID       "6e400008-b5a3-f393-e0a9-e50e24dcca9e"  // Packed BleMachineStatus
+#define TRACE_DUMP_CHAR_UUID           "6e400009-b5a3-f393-e0a9-e50e24dcca9e"  // Trace dump stream (notify)
 
 // BLE Authorization Secret (must match backend BLE_AUTH_SECRET)
 // Default for development - MUST be changed in production
@@ -24,19 +30,68 @@
 // BLE Device name for machine loading
 #define BLE_MACHINE_DEVICE_NAME "FullWash-"
 
+// Requested on connect so status strings are not cut at the 20-byte default
+const uint16_t BLE_PREFERRED_MTU = 185;
+// Connection parameters (interval in 1.25 ms units, timeout in 10 ms units).
+// Fast while the user is interacting, slow once nothing but the countdown
+// has changed for BLE_FAST_CONN_HOLD_MS.
+const uint16_t BLE_FAST_CONN_MIN_INTERVAL = 12;   // 15 ms
+const uint16_t BLE_FAST_CONN_MAX_INTERVAL = 24;   // 30 ms
+const uint16_t BLE_FAST_CONN_LATENCY = 0;
+const uint16_t BLE_FAST_CONN_TIMEOUT = 400;       // 4 s
+const uint16_t BLE_SLOW_CONN_MIN_INTERVAL = 160;  // 200 ms
+const uint16_t BLE_SLOW_CONN_MAX_INTERVAL = 320;  // 400 ms
+const uint16_t BLE_SLOW_CONN_LATENCY = 2;
+const uint16_t BLE_SLOW_CONN_TIMEOUT = 500;       // 5 s
+const unsigned long BLE_FAST_CONN_HOLD_MS = 5000;
+
+// Load progress reported in the packed status
+enum BleLoadStatus : uint8_t {
+    BLE_LOAD_READY = 0,
+    BLE_LOAD_CONNECTED,
+    BLE_LOAD_DATA_RECEIVED,  // User ID, user name or tokens accepted
+    BLE_LOAD_SUCCESS,
+    BLE_LOAD_ERROR
+};
+
+// MACHINE_STATUS_CHAR_UUID value, little-endian. Notified once per change
+// (state, load status, tokens or countdown), right after the controller
+// update that caused it.
+const uint8_t BLE_STATUS_VERSION = 1;
+struct __attribute__((packed)) BleMachineStatus {
+    uint8_t version;       // BLE_STATUS_VERSION
+    uint8_t state;         // MachineState
+    uint8_t loadStatus;    // BleLoadStatus
+    uint8_t bay;           // Bay the status describes (0 on single-bay builds)
+    uint16_t tokens;       // Tokens left
+    uint16_t secondsLeft;  // Session time left, as on the display
+};
+
 // Forward declaration
 class CarWashController;
 
-// Machine loading data structure
+// Auth token: userId|machineId|tokens|timestamp|signature (hex HMAC-SHA256)
+const size_t AUTH_TOKEN_MAX_LENGTH = 255;
+const size_t LOAD_ERROR_MAX_LENGTH = 63;
+const size_t AUTH_SIGNATURE_LENGTH = 32;  // HMAC-SHA256 digest (64 hex chars in the token)
+// Longest signed part (userId|machineId|tokens|timestamp) of a maximal token
+const size_t AUTH_PAYLOAD_MAX_LENGTH = AUTH_TOKEN_MAX_LENGTH - 1 - AUTH_SIGNATURE_LENGTH * 2;
+// Recently verified tokens kept so a retried LOAD skips the HMAC; entries
+// expire with the same 5 minute window as the token age check
+const uint8_t AUTH_CACHE_SIZE = 4;
+const unsigned long AUTH_CACHE_TTL_MS = 300000;
+
+// Machine loading data structure (strings stored inline, no heap)
 struct MachineLoadData {
-    String userId;
-    String userName;
+    UserIdString userId;
+    UserNameString userName;
     int tokens;
-    String authToken;  // Authorization token from backend
+    uint8_t bay;  // Target bay ("LOAD<bay>|token", bay 0 without a number)
+    FixedString<AUTH_TOKEN_MAX_LENGTH> authToken;  // Authorization token from backend
     unsigned long tokenReceivedTime;  // When token was received (millis())
     bool loadRequested;
     bool loadComplete;
-    String errorMessage;
+    FixedString<LOAD_ERROR_MAX_LENGTH> errorMessage;
 };
 
 class BLEMachineLoader : public BLEServerCallbacks, public BLECharacteristicCallbacks {
@@ -49,31 +104,85 @@ private:
     BLECharacteristic* pLoadCommandCharacteristic;  // Format: "LOAD|authToken"
     BLECharacteristic* pLoadStatusCharacteristic;
     BLECharacteristic* pMachineStateCharacteristic;
+    BLECharacteristic* pMachineStatusCharacteristic;
+    BLECharacteristic* pTraceCharacteristic;
     
     bool deviceConnected;
     bool bleInitialized;
     MachineLoadData loadData;
-    CarWashController* controller;  // Reference to controller for loading machine
+    // One controller per bay; the token's machine ID must be the target bay's
+    // bayMachineId(). The status characteristics follow the last bay addressed.
+    CarWashController* controllers[MAX_BAYS];
+    uint8_t bayCount;
+    CarWashController* controller;  // controllers[statusBay]
+    uint8_t statusBay;
     String machineId;  // Machine ID for advertising name
     
+    // Last values sent, so only changes go out
+    BleMachineStatus lastStatus;
+    bool statusSent;
+    volatile BleLoadStatus loadStatus;
+    MachineState lastNotifiedState;
+    bool stateNotified;
+    
+    // Connection parameter state for the connected peer
+    esp_bd_addr_t peerAddress;
+    volatile bool peerKnown;
+    volatile bool fastConnection;
+    volatile unsigned long lastInteraction;
+    
+    // Trace dump requested with "TRACE|password" (service password of the
+    // config manager), streamed from loop() by streamTrace()
+    TraceCursor traceCursor;
+    volatile bool traceRequested;
+    
+    // HMAC key schedule: SHA-256 state after the ipad and opad key blocks,
+    // computed once in begin() and cloned for every signature
+    mbedtls_sha256_context hmacInner;
+    mbedtls_sha256_context hmacOuter;
+    bool hmacReady;
+    
+    struct VerifiedToken {
+        uint8_t signature[AUTH_SIGNATURE_LENGTH];
+        // Full signed payload: a hit must be byte-identical to what the HMAC
+        // covered, a hash of it could be forged to match
+        char payload[AUTH_PAYLOAD_MAX_LENGTH];
+        uint16_t payloadLength;
+        unsigned long verifiedAt;  // millis() when the HMAC matched
+        unsigned long lastUsed;    // LRU order
+        bool valid;
+    };
+    VerifiedToken verifiedTokens[AUTH_CACHE_SIZE];
+    
     // Callback handlers
     void onWrite(BLECharacteristic* pCharacteristic) override;
     void onConnect(BLEServer* pServer) override;
+    void onConnect(BLEServer* pServer, esp_ble_gatts_cb_param_t* param) override;
     void onDisconnect(BLEServer* pServer) override;
+    void onMtuChanged(BLEServer* pServer, esp_ble_gatts_cb_param_t* param) override;
     
     // Helper methods
-    void updateLoadStatusCharacteristic(const String& status);
-    void updateMachineStateCharacteristic(const String& state);
+    void updateLoadStatusCharacteristic(BleLoadStatus code, const char* status);
+    void updateMachineStateCharacteristic(const char* state);
     void resetLoadData();
     void processLoadCommand();
-    bool validateAuthToken(const String& token, const String& userId, const String& machineId, int tokens);
+    void selectStatusBay(uint8_t bay);
+    void failLoad(const char* message);
+    void requestTraceDump(const char* password);
+    void requestConnectionParams(bool fast);
+    void noteInteraction();
+    bool validateAuthToken(const char* token, size_t length, const char* userId, const char* machineId, int tokens);
+    bool prepareAuthKey();
+    bool computeAuthSignature(const char* payload, size_t length, uint8_t* digest);
+    bool findVerifiedToken(const uint8_t* signature, const char* payload, size_t payloadLength);
+    void rememberVerifiedToken(const uint8_t* signature, const char* payload, size_t payloadLength);
     
 public:
     BLEMachineLoader();
     ~BLEMachineLoader();
     
-    // Initialize BLE for machine loading
-    bool begin(const String& machineId, CarWashController* ctrl);
+    // Initialize BLE for machine loading (one controller per bay, bay 0 first)
+    bool begin(const String& machineId, CarWashController* const* ctrls, uint8_t count);
     
     // Start/stop advertising
     void startAdvertising();
@@ -82,6 +191,9 @@ public:
     // Check if a device is connected
     bool isConnected();
     
+    // Advertising should run while this is true
+    bool isAnyBayFree() const;
+    
     // Check if initialized
     bool isInitialized();
     
@@ -91,11 +203,18 @@ public:
     // Update method (call regularly)
     void update();
     
+    // Notify the packed status if it changed (call after every controller update)
+    void publishStatus();
+    
+    // Send the next blocks of a requested trace dump (call from loop())
+    void streamTrace();
+    bool isStreamingTrace() const { return traceRequested || traceCursor.active; }
+    
     // Check if load is complete
     bool isLoadComplete();
     
     // Get load data
-    MachineLoadData getLoadData();
+    const MachineLoadData& getLoadData() const;
 };
 
 #endif // BLE_MACHINE_LOADER_H
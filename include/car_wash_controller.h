@@ -2,12 +2,18 @@
 #define CAR_WASH_CONTROLLER_H
 
 #include "mqtt_lte_client.h"
+#include "mqtt_message_pool.h"
 #include "utilities.h"
 #include <ArduinoJson.h>
 #include <algorithm>
 #include "domain.h"
 #include "constants.h"
 #include "logger.h"
+#include "wire_format.h"
+#include "mqtt_inbound.h"
+#include "rtc_manager.h"
+#include "input_event_queue.h"
+#include "deadline_scheduler.h"
 #include <freertos/FreeRTOS.h>
 #include <freertos/queue.h>
 
@@ -15,43 +21,69 @@
 // External reference to the MQTT publish queue (defined in main.cpp)
 extern QueueHandle_t xMqttPublishQueue;
 
+class IoExpander;
+
 class CarWashController {
 public:
-    CarWashController(MqttLteClient& client);
-    void handleMqttMessage(const char* topic, const uint8_t* payload, uint32_t len);
-    void handleButtons();
-    void handleCoinAcceptor();
+    // One controller per bay: its own IO expander (buttons, coins, relays),
+    // topic row and display mailbox (one-slot DisplaySnapshot queue read by
+    // the display task, NULL when the bay has no display). All bays share the
+    // MQTT client, message pool and publish queue.
+    CarWashController(MqttLteClient& client, uint8_t bay, IoExpander& io, QueueHandle_t displayMailbox);
+    void handleMqttMessage(MqttTopicId topic, const uint8_t* payload, unsigned int len);
+    // Start a session (INIT message or BLE load); strings are copied into inline buffers
+    void loadSession(const char* sessionId, const char* userId, const char* userName, int tokens, const char* timestamp);
+    void handleInputEvents();  // Drain queued coin/button events in capture order
+    bool waitForInput(TickType_t timeout);  // Block until an input event, the next deadline, or timeout
+    void handleButtons(const InputEvent& event);
+    void handleCoinAcceptor(const InputEvent& event);
     void pauseMachine();
     void resumeMachine(int buttonIndex);
     void stopMachine(TriggerType triggerType = AUTOMATIC);
     void activateButton(int buttonIndex, TriggerType triggerType = MANUAL);
     void tokenExpired();
     void update();
+    // ACTION_TOPIC events are critical: they go through the flash outbox.
+    // The SETUP event may be requested from any task; update() publishes it.
     void publishMachineSetupActionEvent();
     void publishCoinInsertedEvent();
+    // Publish the profiler's last sample on STATS_TOPIC (summary, histograms, task batches)
+    void publishStats();
+    // Send a full state keyframe from the next update(); the publisher calls
+    // this when it drops a state message, the network task after a reconnect
+    void requestKeyframe() { keyframeRequested = true; }
+    // Queue an already encoded payload (trace dump blocks); false if the pool or queue is full
+    bool queueMqttPayload(MqttTopicId topic, const uint8_t* payload, size_t length, uint8_t qos, bool isCritical);
     
-    // Debug method to simulate a coin insertion
+    // Debug method to simulate a coin insertion (any task; credited by the next update())
     void simulateCoinInsertion();
     
     // Debug method to print current relay states
     void printRelayStates();
     
     // Getter methods
+    uint8_t getBay() const { return bay; }
     MachineState getCurrentState() const;
     bool isMachineLoaded() const;
+    size_t formatTimestamp(char* buffer, size_t size);  // ISO 8601, no heap use (ISO_TIMESTAMP_SIZE bytes)
     String getTimestamp();
     void setLogLevel(LogLevel level);
     
     // Additional getters for LCD display
-    String getUserName() const { return config.userName; }
+    const char* getUserName() const { return config.userName.c_str(); }
     int getTokensLeft() const { return config.tokens; }
     unsigned long getTimeToInactivityTimeout() const;
     unsigned long getSecondsLeft();
     unsigned long getGracePeriodSecondsLeft() const; // Get remaining grace period time (0 if not active)
     int getActiveButton() const { return activeButton; } // Get current active button index (-1 if none)
+    // Last snapshot handed to the display task (false before the first update)
+    bool getDisplaySnapshot(DisplaySnapshot& snapshot) const;
 
 private:
     MqttLteClient& mqttClient;
+    const uint8_t bay;
+    IoExpander& io;
+    QueueHandle_t displayMailbox;
     MachineState currentState;
     MachineConfig config;
     
@@ -66,32 +98,99 @@ private:
     bool gracePeriodActive; // Whether the grace period is currently active
     int tokensConsumedCount; // Track how many tokens have been consumed in current session
 
-    static const unsigned long DEBOUNCE_DELAY = 100;
+    // Session deadlines (armed on state transitions, fired from update())
+    enum ControllerTimer : uint8_t {
+        TIMER_GRACE_PERIOD = 0,  // gracePeriodStartTime + GRACE_PERIOD_TIMEOUT
+        TIMER_INACTIVITY = 1,    // lastActionTime + getInactivityTimeout() (IDLE/PAUSED)
+        TIMER_TOKEN = 2          // tokenStartTime + remaining token time
+    };
+    DeadlineScheduler timers;
+    unsigned long graceExpiryHandledAt; // gracePeriodStartTime whose expiry was already handled
+    volatile bool timersDirty; // Set by transitions, consumed by update()
+
     static const unsigned long PAUSE_RESUME_COOLDOWN = 500; // Minimum time between pause/resume (500ms)
     static const unsigned long FUNCTION_SWITCH_COOLDOWN = 500; // Minimum time after function switch before same button can pause (500ms)
     // Note: Coin detection constants moved to constants.h (COIN_STARTUP_DELAY, COIN_COOLDOWN_MS, etc.)
-    unsigned long lastDebounceTime[NUM_BUTTONS + 1];
-    int lastButtonState[NUM_BUTTONS + 1];
     unsigned long lastCoinDebounceTime;
     unsigned long lastCoinProcessedTime; // Track when a coin was last successfully processed
     int lastCoinState;
+#ifdef COIN_PCNT_PIN
+    bool coinCounterStartup;     // Still inside COIN_STARTUP_DELAY; pulses are discarded
+    uint32_t coinRejectsLogged;  // Rejected pulse count already reported
+#endif
 
+    // State publishing: fields that changed since the last update() go out as a
+    // delta right away; a full keyframe is sent on a long heartbeat
+    enum StateField : uint16_t {
+        FIELD_STATE = 1 << 0,
+        FIELD_TOKENS = 1 << 1,
+        FIELD_PHYSICAL_TOKENS = 1 << 2,
+        FIELD_ACTIVE_BUTTON = 1 << 3,
+        FIELD_GRACE_PERIOD = 1 << 4,
+        FIELD_SESSION = 1 << 5,   // session_id, user_id, user_name
+        FIELD_LOADED = 1 << 6,
+        FIELD_ALL = (1 << 7) - 1
+    };
+    struct StateSnapshot {
+        MachineState state;
+        int tokens;
+        int physicalTokens;
+        int activeButton;
+        bool gracePeriodActive;
+        unsigned long gracePeriodStartTime;
+        bool isLoaded;
+        SessionIdString sessionId;
+        UserIdString userId;
+    };
+    StateSnapshot lastObservedState;
+    uint16_t pendingStateFields; // Changed since the last successful delta
+    uint32_t stateSequence; // Incremented per state message so the backend can spot gaps
     unsigned long lastStatePublishTime;
-    const unsigned long STATE_PUBLISH_INTERVAL = 10000;
+    unsigned long lastKeyframeTime;
+    unsigned long statePublishRetryAt; // Backoff after the queue rejected a state message
+    volatile bool keyframeRequested; // Set by get_state/requestKeyframe(), consumed by update()
+    // State and action messages are built on this arena instead of the heap
+    // (controller task only): one slot pool (1 KB on the ESP32, 2 KB on 64-bit
+    // hosts) plus the session strings
+    static const size_t STATE_ARENA_SIZE = 3072;
+    alignas(8) uint8_t stateArena[STATE_ARENA_SIZE];
+    ArenaAllocator stateAllocator;
 
     void diagnosticCoinSignal();
     void processCoinInsertion(unsigned long currentTime);
+#ifdef COIN_PCNT_PIN
+    void handleCoinCounter(); // Consume pulses counted by the PCNT peripheral
+#endif
     void autoConsumeToken(); // Automatically consume a token and transition to PAUSED
     void consumeNextToken(); // Consume next token when current one expires
     void switchFunction(int newButtonIndex); // Switch to a different function while RUNNING
     unsigned long getInactivityTimeout() const; // Calculate dynamic inactivity timeout based on tokens
+    void rescheduleTimers(); // Re-arm session deadlines from the current state
+    void setState(MachineState state); // Every state transition goes through here (traced)
+    void runExpiredTimers(unsigned long currentTime);
+    void onGracePeriodExpired(unsigned long currentTime);
+    void onInactivityTimeout(unsigned long currentTime);
+    void onTokenTimeExpired(unsigned long currentTime);
+
+    void publishActionEvent(int buttonIndex, MachineAction machineAction, TriggerType triggerType = MANUAL);
+    volatile bool setupEventRequested; // Set by publishMachineSetupActionEvent(), consumed by update()
+    volatile bool simulatedCoinRequested; // Set by simulateCoinInsertion(), consumed by update()
+    // Display snapshot pushed to displayMailbox when it changes (at most 1 Hz
+    // while counting down, never while FREE)
+    DisplaySnapshot lastDisplaySnapshot;
+    bool displaySnapshotSent;
+    bool buildDisplaySnapshot(DisplaySnapshot& snapshot);
+    void publishDisplaySnapshot();
 
-    // void publishActionEvent(int buttonIndex, MachineAction machineAction, TriggerType triggerType = MANUAL);
-    // void publishPeriodicState(bool force = false);
-    // void publishStateOnDemand();  // Publish state on demand with high priority (QOS1)
+    uint16_t collectDirtyStateFields();
+    void publishStateChanges(unsigned long currentTime);
+    bool publishState(uint16_t fields, bool keyframe);
+    bool hasMqttPublisher() const; // false when nothing would ever send a queued message
     
     // Helper method to queue MQTT messages for the dedicated publisher task
-    bool queueMqttMessage(const char* topic, const char* payload, uint8_t qos, bool isCritical);
+    bool queueMqttMessage(MqttTopicId topic, const char* payload, uint8_t qos, bool isCritical);
+    // Encode doc in the environment's wire format (JSON or MessagePack) and queue it
+    bool queueMqttDocument(MqttTopicId topic, const JsonDocument& doc, uint8_t qos, bool isCritical);
 };
 
 #endif
\ No newline at end of file
@@ -16,6 +16,10 @@
  * Display Layout:
  * - Top display (digits 0-3): Shows tokens as decimal (e.g., "01.50" = 1.5 tokens)
  * - Bottom display (digits 4-7): Shows time in MM.SS format (e.g., "02.00" = 2:00 minutes)
+ * 
+ * Digit writes go through a framebuffer: the driver remembers what each digit
+ * register holds and flush() only sends the digits that changed, all under
+ * one hold of the I2C mutex.
  */
 class CH453SDriver {
 public:
@@ -23,9 +27,22 @@ public:
     // but it does NOT use a normal I²C 7-bit slave address. The first transmitted
     // byte is an 8-bit command (e.g. 0x48, 0x60, 0x62...) and must be sent verbatim.
     
-    // Segment patterns for 7-segment display (common cathode, active high)
-    // Bit order: DP G F E D C B A
-    static const uint8_t SEGMENTS[];
+    // Segment patterns for digits 0-9 (common cathode, active high)
+    // Bit order: DP G F E D C B A (CH453 datasheet: SEG7=DP, SEG6-0 = G-A)
+    static constexpr uint8_t SEGMENTS[10] = {
+        0x3F,  // 0: A B C D E F
+        0x06,  // 1: B C
+        0x5B,  // 2: A B D E G
+        0x4F,  // 3: A B C D G
+        0x66,  // 4: B C F G
+        0x6D,  // 5: A C D F G
+        0x7D,  // 6: A C D E F G
+        0x07,  // 7: A B C
+        0x7F,  // 8: A B C D E F G
+        0x6F,  // 9: A B C D F G
+    };
+    
+    static const uint8_t DIGIT_REGISTERS = 16;  // DIG0-DIG15 (8 are wired)
     
     /**
      * Constructor
@@ -57,52 +74,85 @@ public:
      * NOTE: Despite the name, this now displays on the BOTTOM display (digits 4-7)
      * @param value Time in seconds (0-5999, max 99:59)
      * @param leadingZeros Unused (kept for compatibility)
+     * @return true if the frame reached the chip (false: retry later)
      */
-    void displayTopNumber(uint16_t value, bool leadingZeros = false);
+    bool displayTopNumber(uint16_t value, bool leadingZeros = false);
     
     /**
      * Display token count with decimal places
      * NOTE: Despite the name, this now displays on the TOP display (digits 0-3)
      * @param value Token count to display (0.00-99.99, e.g., 1.00 tokens)
      * @param decimalPlaces Number of decimal places (use 2 for TT.UU formatting)
+     * @return true if the frame reached the chip (false: retry later)
+     */
+    bool displayBottomDecimal(float value, uint8_t decimalPlaces = 1);
+    
+    /**
+     * Display token count from fixed point (no float math)
+     * NOTE: Despite the name, this displays on the TOP display (digits 0-3)
+     * @param hundredths Tokens x100 (0-9999, e.g., 150 = "01.50")
+     * @return true if the frame reached the chip (false: retry later)
      */
-    void displayBottomDecimal(float value, uint8_t decimalPlaces = 1);
+    bool displayBottomFixed(uint16_t hundredths);
     
     /**
-     * Display raw segment data on a specific digit
+     * Display raw segment data on a specific digit (written immediately if it changed)
      * @param digit Digit position (0-7, 0-3=top, 4-7=bottom)
      * @param segments Segment pattern (bit 0=A, bit 1=B, ... bit 7=DP)
+     * @return true if the digit reached the chip (false: retry later)
+     */
+    bool setDigit(uint8_t digit, uint8_t segments);
+    
+    /**
+     * Write all digits whose framebuffer value differs from what the chip holds
+     * @return true if every changed digit was written (failed digits stay dirty)
+     */
+    bool flush();
+    
+    /**
+     * Forget what the chip holds so the next flush() rewrites every digit
+     * (e.g. after the display was power cycled)
+     */
+    void invalidate();
+    
+    /**
+     * Number of digit writes actually sent to the chip (for bus load diagnostics)
      */
-    void setDigit(uint8_t digit, uint8_t segments);
+    uint32_t getDigitWriteCount() const { return _digitWrites; }
     
     /**
      * Display a single character on a digit
      * @param digit Digit position (0-7)
      * @param character Character to display ('0'-'9', '-', ' ', etc.)
      * @param decimal Show decimal point
+     * @return true if the digit reached the chip (false: retry later)
      */
-    void setCharacter(uint8_t digit, char character, bool decimal = false);
+    bool setCharacter(uint8_t digit, char character, bool decimal = false);
     
     /**
      * Clear all digits (turn off all segments)
+     * @return true if the frame reached the chip (false: retry later)
      */
-    void clear();
+    bool clear();
     
     /**
      * Clear only the top display (digits 0-3)
+     * @return true if the frame reached the chip (false: retry later)
      */
-    void clearTop();
+    bool clearTop();
     
     /**
      * Clear only the bottom display (digits 4-7)
+     * @return true if the frame reached the chip (false: retry later)
      */
-    void clearBottom();
+    bool clearBottom();
     
     /**
      * Display "----" on a display to indicate error or loading
      * @param top If true, show on top display; if false, show on bottom
+     * @return true if the frame reached the chip (false: retry later)
      */
-    void displayDashes(bool top = true);
+    bool displayDashes(bool top = true);
     
     /**
      * Turn display on/off
@@ -119,8 +169,9 @@ public:
     /**
      * Test digit order by displaying "0123" on top and "4567" on bottom
      * Use this to verify physical digit mapping
+     * @return true if the frame reached the chip
      */
-    void testDigitOrder();
+    bool testDigitOrder();
     
 private:
     TwoWire& _wire;
@@ -128,6 +179,16 @@ private:
     uint8_t _brightness;
     bool _displayOn;
     
+    uint8_t _frame[DIGIT_REGISTERS];   // What the digits should show
+    uint8_t _shadow[DIGIT_REGISTERS];  // What the chip was last sent
+    uint16_t _knownMask;               // Digits whose _shadow matches the chip
+    uint32_t _digitWrites;
+    
+    /**
+     * Update the framebuffer only (sent by the next flush())
+     */
+    void stageDigit(uint8_t digit, uint8_t segments);
+    
     /**
      * Send a 16-bit command to the CH453S
      * The CH453S uses a unique protocol where commands are split into two bytes
@@ -0,0 +1,93 @@
+#ifndef COIN_COUNTER_H
+#define COIN_COUNTER_H
+
+#include <Arduino.h>
+#include <driver/gpio.h>
+#include <driver/pcnt.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include "logger.h"
+
+/**
+ * Coin pulse counter on a direct GPIO (GPIO interrupt, PCNT for diagnostics)
+ *
+ * Optional coin input path: COIN_SIG is wired to a direct GPIO
+ * (COIN_PCNT_PIN); the coin acceptor pulls the line LOW for each coin.
+ *
+ * Coins are counted by a GPIO interrupt on both edges of the pin: it times
+ * each LOW pulse and only accepts it as a coin once it has lasted
+ * COIN_MIN_PULSE_WIDTH_MS; shorter pulses are counted as rejected.
+ * Accepting a pulse also wakes the consuming task, so a coin is read right
+ * away even when the task sleeps for the low-power wait.
+ *
+ * The PCNT unit counts every falling edge on the same pin. Its glitch filter
+ * only rejects spikes under ~12.8us, so the count includes relay transients
+ * and contact bounce; it is kept for diagnostics (getEdgeCount()) only and
+ * is not used to credit coins.
+ *
+ * Only compiled in when the firmware is built with -DCOIN_PCNT_PIN=<gpio>.
+ */
+class CoinPulseCounter {
+public:
+    /**
+     * @param pin GPIO carrying the coin acceptor signal (active LOW)
+     * @param unit PCNT unit to use
+     */
+    CoinPulseCounter(int pin, pcnt_unit_t unit = PCNT_UNIT_0);
+
+    /**
+     * Configure the PCNT unit, glitch filter and start counting
+     * @return true if the peripheral was configured
+     */
+    bool begin();
+
+    /**
+     * Task to notify (xTaskNotifyGive) on each accepted pulse; set before begin()
+     */
+    void setWakeTask(TaskHandle_t task) { _wakeTask = task; }
+
+    /**
+     * True if a pulse was accepted since the previous call
+     */
+    bool takeWake();
+
+    /**
+     * Pulses of at least COIN_MIN_PULSE_WIDTH_MS since the previous call
+     * (0 if not initialized)
+     */
+    uint32_t takeDelta();
+
+    // Pulses accepted since begin()
+    uint32_t getAcceptedCount() const { return _acceptedCount; }
+    // Pulses shorter than COIN_MIN_PULSE_WIDTH_MS since begin()
+    uint32_t getRejectedCount() const { return _rejectedCount; }
+    // Falling edges counted by PCNT since begin() (noise included, diagnostics only)
+    uint32_t getEdgeCount();
+
+    bool isInitialized() const { return _initialized; }
+
+private:
+    int _pin;
+    pcnt_unit_t _unit;
+    bool _initialized;
+    int16_t _lastCount;
+    uint32_t _edgeCount;
+    uint32_t _takenCount;  // _acceptedCount at the previous takeDelta()
+    TaskHandle_t _wakeTask;
+
+    // Written by onEdge()
+    volatile uint32_t _pulseStartUs;
+    volatile bool _inPulse;
+    volatile uint32_t _acceptedCount;
+    volatile uint32_t _rejectedCount;
+    volatile bool _wakePending;
+
+    static void IRAM_ATTR onEdge(void* arg);
+
+    // Counter wraps back to 0 when it reaches this value
+    static const int16_t COUNTER_LIMIT = 32000;
+    // PCNT filter length is 10 bits of APB (80MHz) cycles, so ~12.8us is the hardware maximum
+    static const uint16_t FILTER_MAX_APB_CYCLES = 1023;
+};
+
+#endif // COIN_COUNTER_H
@@ -29,8 +29,10 @@ const unsigned long BASE_INACTIVE_TIMEOUT = 30000; // 30 seconds base
 const unsigned long SESSION_END_TIMEOUT = 150000; // 2 minutes 30 seconds
 
 // Coin Detection Constants
-// Startup delay before coin detection is active (prevents false triggers at boot)
-const unsigned long COIN_STARTUP_DELAY = 3000;    // 3 seconds
+// Time after power-on before coin detection is active (prevents false triggers
+// while the acceptor powers up; a line still LOW afterwards stays latched
+// until it is first seen idle HIGH)
+const unsigned long COIN_STARTUP_DELAY = 500;     // 500ms since boot
 // Minimum time between valid coin insertions
 const unsigned long COIN_COOLDOWN_MS = 800;       // 800ms - allows rapid successive insertions
 // Number of consecutive stable reads required to validate coin state change
@@ -39,38 +41,131 @@ const int COIN_STABLE_READS_REQUIRED = 2;
 const unsigned long COIN_POLL_INTERVAL_MS = 5;    // 5ms polling interval
 // Minimum pulse width for a valid coin signal (filters out noise spikes)
 const unsigned long COIN_MIN_PULSE_WIDTH_MS = 30; // 30ms minimum pulse
+// Fallback PORT0 poll interval for the input reader when no INT edge arrives
+const unsigned long INPUT_FALLBACK_POLL_MS = 50;  // 50ms - catches missed INT edges
+// Maximum time the controller loop sleeps when no input event arrives
+const unsigned long CONTROLLER_IDLE_WAIT_MS = 50;
+// Retry period of the display task while a frame failed to reach the CH453
+const unsigned long DISPLAY_RETRY_INTERVAL_MS = 500;  // The old fixed refresh period
 
-// MQTT Topics
-extern String MACHINE_ID;  // Changed to String to allow dynamic loading
+// Low-power FREE mode (see PowerManager)
+// Time FREE with no input or BLE client before entering low-power mode
+const unsigned long LOW_POWER_ENTRY_DELAY_MS = 60000;  // 1 minute
+// Idle timeouts while in low-power mode (INT edges still wake the reader at once)
+const unsigned long INPUT_LOWPOWER_POLL_MS = 1000;
+const unsigned long CONTROLLER_LOWPOWER_WAIT_MS = 1000;  // Matches the BLE/LED housekeeping period
+// Dynamic frequency scaling range (80 MHz keeps APB, and so I2C/UART timing, unchanged)
+const int LOW_POWER_MAX_FREQ_MHZ = 240;
+const int LOW_POWER_MIN_FREQ_MHZ = 80;
+
+// LTE/MQTT (-DENABLE_MQTT=1, env:T-SIM7600X-mqtt). Off by default: the board
+// is loaded over BLE only, and the modem, network/publisher tasks, message
+// pool, outbox and publish queue are neither compiled in nor allocated.
+#ifndef ENABLE_MQTT
+#define ENABLE_MQTT 0
+#endif
+
+// Multi-bay builds: one firmware instance drives BAY_COUNT IO expander /
+// controller pairs that share the modem and the MQTT publish queue
+// (-DBAY_COUNT=2 in platformio.ini). Bay 0 is the board's own TCA9535 and
+// keeps the display, BLE loader and PCNT coin counter.
+#ifndef BAY_COUNT
+#define BAY_COUNT 1
+#endif
+const uint8_t MAX_BAYS = 3;
+static_assert(BAY_COUNT >= 1 && BAY_COUNT <= MAX_BAYS, "BAY_COUNT must be 1-3");
+// Extra bays hang off the same Wire bus with the next A0-A2 straps
+const uint8_t BAY_EXPANDER_ADDRESSES[MAX_BAYS] = {TCA9535_ADDR, TCA9535_ADDR + 1, TCA9535_ADDR + 2};
+const int BAY_INT_PINS[MAX_BAYS] = {INT_PIN, BAY1_INT_PIN, BAY2_INT_PIN};  // -1 = no INT line
+// Core for a bay's InputReader and controller tasks (-1 = no affinity; bay 0's
+// controller runs in loop() on core 1)
+const int BAY_TASK_CORES[MAX_BAYS] = {-1, 0, 1};
+// PORT0 poll interval for a bay without an INT line (also in low-power mode,
+// since nothing else would notice a coin)
+const unsigned long INPUT_POLL_NO_INT_MS = 10;
+
+// FreeRTOS task stack sizes (bytes); the profiler reports headroom against these
+const uint32_t INPUT_READER_STACK_SIZE = 4096;
+const uint32_t NETWORK_MANAGER_STACK_SIZE = 16384;  // SSL/TLS requires a large stack
+const uint32_t WATCHDOG_STACK_SIZE = 4096;  // Profiler::sample() and the health checks log from it
+const uint32_t DISPLAY_UPDATE_STACK_SIZE = 4096;
+const uint32_t MQTT_PUBLISHER_STACK_SIZE = 8192;
+const uint32_t BAY_CONTROLLER_STACK_SIZE = 8192;  // Same as the Arduino loop task
+// Short-lived boot init tasks (deleted once their step is done)
+const uint32_t INIT_WIRE1_STACK_SIZE = 3072;
+const uint32_t INIT_BLE_STACK_SIZE = 6144;  // BLEDevice::init + GATT server setup
+const uint32_t RESET_WINDOW_STACK_SIZE = 2048;
+// Time the watchdog waits for the boot init graph before reporting what is missing
+const unsigned long BOOT_INIT_TIMEOUT_MS = 10000;
 
 // Function declarations
-String buildTopicName(const String& machineId, const char* eventType, const String& environment = "prod");
 void updateMQTTTopics(const String& machineId, const String& environment = "prod");  // New function to update topics dynamically
 
-// MQTT Topics (will be initialized dynamically)
-extern String INIT_TOPIC;
-extern String CONFIG_TOPIC;
-extern String ACTION_TOPIC;
-extern String STATE_TOPIC;
-extern String COMMAND_TOPIC;
-extern String GET_STATE_TOPIC;
+// MQTT Topics. Queued messages carry the 1-byte ID and their bay; the
+// strings live in a fixed table (one row per bay) that updateMQTTTopics()
+// rebuilds when the machine ID or environment changes, so nothing is
+// concatenated per message. Safe to call and read from any task.
+enum MqttTopicId : uint8_t {
+    TOPIC_INIT = 0,
+    TOPIC_CONFIG,
+    TOPIC_ACTION,
+    TOPIC_STATE,
+    TOPIC_COMMAND,
+    TOPIC_GET_STATE,
+    TOPIC_STATS,
+    TOPIC_TRACE,  // Binary trace dump blocks (see Trace)
+    TOPIC_COUNT,
+    TOPIC_UNKNOWN = 0xFF
+};
+// Longest topic string: "machines/" + bay machine ID + "/get_state" must fit
+const size_t MQTT_TOPIC_MAX_LENGTH = 63;
+
+// Machine ID a bay reports and subscribes under: the stored machine number
+// for bay 0, "<number>-<bay>" for the others ("99" until it is loaded)
+const char* bayMachineId(uint8_t bay);
+
+// Topic string for an ID ("" for TOPIC_UNKNOWN or an unknown bay)
+const char* mqttTopic(MqttTopicId id, uint8_t bay = 0);
+size_t mqttTopicLength(MqttTopicId id, uint8_t bay = 0);
+// Incoming topic to ID and bay: one prefix compare per bay plus a switch on
+// the suffix length, confirmed against the table (TOPIC_UNKNOWN if not ours)
+MqttTopicId classifyTopic(const char* topic, uint8_t* bay = NULL);
 
 // QoS Levels
 const uint32_t QOS0_AT_MOST_ONCE = 0;
 const uint32_t QOS1_AT_LEAST_ONCE = 1;
 
 // MQTT Message Queue Configuration
-const int MQTT_QUEUE_SIZE = 100;  // Maximum number of messages to buffer (increased to handle bursts)
+// Messages live in MqttMessagePool blocks (PSRAM when available); the queue
+// only carries 2-byte handles, so its depth is the pool's block count.
+const uint16_t MQTT_POOL_BLOCK_SIZES[] = {128, 256, 640};  // Bytes per block (header + payload)
+const uint16_t MQTT_POOL_BLOCK_COUNTS[] = {96, 64, 32};    // Blocks per size class
+const int MQTT_QUEUE_SIZE = 96 + 64 + 32;  // Maximum number of messages to buffer (one per pool block)
 const int MQTT_MESSAGE_MAX_SIZE = 512;  // Maximum size for topic + payload
+const size_t MQTT_OUTBOX_REPLAY_BATCH = 16;  // Outbox records published per replay pass
+const size_t MQTT_BATCH_MAX_MESSAGES = 8;    // Messages coalesced per publishBatch() burst
+const unsigned long MQTT_BATCH_LINGER_MS = 20;  // How long a burst waits for more messages
 
-// MQTT Message Structure for Queue
-struct MqttMessage {
-    char topic[128];        // Topic name
-    char payload[384];      // Message payload (JSON)
-    uint8_t qos;           // Quality of Service (0 or 1)
-    bool isCritical;       // Flag for message priority
-    unsigned long timestamp;  // When message was created
-};
+// State publishing (deltas on change, full keyframe on a heartbeat)
+const unsigned long STATE_KEYFRAME_INTERVAL = 300000;   // Full state snapshot every 5 minutes
+const unsigned long STATE_DELTA_MIN_INTERVAL = 200;     // Coalesce bursts of changes (e.g. coins)
+const unsigned long STATE_PUBLISH_RETRY_MS = 5000;      // Backoff when the publish queue is full
+
+// Modem bring-up and network recovery
+const unsigned long MODEM_WARM_PROBE_MS = 500;       // AT probe: is the modem already powered?
+const unsigned long MODEM_BOOT_TIMEOUT_MS = 15000;   // Max wait for AT after a PWRKEY pulse
+const unsigned long NETWORK_RETRY_MIN_MS = 2000;     // First retry after a failed attach/TLS connect
+const unsigned long NETWORK_RETRY_MAX_MS = 30000;    // Backoff ceiling (was the fixed wait)
+
+// Event trace (see Trace); ring sizes must be powers of two
+const uint32_t TRACE_RING_RECORDS_PSRAM = 8192;     // 96 KB
+const uint32_t TRACE_RING_RECORDS_INTERNAL = 512;   // 6 KB without PSRAM
+const uint32_t TRACE_CONSOLE_DEFAULT_RECORDS = 512; // "trace" dumps the newest 512, "trace all" the ring
+const uint8_t TRACE_SERIAL_BLOCK_RECORDS = 8;       // Records per console line
+const uint8_t TRACE_SERIAL_BLOCKS_PER_PASS = 2;     // Console lines per loop() pass (~40 ms at 115200)
+const uint8_t TRACE_MQTT_BLOCK_RECORDS = 32;        // Records per trace topic message
+const uint8_t TRACE_MQTT_BLOCKS_PER_PASS = 4;
+const uint8_t TRACE_BLE_BLOCKS_PER_PASS = 4;        // Notifications per loop() pass
 
 // Diagnostic flags
 const bool ENABLE_NETWORK_MANAGER_DIAGNOSTICS = true; // Set to true to enable diagnostic messages in Network Manager task and MQTT client
@@ -0,0 +1,44 @@
+#ifndef DEADLINE_SCHEDULER_H
+#define DEADLINE_SCHEDULER_H
+
+#include <Arduino.h>
+
+// Small fixed-slot deadline scheduler. Deadlines are absolute millis() values
+// compared with wrap-safe signed arithmetic. The earliest deadline is cached,
+// so checking for due timers is O(1) when nothing has expired.
+class DeadlineScheduler {
+public:
+    static const uint8_t MAX_TIMERS = 4;
+    static const int8_t NO_TIMER = -1;
+    static const unsigned long NEVER = 0xFFFFFFFFUL;
+
+    DeadlineScheduler();
+
+    // Arm (or re-arm) timer id to fire at the absolute time deadline
+    void armAt(uint8_t id, unsigned long deadline);
+    void cancel(uint8_t id);
+    void cancelAll();
+
+    bool isArmed(uint8_t id) const { return id < MAX_TIMERS && _armed[id]; }
+
+    // True if the earliest deadline has passed
+    bool isDue(unsigned long now) const;
+
+    // Disarm and return the earliest expired timer, or NO_TIMER
+    int8_t popExpired(unsigned long now);
+
+    // Milliseconds until the earliest deadline (0 if due, NEVER if none armed)
+    unsigned long msUntilNext(unsigned long now) const;
+
+private:
+    void recomputeNext();
+    static bool reached(unsigned long now, unsigned long deadline) {
+        return (long)(now - deadline) >= 0;
+    }
+
+    unsigned long _deadline[MAX_TIMERS];
+    bool _armed[MAX_TIMERS];
+    int8_t _next;  // Index of the earliest armed timer
+};
+
+#endif // DEADLINE_SCHEDULER_H
@@ -26,6 +26,9 @@
  * - Example: 2 tokens loaded, each token = 2 minutes (120 seconds)
  *   - After 1 minute used: 1.5 tokens remaining
  *   - After 2 minutes used: 1.0 tokens remaining
+ * 
+ * The controller computes what to show (DisplaySnapshot) and pushes it to the
+ * display task only when it changes, so rendering never reads controller state.
  */
 class DisplayManager {
 public:
@@ -43,10 +46,11 @@ public:
     void setI2CMutex(SemaphoreHandle_t mutex);
     
     /**
-     * Update display based on machine state
-     * @param controller Pointer to car wash controller
+     * Render a snapshot pushed by the controller
+     * @param snapshot State, time left and tokens left to show
+     * @return true if the whole frame reached the chip (false: render again later)
      */
-    void update(CarWashController* controller);
+    bool render(const DisplaySnapshot& snapshot);
     
     /**
      * Clear all displays
@@ -74,59 +78,27 @@ private:
     TwoWire* _wire;
     SemaphoreHandle_t _i2cMutex;
     
-    // Track last values to avoid unnecessary redraws
-    MachineState _lastState;
+    // Last values that reached the chip (skip redraws of an unchanged value)
     unsigned long _lastSecondsLeft;
-    float _lastTokensLeft;
-    unsigned long _lastUpdateTime;
+    uint16_t _lastTokenHundredths;
     
     /**
      * Display FREE state (machine available)
      * Shows "----" on both displays or blank
      */
-    void displayFreeState();
-    
-    /**
-     * Display IDLE state (loaded, waiting for button)
-     * @param controller Pointer to controller for getting state
-     */
-    void displayIdleState(CarWashController* controller);
-    
-    /**
-     * Display RUNNING state (actively washing)
-     * @param controller Pointer to controller for getting state
-     */
-    void displayRunningState(CarWashController* controller);
+    bool displayFreeState();
     
     /**
-     * Display PAUSED state (temporarily stopped)
-     * @param controller Pointer to controller for getting state
-     */
-    void displayPausedState(CarWashController* controller);
-    
-    /**
-     * Update time display (top display)
+     * Update time display (bottom display, MM.SS)
      * @param seconds Time remaining in seconds
      */
-    void updateTimeDisplay(unsigned long seconds);
-    
-    /**
-     * Update tokens display (bottom display)
-     * Shows tokens as a decimal fraction
-     * @param tokensRemaining Integer tokens remaining (not yet started)
-     * @param secondsLeftInCurrentToken Seconds remaining in current token (0 if none)
-     * @param tokenTimeSeconds Total seconds per token
-     */
-    void updateTokensDisplay(int tokensRemaining, unsigned long secondsLeftInCurrentToken, unsigned long tokenTimeSeconds);
+    bool updateTimeDisplay(unsigned long seconds);
     
     /**
-     * Calculate token fraction from time
-     * @param tokensRemaining Whole tokens not yet consumed
-     * @param secondsLeftInCurrentToken Seconds remaining in current token
-     * @param tokenTimeSeconds Total seconds per token
-     * @return Tokens as a decimal (e.g., 1.5)
+     * Update tokens display (top display)
+     * @param tokenHundredths Tokens remaining x100 (e.g. 150 = 1.50 tokens)
      */
-    float calculateTokenFraction(int tokensRemaining, unsigned long secondsLeftInCurrentToken, unsigned long tokenTimeSeconds);
+    bool updateTokensDisplay(uint16_t tokenHundredths);
 };
 
 #endif // DISPLAY_MANAGER_H
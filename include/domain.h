@@ -2,6 +2,7 @@
 #define DOMAIN_H
 
 #include <WString.h>
+#include "fixed_string.h"
 
 // Struct for machine configuration
 // Enum for token types
@@ -10,13 +11,26 @@ enum TokenType {
     PHYSICAL
 };
 
+// Session string capacities (characters, excluding the terminator)
+const size_t SESSION_ID_MAX_LENGTH = 63;
+const size_t USER_ID_MAX_LENGTH = 100;         // Same limit the BLE loader enforces
+const size_t USER_NAME_MAX_LENGTH = 100;
+const size_t SESSION_TIMESTAMP_MAX_LENGTH = 31;
+
+typedef FixedString<SESSION_ID_MAX_LENGTH> SessionIdString;
+typedef FixedString<USER_ID_MAX_LENGTH> UserIdString;
+typedef FixedString<USER_NAME_MAX_LENGTH> UserNameString;
+typedef FixedString<SESSION_TIMESTAMP_MAX_LENGTH> SessionTimestampString;
+
+// Session strings are stored inline so loading, copying and reading a session
+// never touches the heap
 struct MachineConfig {
-    String sessionId;
-    String userId;
-    String userName;
+    SessionIdString sessionId;
+    UserIdString userId;
+    UserNameString userName;
     int tokens;           // Total tokens (digital + physical)
     int physicalTokens;   // Only physical tokens from coin acceptor
-    String timestamp;
+    SessionTimestampString timestamp;
     unsigned long timestampMillis;
     bool isLoaded;
 };
@@ -29,6 +43,14 @@ enum MachineState {
     STATE_PAUSED
 };
 
+// What the 7-segment displays show. Built by the controller and handed to the
+// display task through a one-slot mailbox whenever it changes.
+struct DisplaySnapshot {
+    MachineState state;
+    uint16_t secondsLeft;      // Bottom display, MM.SS (0-9999)
+    uint16_t tokenHundredths;  // Top display, tokens x100 (150 = "01.50")
+};
+
 // Enum for machine actions
 enum MachineAction {
     ACTION_SETUP,
@@ -40,8 +62,8 @@ enum MachineAction {
 };
 
 // Function declarations
-String getMachineActionString(MachineAction action);
-String getMachineStateString(MachineState state);
+const char* getMachineActionString(MachineAction action);
+const char* getMachineStateString(MachineState state);
 
 // Enum for trigger types
 enum TriggerType {
@@ -0,0 +1,66 @@
+#ifndef FIXED_STRING_H
+#define FIXED_STRING_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+// Bounded string stored inline (no heap). Holds up to N characters plus the
+// terminator; longer input is truncated and reported by assign().
+template <size_t N>
+class FixedString {
+public:
+    FixedString() : _length(0) { _data[0] = '\0'; }
+    FixedString(const char* value) : _length(0) { assign(value); }
+
+    // Copy value in (NULL clears); false if it had to be truncated
+    bool assign(const char* value) {
+        return assign(value, value != NULL ? strlen(value) : 0);
+    }
+
+    bool assign(const char* value, size_t length) {
+        bool fits = length <= N;
+        if (!fits) {
+            length = N;
+        }
+        if (length > 0) {
+            memmove(_data, value, length);
+        }
+        _data[length] = '\0';
+        _length = (uint16_t)length;
+        return fits;
+    }
+
+    FixedString& operator=(const char* value) {
+        assign(value);
+        return *this;
+    }
+
+    void clear() {
+        _data[0] = '\0';
+        _length = 0;
+    }
+
+    const char* c_str() const { return _data; }
+    size_t length() const { return _length; }
+    bool isEmpty() const { return _length == 0; }
+    static size_t capacity() { return N; }
+
+    bool operator==(const char* other) const {
+        return other != NULL && strcmp(_data, other) == 0;
+    }
+    bool operator!=(const char* other) const { return !(*this == other); }
+
+    template <size_t M>
+    bool operator==(const FixedString<M>& other) const {
+        return _length == other.length() && memcmp(_data, other.c_str(), _length) == 0;
+    }
+    template <size_t M>
+    bool operator!=(const FixedString<M>& other) const { return !(*this == other); }
+
+private:
+    char _data[N + 1];
+    uint16_t _length;
+};
+
+#endif // FIXED_STRING_H
@@ -0,0 +1,53 @@
+#ifndef INPUT_EVENT_QUEUE_H
+#define INPUT_EVENT_QUEUE_H
+
+#include <Arduino.h>
+#include <atomic>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+// Input event types produced by the InputReader task
+enum InputEventType : uint8_t {
+    INPUT_EVENT_BUTTON_PRESS = 0,  // id = button index (0..NUM_BUTTONS-1)
+    INPUT_EVENT_COIN = 1           // id unused (0)
+};
+
+struct InputEvent {
+    InputEventType type;
+    uint8_t id;
+    unsigned long timestamp;  // millis() of the captured edge
+};
+
+// Lock-free single-producer/single-consumer ring buffer.
+// push() may only be called from one task (InputReader) and pop()/wait()
+// from one other task (the controller loop).
+class InputEventQueue {
+public:
+    static const uint32_t CAPACITY = 32;  // Must be a power of two
+
+    InputEventQueue();
+
+    // Producer: enqueue and wake the consumer (false if full, event dropped)
+    bool push(const InputEvent& event);
+
+    // Consumer: dequeue the oldest event (false if empty)
+    bool pop(InputEvent& event);
+
+    // Consumer: block until an event is pending or timeout (true = event pending)
+    bool wait(TickType_t timeout);
+
+    // Task to notify on push (the consumer)
+    void setConsumer(TaskHandle_t task) { _consumer = task; }
+
+    uint32_t size() const;
+    uint32_t getDroppedCount() const { return _dropped; }
+
+private:
+    InputEvent _events[CAPACITY];
+    std::atomic<uint32_t> _head;  // Written by producer only
+    std::atomic<uint32_t> _tail;  // Written by consumer only
+    TaskHandle_t _consumer;
+    volatile uint32_t _dropped;
+};
+
+#endif // INPUT_EVENT_QUEUE_H
@@ -4,7 +4,17 @@
 #include <Arduino.h>
 #include <Wire.h>
 #include "logger.h"
-#include <functional>
+#include "input_event_queue.h"
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+// One INPUT_PORT0 sample taken by the input capture reader
+struct InputCapture {
+    uint8_t portValue;        // Raw INPUT_PORT0 value
+    uint8_t changedMask;      // Bits that differ from the previous capture
+    unsigned long timestamp;  // millis() of the INT edge (or of the fallback poll)
+    bool fromInterrupt;       // false when the sample came from the fallback poll
+};
 
 class IoExpander {
 public:
@@ -20,9 +30,25 @@ public:
     // Read from register
     uint8_t readRegister(uint8_t reg);
     
-    // Set relay state
+    // Read from register, returning false on bus error instead of a 0 value
+    bool readRegister(uint8_t reg, uint8_t& value);
+    
+    // Set relay state (deferred until commitRelayBatch() while a batch is open)
     void setRelay(uint8_t relay, bool state);
     
+    // Relay batches: collect several setRelay() calls and apply them in one write
+    void beginRelayBatch();
+    bool commitRelayBatch();
+    
+    // Cached OUTPUT_PORT1 value (no bus access)
+    uint8_t getRelayStates() const { return _outputShadow; }
+    
+    // Read back OUTPUT_PORT1 after every relay write (off by default)
+    void setRelayVerification(bool enabled) { _verifyRelayWrites = enabled; }
+    
+    // Compare OUTPUT_PORT1 with the shadow and rewrite it on mismatch
+    bool verifyRelayShadow();
+    
     // Read button state
     bool readButton(uint8_t button);
     
@@ -39,45 +65,73 @@ public:
     // Enable interrupt handler for specific port and pins
     void enableInterrupt(uint8_t port, uint8_t pinMask);
     
-    // Set callback function for interrupt
-    void setInterruptCallback(std::function<void(uint8_t)> callback);
+    // Attach the INT pin ISR (also a light-sleep wake source); every INT
+    // assertion notifies readerTask once, until captureInput() re-arms it
+    bool enableInputCapture(TaskHandle_t readerTask);
+    
+    // false when the expander's INT line is not wired (intPin < 0): the
+    // reader has to poll, and the expander cannot wake the chip from light sleep
+    bool hasInputInterrupt() const { return _intPin >= 0; }
+    uint8_t getAddress() const { return _address; }
+    
+    // Bay number stamped on this expander's relay trace records
+    void setTraceBay(uint8_t bay) { _traceBay = bay; }
     
-    // Handle interrupt (called from ISR or main loop)
-    void handleInterrupt();
+    // Block the reader task until an INT edge or timeout (true = woken by edge)
+    bool waitForInputEdge(TickType_t timeout);
     
-    // Check if a coin signal has been detected
-    bool isCoinSignalDetected();
+    // Take one INPUT_PORT0 sample and re-arm the INT ISR (caller must hold xIoExpanderMutex)
+    bool captureInput(InputCapture& capture, bool fromInterrupt);
     
-    // Set coin signal flag (called from FreeRTOS task)
-    void setCoinSignal(uint8_t sig);
+    // micros() when the ISR last ran (for wake-latency measurement)
+    unsigned long getLastEdgeMicros() const { return _lastEdgeMicros; }
     
-    // Clear the coin signal flag
-    void clearCoinSignalFlag();
+    // Number of INT edges seen by the ISR since boot
+    uint32_t getInputEdgeCount() const { return _edgeCount; }
     
-    // Button detection methods
-    bool isButtonDetected();
-    uint8_t getDetectedButtonId();
-    void setButtonFlag(uint8_t buttonId, bool state);
-    void clearButtonFlag();
+    // Input events (producer side - InputReader task only)
+    bool postCoinEvent(unsigned long timestamp);
+    bool postButtonPress(uint8_t buttonId, unsigned long timestamp);  // Debounced per button
+    
+    // Input events (consumer side - controller loop only)
+    bool nextInputEvent(InputEvent& event) { return _events.pop(event); }
+    bool waitForInputEvent(TickType_t timeout) { return _events.wait(timeout); }
+    void setInputEventConsumer(TaskHandle_t task) { _events.setConsumer(task); }
+    uint32_t getDroppedInputEvents() const { return _events.getDroppedCount(); }
     
     // Public interrupt counter for debugging
     unsigned int _intCnt;
-    uint8_t _portVal;
+    volatile uint8_t _portVal;  // Last captured INPUT_PORT0 value
 
 private:
+    // Untimed register read (readRegister records its latency in the profiler)
+    bool transferRead(uint8_t reg, uint8_t& value);
+    
     uint8_t _address;
     int _sdaPin;
     int _sclPin;
     int _intPin;
     
     bool _initialized;
-    std::function<void(uint8_t)> _interruptCallback;
-    unsigned long _lastInterruptTime;
-    volatile bool _coinSignalDetected;
-    
-    // Button detection variables
-    volatile bool _buttonDetected;
-    volatile uint8_t _detectedButtonId;
+    uint8_t _traceBay;
+    
+    // Input capture state
+    static void IRAM_ATTR onIntPinLow(void* arg);
+    TaskHandle_t _captureTask;
+    volatile unsigned long _lastEdgeTime;
+    volatile unsigned long _lastEdgeMicros;
+    volatile uint32_t _edgeCount;
+    uint8_t _lastCapturedPort;
+    
+    // OUTPUT_PORT1 shadow register
+    bool writeRelayPort(uint8_t value);
+    uint8_t _outputShadow;
+    uint8_t _batchValue;
+    bool _batchActive;
+    bool _verifyRelayWrites;
+    
+    // Coin/button events for the controller
+    InputEventQueue _events;
     unsigned long _lastButtonTime[6]; // 6 buttons max
     
     static const unsigned long DEBOUNCE_INTERVAL = 50; // 50ms debounce
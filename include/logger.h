@@ -2,6 +2,10 @@
 #define LOGGER_H
 
 #include <Arduino.h>
+#include <atomic>
+#include <type_traits>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
 
 // Log Levels
 enum LogLevel {
@@ -12,32 +16,157 @@ enum LogLevel {
     LOG_DEBUG = 4     // Detailed debug information
 };
 
+// Async ring sizing (records are allocated once by Logger::startAsync)
+#define LOG_RING_CAPACITY 64     // Records, must be a power of two
+#define LOG_MAX_ARGS 12          // Arguments captured per record
+#define LOG_STRING_POOL 96       // Bytes of %s argument text copied per record
+#define LOG_LINE_LENGTH 256      // Formatted line length (same as the old stack buffer)
+
+// One raw printf argument, captured by type so formatting can be deferred
+struct LogArg {
+    enum Kind : uint8_t { SIGNED, UNSIGNED, FLOAT, STRING, POINTER };
+
+    Kind kind;
+    union {
+        long long i;
+        unsigned long long u;
+        double d;
+        const char* s;
+        const void* p;
+    };
+
+    LogArg(bool v) : kind(UNSIGNED), u(v) {}
+    LogArg(char v) : kind(SIGNED), i(v) {}
+    LogArg(signed char v) : kind(SIGNED), i(v) {}
+    LogArg(unsigned char v) : kind(UNSIGNED), u(v) {}
+    LogArg(short v) : kind(SIGNED), i(v) {}
+    LogArg(unsigned short v) : kind(UNSIGNED), u(v) {}
+    LogArg(int v) : kind(SIGNED), i(v) {}
+    LogArg(unsigned int v) : kind(UNSIGNED), u(v) {}
+    LogArg(long v) : kind(SIGNED), i(v) {}
+    LogArg(unsigned long v) : kind(UNSIGNED), u(v) {}
+    LogArg(long long v) : kind(SIGNED), i(v) {}
+    LogArg(unsigned long long v) : kind(UNSIGNED), u(v) {}
+    LogArg(float v) : kind(FLOAT), d(v) {}
+    LogArg(double v) : kind(FLOAT), d(v) {}
+    LogArg(const char* v) : kind(STRING), s(v) {}
+    LogArg(char* v) : kind(STRING), s(v) {}
+    LogArg(std::nullptr_t) : kind(POINTER), p(nullptr) {}
+    template<typename T>
+    LogArg(const T* v) : kind(POINTER), p(v) {}
+    template<typename T, typename std::enable_if<std::is_enum<T>::value, int>::type = 0>
+    LogArg(T v) : kind(SIGNED), i(static_cast<long long>(v)) {}
+};
+
 class Logger {
 private:
     static LogLevel currentLevel;
     static const char* levelNames[];
     static bool initialized;
-    
+
+    // Async mode: lock-free MPSC ring drained by a low-priority task
+    struct Record {
+        std::atomic<uint32_t> sequence;
+        uint32_t timestamp;
+        const char* format;
+        uint8_t level;
+        uint8_t argc;
+        LogArg args[LOG_MAX_ARGS];
+        char strings[LOG_STRING_POOL];
+    };
+    static Record* ring;
+    static uint32_t ringMask;
+    static std::atomic<uint32_t> enqueuePos;
+    static uint32_t dequeuePos;
+    static std::atomic<uint32_t> droppedCount;
+    static TaskHandle_t drainTask;
+
     // Helper function to get formatted timestamp
-    static void getTimestamp(char* buffer, size_t bufferSize);
+    static void getTimestamp(uint32_t ms, char* buffer, size_t bufferSize);
+
+    // printf-style formatting over captured arguments
+    static size_t formatArgs(char* out, size_t size, const char* format, const LogArg* args, uint8_t argc);
+
+    static void emit(LogLevel level, const char* format, const LogArg* args, uint8_t argc);
+    static bool enqueue(LogLevel level, uint32_t timestamp, const char* format, const LogArg* args, uint8_t argc);
+    static void writeLine(LogLevel level, uint32_t timestamp, const char* format, const LogArg* args, uint8_t argc);
+    static bool drainOne();
+    static void drainTaskMain(void* parameter);
+
+    template<typename... Args>
+    static void write(LogLevel level, const char* format, Args... args) {
+        if (currentLevel < level || level <= LOG_NONE) {
+            return;
+        }
+        const LogArg packed[] = { LogArg(args)..., LogArg(0) };
+        emit(level, format, packed, sizeof...(Args));
+    }
 
 public:
     static void init(LogLevel level = LOG_DEBUG, unsigned long baudRate = 115200);
     static void setLogLevel(LogLevel level);
     static LogLevel getLogLevel();
-    
-    static void error(const char* format, ...);
-    static void warning(const char* format, ...);
-    static void info(const char* format, ...);
-    static void debug(const char* format, ...);
-    
-    static void log(LogLevel level, const char* format, ...);
+
+    // Move UART output to a drain task; callers then only copy their arguments
+    // into the ring and never block on Serial (messages are dropped when full)
+    static bool startAsync(UBaseType_t priority = 1, BaseType_t core = 1);
+    static bool isAsync() { return drainTask != NULL; }
+    static uint32_t getDroppedCount() { return droppedCount.load(std::memory_order_relaxed); }
+
+    // Wait until the drain task has written everything queued so far
+    static bool flush(TickType_t timeout);
+
+    template<typename... Args>
+    static void error(const char* format, Args... args) { write(LOG_ERROR, format, args...); }
+    template<typename... Args>
+    static void warning(const char* format, Args... args) { write(LOG_WARNING, format, args...); }
+    template<typename... Args>
+    static void info(const char* format, Args... args) { write(LOG_INFO, format, args...); }
+    template<typename... Args>
+    static void debug(const char* format, Args... args) { write(LOG_DEBUG, format, args...); }
+
+    template<typename... Args>
+    static void log(LogLevel level, const char* format, Args... args) { write(level, format, args...); }
 };
 
+// Compile-time log level: macros above this level expand to nothing, so their
+// arguments are never evaluated and their format strings never reach flash.
+// Must be numeric (e.g. -DLOG_COMPILE_LEVEL=3 for INFO); the enum names are
+// not visible to the preprocessor. setLogLevel() still filters at runtime.
+#ifndef LOG_COMPILE_LEVEL
+#define LOG_COMPILE_LEVEL 4
+#endif
+
+// Never defined: only named inside sizeof, which does not evaluate its
+// operand but still counts the arguments as used, so a local that only feeds
+// a stripped log call does not trigger -Wunused-variable
+template<typename... Args>
+int logDiscard(const char* format, const Args&... args);
+#define LOG_DISCARD(format, ...) do { (void)sizeof(logDiscard(format, ##__VA_ARGS__)); } while (0)
+
 // Convenience macros for logging
+#if LOG_COMPILE_LEVEL >= 1
 #define LOG_ERROR(format, ...) Logger::error(format, ##__VA_ARGS__)
+#else
+#define LOG_ERROR(format, ...) LOG_DISCARD(format, ##__VA_ARGS__)
+#endif
+
+#if LOG_COMPILE_LEVEL >= 2
 #define LOG_WARNING(format, ...) Logger::warning(format, ##__VA_ARGS__)
+#else
+#define LOG_WARNING(format, ...) LOG_DISCARD(format, ##__VA_ARGS__)
+#endif
+
+#if LOG_COMPILE_LEVEL >= 3
 #define LOG_INFO(format, ...) Logger::info(format, ##__VA_ARGS__)
+#else
+#define LOG_INFO(format, ...) LOG_DISCARD(format, ##__VA_ARGS__)
+#endif
+
+#if LOG_COMPILE_LEVEL >= 4
 #define LOG_DEBUG(format, ...) Logger::debug(format, ##__VA_ARGS__)
+#else
+#define LOG_DEBUG(format, ...) LOG_DISCARD(format, ##__VA_ARGS__)
+#endif
 
 #endif // LOGGER_H
\ No newline at end of file
@@ -0,0 +1,91 @@
+#ifndef MQTT_INBOUND_H
+#define MQTT_INBOUND_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+// Bump allocator over a fixed buffer for ArduinoJson. Only the most recent
+// block can grow, shrink or be freed in place; everything else is
+// reclaimed by reset() before the next payload.
+class ArenaAllocator : public ArduinoJson::Allocator {
+public:
+    ArenaAllocator(uint8_t* buffer, size_t size);
+
+    void* allocate(size_t size) override;
+    void deallocate(void* ptr) override;
+    void* reallocate(void* ptr, size_t newSize) override;
+
+    void reset();
+    size_t getUsed() const { return _used; }
+    size_t getPeak() const { return _peak; }
+
+private:
+    static const size_t ALIGNMENT = 8;
+    static const size_t HEADER_SIZE = ALIGNMENT;  // Block size, padded to keep payloads aligned
+
+    static size_t align(size_t size) { return (size + ALIGNMENT - 1) & ~(ALIGNMENT - 1); }
+    static size_t& blockSize(void* ptr) { return *reinterpret_cast<size_t*>(static_cast<uint8_t*>(ptr) - HEADER_SIZE); }
+
+    uint8_t* _buffer;
+    size_t _size;
+    size_t _used;
+    size_t _peak;
+    void* _last;  // Most recent block (NULL after it was freed)
+};
+
+// JSON or MessagePack payload parsed into a fixed arena: no heap allocation
+// per message, and string fields are read as const char* views into the
+// arena instead of String copies. parse() clears the previous payload, so
+// only the MQTT callback (network task) may use it.
+class MqttInboundDocument {
+public:
+    // Largest payload accepted (the PubSubClient buffer size); longer ones
+    // are rejected before parsing
+    static const size_t MAX_PAYLOAD = 512;
+    // One parsed payload: the document's slot pool plus its strings
+    static const size_t ARENA_SIZE = 4096;
+
+    MqttInboundDocument();
+
+    // Oversize and malformed payloads are logged and rejected
+    bool parse(const uint8_t* payload, size_t length);
+
+    JsonDocument& doc() { return _doc; }
+    size_t getArenaPeak() const { return _allocator.getPeak(); }
+
+private:
+    alignas(8) uint8_t _arena[ARENA_SIZE];
+    ArenaAllocator _allocator;
+    JsonDocument _doc;
+};
+
+extern MqttInboundDocument mqttInbound;
+
+// COMMAND_TOPIC commands
+enum MqttCommand : uint8_t {
+    MQTT_COMMAND_UNKNOWN = 0,
+    MQTT_COMMAND_SET_LOG_LEVEL,
+    MQTT_COMMAND_SIMULATE_COIN,
+    MQTT_COMMAND_TEST_COIN_SIGNAL,
+    MQTT_COMMAND_STATS,
+    MQTT_COMMAND_DEBUG_IO,
+    MQTT_COMMAND_DEBUG_NETWORK,
+    MQTT_COMMAND_DEBUG_BLE,
+    MQTT_COMMAND_SET_MACHINE_NUMBER,
+    MQTT_COMMAND_SET_ENVIRONMENT,
+    MQTT_COMMAND_DUMP_TRACE
+};
+
+// FNV-1a over a command name. The constexpr form builds the switch labels in
+// parseMqttCommand(), where a collision between two names fails to compile.
+constexpr uint32_t commandHash(const char* name, uint32_t hash = 2166136261u) {
+    return *name == '\0' ? hash : commandHash(name + 1, (hash ^ (uint8_t)*name) * 16777619u);
+}
+
+// Iterative form for names taken from a payload (same result as commandHash)
+uint32_t commandHashOf(const char* name);
+
+// Name to command with one hash and one strcmp (NULL or unknown -> UNKNOWN)
+MqttCommand parseMqttCommand(const char* name);
+
+#endif // MQTT_INBOUND_H
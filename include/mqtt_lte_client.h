@@ -5,18 +5,33 @@
 #include "utilities.h"
 #include "SSLClient.h"
 #include <PubSubClient.h>
+#include "batching_client.h"
+#include "mqtt_message_pool.h"
 #include <vector>
 #include <freertos/FreeRTOS.h>
 #include <freertos/semphr.h>
 
 class MqttLteClient {
 public:
+    // How the last begin() reached the network
+    enum BringUpPath : uint8_t {
+        BRINGUP_FAILED = 0,
+        BRINGUP_WARM_ATTACHED,    // Modem still powered with a data session: nothing to redo
+        BRINGUP_WARM_REGISTERED,  // Modem still registered: only the PDP context was re-opened
+        BRINGUP_COLD              // Power-key cycle and full registration
+    };
+    
+
     // Constructor with required pins
     MqttLteClient(HardwareSerial& modemSerial, int pwrKeyPin, int dtrPin, int flightPin, 
                  int txPin, int rxPin);
     
-    // Initialize modem and network
+    // Initialize modem and network. A modem that is already powered (ESP32
+    // reset, brownout) is re-attached without the power-key cycle.
     bool begin(const char* apn, const char* user = "", const char* pass = "", const char* pin = "");
+    BringUpPath getBringUpPath() const { return _bringUpPath; }
+    unsigned long getBringUpDuration() const { return _bringUpMs; }
+    const char* getOperatorName() const { return _cachedOperator; }  // Last registered operator
     
     // Configure SSL/TLS
     void setCACert(const char* caCert);
@@ -28,6 +43,10 @@ public:
     bool connect(const char* broker, uint16_t port, const char* clientId);
     bool publish(const char* topic, const char* payload, const uint8_t qos);
     bool publishNonBlocking(const char* topic, const char* payload, const uint8_t qos, TickType_t timeoutMs = 100);
+    bool publishNonBlocking(const char* topic, const uint8_t* payload, size_t length, const uint8_t qos, TickType_t timeoutMs = 100);
+    // Publish a burst under one lock acquire, coalesced into as few TLS writes as possible.
+    // Returns how many messages (from the front, in order) reached the modem.
+    size_t publishBatch(MqttMessage* const* messages, size_t count, TickType_t timeoutMs = 100);
     bool subscribe(const char* topic);
     void loop();
     
@@ -52,10 +71,18 @@ public:
     
 private:
     // Private methods
+    void configureControlPins();
     void powerOnModem();
-    bool testModemAT();
+    bool waitForModemReady(unsigned long timeoutMs);
+    bool testModemAT(unsigned long timeoutMs = 3000);
     void clearModemBuffer();
+    bool warmAttach();
     bool initModemAndConnectNetwork();
+    bool finishAttach();
+    
+    // Last good network settings (NVS), used to skip redundant modem setup
+    void loadNetworkCache();
+    void saveNetworkCache();
     
     // References to hardware
     HardwareSerial& _modemSerial;
@@ -90,6 +117,7 @@ private:
     TinyGsm* _modem;
     TinyGsmClient* _gsmClient;
     SSLClient* _sslClient;
+    BatchingClient* _batchClient;  // Between PubSubClient and SSLClient, coalesces publishBatch() writes
     PubSubClient* _mqttClient;
     SemaphoreHandle_t _mutex; // Recursive mutex to guard MQTT/SSL operations
     
@@ -97,6 +125,12 @@ private:
     bool _initialized;
     bool _networkConnected;
     bool _mqttConnected;
+    BringUpPath _bringUpPath = BRINGUP_FAILED;
+    unsigned long _bringUpMs = 0;
+    
+    // Network cache: valid only for the APN it was stored with
+    bool _networkModeApplied = false;  // AT+CNMP=2 already stored in the modem's NVM
+    char _cachedOperator[32] = "";
 
     std::vector<String> _subscribedTopics;  // Store subscribed topics
 };
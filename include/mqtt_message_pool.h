@@ -0,0 +1,80 @@
+#ifndef MQTT_MESSAGE_POOL_H
+#define MQTT_MESSAGE_POOL_H
+
+#include <Arduino.h>
+#include <freertos/FreeRTOS.h>
+#include "constants.h"
+
+// Handle passed through xMqttPublishQueue instead of the message itself
+typedef uint16_t MqttMessageHandle;
+const MqttMessageHandle MQTT_INVALID_HANDLE = 0xFFFF;
+
+// Pooled MQTT message. The topic is stored as its table ID plus the bay that
+// queued it (all bays share one pool and publish queue), and the payload
+// follows the header, NUL-terminated at its exact length (payloadLength is
+// authoritative: binary payloads may contain NUL bytes).
+struct MqttMessage {
+    unsigned long timestamp;  // When message was created
+    uint16_t payloadLength;
+    uint8_t topicId;          // MqttTopicId
+    uint8_t qos;              // Quality of Service (0 or 1)
+    bool isCritical;          // Flag for message priority
+    uint8_t bay;              // Topic table row (0 in single-bay builds)
+
+    // Resolved at publish time, so a queued message follows a topic table rebuild
+    const char* topic() const { return mqttTopic((MqttTopicId)topicId, bay); }
+    const char* payload() const { return reinterpret_cast<const char*>(this + 1); }
+};
+
+// Slab allocator for MQTT messages. Three block size classes are carved out
+// of one arena (PSRAM when available); a message takes the smallest block
+// that fits, so queueing and publishing never copy more than the message.
+// Any task may create/release; the free lists are guarded by a spinlock.
+class MqttMessagePool {
+public:
+    static const uint8_t CLASS_COUNT = 3;
+
+    MqttMessagePool();
+
+    // Allocate the arena (call once before the first create)
+    bool begin();
+
+    // Copy the payload into a block; MQTT_INVALID_HANDLE when full or too large
+    MqttMessageHandle create(MqttTopicId topic, uint8_t bay, const char* payload, uint8_t qos, bool isCritical);
+    // Binary-safe variant (MessagePack payloads may contain NUL bytes)
+    MqttMessageHandle create(MqttTopicId topic, uint8_t bay, const uint8_t* payload, size_t payloadLength,
+                             uint8_t qos, bool isCritical);
+
+    // Resolve a handle (NULL if invalid); valid until release()
+    MqttMessage* get(MqttMessageHandle handle) const;
+
+    // Return the block to its free list
+    void release(MqttMessageHandle handle);
+
+    // Total blocks, i.e. the deepest the publish queue can get
+    uint16_t getCapacity() const;
+    uint16_t getInUse() const;
+    uint32_t getAllocationFailures() const { return _allocationFailures; }
+    bool isInPsram() const { return _inPsram; }
+
+private:
+    struct Slab {
+        uint8_t* blocks;
+        uint16_t* freeList;   // Stack of free block indices
+        uint16_t blockSize;
+        uint16_t count;
+        uint16_t freeTop;
+    };
+
+    Slab _slabs[CLASS_COUNT];
+    uint8_t* _arena;
+    bool _inPsram;
+    uint32_t _allocationFailures;
+
+    static const uint8_t CLASS_SHIFT = 14;
+    static const uint16_t INDEX_MASK = (1 << CLASS_SHIFT) - 1;
+};
+
+extern MqttMessagePool mqttMessagePool;
+
+#endif // MQTT_MESSAGE_POOL_H
@@ -0,0 +1,106 @@
+#ifndef MQTT_OUTBOX_H
+#define MQTT_OUTBOX_H
+
+#include <Arduino.h>
+#include <esp_partition.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+
+// Store-and-forward outbox for critical MQTT messages (ACTION_TOPIC events).
+//
+// A log-structured ring over the "outbox" data partition: each 4 KB sector
+// starts with a sequence-numbered header and is filled with CRC-checked,
+// sequence-numbered records. Appends are staged in RAM and written in
+// batches to limit flash wear; published messages are acknowledged by
+// appending one ACK record per replay batch. When the ring wraps onto
+// unacknowledged data the oldest sector is reclaimed and counted as dropped.
+//
+// Controllers append when they queue a critical message; the MQTT publisher
+// task flushes and replays. A mutex created in begin() guards the log; replay()
+// releases it while a message is being published.
+class MqttOutbox {
+public:
+    // Publish one replayed message; return false to stop the replay
+    typedef bool (*PublishFn)(const char* topic, const uint8_t* payload, size_t length, uint8_t qos, void* context);
+
+    static const size_t SECTOR_SIZE = 4096;
+    static const size_t STAGING_SIZE = 1024;
+    static const unsigned long FLUSH_INTERVAL_MS = 2000;  // Max time a record waits in RAM
+
+    MqttOutbox();
+
+    // Find the partition and recover head/ack state from flash
+    bool begin(const char* partitionLabel = "outbox");
+    bool isReady() const { return _partition != NULL; }
+
+    // Stage a message (sequence number assigned here); written on the next flush
+    bool append(const char* topic, const uint8_t* payload, size_t length, uint8_t qos);
+
+    // Write staged records now / when the batching window has elapsed
+    bool flush();
+    bool flushIfDue(unsigned long now);
+
+    // Publish up to maxMessages pending records in order; returns how many were sent
+    size_t replay(PublishFn publish, void* context, size_t maxMessages);
+
+    uint32_t getPendingCount() const { return _pendingCount; }
+    uint32_t getDroppedCount() const { return _droppedCount; }
+
+private:
+    struct SectorHeader {
+        uint32_t magic;
+        uint32_t sequence;
+    };
+
+    struct RecordHeader {
+        uint16_t magic;
+        uint8_t type;
+        uint8_t qos;
+        uint32_t sequence;
+        uint16_t topicLength;
+        uint16_t payloadLength;
+        uint32_t crc;  // CRC32 over topic\0payload\0
+    };
+
+    enum RecordType : uint8_t {
+        RECORD_DATA = 1,
+        RECORD_ACK = 2
+    };
+
+    static const uint32_t SECTOR_MAGIC = 0x584F424D;  // "MBOX"
+    static const uint16_t RECORD_MAGIC = 0xB0C5;
+
+    static size_t recordSize(const RecordHeader& header);
+    bool readSectorHeader(uint16_t sector, SectorHeader& header) const;
+    bool readRecordHeader(uint16_t sector, size_t offset, RecordHeader& header) const;
+    size_t scanSector(uint16_t sector, uint32_t& maxData, uint32_t& maxAck, uint32_t pendingAbove, uint32_t& pending) const;
+    bool writeStaged();  // _lock held
+    bool stage(RecordType type, uint32_t sequence, const char* topic, const uint8_t* payload, size_t length, uint8_t qos);
+    bool advanceSector();
+
+    const esp_partition_t* _partition;
+    uint16_t _sectorCount;
+    SemaphoreHandle_t _lock;  // Guards everything below
+
+    // Write position (flash) plus records not yet written
+    uint16_t _headSector;
+    size_t _headOffset;
+    uint32_t _headSectorSequence;
+    uint8_t _staging[STAGING_SIZE];
+    size_t _stagingLength;
+    unsigned long _stagedSince;
+
+    // Replay cursor (oldest record that may still be pending)
+    uint16_t _replaySector;
+    size_t _replayOffset;
+    char _replayBuffer[STAGING_SIZE];
+
+    uint32_t _nextSequence;
+    uint32_t _ackedSequence;
+    uint32_t _pendingCount;
+    uint32_t _droppedCount;
+};
+
+extern MqttOutbox mqttOutbox;
+
+#endif // MQTT_OUTBOX_H
@@ -0,0 +1,62 @@
+#ifndef POWER_MANAGER_H
+#define POWER_MANAGER_H
+
+#include <Arduino.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#if CONFIG_PM_ENABLE
+#include <esp_pm.h>
+#endif
+
+// Low-power FREE mode.
+//
+// Once the machine has been FREE with no BLE client and no coin/button edge
+// for LOW_POWER_ENTRY_DELAY_MS, the "active" power-management locks are
+// released: the CPU scales down to LOW_POWER_MIN_FREQ_MHZ and, when the
+// framework is built with CONFIG_FREERTOS_USE_TICKLESS_IDLE, the idle task
+// enters automatic light sleep between wake-ups. The input reader and the
+// controller loop stretch their idle timeouts (inputPollTicks/idleWaitTicks)
+// so the chip can stay asleep. The IO expander INT pin is a light-sleep wake
+// source, and any edge or BLE connection restores full rate at once.
+//
+// Without CONFIG_PM_ENABLE only the timeout throttling applies. While the BT
+// controller is enabled it holds its own no-sleep lock unless modem sleep is
+// configured, so light sleep may then be limited to DFS.
+class PowerManager {
+public:
+    // Configure DFS/light sleep and hold the active locks (call once from setup)
+    static void begin();
+
+    // Controller loop: idle = FREE and no BLE client
+    static void update(bool idle);
+
+    // Input reader: a coin/button edge arrived; leaves low-power mode at once
+    static void noteActivity();
+
+    static bool isLowPower() { return lowPower; }
+
+    // Idle timeouts for the input reader fallback poll and the controller loop
+    static TickType_t inputPollTicks();
+    static TickType_t idleWaitTicks();
+
+    // Times low-power mode was entered, and total time spent in it (ms)
+    static uint32_t getLowPowerEntries() { return entries; }
+    static unsigned long getLowPowerTime();
+
+private:
+    static void enterLocked();
+    static void exitLocked();
+
+    static SemaphoreHandle_t lock;
+    static volatile bool lowPower;
+    static volatile unsigned long lastActivity;
+    static unsigned long lowPowerSince;
+    static unsigned long lowPowerTotal;
+    static uint32_t entries;
+#if CONFIG_PM_ENABLE
+    static esp_pm_lock_handle_t cpuLock;      // ESP_PM_CPU_FREQ_MAX
+    static esp_pm_lock_handle_t noSleepLock;  // ESP_PM_NO_LIGHT_SLEEP
+#endif
+};
+
+#endif // POWER_MANAGER_H
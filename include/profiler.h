@@ -0,0 +1,205 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/semphr.h>
+
+// Shared bus mutexes whose wait and hold times are recorded
+enum ProfiledMutex : uint8_t {
+    PROFILED_MUTEX_IO_EXPANDER = 0,  // xIoExpanderMutex (Wire)
+    PROFILED_MUTEX_I2C = 1,          // xI2CMutex (Wire1: RTC + CH453)
+    PROFILED_MUTEX_COUNT
+};
+
+// Bus transactions whose caller-visible latency and failures are recorded
+enum ProfiledBusOp : uint8_t {
+    PROFILED_OP_IOX_READ = 0,        // IoExpander::readRegister (caller holds the mutex)
+    PROFILED_OP_RTC_READ = 1,        // RTCManager::readRegisters (includes its mutex wait)
+    PROFILED_OP_CH453_SEND = 2,      // Every CH453 transfer: sendCommand and flush() bursts
+    PROFILED_OP_COUNT
+};
+
+// Controller input events whose handling cost is recorded
+enum ProfiledEvent : uint8_t {
+    PROFILED_EVENT_COIN = 0,
+    PROFILED_EVENT_BUTTON = 1,
+    PROFILED_EVENT_COUNT
+};
+
+// Power mode the input reader was woken in (see PowerManager)
+enum ProfiledWake : uint8_t {
+    PROFILED_WAKE_FULL_RATE = 0,
+    PROFILED_WAKE_LOW_POWER = 1,     // CPU scaled down / light sleep allowed
+    PROFILED_WAKE_COUNT
+};
+
+#define PROFILER_MAX_TASKS 24          // Tasks captured per sample (IDF + BLE + ours)
+#define PROFILER_HISTOGRAM_BUCKETS 10  // Bucket b counts [4^b, 4^(b+1)) us; the last is open-ended
+
+// Runtime profiling: per-task stack headroom, heap low-water marks, and bus
+// mutex / I2C transaction latency, for sizing stacks and finding contention.
+//
+// sample() reads uxTaskGetSystemState() (the watchdog samples every 10 s).
+// Per-task CPU share is not reported: the prebuilt Arduino core is compiled
+// without configGENERATE_RUN_TIME_STATS. Per-core load is estimated instead
+// from idle hook calls: an idle core's hook runs once per wake-up, so at
+// least once per tick, and load is 1 - calls / ticks over the sample period.
+// Interrupts that wake an idle core (radio, UART) make it read low, and
+// light sleep skips ticks, which makes a sleeping core read busy.
+//
+// Latency recording costs two micros() reads and a few increments under a
+// spinlock, so it stays enabled in production builds.
+class Profiler {
+public:
+    struct TaskSample {
+        TaskHandle_t handle;
+        char name[16];           // configMAX_TASK_NAME_LEN on ESP32
+        uint32_t stackFree;      // High-water mark (bytes never used)
+        uint32_t stackSize;      // Configured size, 0 if not registered
+        uint8_t priority;
+        int8_t core;             // -1 = no affinity
+    };
+
+    // Log4 latency histogram (1 us .. 262 ms and above)
+    struct Histogram {
+        uint32_t buckets[PROFILER_HISTOGRAM_BUCKETS];
+        uint32_t count;
+        uint64_t totalUs;
+        uint32_t maxUs;
+    };
+
+    struct MutexStats {
+        uint32_t acquired;
+        uint32_t timeouts;       // Takes that gave up (the caller skipped its bus access)
+        Histogram wait;          // Time spent in xSemaphoreTake, acquired or not
+        Histogram hold;          // Take to give, for acquired takes
+    };
+
+    struct BusOpStats {
+        uint32_t failures;       // Mutex timeout or NACK/short read
+        Histogram latency;       // Per call (see ProfiledBusOp for what is included)
+        uint32_t perSecond;      // Calls per second over the last sample period
+    };
+
+    struct EventStats {
+        Histogram delay;         // Edge capture to start of handling
+        Histogram handling;      // Controller time spent on the event
+        uint32_t busOps;         // Bus transactions the controller issued for these events
+        uint32_t maxBusOps;      // Most issued for a single event
+    };
+
+    // Create the sample lock (call once from setup)
+    static void begin();
+
+    // Remember a task's configured stack size so reports show headroom
+    static void registerTask(TaskHandle_t handle, uint32_t stackSize);
+
+    // Capture a new sample; bus call rates and core load cover the time
+    // since the last one
+    static void sample();
+
+    // Load of a core over the last sample period in percent, -1 before the
+    // second sample
+    static int8_t getCoreLoad(uint8_t core);
+
+    // Record profiled mutex takes/gives (see profiledTake/profiledGive)
+    static void recordMutexWait(ProfiledMutex mutex, uint32_t waitUs, bool acquired);
+    static void recordMutexHold(ProfiledMutex mutex, uint32_t holdUs);
+    static void recordBusOp(ProfiledBusOp op, uint32_t durationUs, bool ok);
+
+    // Per-event cost accounting for the task that handles input events:
+    // bus transactions issued by that task are counted separately so an
+    // event's share is not mixed with the display task's traffic
+    static void setEventTask(TaskHandle_t task) { eventTask = task; }
+    static uint32_t getEventTaskBusOps() { return eventTaskBusOps; }
+    static void recordEvent(ProfiledEvent event, uint32_t delayUs, uint32_t handlingUs, uint32_t busOps);
+
+    // INT ISR to PORT0 sample taken, per power mode. The light-sleep exit
+    // itself runs before the ISR and is not included (it is well under 1 ms).
+    static void recordInputWake(ProfiledWake mode, uint32_t latencyUs);
+
+    static MutexStats getMutexStats(ProfiledMutex mutex);
+    static BusOpStats getBusOpStats(ProfiledBusOp op);
+    static EventStats getEventStats(ProfiledEvent event);
+    static Histogram getInputWake(ProfiledWake mode);
+
+    // Zero the mutex, bus, event and wake counters (task samples are unaffected)
+    static void resetLatencyStats();
+
+    // Report the last sample to the log
+    static void printStats();
+
+    // Report the last sample as JSON, split so each part fits one MQTT
+    // message: 0 = heap/mutex summary, 1 = mutex histograms, 2 = bus
+    // histograms, 3 = event costs, 4 = input wake latency, then
+    // TASKS_PER_PART tasks per part.
+    // Returns false past the last part.
+    static const uint8_t TASKS_PER_PART = 3;
+    static bool buildStatsPart(JsonDocument& doc, uint8_t part);
+
+    // Acquire time of each mutex's current holder (0 = not taken through
+    // profiledTake). Only the holder writes its slot, so no lock is needed.
+    static unsigned long heldSince[PROFILED_MUTEX_COUNT];
+
+private:
+    struct Registration {
+        TaskHandle_t handle;
+        uint32_t stackSize;
+    };
+
+    static uint32_t stackSizeOf(TaskHandle_t handle);
+    static void addSample(Histogram& histogram, uint32_t us);
+    static void buildSummary(JsonDocument& doc);
+    static void buildMutexHistograms(JsonDocument& doc);
+    static void buildBusHistograms(JsonDocument& doc);
+    static void buildEventStats(JsonDocument& doc);
+    static void buildWakeStats(JsonDocument& doc);
+    static bool buildTasks(JsonDocument& doc, uint8_t firstTask);
+    static bool countIdleCore0();
+    static bool countIdleCore1();
+
+    static SemaphoreHandle_t sampleLock;
+    static Registration registrations[PROFILER_MAX_TASKS];
+    static uint8_t registrationCount;
+    static TaskSample tasks[PROFILER_MAX_TASKS];
+    static uint8_t taskCount;
+    static unsigned long lastSampleTime;
+    static TickType_t lastSampleTick;
+    static volatile uint32_t idleCalls[portNUM_PROCESSORS];  // Written only by that core's idle task
+    static uint32_t idleCallsSampled[portNUM_PROCESSORS];
+    static int8_t coreLoad[portNUM_PROCESSORS];
+    static MutexStats mutexStats[PROFILED_MUTEX_COUNT];
+    static BusOpStats busOpStats[PROFILED_OP_COUNT];
+    static uint32_t busOpSampledCount[PROFILED_OP_COUNT];
+    static EventStats eventStats[PROFILED_EVENT_COUNT];
+    static Histogram inputWake[PROFILED_WAKE_COUNT];
+    static TaskHandle_t eventTask;
+    static volatile uint32_t eventTaskBusOps;
+};
+
+// xSemaphoreTake that records how long the caller waited
+inline BaseType_t profiledTake(SemaphoreHandle_t mutex, TickType_t timeout, ProfiledMutex id) {
+    unsigned long start = micros();
+    BaseType_t taken = xSemaphoreTake(mutex, timeout);
+    unsigned long now = micros();
+    Profiler::recordMutexWait(id, (uint32_t)(now - start), taken == pdTRUE);
+    if (taken == pdTRUE) {
+        Profiler::heldSince[id] = now | 1;
+    }
+    return taken;
+}
+
+// xSemaphoreGive that records how long the mutex was held
+inline BaseType_t profiledGive(SemaphoreHandle_t mutex, ProfiledMutex id) {
+    unsigned long since = Profiler::heldSince[id];
+    if (since != 0) {
+        Profiler::heldSince[id] = 0;
+        Profiler::recordMutexHold(id, (uint32_t)(micros() - since));
+    }
+    return xSemaphoreGive(mutex);
+}
+
+#endif // PROFILER_H
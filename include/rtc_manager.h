@@ -8,6 +8,9 @@
 #include <freertos/semphr.h>
 #include "logger.h"
 
+// Buffer size for "2024-10-29T15:30:45.123Z" plus terminator
+const size_t ISO_TIMESTAMP_SIZE = 25;
+
 /**
  * @brief RTC Manager for DS1340Z Real-Time Clock
  * 
@@ -21,6 +24,8 @@
  * - Battery backup support
  * - ISO 8601 timestamp formatting
  * - 24-hour format
+ * - Cached clock: timestamps are interpolated from the last chip read with
+ *   millis() (drift-corrected) and the chip is only re-read once a minute
  * 
  * I2C Connection:
  * - Uses Wire1 (same bus as LCD)
@@ -98,9 +103,80 @@ public:
      */
     time_t getDateTime();
     
+    /**
+     * @brief Get current time from the cached clock
+     * 
+     * Interpolates from the last chip read with millis(), corrected for the
+     * measured drift. Only touches the I2C bus when the resync interval has
+     * elapsed (or the clock has never been read).
+     * 
+     * @param milliseconds Optional output for the sub-second part (0-999)
+     * @return time_t Unix timestamp, or 0 if the RTC could not be read
+     */
+    time_t getCachedDateTime(uint16_t* milliseconds = NULL);
+    
+    /**
+     * @brief Re-read the chip and re-anchor the cached clock
+     * 
+     * Called automatically by getCachedDateTime() every resync interval;
+     * call it directly to resync on demand.
+     * 
+     * @return true if the chip was read
+     */
+    bool resync();
+    
+    /**
+     * @brief Set how often the cached clock re-reads the chip
+     * 
+     * @param intervalMs Resync period in milliseconds (0 = read the chip on every call)
+     */
+    void setResyncInterval(unsigned long intervalMs) { _resyncIntervalMs = intervalMs; }
+    
+    /**
+     * @brief Get the measured drift of millis() against the RTC
+     * 
+     * @return int32_t Parts per million (positive = millis() runs fast), 0 until measured
+     */
+    int32_t getDriftPpm() const { return _driftPpm; }
+    
+    /**
+     * @brief Format current time as ISO 8601 into a caller buffer (no heap use)
+     * 
+     * Served from the cached clock.
+     * Format: "2024-10-29T15:30:45Z"
+     * 
+     * @param buffer Destination (ISO_TIMESTAMP_SIZE bytes is always enough)
+     * @param size Size of buffer
+     * @return size_t Characters written, or 0 (empty string) if the RTC read failed
+     */
+    size_t formatTimestamp(char* buffer, size_t size);
+    
+    /**
+     * @brief Format current time as ISO 8601 with milliseconds into a caller buffer
+     * 
+     * Format: "2024-10-29T15:30:45.123Z"
+     * 
+     * @param buffer Destination (ISO_TIMESTAMP_SIZE bytes)
+     * @param size Size of buffer
+     * @return size_t Characters written, or 0 (empty string) if the RTC read failed
+     */
+    size_t formatTimestampWithMillis(char* buffer, size_t size);
+    
+    /**
+     * @brief Fixed-width ISO 8601 formatter (no snprintf, no heap)
+     * 
+     * @param epochTime Unix timestamp
+     * @param milliseconds Sub-second part (0-999), or -1 to omit it
+     * @param buffer Destination
+     * @param size Size of buffer (20 bytes without milliseconds, 24 with)
+     * @return size_t Characters written, or 0 if the buffer is too small
+     */
+    static size_t formatIso8601(time_t epochTime, int milliseconds, char* buffer, size_t size);
+    
     /**
      * @brief Get current time as ISO 8601 formatted string
      * 
+     * Convenience wrapper around formatTimestamp() (allocates a String).
      * Format: "2024-10-29T15:30:45Z"
      * 
      * @return String ISO 8601 timestamp, or "RTC Error" if read failed
@@ -110,7 +186,7 @@ public:
     /**
      * @brief Get current time as ISO 8601 formatted string with milliseconds
      * 
-     * Uses millis() to add sub-second precision
+     * Convenience wrapper around formatTimestampWithMillis() (allocates a String).
      * Format: "2024-10-29T15:30:45.123Z"
      * 
      * @return String ISO 8601 timestamp with milliseconds
@@ -162,10 +238,23 @@ private:
     uint8_t _address;           ///< I2C address of the DS1340
     TwoWire* _wire;             ///< Pointer to Wire interface (Wire1)
     bool _initialized;          ///< Initialization status
-    unsigned long _lastReadMillis; ///< Millis value from last RTC read
-    time_t _lastReadTime;       ///< Time value from last RTC read
+    unsigned long _lastReadMillis; ///< Millis value at the cache anchor
+    time_t _lastReadTime;       ///< RTC time at the cache anchor (0 = never read)
     SemaphoreHandle_t _i2cMutex;  ///< Mutex for Wire1 access (shared with LCD)
     
+    // Cached clock state (guarded by a spinlock in rtc_manager.cpp)
+    unsigned long _lastResyncMillis; ///< When resync() last tried to read the chip
+    unsigned long _resyncIntervalMs; ///< Resync period (0 = no caching)
+    time_t _driftBaseTime;      ///< RTC time at the start of the drift measurement
+    unsigned long _driftBaseMillis; ///< Millis value at the start of the drift measurement
+    int32_t _driftPpm;          ///< Measured drift of millis() against the RTC
+    uint64_t _lastServedMs;     ///< Last epoch milliseconds served (keeps timestamps monotonic)
+    
+    static const unsigned long DEFAULT_RESYNC_INTERVAL_MS = 60000;  ///< Re-read the chip once a minute
+    static const unsigned long DRIFT_MIN_SPAN_MS = 6UL * 3600000UL;  ///< Span before drift is trusted (1 s resolution)
+    static const unsigned long DRIFT_MAX_SPAN_MS = 30UL * 86400000UL; ///< Restart the span before millis() wraps
+    static const long STEP_THRESHOLD_S = 2;  ///< Larger corrections are clock steps, not drift
+    
     // DS1340 Register addresses
     static const uint8_t REG_SECONDS = 0x00;
     static const uint8_t REG_MINUTES = 0x01;
@@ -195,6 +284,22 @@ private:
      */
     uint8_t bcdToDec(uint8_t val);
     
+    /**
+     * @brief Interpolate epoch milliseconds from the cache anchor
+     * 
+     * @param nowMillis Current millis() value
+     * @return uint64_t Drift-corrected epoch time in milliseconds
+     */
+    uint64_t interpolateMs(unsigned long nowMillis) const;
+    
+    /**
+     * @brief Move the cache anchor (and drift span) to a known chip time
+     * 
+     * @param epochTime RTC time
+     * @param atMillis Millis value at which the RTC showed epochTime
+     */
+    void anchorCache(time_t epochTime, unsigned long atMillis);
+    
     /**
      * @brief Write a single byte to RTC register
      * 
@@ -224,6 +329,11 @@ private:
      */
     bool readRegisters(uint8_t reg, uint8_t* buffer, uint8_t length);
     
+    /**
+     * @brief readRegisters() without latency recording (takes the I2C mutex)
+     */
+    bool readRegistersLocked(uint8_t reg, uint8_t* buffer, uint8_t length);
+    
     /**
      * @brief Write multiple bytes to RTC starting at register
      * 
@@ -0,0 +1,102 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <Arduino.h>
+
+// Binary event trace for post-mortem timing analysis.
+//
+// Fixed 12-byte records (microsecond timestamp, event, three arguments) go
+// into a ring in PSRAM (a smaller one in internal RAM without it). record()
+// only copies its arguments under a spinlock, so it is cheap enough for the
+// input, controller and publisher paths and changes no timing the way
+// verbose logging does; nothing is formatted until a dump is decoded by
+// tools/trace_decode.py.
+//
+// Dump stream (little-endian), cut into pieces by readDump():
+//   header  "FWTR", u8 version, u8 record size, u16 ring capacity,
+//           u32 first sequence number, u32 end sequence number (16 bytes)
+//   block   u32 sequence of the first record, u8 record count, 3 reserved
+//           bytes, then count records
+//   end     a block with count 0 carrying the end sequence number; its
+//           reserved bytes hold the number of records lost (u24, saturating)
+// Records overwritten while a slow dump is still running show up as a jump
+// in the block sequence numbers rather than as corrupted data, and are
+// counted in the end block.
+
+enum TraceEvent : uint8_t {
+    TRACE_NONE = 0,
+    TRACE_BOOT,          // a32 = esp_reset_reason()
+    TRACE_BUTTON,        // a8 = bay | button index, a16 = 1 pressed / 0 released
+    TRACE_COIN,          // a8 = bay, a32 = coins detected so far (a16 = 1 for PCNT pulses)
+    TRACE_STATE,         // a8 = bay | old MachineState, a16 = new MachineState, a32 = tokens left
+    TRACE_RELAY,         // a8 = bay | relay, a16 = 1 on / 0 off, a32 = resulting relay port value
+    TRACE_MQTT_ENQUEUE,  // a8 = MqttTopicId, a16 = payload bytes, a32 = pool handle (0xFFFF: flash outbox)
+    TRACE_MQTT_PUBLISH,  // a8 = MqttTopicId, a16 = payload bytes, a32 = time queued (ms)
+    TRACE_MQTT_DROP      // a8 = MqttTopicId, a16 = payload bytes, a32 = TraceDropReason
+};
+
+enum TraceDropReason : uint8_t {
+    TRACE_DROP_POOL_FULL = 1,
+    TRACE_DROP_QUEUE_FULL,
+    TRACE_DROP_RETRIES,
+    TRACE_DROP_DISCONNECTED
+};
+
+struct TraceRecord {
+    uint32_t micros;
+    uint8_t event;  // TraceEvent
+    uint8_t a8;
+    uint16_t a16;
+    uint32_t a32;
+};
+static_assert(sizeof(TraceRecord) == 12, "trace_decode.py expects 12-byte records");
+
+// Read position of one dump; each transport (console, BLE, MQTT) keeps its own
+struct TraceCursor {
+    uint32_t next;
+    uint32_t end;
+    uint32_t lost;  // Records overwritten before they were sent
+    bool headerSent;
+    bool active;
+};
+
+class Trace {
+public:
+    static const uint8_t VERSION = 2;  // 2: bay in a8 of BUTTON/COIN/STATE/RELAY
+    static const size_t HEADER_SIZE = 16;
+    static const size_t BLOCK_HEADER_SIZE = 8;
+
+    // "bay | value" above: the bay in the top two bits of a8, the value
+    // (button, state or relay, all below 64) in the rest
+    static const uint8_t BAY_SHIFT = 6;
+    static uint8_t withBay(uint8_t bay, uint8_t value) {
+        return (uint8_t)((bay << BAY_SHIFT) | (value & ((1 << BAY_SHIFT) - 1)));
+    }
+
+    // Allocate the ring (call once, early in setup)
+    static bool begin();
+
+    // Any task; not from ISRs. recordAt() takes the timestamp of an edge
+    // captured earlier (e.g. the INT edge of an input capture).
+    static void record(TraceEvent event, uint8_t a8 = 0, uint16_t a16 = 0, uint32_t a32 = 0) {
+        recordAt((uint32_t)micros(), event, a8, a16, a32);
+    }
+    static void recordAt(uint32_t timestampMicros, TraceEvent event, uint8_t a8, uint16_t a16, uint32_t a32);
+
+    // Dump the newest maxRecords records (0 = everything still in the ring)
+    static void startDump(TraceCursor& cursor, uint32_t maxRecords = 0);
+    // Next piece of the stream: the header, then blocks of at most
+    // maxRecords records that fit in size bytes, then the end block.
+    // Returns the bytes written; 0 once the end block went out.
+    static size_t readDump(TraceCursor& cursor, uint8_t* buffer, size_t size, uint8_t maxRecords = 255);
+
+    static uint32_t getCapacity() { return capacity; }
+    static uint32_t getRecorded() { return head; }
+
+private:
+    static TraceRecord* ring;
+    static uint32_t capacity;  // Power of two
+    static volatile uint32_t head;  // Sequence number of the next record
+};
+
+#endif // TRACE_H
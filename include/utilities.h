@@ -25,6 +25,15 @@
 #define I2C_SCL_PIN      18
 #define INT_PIN          23  // Interrupt pin from IO expander
 
+// INT lines of the extra bays' IO expanders (BAY_COUNT > 1, see constants.h).
+// Override in platformio.ini once wired; -1 polls that bay's PORT0 instead.
+#ifndef BAY1_INT_PIN
+#define BAY1_INT_PIN     -1
+#endif
+#ifndef BAY2_INT_PIN
+#define BAY2_INT_PIN     -1
+#endif
+
 // Define a built-in LED pin for visual debugging
 #define LED_PIN          12   // Blue LED connected to IO12 per schematic
 
@@ -53,6 +62,11 @@
 // Coin acceptor pins on TCA9535 (Port 0)
 #define COIN_SIG         6   // P06 - Coin signal
 
+// Optional direct coin input for hardware pulse counting (PCNT).
+// Route the acceptor signal to a free GPIO and build with -DCOIN_PCNT_PIN=<gpio>
+// (see platformio.ini). When defined, COIN_SIG on the TCA9535 is ignored.
+// #define COIN_PCNT_PIN    34  // Input-only GPIO, external pull-up recommended
+
 // Relay pins on TCA9535 (Port 1)
 #define RELAY1           0   // P10 - clear water
 #define RELAY2           1   // P11 - Foam
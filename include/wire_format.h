@@ -0,0 +1,37 @@
+#ifndef WIRE_FORMAT_H
+#define WIRE_FORMAT_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+// Payload encoding for STATE_TOPIC / ACTION_TOPIC. JSON stays the default;
+// the backend can switch an environment to MessagePack (same keys, binary
+// framing) by sending "wire_format" in an INIT or CONFIG message. The choice
+// is stored per environment. Inbound payloads are detected per message, so
+// COMMAND_TOPIC accepts either format regardless of the setting.
+enum WireFormat : uint8_t {
+    WIRE_FORMAT_JSON = 0,
+    WIRE_FORMAT_MSGPACK = 1
+};
+
+// Outbound format for the current environment
+WireFormat getWireFormat();
+
+// Load the stored format for an environment (called when topics are rebuilt)
+void loadWireFormat(const String& environment);
+
+// Switch (and persist) the format for the current environment
+void setWireFormat(WireFormat format);
+
+WireFormat parseWireFormat(const char* name, WireFormat fallback);
+const char* wireFormatName(WireFormat format);
+
+// Encode doc in the current (or given) format; returns 0 if it does not fit
+size_t encodePayload(const JsonDocument& doc, uint8_t* out, size_t size);
+size_t encodePayload(const JsonDocument& doc, WireFormat format, uint8_t* out, size_t size);
+
+// Decode a JSON or MessagePack payload (format detected from the first byte)
+DeserializationError decodePayload(JsonDocument& doc, const uint8_t* payload, size_t length);
+bool isMsgPackPayload(const uint8_t* payload, size_t length);
+
+#endif // WIRE_FORMAT_H
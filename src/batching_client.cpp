@@ -0,0 +1,87 @@
+#include "batching_client.h"
+#include "logger.h"
+
+BatchingClient::BatchingClient(Client& inner)
+    : _inner(inner), _buffer(NULL), _length(0), _batching(false), _failed(false), _flushCount(0) {
+}
+
+BatchingClient::~BatchingClient() {
+    free(_buffer);
+}
+
+void BatchingClient::beginBatch() {
+    // Allocated on first use: constructed before the heap/PSRAM setup in setup()
+    if (_buffer == NULL) {
+        _buffer = static_cast<uint8_t*>(malloc(BUFFER_SIZE));
+        if (_buffer == NULL) {
+            LOG_WARNING("BatchingClient: no memory for %u byte buffer, writing unbatched", (unsigned int)BUFFER_SIZE);
+            return;
+        }
+    }
+    _length = 0;
+    _failed = false;
+    _batching = true;
+}
+
+bool BatchingClient::endBatch() {
+    bool ok = flushHeld() && !_failed;
+    _batching = false;
+    _failed = false;
+    _length = 0;
+    return ok;
+}
+
+size_t BatchingClient::write(const uint8_t* buf, size_t size) {
+    if (!_batching) {
+        size_t written = _inner.write(buf, size);
+        if (written == size) {
+            _flushCount++;
+        }
+        return written;
+    }
+
+    // Size threshold: hand over what we hold before it would overflow
+    if (_length + size > BUFFER_SIZE) {
+        if (!flushHeld()) {
+            return 0;
+        }
+    }
+    if (size > BUFFER_SIZE) {
+        size_t written = _inner.write(buf, size);
+        if (written != size) {
+            _failed = true;
+            return 0;
+        }
+        _flushCount++;
+        return written;
+    }
+
+    memcpy(_buffer + _length, buf, size);
+    _length += size;
+    return size;
+}
+
+void BatchingClient::flush() {
+    flushHeld();
+    _inner.flush();
+}
+
+void BatchingClient::stop() {
+    _length = 0;
+    _batching = false;
+    _inner.stop();
+}
+
+bool BatchingClient::flushHeld() {
+    if (_length == 0) {
+        return true;
+    }
+    size_t held = _length;
+    _length = 0;
+    if (_inner.write(_buffer, held) != held) {
+        _failed = true;
+        return false;
+    }
+    _flushCount++;
+    return true;
+}
@@ -1,8 +1,21 @@
 #include "ble_machine_loader.h"
 #include "car_wash_controller.h"
-#include <mbedtls/md.h>
+#include "ble_config_manager.h"
+#include <Preferences.h>
 #include <mbedtls/sha256.h>
 
+// SHA-256 block size, i.e. the HMAC key pad length
+static const size_t HMAC_BLOCK_SIZE = 64;
+
+// Time depends only on the length, not on where the inputs differ
+static bool constantTimeEquals(const uint8_t* a, const uint8_t* b, size_t length) {
+    uint8_t diff = 0;
+    for (size_t i = 0; i < length; i++) {
+        diff |= a[i] ^ b[i];
+    }
+    return diff == 0;
+}
+
 BLEMachineLoader::BLEMachineLoader() 
     : pServer(nullptr), 
       pService(nullptr), 
@@ -12,10 +25,30 @@ BLEMachineLoader::BLEMachineLoader()
       pLoadCommandCharacteristic(nullptr),
       pLoadStatusCharacteristic(nullptr),
       pMachineStateCharacteristic(nullptr),
+      pMachineStatusCharacteristic(nullptr),
+      pTraceCharacteristic(nullptr),
       deviceConnected(false),
       bleInitialized(false),
+      bayCount(0),
       controller(nullptr),
-      machineId("") {
+      statusBay(0),
+      machineId(""),
+      statusSent(false),
+      loadStatus(BLE_LOAD_READY),
+      lastNotifiedState(STATE_FREE),
+      stateNotified(false),
+      peerKnown(false),
+      fastConnection(false),
+      lastInteraction(0),
+      traceRequested(false),
+      hmacReady(false) {
+    memset(controllers, 0, sizeof(controllers));
+    memset(&traceCursor, 0, sizeof(traceCursor));
+    memset(&lastStatus, 0, sizeof(lastStatus));
+    memset(peerAddress, 0, sizeof(peerAddress));
+    mbedtls_sha256_init(&hmacInner);
+    mbedtls_sha256_init(&hmacOuter);
+    memset(verifiedTokens, 0, sizeof(verifiedTokens));
     resetLoadData();
 }
 
@@ -23,22 +56,39 @@ BLEMachineLoader::~BLEMachineLoader() {
     if (pServer && bleInitialized) {
         pServer->getAdvertising()->stop();
     }
+    mbedtls_sha256_free(&hmacInner);
+    mbedtls_sha256_free(&hmacOuter);
 }
 
-bool BLEMachineLoader::begin(const String& machineId, CarWashController* ctrl) {
+bool BLEMachineLoader::begin(const String& machineId, CarWashController* const* ctrls, uint8_t count) {
     LOG_INFO("Initializing BLE Machine Loader...");
     
-    if (ctrl == nullptr) {
-        LOG_ERROR("Controller cannot be null");
+    if (count == 0 || count > MAX_BAYS) {
+        LOG_ERROR("Invalid bay count: %d", count);
         return false;
     }
+    for (uint8_t i = 0; i < count; i++) {
+        if (ctrls[i] == nullptr) {
+            LOG_ERROR("Controller for bay %d cannot be null", i);
+            return false;
+        }
+        controllers[i] = ctrls[i];
+    }
     
     this->machineId = machineId;
-    this->controller = ctrl;
+    this->bayCount = count;
+    this->statusBay = 0;
+    this->controller = controllers[0];
+    
+    if (!hmacReady && !prepareAuthKey()) {
+        LOG_ERROR("Failed to prepare authorization key - BLE loads will be rejected");
+    }
     
     // Initialize BLE with machine-specific name
     String deviceName = String(BLE_MACHINE_DEVICE_NAME) + machineId;
     BLEDevice::init(deviceName.c_str());
+    // Offered in the MTU exchange the phone starts after connecting
+    BLEDevice::setMTU(BLE_PREFERRED_MTU);
     
     // Create BLE Server
     pServer = BLEDevice::createServer();
@@ -84,7 +134,8 @@ bool BLEMachineLoader::begin(const String& machineId, CarWashController* ctrl) {
     pTokensCharacteristic->addDescriptor(tokensDesc);
     
     // Create Load Command Characteristic (Write)
-    // Format: "LOAD|authToken" where authToken is the authorization token from backend
+    // Format: "LOAD|authToken" where authToken is the authorization token from backend,
+    // or "LOAD<bay>|authToken" to load another bay of a multi-bay board
     pLoadCommandCharacteristic = pService->createCharacteristic(
         LOAD_COMMAND_CHAR_UUID,
         BLECharacteristic::PROPERTY_WRITE
@@ -92,7 +143,7 @@ bool BLEMachineLoader::begin(const String& machineId, CarWashController* ctrl) {
     pLoadCommandCharacteristic->setCallbacks(this);
     
     BLEDescriptor* loadCmdDesc = new BLEDescriptor(BLEUUID((uint16_t)0x2901));
-    loadCmdDesc->setValue("Load Command - Write 'LOAD|authToken' to initiate machine loading");
+    loadCmdDesc->setValue("Load Command - Write 'LOAD|authToken' (or 'LOAD<bay>|authToken') to initiate machine loading");
     pLoadCommandCharacteristic->addDescriptor(loadCmdDesc);
     
     // Create Load Status Characteristic (Read/Notify)
@@ -141,18 +192,51 @@ bool BLEMachineLoader::begin(const String& machineId, CarWashController* ctrl) {
     pMachineStateCharacteristic->addDescriptor(machineStateDesc);
     LOG_INFO("Machine State characteristic fully configured");
     
+    // Create Machine Status Characteristic (Read/Notify, packed BleMachineStatus)
+    pMachineStatusCharacteristic = pService->createCharacteristic(
+        MACHINE_STATUS_CHAR_UUID,
+        BLECharacteristic::PROPERTY_READ |
+        BLECharacteristic::PROPERTY_NOTIFY
+    );
+    if (pMachineStatusCharacteristic == nullptr) {
+        LOG_ERROR("Failed to create Machine Status characteristic!");
+        return false;
+    }
+    pMachineStatusCharacteristic->addDescriptor(new BLE2902());
+    
+    BLEDescriptor* machineStatusDesc = new BLEDescriptor(BLEUUID((uint16_t)0x2901));
+    machineStatusDesc->setValue("Machine Status - Packed state, load status, tokens and seconds left");
+    pMachineStatusCharacteristic->addDescriptor(machineStatusDesc);
+    statusSent = false;
+    
+    // Create Trace Dump Characteristic (Notify): header, blocks and end block
+    // of the binary trace stream, one per notification
+    pTraceCharacteristic = pService->createCharacteristic(
+        TRACE_DUMP_CHAR_UUID,
+        BLECharacteristic::PROPERTY_NOTIFY
+    );
+    if (pTraceCharacteristic == nullptr) {
+        LOG_ERROR("Failed to create Trace Dump characteristic!");
+        return false;
+    }
+    pTraceCharacteristic->addDescriptor(new BLE2902());
+    
+    BLEDescriptor* traceDesc = new BLEDescriptor(BLEUUID((uint16_t)0x2901));
+    traceDesc->setValue("Trace Dump - Write 'TRACE|password' to Load Command to stream the event trace");
+    pTraceCharacteristic->addDescriptor(traceDesc);
+    
     // Start the service
     LOG_INFO("Starting BLE service with all characteristics...");
     pService->start();
     LOG_INFO("BLE service started successfully");
     LOG_INFO("5 required characteristics created: User ID, User Name, Tokens, Load Command (with auth), Load Status");
-    LOG_INFO("1 optional characteristic created: Machine State");
+    LOG_INFO("3 optional characteristics created: Machine State, Machine Status, Trace Dump");
     
     // Mark as initialized before starting advertising
     bleInitialized = true;
     
-    // Start advertising only if machine is FREE
-    if (controller && controller->getCurrentState() == STATE_FREE) {
+    // Start advertising only if a bay is FREE
+    if (isAnyBayFree()) {
         startAdvertising();
         LOG_INFO("BLE Machine Loader initialized. Device name: %s", deviceName.c_str());
         LOG_INFO("Machine is FREE - BLE advertising started");
@@ -192,11 +276,29 @@ void BLEMachineLoader::stopAdvertising() {
 void BLEMachineLoader::onConnect(BLEServer* pServer) {
     deviceConnected = true;
     LOG_INFO("BLE client connected for machine loading");
-    updateLoadStatusCharacteristic("Connected - Send user data and LOAD command");
+    updateLoadStatusCharacteristic(BLE_LOAD_CONNECTED, "Connected - Send user data and LOAD command");
+    // Fresh status for the new client
+    statusSent = false;
+}
+
+void BLEMachineLoader::onConnect(BLEServer* pServer, esp_ble_gatts_cb_param_t* param) {
+    // Called right after onConnect(pServer) with the peer address, which the
+    // connection parameter update needs
+    memcpy(peerAddress, param->connect.remote_bda, sizeof(peerAddress));
+    peerKnown = true;
+    requestConnectionParams(true);
+}
+
+void BLEMachineLoader::onMtuChanged(BLEServer* pServer, esp_ble_gatts_cb_param_t* param) {
+    LOG_INFO("BLE MTU negotiated: %u bytes", param->mtu.mtu);
 }
 
 void BLEMachineLoader::onDisconnect(BLEServer* pServer) {
     deviceConnected = false;
+    peerKnown = false;
+    fastConnection = false;
+    traceRequested = false;
+    traceCursor.active = false;
     LOG_INFO("BLE client disconnected from machine loading");
     
     // Reset load data on disconnect
@@ -204,8 +306,8 @@ void BLEMachineLoader::onDisconnect(BLEServer* pServer) {
         resetLoadData();
     }
     
-    // Restart advertising only if machine is still FREE
-    if (controller && controller->getCurrentState() == STATE_FREE) {
+    // Restart advertising only if a bay is still FREE
+    if (isAnyBayFree()) {
         delay(500);
         startAdvertising();
         LOG_INFO("BLE advertising restarted");
@@ -215,6 +317,7 @@ void BLEMachineLoader::onDisconnect(BLEServer* pServer) {
 void BLEMachineLoader::onWrite(BLECharacteristic* pCharacteristic) {
     String uuid = pCharacteristic->getUUID().toString().c_str();
     std::string value = pCharacteristic->getValue();
+    noteInteraction();
     
     // Convert to String, handling null bytes and trimming
     String valueStr = "";
@@ -230,24 +333,24 @@ void BLEMachineLoader::onWrite(BLECharacteristic* pCharacteristic) {
     // User ID Characteristic
     if (uuid == USER_ID_CHAR_UUID) {
         if (valueStr.length() > 0 && valueStr.length() <= 100) {
-            loadData.userId = valueStr;
+            loadData.userId.assign(valueStr.c_str(), valueStr.length());
             LOG_INFO("User ID set: %s", loadData.userId.c_str());
-            updateLoadStatusCharacteristic("User ID received");
+            updateLoadStatusCharacteristic(BLE_LOAD_DATA_RECEIVED, "User ID received");
         } else {
             LOG_WARNING("Invalid user ID length: %d (must be 1-100)", valueStr.length());
-            updateLoadStatusCharacteristic("Error: Invalid user ID");
+            updateLoadStatusCharacteristic(BLE_LOAD_ERROR, "Error: Invalid user ID");
         }
     }
     // User Name Characteristic
     else if (uuid == USER_NAME_CHAR_UUID) {
         if (valueStr.length() > 0 && valueStr.length() <= 100) {
-            loadData.userName = valueStr;
+            loadData.userName.assign(valueStr.c_str(), valueStr.length());
             LOG_INFO("User Name set: %s", loadData.userName.c_str());
-            updateLoadStatusCharacteristic("User name received");
+            updateLoadStatusCharacteristic(BLE_LOAD_DATA_RECEIVED, "User name received");
         } else {
             LOG_WARNING("Invalid user name length: %d (must be 1-100), received: '%s'", 
                        valueStr.length(), valueStr.c_str());
-            updateLoadStatusCharacteristic("Error: Invalid user name");
+            updateLoadStatusCharacteristic(BLE_LOAD_ERROR, "Error: Invalid user name");
         }
     }
     // Tokens Characteristic
@@ -256,189 +359,523 @@ void BLEMachineLoader::onWrite(BLECharacteristic* pCharacteristic) {
         if (tokens > 0 && tokens <= 100) {
             loadData.tokens = tokens;
             LOG_INFO("Tokens set: %d", loadData.tokens);
-            updateLoadStatusCharacteristic("Tokens received");
+            updateLoadStatusCharacteristic(BLE_LOAD_DATA_RECEIVED, "Tokens received");
         } else {
             LOG_WARNING("Invalid token count: %d", tokens);
-            updateLoadStatusCharacteristic("Error: Invalid token count");
+            updateLoadStatusCharacteristic(BLE_LOAD_ERROR, "Error: Invalid token count");
         }
     }
     // Load Command Characteristic
-    // Format: "LOAD|authToken" where authToken is the authorization token
+    // Format: "LOAD[bay]|authToken" where authToken is the authorization token
     else if (uuid == LOAD_COMMAND_CHAR_UUID) {
         // Check if command starts with "LOAD"
         if (valueStr.startsWith("LOAD")) {
             // Parse auth token from command
             int separatorIndex = valueStr.indexOf('|');
-            if (separatorIndex >= 0 && separatorIndex < valueStr.length() - 1) {
-                loadData.authToken = valueStr.substring(separatorIndex + 1);
-                if (loadData.authToken.length() > 0) {
+            // Optional bay number between LOAD and the separator
+            int bay = 0;
+            bool bayValid = true;
+            for (int i = 4; separatorIndex > 4 && i < separatorIndex; i++) {
+                char c = valueStr[i];
+                if (c < '0' || c > '9' || bay > MAX_BAYS) {
+                    bayValid = false;
+                    break;
+                }
+                bay = bay * 10 + (c - '0');
+            }
+            if (!bayValid || bay >= bayCount) {
+                LOG_WARNING("Load command for unknown bay (%d bay(s) on this machine)", bayCount);
+                updateLoadStatusCharacteristic(BLE_LOAD_ERROR, "Error: Unknown bay");
+            } else if (separatorIndex >= 0 && separatorIndex < valueStr.length() - 1) {
+                loadData.bay = (uint8_t)bay;
+                selectStatusBay(loadData.bay);
+                const char* token = valueStr.c_str() + separatorIndex + 1;
+                if (!loadData.authToken.assign(token, valueStr.length() - separatorIndex - 1)) {
+                    LOG_WARNING("Auth token longer than %u characters, rejecting", (unsigned int)AUTH_TOKEN_MAX_LENGTH);
+                    loadData.authToken.clear();
+                    updateLoadStatusCharacteristic(BLE_LOAD_ERROR, "Error: Authorization token too long");
+                } else if (loadData.authToken.length() > 0) {
                     // Store when we received the token for expiration checking
                     loadData.tokenReceivedTime = millis();
-                    LOG_INFO("Load command received with auth token (length: %d)", loadData.authToken.length());
+                    LOG_INFO("Load command received for bay %d with auth token (length: %d)",
+                             loadData.bay, loadData.authToken.length());
                     loadData.loadRequested = true;
                     processLoadCommand();
                 } else {
                     LOG_WARNING("Load command has empty auth token. Format: LOAD|authToken");
-                    updateLoadStatusCharacteristic("Error: Load command must include auth token (LOAD|token)");
+                    updateLoadStatusCharacteristic(BLE_LOAD_ERROR, "Error: Load command must include auth token (LOAD|token)");
                 }
             } else {
                 LOG_WARNING("Load command missing auth token. Format: LOAD|authToken");
-                updateLoadStatusCharacteristic("Error: Load command must include auth token (LOAD|token)");
+                updateLoadStatusCharacteristic(BLE_LOAD_ERROR, "Error: Load command must include auth token (LOAD|token)");
             }
+        } else if (valueStr.startsWith("TRACE|")) {
+            requestTraceDump(valueStr.c_str() + 6);
         } else {
             LOG_WARNING("Unknown command: %s", valueStr.c_str());
-            updateLoadStatusCharacteristic("Error: Unknown command. Use LOAD|authToken");
+            updateLoadStatusCharacteristic(BLE_LOAD_ERROR, "Error: Unknown command. Use LOAD|authToken");
         }
     }
 }
 
+void BLEMachineLoader::failLoad(const char* message) {
+    loadData.errorMessage = message;
+    char status[LOAD_ERROR_MAX_LENGTH + 8];
+    snprintf(status, sizeof(status), "Error: %s", loadData.errorMessage.c_str());
+    updateLoadStatusCharacteristic(BLE_LOAD_ERROR, status);
+}
+
+void BLEMachineLoader::requestTraceDump(const char* password) {
+    // Same password as the configuration service
+    Preferences prefs;
+    prefs.begin(PREFS_NAMESPACE, true);
+    String expected = prefs.getString(PREFS_BLE_PASSWORD, DEFAULT_MASTER_PASSWORD);
+    prefs.end();
+    
+    size_t length = strlen(password);
+    bool match = length == expected.length() &&
+                 constantTimeEquals(reinterpret_cast<const uint8_t*>(password),
+                                    reinterpret_cast<const uint8_t*>(expected.c_str()), length);
+    if (!match) {
+        LOG_WARNING("Trace dump rejected: wrong password");
+        updateLoadStatusCharacteristic(BLE_LOAD_ERROR, "Error: Trace dump not authorized");
+        return;
+    }
+    LOG_INFO("Trace dump requested over BLE");
+    traceRequested = true;
+}
+
 void BLEMachineLoader::processLoadCommand() {
     // Validate all data is present
-    if (loadData.userId.length() == 0) {
-        loadData.errorMessage = "User ID not set";
-        updateLoadStatusCharacteristic("Error: " + loadData.errorMessage);
+    if (loadData.userId.isEmpty()) {
+        failLoad("User ID not set");
         LOG_ERROR("Load failed: %s", loadData.errorMessage.c_str());
         return;
     }
     
-    if (loadData.userName.length() == 0) {
-        loadData.errorMessage = "User name not set";
-        updateLoadStatusCharacteristic("Error: " + loadData.errorMessage);
+    if (loadData.userName.isEmpty()) {
+        failLoad("User name not set");
         LOG_ERROR("Load failed: %s", loadData.errorMessage.c_str());
         return;
     }
     
     if (loadData.tokens <= 0) {
-        loadData.errorMessage = "Invalid token count";
-        updateLoadStatusCharacteristic("Error: " + loadData.errorMessage);
+        failLoad("Invalid token count");
         LOG_ERROR("Load failed: %s", loadData.errorMessage.c_str());
         return;
     }
     
     // Validate authorization token
-    if (loadData.authToken.length() == 0) {
-        loadData.errorMessage = "Authorization token not set";
-        updateLoadStatusCharacteristic("Error: " + loadData.errorMessage);
+    if (loadData.authToken.isEmpty()) {
+        failLoad("Authorization token not set");
         LOG_ERROR("Load failed: %s", loadData.errorMessage.c_str());
         return;
     }
     
-    if (!validateAuthToken(loadData.authToken, loadData.userId, machineId, loadData.tokens)) {
-        loadData.errorMessage = "Invalid or expired authorization token";
-        updateLoadStatusCharacteristic("Error: " + loadData.errorMessage);
+    // Tokens are issued per bay, for the ID the bay publishes under
+    CarWashController* target = controllers[loadData.bay];
+    if (!validateAuthToken(loadData.authToken.c_str(), loadData.authToken.length(), loadData.userId.c_str(),
+                           bayMachineId(loadData.bay), loadData.tokens)) {
+        failLoad("Invalid or expired authorization token");
         LOG_ERROR("Load failed: Authorization token validation failed");
         return;
     }
     
     // Check if machine is FREE
-    if (controller->getCurrentState() != STATE_FREE) {
-        loadData.errorMessage = "Machine is not available";
-        updateLoadStatusCharacteristic("Error: " + loadData.errorMessage);
-        LOG_ERROR("Load failed: Machine is not FREE");
+    if (target->getCurrentState() != STATE_FREE) {
+        failLoad("Machine is not available");
+        LOG_ERROR("Load failed: Bay %d is not FREE", loadData.bay);
         return;
     }
     
-    // Load the machine directly (simulate MQTT INIT message)
-    LOG_INFO("Loading machine via BLE: user=%s, tokens=%d", loadData.userId.c_str(), loadData.tokens);
+    // Load the machine directly
+    LOG_INFO("Loading bay %d via BLE: user=%s, tokens=%d", loadData.bay, loadData.userId.c_str(), loadData.tokens);
     
     // Create a session ID
-    char sessionIdBuffer[50];
-    sprintf(sessionIdBuffer, "ble_%lu", millis());
-    
-    // Simulate MQTT message by directly calling the controller's load logic
-    // We'll need to add a method to CarWashController to load via BLE
-    // For now, use a simulated MQTT message
-    StaticJsonDocument<512> doc;
-    doc["session_id"] = String(sessionIdBuffer);
-    doc["user_id"] = loadData.userId;
-    doc["user_name"] = loadData.userName;
-    doc["tokens"] = loadData.tokens;
-    doc["timestamp"] = "";  // Will be set by controller
-    
-    String jsonString;
-    serializeJson(doc, jsonString);
-    
-    // Call handleMqttMessage with INIT topic to load the machine
-    // Note: This is a bit of a hack - ideally we'd have a dedicated loadMachine() method
-    extern String INIT_TOPIC;
-    controller->handleMqttMessage(INIT_TOPIC.c_str(), (const uint8_t*)jsonString.c_str(), jsonString.length());
+    char sessionIdBuffer[32];
+    snprintf(sessionIdBuffer, sizeof(sessionIdBuffer), "ble_%lu", millis());
+    
+    // Hand the session straight to the controller (same path as an INIT message,
+    // without serializing it to JSON first); the strings are copied once into
+    // the controller's inline buffers
+    target->loadSession(sessionIdBuffer, loadData.userId.c_str(), loadData.userName.c_str(),
+                        loadData.tokens, "");
     
     loadData.loadComplete = true;
-    updateLoadStatusCharacteristic("Success: Machine loaded");
+    updateLoadStatusCharacteristic(BLE_LOAD_SUCCESS, "Success: Machine loaded");
     LOG_INFO("Machine loaded successfully via BLE");
     
-    // Stop advertising since machine is now loaded
-    stopAdvertising();
+    // Stop advertising once no bay is left to load
+    if (!isAnyBayFree()) {
+        stopAdvertising();
+    }
+}
+
+void BLEMachineLoader::selectStatusBay(uint8_t bay) {
+    if (bay >= bayCount || bay == statusBay) {
+        return;
+    }
+    statusBay = bay;
+    controller = controllers[bay];
+    // Resend both status characteristics for the new bay
+    statusSent = false;
+    stateNotified = false;
+}
+
+bool BLEMachineLoader::isAnyBayFree() const {
+    for (uint8_t i = 0; i < bayCount; i++) {
+        if (controllers[i]->getCurrentState() == STATE_FREE) {
+            return true;
+        }
+    }
+    return false;
 }
 
-void BLEMachineLoader::updateLoadStatusCharacteristic(const String& status) {
+void BLEMachineLoader::updateLoadStatusCharacteristic(BleLoadStatus code, const char* status) {
+    // Picked up by the next publishStatus()
+    loadStatus = code;
     if (pLoadStatusCharacteristic && deviceConnected) {
-        pLoadStatusCharacteristic->setValue(status.c_str());
+        pLoadStatusCharacteristic->setValue(status);
         pLoadStatusCharacteristic->notify();
-        LOG_DEBUG("Load status updated: %s", status.c_str());
+        LOG_DEBUG("Load status updated: %s", status);
+    }
+}
+
+void BLEMachineLoader::requestConnectionParams(bool fast) {
+    if (!pServer || !peerKnown) {
+        return;
+    }
+    if (fast) {
+        pServer->updateConnParams(peerAddress, BLE_FAST_CONN_MIN_INTERVAL, BLE_FAST_CONN_MAX_INTERVAL,
+                                  BLE_FAST_CONN_LATENCY, BLE_FAST_CONN_TIMEOUT);
+        lastInteraction = millis();
+    } else {
+        pServer->updateConnParams(peerAddress, BLE_SLOW_CONN_MIN_INTERVAL, BLE_SLOW_CONN_MAX_INTERVAL,
+                                  BLE_SLOW_CONN_LATENCY, BLE_SLOW_CONN_TIMEOUT);
+    }
+    fastConnection = fast;
+    LOG_DEBUG("Requested %s BLE connection interval", fast ? "fast" : "slow");
+}
+
+// Writes and status changes other than the countdown keep the link fast
+void BLEMachineLoader::noteInteraction() {
+    if (!fastConnection) {
+        requestConnectionParams(true);
+    } else {
+        lastInteraction = millis();
+    }
+}
+
+void BLEMachineLoader::streamTrace() {
+    if (traceRequested) {
+        traceRequested = false;
+        Trace::startDump(traceCursor);
+        // Blocks should go out at the fast interval
+        noteInteraction();
+    }
+    if (!traceCursor.active) {
+        return;
+    }
+    if (!deviceConnected || !pTraceCharacteristic) {
+        traceCursor.active = false;
+        return;
+    }
+    
+    // One block per notification, as large as the negotiated MTU allows
+    uint8_t block[BLE_PREFERRED_MTU - 3];
+    size_t size = sizeof(block);
+    uint16_t mtu = pServer->getPeerMTU(pServer->getConnId());
+    if (mtu >= 23 && (size_t)(mtu - 3) < size) {
+        size = mtu - 3;
+    } else if (mtu < 23) {
+        size = 20;
+    }
+    for (uint8_t i = 0; i < TRACE_BLE_BLOCKS_PER_PASS && traceCursor.active; i++) {
+        size_t length = Trace::readDump(traceCursor, block, size);
+        if (length == 0) {
+            break;
+        }
+        pTraceCharacteristic->setValue(block, length);
+        pTraceCharacteristic->notify();
+    }
+    if (!traceCursor.active) {
+        LOG_INFO("Trace dump over BLE complete");
+    } else {
+        lastInteraction = millis();
+    }
+}
+
+void BLEMachineLoader::publishStatus() {
+    if (!bleInitialized || !pMachineStatusCharacteristic || !controller) {
+        return;
+    }
+    
+    // Same values the displays show, already built by controller->update()
+    DisplaySnapshot snapshot;
+    if (!controller->getDisplaySnapshot(snapshot)) {
+        return;
+    }
+    int tokens = controller->getTokensLeft();
+    BleMachineStatus status;
+    status.version = BLE_STATUS_VERSION;
+    status.state = (uint8_t)snapshot.state;
+    status.loadStatus = loadStatus;
+    status.bay = statusBay;
+    status.tokens = (uint16_t)(tokens > 0 ? (tokens < 0xFFFF ? tokens : 0xFFFF) : 0);
+    status.secondsLeft = snapshot.secondsLeft;
+    if (statusSent && memcmp(&status, &lastStatus, sizeof(status)) == 0) {
+        return;
+    }
+    
+    bool interactive = !statusSent || status.state != lastStatus.state ||
+                       status.loadStatus != lastStatus.loadStatus || status.tokens != lastStatus.tokens;
+    pMachineStatusCharacteristic->setValue(reinterpret_cast<uint8_t*>(&status), sizeof(status));
+    if (deviceConnected) {
+        pMachineStatusCharacteristic->notify();
+        if (interactive) {
+            noteInteraction();
+        }
     }
+    lastStatus = status;
+    statusSent = true;
 }
 
-void BLEMachineLoader::updateMachineStateCharacteristic(const String& state) {
+void BLEMachineLoader::updateMachineStateCharacteristic(const char* state) {
     if (pMachineStateCharacteristic && bleInitialized) {
-        pMachineStateCharacteristic->setValue(state.c_str());
+        pMachineStateCharacteristic->setValue(state);
         if (deviceConnected) {
             pMachineStateCharacteristic->notify();
         }
-        LOG_DEBUG("Machine state updated: %s", state.c_str());
+        LOG_DEBUG("Machine state updated: %s", state);
     }
 }
 
 void BLEMachineLoader::resetLoadData() {
-    loadData.userId = "";
-    loadData.userName = "";
+    loadData.userId.clear();
+    loadData.userName.clear();
     loadData.tokens = 0;
-    loadData.authToken = "";
+    loadData.bay = 0;
+    loadData.authToken.clear();
     loadData.tokenReceivedTime = 0;
     loadData.loadRequested = false;
     loadData.loadComplete = false;
-    loadData.errorMessage = "";
+    loadData.errorMessage.clear();
+    loadStatus = BLE_LOAD_READY;
 }
 
-bool BLEMachineLoader::validateAuthToken(const String& token, const String& userId, const String& machineId, int tokens) {
+// Token field as a view into the token buffer (not NUL-terminated)
+struct TokenField {
+    const char* data;
+    size_t length;
+};
+
+static bool fieldEquals(const TokenField& field, const char* expected) {
+    size_t length = strlen(expected);
+    return field.length == length && memcmp(field.data, expected, length) == 0;
+}
+
+// Fields are not terminated (the token is split in place), so log a bounded
+// copy; passing the raw pointer would let the logger copy the whole token tail
+static const char* fieldForLog(const TokenField& field, char* buffer, size_t size) {
+    size_t length = field.length < size - 1 ? field.length : size - 1;
+    memcpy(buffer, field.data, length);
+    buffer[length] = '\0';
+    return buffer;
+}
+
+// Decimal digits only, up to 32 bits
+static bool parseUnsignedField(const TokenField& field, uint32_t& value) {
+    if (field.length == 0 || field.length > 10) {
+        return false;
+    }
+    uint64_t result = 0;
+    for (size_t i = 0; i < field.length; i++) {
+        char c = field.data[i];
+        if (c < '0' || c > '9') {
+            return false;
+        }
+        result = result * 10 + (uint64_t)(c - '0');
+    }
+    if (result > 0xFFFFFFFFull) {
+        return false;
+    }
+    value = (uint32_t)result;
+    return true;
+}
+
+// Lowercase hex, as the backend signs it
+static bool decodeSignature(const TokenField& field, uint8_t* signature) {
+    if (field.length != AUTH_SIGNATURE_LENGTH * 2) {
+        return false;
+    }
+    for (size_t i = 0; i < field.length; i++) {
+        char c = field.data[i];
+        uint8_t nibble;
+        if (c >= '0' && c <= '9') {
+            nibble = c - '0';
+        } else if (c >= 'a' && c <= 'f') {
+            nibble = c - 'a' + 10;
+        } else {
+            return false;
+        }
+        if (i % 2 == 0) {
+            signature[i / 2] = nibble << 4;
+        } else {
+            signature[i / 2] |= nibble;
+        }
+    }
+    return true;
+}
+
+bool BLEMachineLoader::prepareAuthKey() {
+    uint8_t key[HMAC_BLOCK_SIZE];
+    uint8_t pad[HMAC_BLOCK_SIZE];
+    size_t keyLength = strlen(BLE_AUTH_SECRET);
+    memset(key, 0, sizeof(key));
+    if (keyLength > HMAC_BLOCK_SIZE) {
+        // Keys longer than a block are hashed first (RFC 2104)
+        if (mbedtls_sha256_ret((const unsigned char*)BLE_AUTH_SECRET, keyLength, key, 0) != 0) {
+            return false;
+        }
+    } else {
+        memcpy(key, BLE_AUTH_SECRET, keyLength);
+    }
+
+    bool ok = true;
+    mbedtls_sha256_context* targets[2] = { &hmacInner, &hmacOuter };
+    const uint8_t padBytes[2] = { 0x36, 0x5c };
+    for (int t = 0; t < 2 && ok; t++) {
+        for (size_t i = 0; i < HMAC_BLOCK_SIZE; i++) {
+            pad[i] = key[i] ^ padBytes[t];
+        }
+        // Built in a scratch context and cloned: the clone holds the state in
+        // software, so the stored schedule never keeps the SHA engine locked
+        mbedtls_sha256_context scratch;
+        mbedtls_sha256_init(&scratch);
+        ok = mbedtls_sha256_starts_ret(&scratch, 0) == 0 &&
+             mbedtls_sha256_update_ret(&scratch, pad, sizeof(pad)) == 0;
+        if (ok) {
+            mbedtls_sha256_clone(targets[t], &scratch);
+        }
+        mbedtls_sha256_free(&scratch);
+    }
+    memset(key, 0, sizeof(key));
+    memset(pad, 0, sizeof(pad));
+    hmacReady = ok;
+    return ok;
+}
+
+bool BLEMachineLoader::computeAuthSignature(const char* payload, size_t length, uint8_t* digest) {
+    mbedtls_sha256_context ctx;
+    mbedtls_sha256_init(&ctx);
+    // Inner hash continues from the ipad state, outer hash from the opad state
+    mbedtls_sha256_clone(&ctx, &hmacInner);
+    bool ok = mbedtls_sha256_update_ret(&ctx, (const unsigned char*)payload, length) == 0 &&
+              mbedtls_sha256_finish_ret(&ctx, digest) == 0;
+    if (ok) {
+        mbedtls_sha256_clone(&ctx, &hmacOuter);
+        ok = mbedtls_sha256_update_ret(&ctx, digest, AUTH_SIGNATURE_LENGTH) == 0 &&
+             mbedtls_sha256_finish_ret(&ctx, digest) == 0;
+    }
+    mbedtls_sha256_free(&ctx);
+    return ok;
+}
+
+bool BLEMachineLoader::findVerifiedToken(const uint8_t* signature, const char* payload, size_t payloadLength) {
+    unsigned long now = millis();
+    for (uint8_t i = 0; i < AUTH_CACHE_SIZE; i++) {
+        VerifiedToken& entry = verifiedTokens[i];
+        if (!entry.valid) {
+            continue;
+        }
+        if (now - entry.verifiedAt > AUTH_CACHE_TTL_MS) {
+            entry.valid = false;
+            continue;
+        }
+        // Same signature over the same bytes: the HMAC would match again
+        if (entry.payloadLength == payloadLength &&
+            memcmp(entry.payload, payload, payloadLength) == 0 &&
+            constantTimeEquals(entry.signature, signature, AUTH_SIGNATURE_LENGTH)) {
+            entry.lastUsed = now;
+            return true;
+        }
+    }
+    return false;
+}
+
+void BLEMachineLoader::rememberVerifiedToken(const uint8_t* signature, const char* payload, size_t payloadLength) {
+    if (payloadLength > AUTH_PAYLOAD_MAX_LENGTH) {
+        return;  // Not cached; a retry just verifies again
+    }
+    // Free slot first, otherwise the least recently used entry
+    uint8_t slot = 0;
+    for (uint8_t i = 0; i < AUTH_CACHE_SIZE; i++) {
+        if (!verifiedTokens[i].valid) {
+            slot = i;
+            break;
+        }
+        if (verifiedTokens[i].lastUsed < verifiedTokens[slot].lastUsed) {
+            slot = i;
+        }
+    }
+    VerifiedToken& entry = verifiedTokens[slot];
+    memcpy(entry.signature, signature, AUTH_SIGNATURE_LENGTH);
+    memcpy(entry.payload, payload, payloadLength);
+    entry.payloadLength = (uint16_t)payloadLength;
+    entry.verifiedAt = millis();
+    entry.lastUsed = entry.verifiedAt;
+    entry.valid = true;
+}
+
+bool BLEMachineLoader::validateAuthToken(const char* token, size_t length, const char* userId, const char* machineId, int tokens) {
+    unsigned long startMicros = micros();
+    
     // Token format: userId|machineId|tokens|timestamp|signature
-    // Split by |
-    int separatorIndices[4];
-    int separatorCount = 0;
-    
-    for (int i = 0; i < token.length() && separatorCount < 4; i++) {
-        if (token.charAt(i) == '|') {
-            separatorIndices[separatorCount] = i;
-            separatorCount++;
+    // Split in place by | (the signature is everything after the 4th one)
+    TokenField fields[5];
+    size_t fieldCount = 0;
+    size_t fieldStart = 0;
+    for (size_t i = 0; i < length && fieldCount < 4; i++) {
+        if (token[i] == '|') {
+            fields[fieldCount].data = token + fieldStart;
+            fields[fieldCount].length = i - fieldStart;
+            fieldCount++;
+            fieldStart = i + 1;
         }
     }
     
-    if (separatorCount != 4) {
-        LOG_ERROR("Invalid token format: expected 4 separators, got %d", separatorCount);
+    if (fieldCount != 4) {
+        LOG_ERROR("Invalid token format: expected 4 separators, got %u", (unsigned int)fieldCount);
         return false;
     }
-    
-    // Extract parts
-    String tokenUserId = token.substring(0, separatorIndices[0]);
-    String tokenMachineId = token.substring(separatorIndices[0] + 1, separatorIndices[1]);
-    String tokenTokensStr = token.substring(separatorIndices[1] + 1, separatorIndices[2]);
-    String tokenTimestampStr = token.substring(separatorIndices[2] + 1, separatorIndices[3]);
-    String tokenSignature = token.substring(separatorIndices[3] + 1);
+    fields[4].data = token + fieldStart;
+    fields[4].length = length - fieldStart;
+    const TokenField& tokenUserId = fields[0];
+    const TokenField& tokenMachineId = fields[1];
+    const TokenField& tokenTokensStr = fields[2];
+    const TokenField& tokenTimestampStr = fields[3];
+    const TokenField& tokenSignature = fields[4];
     
     // Validate extracted values match
-    if (tokenUserId != userId) {
-        LOG_ERROR("Token userId mismatch: expected %s, got %s", userId.c_str(), tokenUserId.c_str());
+    if (!fieldEquals(tokenUserId, userId)) {
+        char got[33];
+        LOG_ERROR("Token userId mismatch: expected %s, got %s", userId,
+                  fieldForLog(tokenUserId, got, sizeof(got)));
         return false;
     }
     
-    if (tokenMachineId != machineId) {
-        LOG_ERROR("Token machineId mismatch: expected %s, got %s", machineId.c_str(), tokenMachineId.c_str());
+    if (!fieldEquals(tokenMachineId, machineId)) {
+        char got[33];
+        LOG_ERROR("Token machineId mismatch: expected %s, got %s", machineId,
+                  fieldForLog(tokenMachineId, got, sizeof(got)));
         return false;
     }
     
-    int tokenTokens = tokenTokensStr.toInt();
-    if (tokenTokens != tokens) {
-        LOG_ERROR("Token tokens mismatch: expected %d, got %d", tokens, tokenTokens);
+    uint32_t tokenTokens = 0;
+    if (!parseUnsignedField(tokenTokensStr, tokenTokens) || tokens <= 0 || tokenTokens != (uint32_t)tokens) {
+        char got[33];
+        LOG_ERROR("Token tokens mismatch: expected %d, got %s", tokens,
+                  fieldForLog(tokenTokensStr, got, sizeof(got)));
         return false;
     }
     
@@ -453,43 +890,50 @@ bool BLEMachineLoader::validateAuthToken(const String& token, const String& user
     
     // Also validate the token timestamp is reasonable (not too old from backend perspective)
     // This is a sanity check - token should be from last 10 minutes max
-    unsigned long tokenTimestamp = tokenTimestampStr.toInt();
+    uint32_t tokenTimestamp = 0;
     // We can check it's a reasonable Unix timestamp
     // (after year 2020 = 1577836800, before year 2100 = 4102444800)
-    if (tokenTimestamp < 1577836800 || tokenTimestamp > 4102444800) {
-        LOG_ERROR("Token timestamp out of reasonable range: %lu", tokenTimestamp);
+    if (!parseUnsignedField(tokenTimestampStr, tokenTimestamp) ||
+        tokenTimestamp < 1577836800u || tokenTimestamp > 4102444800u) {
+        char got[33];
+        LOG_ERROR("Token timestamp out of reasonable range: %s",
+                  fieldForLog(tokenTimestampStr, got, sizeof(got)));
         return false;
     }
     
-    // Reconstruct payload for signature verification
-    String payload = tokenUserId + "|" + tokenMachineId + "|" + tokenTokensStr + "|" + tokenTimestampStr;
+    uint8_t signature[AUTH_SIGNATURE_LENGTH];
+    if (!decodeSignature(tokenSignature, signature)) {
+        LOG_ERROR("Token signature is not %u hex characters", (unsigned int)(AUTH_SIGNATURE_LENGTH * 2));
+        return false;
+    }
     
-    // Compute HMAC-SHA256
-    unsigned char hmacResult[32];
-    mbedtls_md_context_t ctx;
-    mbedtls_md_type_t md_type = MBEDTLS_MD_SHA256;
+    // The signed payload is the token up to the last separator
+    const char* payload = token;
+    size_t payloadLength = tokenSignature.data - 1 - token;
     
-    mbedtls_md_init(&ctx);
-    mbedtls_md_setup(&ctx, mbedtls_md_info_from_type(md_type), 1);
-    mbedtls_md_hmac_starts(&ctx, (const unsigned char*)BLE_AUTH_SECRET, strlen(BLE_AUTH_SECRET));
-    mbedtls_md_hmac_update(&ctx, (const unsigned char*)payload.c_str(), payload.length());
-    mbedtls_md_hmac_finish(&ctx, hmacResult);
-    mbedtls_md_free(&ctx);
+    // Retried LOAD with a token we already verified
+    if (findVerifiedToken(signature, payload, payloadLength)) {
+        LOG_INFO("Authorization token validated (cached, %lu us)", micros() - startMicros);
+        return true;
+    }
     
-    // Convert to hex string
-    char computedSignature[65];
-    for (int i = 0; i < 32; i++) {
-        sprintf(computedSignature + (i * 2), "%02x", hmacResult[i]);
+    if (!hmacReady) {
+        LOG_ERROR("Authorization key not prepared");
+        return false;
+    }
+    uint8_t computed[AUTH_SIGNATURE_LENGTH];
+    if (!computeAuthSignature(payload, payloadLength, computed)) {
+        LOG_ERROR("Failed to compute token signature");
+        return false;
     }
-    computedSignature[64] = '\0';
     
-    // Compare signatures (constant-time comparison would be better, but this is minimal security)
-    if (tokenSignature != String(computedSignature)) {
+    if (!constantTimeEquals(computed, signature, AUTH_SIGNATURE_LENGTH)) {
         LOG_ERROR("Token signature mismatch");
         return false;
     }
     
-    LOG_INFO("Authorization token validated successfully");
+    rememberVerifiedToken(signature, payload, payloadLength);
+    LOG_INFO("Authorization token validated successfully (%lu us)", micros() - startMicros);
     return true;
 }
 
@@ -525,6 +969,12 @@ void BLEMachineLoader::deinit() {
     pLoadCommandCharacteristic = nullptr;
     pLoadStatusCharacteristic = nullptr;
     pMachineStateCharacteristic = nullptr;
+    pMachineStatusCharacteristic = nullptr;
+    pTraceCharacteristic = nullptr;
+    traceRequested = false;
+    traceCursor.active = false;
+    statusSent = false;
+    stateNotified = false;
     
     bleInitialized = false;
     deviceConnected = false;
@@ -532,30 +982,40 @@ void BLEMachineLoader::deinit() {
 }
 
 void BLEMachineLoader::update() {
-    // Update machine state characteristic
+    // Update machine state characteristic (the packed status carries every
+    // change; the text one is only rewritten when the state itself changes)
     if (controller && bleInitialized) {
         MachineState state = controller->getCurrentState();
-        String stateStr;
-        
-        switch(state) {
-            case STATE_FREE:
-                stateStr = "FREE";
-                break;
-            case STATE_IDLE:
-                stateStr = "IDLE";
-                break;
-            case STATE_RUNNING:
-                stateStr = "RUNNING";
-                break;
-            case STATE_PAUSED:
-                stateStr = "PAUSED";
-                break;
-            default:
-                stateStr = "UNKNOWN";
-                break;
+        if (!stateNotified || state != lastNotifiedState) {
+            const char* stateStr;
+            
+            switch(state) {
+                case STATE_FREE:
+                    stateStr = "FREE";
+                    break;
+                case STATE_IDLE:
+                    stateStr = "IDLE";
+                    break;
+                case STATE_RUNNING:
+                    stateStr = "RUNNING";
+                    break;
+                case STATE_PAUSED:
+                    stateStr = "PAUSED";
+                    break;
+                default:
+                    stateStr = "UNKNOWN";
+                    break;
+            }
+            
+            updateMachineStateCharacteristic(stateStr);
+            lastNotifiedState = state;
+            stateNotified = true;
         }
-        
-        updateMachineStateCharacteristic(stateStr);
+    }
+    
+    // Back to the slow interval once the user stopped interacting
+    if (deviceConnected && fastConnection && millis() - lastInteraction > BLE_FAST_CONN_HOLD_MS) {
+        requestConnectionParams(false);
     }
 }
 
@@ -563,7 +1023,7 @@ bool BLEMachineLoader::isLoadComplete() {
     return loadData.loadComplete;
 }
 
-MachineLoadData BLEMachineLoader::getLoadData() {
+const MachineLoadData& BLEMachineLoader::getLoadData() const {
     return loadData;
 }
 
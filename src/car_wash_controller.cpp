@@ -4,12 +4,26 @@
 #include <freertos/semphr.h>
 #include <Preferences.h>
 #include "ble_config_manager.h"
+#include "profiler.h"
+#include "mqtt_inbound.h"
+#include "trace.h"
+#include "mqtt_outbox.h"
 
-// External mutex for ioExpander access (defined in main.cpp)
+// Wire bus mutex shared by every bay's IO expander (defined in main.cpp)
 extern SemaphoreHandle_t xIoExpanderMutex;
 
-CarWashController::CarWashController(MqttLteClient& client)
+#ifdef COIN_PCNT_PIN
+#include "coin_counter.h"
+// Hardware coin counter (defined in main.cpp)
+extern CoinPulseCounter coinCounter;
+#endif
+
+CarWashController::CarWashController(MqttLteClient& client, uint8_t bayIndex, IoExpander& expander,
+                                     QueueHandle_t mailbox)
     : mqttClient(client),
+      bay(bayIndex),
+      io(expander),
+      displayMailbox(mailbox),
       currentState(STATE_FREE),
       lastActionTime(0),
       activeButton(-1),
@@ -24,14 +38,24 @@ CarWashController::CarWashController(MqttLteClient& client)
       lastFunctionSwitchTime(0),
       gracePeriodStartTime(0),
       gracePeriodActive(false),
-      tokensConsumedCount(0) {
+      tokensConsumedCount(0),
+      graceExpiryHandledAt(0),
+      timersDirty(false),
+      pendingStateFields(0),
+      stateSequence(0),
+      lastKeyframeTime(0),
+      statePublishRetryAt(0),
+      keyframeRequested(true),
+      stateAllocator(stateArena, sizeof(stateArena)),
+      setupEventRequested(false),
+      simulatedCoinRequested(false),
+      displaySnapshotSent(false) {
           
     // Force a read of the coin signal pin at startup to initialize correctly
-    extern IoExpander ioExpander;
     uint8_t rawPortValue0 = 0;
-    if (xIoExpanderMutex != NULL && xSemaphoreTake(xIoExpanderMutex, pdMS_TO_TICKS(100)) == pdTRUE) {
-        rawPortValue0 = ioExpander.readRegister(INPUT_PORT0);
-        xSemaphoreGive(xIoExpanderMutex);
+    if (xIoExpanderMutex != NULL && profiledTake(xIoExpanderMutex, pdMS_TO_TICKS(100), PROFILED_MUTEX_IO_EXPANDER) == pdTRUE) {
+        rawPortValue0 = io.readRegister(INPUT_PORT0);
+        profiledGive(xIoExpanderMutex, PROFILED_MUTEX_IO_EXPANDER);
     } else {
         LOG_ERROR("COIN INIT: Failed to acquire mutex for initial coin state read!");
     }
@@ -62,605 +86,339 @@ CarWashController::CarWashController(MqttLteClient& client)
     LOG_INFO("COIN INIT: COIN_STABLE_READS_REQUIRED = %d", COIN_STABLE_READS_REQUIRED);
     
     // IMPORTANT: Initialize these static variables to prevent false triggers at startup
-    // We'll skip any coin signals that happen in the first few seconds after boot
+    // We'll skip any coin signals that happen in the first COIN_STARTUP_DELAY ms after boot
     unsigned long initTime = millis();
     lastCoinProcessedTime = initTime;
     lastCoinDebounceTime = initTime;
-    LOG_INFO("COIN INIT: Timers initialized at %lu ms (will ignore coins for first %lu ms)", initTime, COIN_STARTUP_DELAY);
+#ifdef COIN_PCNT_PIN
+    coinCounterStartup = true;
+    coinRejectsLogged = 0;
+#endif
+    LOG_INFO("COIN INIT: Timers initialized at %lu ms (coins ignored until %lu ms after boot)", initTime, COIN_STARTUP_DELAY);
     LOG_INFO("=== END COIN DETECTOR INITIALIZATION ===");
 
-    // Initialize LED pins - using built-in LED
-    pinMode(LED_PIN_INIT, OUTPUT);
-    digitalWrite(LED_PIN_INIT, LOW);
-
-    // Initialize button debounce times - we'll use the IO expander to read buttons
-    for (int i = 0; i < NUM_BUTTONS; i++) {
-        lastDebounceTime[i] = 0;
-        lastButtonState[i] = HIGH;  // Buttons are active low
+    // Initialize LED pins - using built-in LED (one LED on the board: bay 0 drives it)
+    if (bay == 0) {
+        pinMode(LED_PIN_INIT, OUTPUT);
+        digitalWrite(LED_PIN_INIT, LOW);
     }
 
-    // Set up for the stop button (BUTTON6)
-    lastDebounceTime[NUM_BUTTONS-1] = 0;  // NUM_BUTTONS-1 is the index for the stop button
-    lastButtonState[NUM_BUTTONS-1] = HIGH;
-
     config.isLoaded = false;
     config.physicalTokens = 0;
+
+    // Baseline for change detection; the first update() sends a keyframe
+    collectDirtyStateFields();
+    pendingStateFields = 0;
 }
 
 
-void CarWashController::handleMqttMessage(const char* topic, const uint8_t* payload, unsigned len) {
+void CarWashController::handleMqttMessage(MqttTopicId topic, const uint8_t* payload, unsigned int len) {
     // Handle get_state topic first (doesn't require JSON parsing)
-    if (String(topic) == GET_STATE_TOPIC) {
+    if (topic == TOPIC_GET_STATE) {
         LOG_INFO("Received get_state request, publishing state on demand");
-        // Publish state on demand with high priority when get_state message is received
-        // publishStateOnDemand();
+        // Full keyframe from the next update()
+        keyframeRequested = true;
+        return;
+    }
+    if (topic != TOPIC_INIT && topic != TOPIC_CONFIG) {
+        LOG_WARNING("Unexpected message on topic: %s", mqttTopic(topic, bay));
         return;
     }
     
-    // Other topics require JSON parsing
-    StaticJsonDocument<512> doc;
-    DeserializationError error = deserializeJson(doc, payload, len);
-    if (error) {
-        LOG_ERROR("Failed to parse JSON");
+    // Other topics require JSON (or MessagePack) parsing, into the fixed
+    // inbound arena; fields are passed on as const char* views into it
+    if (!mqttInbound.parse(payload, len)) {
         return;
     }
-    if (String(topic) == INIT_TOPIC) {
-        // Check if machine ID is 99 (factory default) and this is the first load
-        // If so, use the number of tokens as the new machine ID and DO NOT load tokens
-        if (MACHINE_ID == "99") {
-            int tokensFromMessage = doc["tokens"].as<int>();
-            String newMachineId = String(tokensFromMessage);
-            LOG_INFO("Factory machine ID (99) detected on first load. Setting new machine ID to: %s (from tokens: %d)", 
-                     newMachineId.c_str(), tokensFromMessage);
-            LOG_INFO("NOT loading tokens - this is a setup operation only");
-            
-            // Store the new machine ID in persistent storage
-            Preferences prefs;
-            prefs.begin(PREFS_NAMESPACE, false); // false = read-write mode
-            prefs.putString(PREFS_MACHINE_NUM, newMachineId);
-            
-            // Get current environment to preserve it
-            String environment = prefs.getString(PREFS_ENVIRONMENT, "prod");
-            prefs.end();
-            
-            // Update MACHINE_ID and MQTT topics
-            updateMQTTTopics(newMachineId, environment);
-            LOG_INFO("Machine ID updated to: %s, MQTT topics updated. Machine NOT loaded with tokens.", newMachineId.c_str());
-            
-            // Return early - do NOT load tokens or initialize the machine
-            // The tokens were only used to determine the new machine ID
-            return;
-        }
-        
-        // Normal initialization flow (machine ID is not 99)
-        config.sessionId = doc["session_id"].as<String>();
-        config.userId = doc["user_id"].as<String>();
-        config.userName = doc["user_name"].as<String>();
-        config.tokens = doc["tokens"].as<int>();
-        config.physicalTokens = 0;
-        
-        // Extract timestamp from INIT_TOPIC message if present
-        if (doc.containsKey("timestamp") && doc["timestamp"].as<String>().length() > 0) {
-            config.timestamp = doc["timestamp"].as<String>();
-            LOG_INFO("Timestamp from INIT_TOPIC: %s", config.timestamp.c_str());
-        } else {
-            config.timestamp = ""; // No timestamp available
-            LOG_WARNING("No timestamp available in INIT_TOPIC");
-        }
-        
-        config.isLoaded = true;
-        currentState = STATE_IDLE;
-        lastActionTime = millis();
-        gracePeriodStartTime = millis(); // Start 30-second grace period
-        gracePeriodActive = true;
-        // Reset token timing variables to ensure clean state
-        tokenStartTime = 0;
-        tokenTimeElapsed = 0;
-        pauseStartTime = 0;
-        activeButton = -1;
-        tokensConsumedCount = 0; // Reset consumed token counter
-        LOG_INFO("Machine loaded - 30-second grace period started");
-        LOG_INFO("Switching on LED");
-        digitalWrite(LED_PIN_INIT, HIGH);
-        LOG_INFO("Machine loaded with new configuration");
-        
-        // CRITICAL: Publish state immediately after loading with high priority (QOS1)
-        // This ensures the backend receives the IDLE state quickly so the app can detect it
-        // publishStateOnDemand();
-    } else if (String(topic) == CONFIG_TOPIC) {
+    JsonDocument& doc = mqttInbound.doc();
+    
+    // Backend picks the outbound encoding for this environment
+    if (doc["wire_format"].is<const char*>()) {
+        setWireFormat(parseWireFormat(doc["wire_format"].as<const char*>(), getWireFormat()));
+    }
+    if (topic == TOPIC_INIT) {
+        loadSession(doc["session_id"] | "", doc["user_id"] | "", doc["user_name"] | "",
+                    doc["tokens"].as<int>(), doc["timestamp"] | "");
+    } else {
         LOG_INFO("Received config message from server");
-        config.timestamp = doc["timestamp"].as<String>();
+        config.timestamp = doc["timestamp"] | "";
         
         // Note: Config no longer clears session data
         // Session is only cleared on STOP action or timeout
-    } else {
-        LOG_WARNING("Unknown topic: %s", topic);
     }
 }
 
-void CarWashController::handleButtons() {
-    // Get reference to the IO expander (assumed to be a global or accessible)
-    extern IoExpander ioExpander;
+void CarWashController::loadSession(const char* sessionId, const char* userId, const char* userName,
+                                    int tokens, const char* timestamp) {
+    // Check if machine ID is 99 (factory default) and this is the first load
+    // If so, use the number of tokens as the new machine ID and DO NOT load tokens
+    // (bay 0 only: the other bays derive their IDs from it)
+    if (bay == 0 && strcmp(bayMachineId(0), "99") == 0) {
+        String newMachineId = String(tokens);
+        LOG_INFO("Factory machine ID (99) detected on first load. Setting new machine ID to: %s (from tokens: %d)", 
+                 newMachineId.c_str(), tokens);
+        LOG_INFO("NOT loading tokens - this is a setup operation only");
+        
+        // Store the new machine ID in persistent storage
+        Preferences prefs;
+        prefs.begin(PREFS_NAMESPACE, false); // false = read-write mode
+        prefs.putString(PREFS_MACHINE_NUM, newMachineId);
+        
+        // Get current environment to preserve it
+        String environment = prefs.getString(PREFS_ENVIRONMENT, "prod");
+        prefs.end();
+        
+        // Update the machine ID and MQTT topics
+        updateMQTTTopics(newMachineId, environment);
+        LOG_INFO("Machine ID updated to: %s, MQTT topics updated. Machine NOT loaded with tokens.", newMachineId.c_str());
+        
+        // Return early - do NOT load tokens or initialize the machine
+        // The tokens were only used to determine the new machine ID
+        return;
+    }
+    
+    // Normal initialization flow (machine ID is not 99)
+    // Truncation is logged but not fatal: the session still has to start
+    if (!config.sessionId.assign(sessionId)) {
+        LOG_WARNING("Session ID truncated to %u characters", (unsigned int)SESSION_ID_MAX_LENGTH);
+    }
+    if (!config.userId.assign(userId)) {
+        LOG_WARNING("User ID truncated to %u characters", (unsigned int)USER_ID_MAX_LENGTH);
+    }
+    if (!config.userName.assign(userName)) {
+        LOG_WARNING("User name truncated to %u characters", (unsigned int)USER_NAME_MAX_LENGTH);
+    }
+    config.tokens = tokens;
+    config.physicalTokens = 0;
 
-    // Fast path: consume button flags set by the ButtonDetector task
-    // This ensures short presses (that may be missed by raw polling) are handled
-    if (ioExpander.isButtonDetected()) {
-        uint8_t detectedId = ioExpander.getDetectedButtonId();
-        bool buttonProcessed = false;
+    // Timestamp from the INIT message if present
+    config.timestamp = timestamp;
+    if (!config.timestamp.isEmpty()) {
+        LOG_INFO("Timestamp from INIT_TOPIC: %s", config.timestamp.c_str());
+    } else {
+        LOG_WARNING("No timestamp available in INIT_TOPIC");
+    }
+    
+    config.isLoaded = true;
+    setState(STATE_IDLE);
+    lastActionTime = millis();
+    gracePeriodStartTime = millis(); // Start 30-second grace period
+    gracePeriodActive = true;
+    // Reset token timing variables to ensure clean state
+    tokenStartTime = 0;
+    tokenTimeElapsed = 0;
+    pauseStartTime = 0;
+    activeButton = -1;
+    tokensConsumedCount = 0; // Reset consumed token counter
+    timersDirty = true;
+    LOG_INFO("Machine loaded - 30-second grace period started");
+    if (bay == 0) {
+        LOG_INFO("Switching on LED");
+        digitalWrite(LED_PIN_INIT, HIGH);
+    }
+    LOG_INFO("Machine loaded with new configuration");
+    
+    // CRITICAL: The session fields and IDLE state go out as a delta from the next
+    // update(), so the backend receives the IDLE state quickly and the app can detect it
+}
 
-        LOG_INFO("Button flag detected: button %d, currentState=%d, activeButton=%d, isLoaded=%d, timestamp='%s'", 
-                detectedId + 1, currentState, activeButton, config.isLoaded, 
-                config.timestamp.length() > 0 ? config.timestamp.c_str() : "(empty)");
+void CarWashController::handleButtons(const InputEvent& event) {
+    uint8_t detectedId = event.id;
+    bool buttonProcessed = false;
 
-        ioExpander.clearButtonFlag();
+    LOG_INFO("Button event: button %d (t=%lu ms), currentState=%d, activeButton=%d, isLoaded=%d, timestamp='%s'", 
+            detectedId + 1, event.timestamp, currentState, activeButton, config.isLoaded, 
+            !config.timestamp.isEmpty() ? config.timestamp.c_str() : "(empty)");
 
-        // Explicit check: Buttons should not work when machine is FREE
-        // This ensures buttons are ignored even if config.isLoaded is somehow true
-        if (currentState == STATE_FREE) {
-            LOG_WARNING("Button %d press ignored - machine is FREE (config.isLoaded=%d)", 
-                       detectedId + 1, config.isLoaded);
-            return; // Skip processing and raw polling
-        }
+    // Explicit check: Buttons should not work when machine is FREE
+    // This ensures buttons are ignored even if config.isLoaded is somehow true
+    if (currentState == STATE_FREE) {
+        LOG_WARNING("Button %d press ignored - machine is FREE (config.isLoaded=%d)", 
+                   detectedId + 1, config.isLoaded);
+        return;
+    }
 
-        // Function buttons (0..NUM_BUTTONS-2)
-        // Button 5 = index 4, NUM_BUTTONS = 6, so NUM_BUTTONS - 1 = 5
-        // So detectedId < 5 means buttons 0-4 (buttons 1-5)
-        if (detectedId < NUM_BUTTONS - 1) {
-            LOG_INFO("Processing function button %d (detectedId=%d, NUM_BUTTONS-1=%d)", 
-                    detectedId + 1, detectedId, NUM_BUTTONS - 1);
-            if (config.isLoaded) {
-                if (currentState == STATE_IDLE) {
-                    LOG_INFO("Activating button %d from IDLE state", detectedId + 1);
-                    activateButton(detectedId, MANUAL);
-                    buttonProcessed = true;
-                } else if (currentState == STATE_RUNNING) {
-                    // Same button pause the machine, different button switches function
-                    LOG_INFO("Button %d pressed while RUNNING (activeButton=%d)", 
-                            detectedId + 1, activeButton + 1);
-                    if (activeButton == -1 || (int)detectedId == activeButton) {
-                        // Same button pressed - pause the machine
-                        unsigned long currentTime = millis();
-                        
-                        // CRITICAL FIX: Check if this is the same button press that just activated the machine
-                        // If tokenStartTime was set very recently (within 200ms), this is likely the same press
-                        // that activated from IDLE, so we should ignore it to prevent immediate pause
-                        if (tokenStartTime != 0) {
-                            unsigned long timeSinceActivation;
-                            if (currentTime >= tokenStartTime) {
-                                timeSinceActivation = currentTime - tokenStartTime;
-                            } else {
-                                timeSinceActivation = (0xFFFFFFFFUL - tokenStartTime) + currentTime + 1;
-                            }
-                            
-                            // If activation happened very recently (within 200ms), ignore this pause request
-                            // This prevents the flag handler from stopping immediately after raw polling activated
-                            if (timeSinceActivation < 200) {
-                                LOG_INFO("Button %d pressed while RUNNING - ignoring (just activated %lu ms ago, likely same press)", 
-                                       detectedId + 1, timeSinceActivation);
-                                // Still reset inactivity timeout
-                                lastActionTime = currentTime;
-                                buttonProcessed = true;
-                                return; // Skip raw polling
-                            }
-                        }
-                        
-                        // CRITICAL FIX: Check if we just switched to this button - if so, ignore pause request
-                        // This prevents the same button press that triggered the switch from also triggering a pause
-                        unsigned long timeSinceFunctionSwitch;
-                        if (currentTime >= lastFunctionSwitchTime) {
-                            timeSinceFunctionSwitch = currentTime - lastFunctionSwitchTime;
-                        } else {
-                            timeSinceFunctionSwitch = (0xFFFFFFFFUL - lastFunctionSwitchTime) + currentTime + 1;
-                        }
-                        
-                        if (timeSinceFunctionSwitch < FUNCTION_SWITCH_COOLDOWN) {
-                            LOG_INFO("Button %d pressed while RUNNING - ignoring (just switched to this button %lu ms ago, likely same press)", 
-                                   detectedId + 1, timeSinceFunctionSwitch);
-                            // Still reset inactivity timeout
-                            lastActionTime = currentTime;
-                            buttonProcessed = true;
-                            return; // Skip raw polling
-                        }
-                        
-                        // CRITICAL FIX: Reset inactivity timeout on ANY user action, even if ignored
-                        lastActionTime = currentTime;
-                        
-                        if (activeButton == -1) {
-                            LOG_WARNING("activeButton is -1 in RUNNING state - setting to pressed button %d", detectedId + 1);
-                            // Set activeButton to the pressed button to fix the tracking
-                            activeButton = detectedId;
-                        }
-                        LOG_INFO("Pausing machine - same button pressed while running");
-                        pauseMachine();
-                        buttonProcessed = true;
-                    } else {
-                        // Different button pressed - switch to new function (keep running, switch relay)
-                        lastActionTime = millis();
-                        LOG_INFO("Button %d pressed while RUNNING (activeButton=%d) - switching function", 
-                                   detectedId + 1, activeButton + 1);
-                        switchFunction(detectedId);
-                        buttonProcessed = true;
-                    }
-                } else if (currentState == STATE_PAUSED) {
-                    // Same button resumes, different button switches function and resumes
-                    unsigned long currentTime = millis();
-                    
-                    // CRITICAL FIX: Prevent rapid pause/resume toggling
-                    unsigned long timeSinceLastPauseResume;
-                    if (currentTime >= lastPauseResumeTime) {
-                        timeSinceLastPauseResume = currentTime - lastPauseResumeTime;
-                    } else {
-                        timeSinceLastPauseResume = (0xFFFFFFFFUL - lastPauseResumeTime) + currentTime + 1;
-                    }
-                    
-                    // CRITICAL FIX: Reset inactivity timeout on ANY user action, even if ignored
-                    lastActionTime = currentTime;
-                    
-                    if (timeSinceLastPauseResume < PAUSE_RESUME_COOLDOWN) {
-                        LOG_WARNING("Button %d pressed while PAUSED - ignoring (cooldown: %lu ms < %lu ms)", 
-                                   detectedId + 1, timeSinceLastPauseResume, PAUSE_RESUME_COOLDOWN);
-                    } else {
-                        if (activeButton == -1 || (int)detectedId == activeButton) {
-                            // Same button (or no active button) - resume with same button
-                            if (activeButton == -1) {
-                                LOG_WARNING("activeButton is -1 in PAUSED state - allowing resume anyway (button %d)", detectedId + 1);
-                                // Set activeButton to the pressed button to fix the tracking
-                                activeButton = detectedId;
-                            }
-                            LOG_INFO("Button %d: Resuming from PAUSED state (same button)", detectedId + 1);
-                            resumeMachine(detectedId);
-                            lastPauseResumeTime = currentTime;
-                            buttonProcessed = true;
-                        } else {
-                            // Different button pressed - switch function and resume
-                            LOG_INFO("Button %d pressed while PAUSED (activeButton=%d) - switching function and resuming", 
-                                   detectedId + 1, activeButton + 1);
-                            // First deactivate the old relay if there was one
-                            if (activeButton >= 0) {
-                                extern IoExpander ioExpander;
-                                if (xIoExpanderMutex != NULL && xSemaphoreTake(xIoExpanderMutex, pdMS_TO_TICKS(100)) == pdTRUE) {
-                                    ioExpander.setRelay(RELAY_INDICES[activeButton], false);
-                                    LOG_INFO("Deactivated relay %d (button %d)", activeButton + 1, activeButton + 1);
-                                    xSemaphoreGive(xIoExpanderMutex);
-                                }
-                            }
-                            // Now resume with the new button
-                            resumeMachine(detectedId);
-                            lastPauseResumeTime = currentTime;
-                            lastFunctionSwitchTime = currentTime;
-                            buttonProcessed = true;
-                        }
-                    }
-                } else {
-                    // CRITICAL FIX: Reset inactivity timeout on ANY user action, even if ignored
-                    if (config.isLoaded && currentState != STATE_FREE) {
-                        lastActionTime = millis();
-                    }
-                    LOG_WARNING("Flag press on button %d ignored. State=%d, activeButton=%d",
-                                detectedId + 1, currentState, activeButton);
-                    // Flag already cleared above - no need to process
-                }
-            } else {
-                LOG_WARNING("Button %d press ignored - config not loaded", detectedId + 1);
-                // Flag already cleared above - no delayed processing
-            }
-        } else if (detectedId == NUM_BUTTONS - 1) {
-            // Stop button - should only pause when RUNNING, same behavior as pressing same button
-            // CRITICAL FIX: Reset inactivity timeout on ANY user action, even if ignored
-            lastActionTime = millis();
-            if (config.isLoaded) {
-                if (currentState == STATE_RUNNING) {
-                    // Same behavior as pressing the same button when RUNNING - pause the machine
+    // Function buttons (0..NUM_BUTTONS-2)
+    // Button 5 = index 4, NUM_BUTTONS = 6, so NUM_BUTTONS - 1 = 5
+    // So detectedId < 5 means buttons 0-4 (buttons 1-5)
+    if (detectedId < NUM_BUTTONS - 1) {
+        LOG_INFO("Processing function button %d (detectedId=%d, NUM_BUTTONS-1=%d)", 
+                detectedId + 1, detectedId, NUM_BUTTONS - 1);
+        if (config.isLoaded) {
+            if (currentState == STATE_IDLE) {
+                LOG_INFO("Activating button %d from IDLE state", detectedId + 1);
+                activateButton(detectedId, MANUAL);
+                buttonProcessed = true;
+            } else if (currentState == STATE_RUNNING) {
+                // Same button pause the machine, different button switches function
+                LOG_INFO("Button %d pressed while RUNNING (activeButton=%d)", 
+                        detectedId + 1, activeButton + 1);
+                if (activeButton == -1 || (int)detectedId == activeButton) {
+                    // Same button pressed - pause the machine
                     unsigned long currentTime = millis();
                     
                     // CRITICAL FIX: Check if this is the same button press that just activated the machine
                     // If tokenStartTime was set very recently (within 200ms), this is likely the same press
                     // that activated from IDLE, so we should ignore it to prevent immediate pause
                     if (tokenStartTime != 0) {
-                        unsigned long timeSinceActivation;
-                        if (currentTime >= tokenStartTime) {
-                            timeSinceActivation = currentTime - tokenStartTime;
-                        } else {
-                            timeSinceActivation = (0xFFFFFFFFUL - tokenStartTime) + currentTime + 1;
-                        }
+                        unsigned long timeSinceActivation = currentTime - tokenStartTime;
                         
                         // If activation happened very recently (within 200ms), ignore this pause request
                         if (timeSinceActivation < 200) {
-                            LOG_INFO("STOP button pressed while RUNNING - ignoring (just activated %lu ms ago, likely same press)", 
-                                   timeSinceActivation);
+                            LOG_INFO("Button %d pressed while RUNNING - ignoring (just activated %lu ms ago, likely same press)", 
+                                   detectedId + 1, timeSinceActivation);
+                            // Still reset inactivity timeout
+                            lastActionTime = currentTime;
                             buttonProcessed = true;
-                            return; // Skip raw polling
+                            return;
                         }
                     }
                     
                     // CRITICAL FIX: Check if we just switched to this button - if so, ignore pause request
                     // This prevents the same button press that triggered the switch from also triggering a pause
-                    unsigned long timeSinceFunctionSwitch;
-                    if (currentTime >= lastFunctionSwitchTime) {
-                        timeSinceFunctionSwitch = currentTime - lastFunctionSwitchTime;
-                    } else {
-                        timeSinceFunctionSwitch = (0xFFFFFFFFUL - lastFunctionSwitchTime) + currentTime + 1;
-                    }
+                    unsigned long timeSinceFunctionSwitch = currentTime - lastFunctionSwitchTime;
                     
                     if (timeSinceFunctionSwitch < FUNCTION_SWITCH_COOLDOWN) {
-                        LOG_INFO("STOP button pressed while RUNNING - ignoring (just switched function %lu ms ago, likely same press)", 
-                               timeSinceFunctionSwitch);
+                        LOG_INFO("Button %d pressed while RUNNING - ignoring (just switched to this button %lu ms ago, likely same press)", 
+                               detectedId + 1, timeSinceFunctionSwitch);
+                        // Still reset inactivity timeout
+                        lastActionTime = currentTime;
                         buttonProcessed = true;
-                        return; // Skip raw polling
+                        return;
                     }
                     
-                    LOG_INFO("STOP button: Pausing machine (same behavior as pressing same button when RUNNING)");
+                    // CRITICAL FIX: Reset inactivity timeout on ANY user action, even if ignored
+                    lastActionTime = currentTime;
+                    
+                    if (activeButton == -1) {
+                        LOG_WARNING("activeButton is -1 in RUNNING state - setting to pressed button %d", detectedId + 1);
+                        // Set activeButton to the pressed button to fix the tracking
+                        activeButton = detectedId;
+                    }
+                    LOG_INFO("Pausing machine - same button pressed while running");
                     pauseMachine();
                     buttonProcessed = true;
                 } else {
-                    // Not in RUNNING state - ignore stop button press
-                    LOG_INFO("STOP button pressed but machine is not RUNNING (state=%d) - ignoring", currentState);
+                    // Different button pressed - switch to new function (keep running, switch relay)
+                    lastActionTime = millis();
+                    LOG_INFO("Button %d pressed while RUNNING (activeButton=%d) - switching function", 
+                               detectedId + 1, activeButton + 1);
+                    switchFunction(detectedId);
                     buttonProcessed = true;
                 }
-            } else {
-                LOG_WARNING("STOP button press ignored - config not loaded");
-                // Flag already cleared above - no delayed processing
-            }
-        }
-
-        // We've handled a flagged press; skip raw polling this cycle
-        return;
-    }
-
-    // Protect IO expander access with mutex
-    uint8_t rawPortValue0 = 0;
-    if (xIoExpanderMutex != NULL && xSemaphoreTake(xIoExpanderMutex, pdMS_TO_TICKS(100)) == pdTRUE) {
-        rawPortValue0 = ioExpander.readRegister(INPUT_PORT0);
-        xSemaphoreGive(xIoExpanderMutex);
-    } else {
-        LOG_WARNING("Failed to acquire IO expander mutex in handleButtons()");
-        return; // Skip button handling if mutex not available
-    }
-    
-    // Print raw state for debugging
-    
-    // Read all 5 function buttons - using simple approach
-    for (int i = 0; i < NUM_BUTTONS-1; i++) {  // -1 because last button is STOP button
-        int buttonPin = BUTTON_INDICES[i];
-        
-        // Check if button is pressed (active LOW in the IO expander)
-        bool buttonPressed = !(rawPortValue0 & (1 << buttonPin));
-        
-      
-        // Handle button press with debouncing
-        if (buttonPressed) {
-            // If button wasn't pressed before or enough time has passed since last action
-            unsigned long timeSinceLastDebounce = millis() - lastDebounceTime[i];
-            bool wasReleased = (lastButtonState[i] == HIGH);
-            if (wasReleased || timeSinceLastDebounce > DEBOUNCE_DELAY * 5) {
-                
-                // Record time of this press
-                lastDebounceTime[i] = millis();
-                lastButtonState[i] = LOW;  // Now pressed (active LOW)
+            } else if (currentState == STATE_PAUSED) {
+                // Same button resumes, different button switches function and resumes
+                unsigned long currentTime = millis();
                 
-                LOG_INFO("Button %d raw polling: pressed (state transition: %s, time since last: %lu ms)", 
-                        i + 1, wasReleased ? "HIGH->LOW" : "repeat press", timeSinceLastDebounce);
+                // CRITICAL FIX: Prevent rapid pause/resume toggling
+                unsigned long timeSinceLastPauseResume = currentTime - lastPauseResumeTime;
                 
-                // Explicit check: Buttons should not work when machine is FREE
-                if (currentState == STATE_FREE) {
-                    LOG_DEBUG("Button %d ignored - machine is FREE", i + 1);
-                    continue; // Skip this button, check others
-                }
+                // CRITICAL FIX: Reset inactivity timeout on ANY user action, even if ignored
+                lastActionTime = currentTime;
                 
-                // Process button action
-                if (config.isLoaded) {
-                    if (currentState == STATE_IDLE) {
-                        LOG_INFO("Button %d: Activating from IDLE state", i + 1);
-                        activateButton(i, MANUAL);
-                    } else if (currentState == STATE_RUNNING) {
-                        // Same button stops machine, different button switches function
-                        LOG_INFO("Button %d pressed while RUNNING (activeButton=%d) - raw polling", 
-                                i + 1, activeButton + 1);
-                        if (activeButton == -1 || i == activeButton) {
-                            // Same button pressed - stop the machine
-                            unsigned long currentTime = millis();
-                            
-                            // CRITICAL FIX: Check if this is the same button press that just activated the machine
-                            // If tokenStartTime was set very recently (within 200ms), this is likely the same press
-                            // that activated from IDLE, so we should ignore it to prevent immediate stop
-                            if (tokenStartTime != 0) {
-                                unsigned long timeSinceActivation;
-                                if (currentTime >= tokenStartTime) {
-                                    timeSinceActivation = currentTime - tokenStartTime;
-                                } else {
-                                    timeSinceActivation = (0xFFFFFFFFUL - tokenStartTime) + currentTime + 1;
-                                }
-                                
-                                // If activation happened very recently (within 200ms), ignore this stop request
-                                // This prevents double-processing of the same button press
-                                if (timeSinceActivation < 200) {
-                                    LOG_INFO("Button %d pressed while RUNNING - ignoring (just activated %lu ms ago, likely same press) - raw polling", 
-                                           i + 1, timeSinceActivation);
-                                    // Still reset inactivity timeout
-                                    lastActionTime = currentTime;
-                                    continue; // Skip to next button
-                                }
-                            }
-                            
-                            // CRITICAL FIX: Check if we just switched to this button - if so, ignore pause request
-                            // This prevents the same button press that triggered the switch from also triggering a pause
-                            unsigned long timeSinceFunctionSwitch;
-                            if (currentTime >= lastFunctionSwitchTime) {
-                                timeSinceFunctionSwitch = currentTime - lastFunctionSwitchTime;
-                            } else {
-                                timeSinceFunctionSwitch = (0xFFFFFFFFUL - lastFunctionSwitchTime) + currentTime + 1;
-                            }
-                            
-                            if (timeSinceFunctionSwitch < FUNCTION_SWITCH_COOLDOWN) {
-                                LOG_INFO("Button %d pressed while RUNNING - ignoring (just switched to this button %lu ms ago, likely same press) - raw polling", 
-                                       i + 1, timeSinceFunctionSwitch);
-                                // Still reset inactivity timeout
-                                lastActionTime = currentTime;
-                                continue; // Skip to next button
-                            }
-                            
-                            // CRITICAL FIX: Reset inactivity timeout on ANY user action, even if ignored
-                            lastActionTime = currentTime;
-                            
-                            if (activeButton == -1) {
-                                LOG_WARNING("activeButton is -1 in RUNNING state - setting to pressed button %d - raw polling", i + 1);
-                                // Set activeButton to the pressed button to fix the tracking
-                                activeButton = i;
-                            }
-                            LOG_INFO("Pausing machine - same button pressed while running (raw polling)");
-                            pauseMachine();
-                        } else {
-                            // Different button pressed - switch to new function (keep running, switch relay)
-                            lastActionTime = millis();
-                            LOG_INFO("Button %d pressed while RUNNING (activeButton=%d) - switching function (raw polling)", 
-                                       i + 1, activeButton + 1);
-                            switchFunction(i);
-                        }
-                    } else if (currentState == STATE_PAUSED) {
-                        // Same button resumes, different button switches function and resumes
-                        unsigned long currentTime = millis();
-                        
-                        // CRITICAL FIX: Prevent rapid pause/resume toggling
-                        unsigned long timeSinceLastPauseResume;
-                        if (currentTime >= lastPauseResumeTime) {
-                            timeSinceLastPauseResume = currentTime - lastPauseResumeTime;
-                        } else {
-                            timeSinceLastPauseResume = (0xFFFFFFFFUL - lastPauseResumeTime) + currentTime + 1;
+                if (timeSinceLastPauseResume < PAUSE_RESUME_COOLDOWN) {
+                    LOG_WARNING("Button %d pressed while PAUSED - ignoring (cooldown: %lu ms < %lu ms)", 
+                               detectedId + 1, timeSinceLastPauseResume, PAUSE_RESUME_COOLDOWN);
+                } else {
+                    if (activeButton == -1 || (int)detectedId == activeButton) {
+                        // Same button (or no active button) - resume with same button
+                        if (activeButton == -1) {
+                            LOG_WARNING("activeButton is -1 in PAUSED state - allowing resume anyway (button %d)", detectedId + 1);
+                            // Set activeButton to the pressed button to fix the tracking
+                            activeButton = detectedId;
                         }
-                        
-                        // CRITICAL FIX: Reset inactivity timeout on ANY user action, even if ignored
-                        lastActionTime = currentTime;
-                        
-                        if (timeSinceLastPauseResume < PAUSE_RESUME_COOLDOWN) {
-                            LOG_WARNING("Button %d pressed while PAUSED - ignoring (cooldown: %lu ms < %lu ms) - raw polling", 
-                                       i + 1, timeSinceLastPauseResume, PAUSE_RESUME_COOLDOWN);
-                        } else {
-                            if (activeButton == -1 || i == activeButton) {
-                                // Same button (or no active button) - resume with same button
-                                if (activeButton == -1) {
-                                    LOG_WARNING("activeButton is -1 in PAUSED state - allowing resume anyway (button %d) - raw polling", i + 1);
-                                    // Set activeButton to the pressed button to fix the tracking
-                                    activeButton = i;
-                                }
-                                LOG_INFO("Button %d: Resuming from PAUSED state (same button) - raw polling", i + 1);
-                                resumeMachine(i);
-                                lastPauseResumeTime = currentTime;
-                            } else {
-                                // Different button pressed - switch function and resume
-                                LOG_INFO("Button %d pressed while PAUSED (activeButton=%d) - switching function and resuming (raw polling)", 
-                                       i + 1, activeButton + 1);
-                                // First deactivate the old relay if there was one
-                                extern IoExpander ioExpander;
-                                if (xIoExpanderMutex != NULL && xSemaphoreTake(xIoExpanderMutex, pdMS_TO_TICKS(100)) == pdTRUE) {
-                                    ioExpander.setRelay(RELAY_INDICES[activeButton], false);
-                                    LOG_INFO("Deactivated relay %d (button %d)", activeButton + 1, activeButton + 1);
-                                    xSemaphoreGive(xIoExpanderMutex);
-                                }
-                                // Now resume with the new button
-                                resumeMachine(i);
-                                lastPauseResumeTime = currentTime;
-                                lastFunctionSwitchTime = currentTime;
+                        LOG_INFO("Button %d: Resuming from PAUSED state (same button)", detectedId + 1);
+                        resumeMachine(detectedId);
+                        lastPauseResumeTime = currentTime;
+                        buttonProcessed = true;
+                    } else {
+                        // Different button pressed - switch function and resume
+                        LOG_INFO("Button %d pressed while PAUSED (activeButton=%d) - switching function and resuming", 
+                               detectedId + 1, activeButton + 1);
+                        // First deactivate the old relay if there was one
+                        if (activeButton >= 0) {
+                            if (xIoExpanderMutex != NULL && profiledTake(xIoExpanderMutex, pdMS_TO_TICKS(100), PROFILED_MUTEX_IO_EXPANDER) == pdTRUE) {
+                                io.setRelay(RELAY_INDICES[activeButton], false);
+                                LOG_INFO("Deactivated relay %d (button %d)", activeButton + 1, activeButton + 1);
+                                profiledGive(xIoExpanderMutex, PROFILED_MUTEX_IO_EXPANDER);
                             }
                         }
+                        // Now resume with the new button
+                        resumeMachine(detectedId);
+                        lastPauseResumeTime = currentTime;
+                        lastFunctionSwitchTime = currentTime;
+                        buttonProcessed = true;
                     }
-                } else {
-                    LOG_WARNING("Button %d ignored - config not loaded", i + 1);
                 }
             } else {
-                LOG_DEBUG("Button %d raw polling: pressed but debounced (time since last: %lu ms, need %lu ms)", 
-                         i + 1, timeSinceLastDebounce, DEBOUNCE_DELAY * 5);
+                // CRITICAL FIX: Reset inactivity timeout on ANY user action, even if ignored
+                if (config.isLoaded && currentState != STATE_FREE) {
+                    lastActionTime = millis();
+                }
+                LOG_WARNING("Flag press on button %d ignored. State=%d, activeButton=%d",
+                            detectedId + 1, currentState, activeButton);
             }
         } else {
-            // Button is released
-            if (lastButtonState[i] == LOW) {
-                LOG_DEBUG("Button %d raw polling: released (LOW->HIGH)", i + 1);
-            }
-            lastButtonState[i] = HIGH;  // Not pressed (idle HIGH)
+            LOG_WARNING("Button %d press ignored - config not loaded", detectedId + 1);
         }
-    }
-
-    // Handle stop button (BUTTON6) - should only pause when RUNNING, same behavior as pressing same button
-    bool stopButtonPressed = !(rawPortValue0 & (1 << STOP_BUTTON_PIN));
-    
-    // Print debug for stop button
-    // LOG_DEBUG("STOP Button (pin %d) state: %s\n", 
-    //              STOP_BUTTON_PIN, stopButtonPressed ? "PRESSED" : "RELEASED");
-    
-    // Handle stop button press with debouncing
-    if (stopButtonPressed) {
-        // If button wasn't pressed before or enough time has passed
-        if (lastButtonState[NUM_BUTTONS-1] == HIGH || 
-            (millis() - lastDebounceTime[NUM_BUTTONS-1]) > DEBOUNCE_DELAY * 5) {
-            
-            // Record time of this press
-            lastDebounceTime[NUM_BUTTONS-1] = millis();
-            lastButtonState[NUM_BUTTONS-1] = LOW;  // Now pressed (active LOW)
-            
-            // CRITICAL FIX: Reset inactivity timeout on ANY user action, even if ignored
-            lastActionTime = millis();
-            
-            // Process button action - stop button should only pause when RUNNING
-            if (config.isLoaded && currentState == STATE_RUNNING) {
+    } else if (detectedId == NUM_BUTTONS - 1) {
+        // Stop button - should only pause when RUNNING, same behavior as pressing same button
+        // CRITICAL FIX: Reset inactivity timeout on ANY user action, even if ignored
+        lastActionTime = millis();
+        if (config.isLoaded) {
+            if (currentState == STATE_RUNNING) {
+                // Same behavior as pressing the same button when RUNNING - pause the machine
                 unsigned long currentTime = millis();
                 
                 // CRITICAL FIX: Check if this is the same button press that just activated the machine
                 // If tokenStartTime was set very recently (within 200ms), this is likely the same press
                 // that activated from IDLE, so we should ignore it to prevent immediate pause
                 if (tokenStartTime != 0) {
-                    unsigned long timeSinceActivation;
-                    if (currentTime >= tokenStartTime) {
-                        timeSinceActivation = currentTime - tokenStartTime;
-                    } else {
-                        timeSinceActivation = (0xFFFFFFFFUL - tokenStartTime) + currentTime + 1;
-                    }
+                    unsigned long timeSinceActivation = currentTime - tokenStartTime;
                     
                     // If activation happened very recently (within 200ms), ignore this pause request
                     if (timeSinceActivation < 200) {
                         LOG_INFO("STOP button pressed while RUNNING - ignoring (just activated %lu ms ago, likely same press)", 
                                timeSinceActivation);
-                        return; // Skip processing
+                        buttonProcessed = true;
+                        return;
                     }
                 }
                 
                 // CRITICAL FIX: Check if we just switched to this button - if so, ignore pause request
                 // This prevents the same button press that triggered the switch from also triggering a pause
-                unsigned long timeSinceFunctionSwitch;
-                if (currentTime >= lastFunctionSwitchTime) {
-                    timeSinceFunctionSwitch = currentTime - lastFunctionSwitchTime;
-                } else {
-                    timeSinceFunctionSwitch = (0xFFFFFFFFUL - lastFunctionSwitchTime) + currentTime + 1;
-                }
+                unsigned long timeSinceFunctionSwitch = currentTime - lastFunctionSwitchTime;
                 
                 if (timeSinceFunctionSwitch < FUNCTION_SWITCH_COOLDOWN) {
                     LOG_INFO("STOP button pressed while RUNNING - ignoring (just switched function %lu ms ago, likely same press)", 
                            timeSinceFunctionSwitch);
-                    return; // Skip processing
+                    buttonProcessed = true;
+                    return;
                 }
                 
-                LOG_INFO("STOP button: Pausing machine (same behavior as pressing same button when RUNNING) - raw polling");
+                LOG_INFO("STOP button: Pausing machine (same behavior as pressing same button when RUNNING)");
                 pauseMachine();
-            } else if (config.isLoaded && currentState != STATE_RUNNING) {
+                buttonProcessed = true;
+            } else {
                 // Not in RUNNING state - ignore stop button press
                 LOG_INFO("STOP button pressed but machine is not RUNNING (state=%d) - ignoring", currentState);
+                buttonProcessed = true;
             }
+        } else {
+            LOG_WARNING("STOP button press ignored - config not loaded");
         }
-    } else {
-        // Button is released
-        lastButtonState[NUM_BUTTONS-1] = HIGH;  // Not pressed (idle HIGH)
     }
+
 }
 
 void CarWashController::pauseMachine() {
+    timersDirty = true;
     if (activeButton >= 0) {
-        extern IoExpander ioExpander;
-        
-        if (xIoExpanderMutex != NULL && xSemaphoreTake(xIoExpanderMutex, pdMS_TO_TICKS(100)) == pdTRUE) {
+        if (xIoExpanderMutex != NULL && profiledTake(xIoExpanderMutex, pdMS_TO_TICKS(100), PROFILED_MUTEX_IO_EXPANDER) == pdTRUE) {
             // Turn off the active relay
-            ioExpander.setRelay(RELAY_INDICES[activeButton], false);
-            
-            // Verify relay state after deactivation
-            uint8_t relayStateAfter = ioExpander.readRegister(OUTPUT_PORT1);
-            xSemaphoreGive(xIoExpanderMutex);
+            io.setRelay(RELAY_INDICES[activeButton], false);
+            uint8_t relayStateAfter = io.getRelayStates();
+            profiledGive(xIoExpanderMutex, PROFILED_MUTEX_IO_EXPANDER);
             
             // Check relay bit is actually cleared
             bool relayBitCleared = (relayStateAfter & (1 << RELAY_INDICES[activeButton])) == 0;
@@ -674,7 +432,7 @@ void CarWashController::pauseMachine() {
     }
     
     unsigned long currentTime = millis();
-    currentState = STATE_PAUSED;
+    setState(STATE_PAUSED);
     lastActionTime = currentTime;
     pauseStartTime = currentTime;
     
@@ -693,13 +451,7 @@ void CarWashController::pauseMachine() {
     // This will be reset to 0 if grace period expires (fresh 2-min countdown)
     // But if user resumes before grace period, they continue from where they left off
     if (tokenStartTime != 0) {
-        unsigned long elapsedSinceStart;
-        if (pauseStartTime >= tokenStartTime) {
-            elapsedSinceStart = pauseStartTime - tokenStartTime;
-        } else {
-            // Overflow occurred - calculate correctly
-            elapsedSinceStart = (0xFFFFFFFFUL - tokenStartTime) + pauseStartTime + 1;
-        }
+        unsigned long elapsedSinceStart = pauseStartTime - tokenStartTime;
         tokenTimeElapsed += elapsedSinceStart;
     }
     
@@ -707,19 +459,18 @@ void CarWashController::pauseMachine() {
     LOG_INFO("User has 30s to resume, then 2-minute inactivity countdown begins (2:30 total to session end)");
    
     // Publish pause event
-    // publishActionEvent(activeButton, ACTION_PAUSE, MANUAL);
+    publishActionEvent(activeButton, ACTION_PAUSE, MANUAL);
 }
 
 void CarWashController::resumeMachine(int buttonIndex) {
+    timersDirty = true;
     LOG_INFO("Resuming machine with button %d (relay %d, bit %d)", 
              buttonIndex+1, buttonIndex+1, RELAY_INDICES[buttonIndex]);
     activeButton = buttonIndex;
     
-    extern IoExpander ioExpander;
-    
-    if (xIoExpanderMutex != NULL && xSemaphoreTake(xIoExpanderMutex, pdMS_TO_TICKS(100)) == pdTRUE) {
-        // Read relay state before activation
-        uint8_t relayStateBefore = ioExpander.readRegister(OUTPUT_PORT1);
+    if (xIoExpanderMutex != NULL && profiledTake(xIoExpanderMutex, pdMS_TO_TICKS(100), PROFILED_MUTEX_IO_EXPANDER) == pdTRUE) {
+        // Relay state before activation (from the OUTPUT_PORT1 shadow)
+        uint8_t relayStateBefore = io.getRelayStates();
         LOG_INFO("Relay state BEFORE resume: 0x%02X (binary: %d%d%d%d%d%d%d%d)", 
                  relayStateBefore,
                  (relayStateBefore & 0x80) ? 1 : 0, (relayStateBefore & 0x40) ? 1 : 0,
@@ -728,11 +479,10 @@ void CarWashController::resumeMachine(int buttonIndex) {
                  (relayStateBefore & 0x02) ? 1 : 0, (relayStateBefore & 0x01) ? 1 : 0);
         
         // Turn on the relay for the active button
-        ioExpander.setRelay(RELAY_INDICES[buttonIndex], true);
+        io.setRelay(RELAY_INDICES[buttonIndex], true);
         
-        // Verify relay state after activation
-        uint8_t relayStateAfter = ioExpander.readRegister(OUTPUT_PORT1);
-        xSemaphoreGive(xIoExpanderMutex);
+        uint8_t relayStateAfter = io.getRelayStates();
+        profiledGive(xIoExpanderMutex, PROFILED_MUTEX_IO_EXPANDER);
         
         LOG_INFO("Relay state AFTER resume: 0x%02X (binary: %d%d%d%d%d%d%d%d)", 
                  relayStateAfter,
@@ -756,7 +506,7 @@ void CarWashController::resumeMachine(int buttonIndex) {
     }
     
     unsigned long currentTime = millis();
-    currentState = STATE_RUNNING;
+    setState(STATE_RUNNING);
     lastActionTime = currentTime;
     tokenStartTime = currentTime;
     
@@ -771,27 +521,25 @@ void CarWashController::resumeMachine(int buttonIndex) {
     LOG_INFO("Machine resumed - grace period cleared, token continues from %lu ms elapsed", tokenTimeElapsed);
     
     // Publish resume event
-    // publishActionEvent(buttonIndex, ACTION_RESUME, MANUAL);
+    publishActionEvent(buttonIndex, ACTION_RESUME, MANUAL);
 }
 
 void CarWashController::stopMachine(TriggerType triggerType) {
+    timersDirty = true;
     // Capture activeButton before resetting it (needed for stop event)
     int buttonToStop = activeButton;
     
     if (activeButton >= 0) {
-        extern IoExpander ioExpander;
-        
-        if (xIoExpanderMutex != NULL && xSemaphoreTake(xIoExpanderMutex, pdMS_TO_TICKS(100)) == pdTRUE) {
-            // Turn off the active relay
-            ioExpander.setRelay(RELAY_INDICES[activeButton], false);
-            
-            // Verify relay state after deactivation
-            uint8_t relayStateAfter = ioExpander.readRegister(OUTPUT_PORT1);
-            xSemaphoreGive(xIoExpanderMutex);
+        if (xIoExpanderMutex != NULL && profiledTake(xIoExpanderMutex, pdMS_TO_TICKS(100), PROFILED_MUTEX_IO_EXPANDER) == pdTRUE) {
+            // Turn off every function relay in a single write
+            io.beginRelayBatch();
+            for (int i = 0; i < NUM_BUTTONS - 1; i++) {
+                io.setRelay(RELAY_INDICES[i], false);
+            }
+            bool committed = io.commitRelayBatch();
+            profiledGive(xIoExpanderMutex, PROFILED_MUTEX_IO_EXPANDER);
             
-            // Check relay bit is actually cleared
-            bool relayBitCleared = (relayStateAfter & (1 << RELAY_INDICES[activeButton])) == 0;
-            if (!relayBitCleared) {
+            if (!committed) {
                 LOG_ERROR("Failed to deactivate relay %d for stop!", activeButton+1);
             }
         } else {
@@ -800,7 +548,7 @@ void CarWashController::stopMachine(TriggerType triggerType) {
     }
     
     config.isLoaded = false;
-    currentState = STATE_FREE;
+    setState(STATE_FREE);
     activeButton = -1;
     tokenStartTime = 0;
     tokenTimeElapsed = 0;
@@ -811,18 +559,19 @@ void CarWashController::stopMachine(TriggerType triggerType) {
     gracePeriodActive = false;
     tokensConsumedCount = 0; // Reset consumed tokens counter
     
-    // // Publish stop event (only if we had an active button before stopping)
-    // if (buttonToStop >= 0) {
-    //     publishActionEvent(buttonToStop, ACTION_STOP, triggerType);
-    // }
+    // Publish stop event (only if we had an active button before stopping)
+    if (buttonToStop >= 0) {
+        publishActionEvent(buttonToStop, ACTION_STOP, triggerType);
+    }
 }
 
 void CarWashController::activateButton(int buttonIndex, TriggerType triggerType) {
+    timersDirty = true;
     // CRITICAL FIX: Ensure we're in IDLE state before activating
     // This prevents issues where activateButton might be called from wrong state
     if (currentState != STATE_IDLE) {
         LOG_ERROR("activateButton() called from wrong state: %d (expected STATE_IDLE). Resetting to IDLE first.", currentState);
-        currentState = STATE_IDLE;
+        setState(STATE_IDLE);
         activeButton = -1;
         tokenStartTime = 0;
         tokenTimeElapsed = 0;
@@ -841,22 +590,22 @@ void CarWashController::activateButton(int buttonIndex, TriggerType triggerType)
     unsigned long currentTime = millis();
     lastActionTime = currentTime;
     
-    digitalWrite(RUNNING_LED_PIN, HIGH);
-    currentState = STATE_RUNNING;
+    if (bay == 0) {
+        digitalWrite(RUNNING_LED_PIN, HIGH);
+    }
+    setState(STATE_RUNNING);
     activeButton = buttonIndex;
     tokenStartTime = currentTime;
     tokenTimeElapsed = 0;
     gracePeriodStartTime = 0;
     gracePeriodActive = false; // Clear grace period when starting to run
     
-    extern IoExpander ioExpander;
-    
     LOG_INFO("Activating button %d (relay %d, bit %d)", 
              buttonIndex+1, buttonIndex+1, RELAY_INDICES[buttonIndex]);
     
-    if (xIoExpanderMutex != NULL && xSemaphoreTake(xIoExpanderMutex, pdMS_TO_TICKS(100)) == pdTRUE) {
-        // Read relay state before activation
-        uint8_t relayStateBefore = ioExpander.readRegister(OUTPUT_PORT1);
+    if (xIoExpanderMutex != NULL && profiledTake(xIoExpanderMutex, pdMS_TO_TICKS(100), PROFILED_MUTEX_IO_EXPANDER) == pdTRUE) {
+        // Relay state before activation (from the OUTPUT_PORT1 shadow)
+        uint8_t relayStateBefore = io.getRelayStates();
         LOG_INFO("Relay state BEFORE activation: 0x%02X (binary: %d%d%d%d%d%d%d%d)", 
                  relayStateBefore,
                  (relayStateBefore & 0x80) ? 1 : 0, (relayStateBefore & 0x40) ? 1 : 0,
@@ -865,11 +614,10 @@ void CarWashController::activateButton(int buttonIndex, TriggerType triggerType)
                  (relayStateBefore & 0x02) ? 1 : 0, (relayStateBefore & 0x01) ? 1 : 0);
         
         // Turn on the corresponding relay
-        ioExpander.setRelay(RELAY_INDICES[buttonIndex], true);
+        io.setRelay(RELAY_INDICES[buttonIndex], true);
         
-        // Verify relay state after activation
-        uint8_t relayStateAfter = ioExpander.readRegister(OUTPUT_PORT1);
-        xSemaphoreGive(xIoExpanderMutex);
+        uint8_t relayStateAfter = io.getRelayStates();
+        profiledGive(xIoExpanderMutex, PROFILED_MUTEX_IO_EXPANDER);
         
         LOG_INFO("Relay state AFTER activation: 0x%02X (binary: %d%d%d%d%d%d%d%d)", 
                  relayStateAfter,
@@ -887,19 +635,8 @@ void CarWashController::activateButton(int buttonIndex, TriggerType triggerType)
             LOG_ERROR("Failed to activate relay %d (bit %d)! Expected bit %d to be set in 0x%02X", 
                      buttonIndex+1, RELAY_INDICES[buttonIndex], RELAY_INDICES[buttonIndex], relayStateAfter);
         }
-        
-        // Verify port configuration
-        uint8_t configPort1 = ioExpander.readRegister(CONFIG_PORT1);
-        bool pinConfiguredAsOutput = ((configPort1 & (1 << RELAY_INDICES[buttonIndex])) == 0);
-        if (!pinConfiguredAsOutput) {
-            LOG_ERROR("CRITICAL: Relay %d pin (P1%d, bit %d) is configured as INPUT instead of OUTPUT!", 
-                     buttonIndex+1, RELAY_INDICES[buttonIndex], RELAY_INDICES[buttonIndex]);
-            LOG_ERROR("Port 1 Config register: 0x%02X (should have bit %d = 0 for output)", 
-                     configPort1, RELAY_INDICES[buttonIndex]);
-        }
-        
-        // Print full relay state diagnostic
-        printRelayStates();
+        // NOTE: Device read-back and port configuration are checked periodically by
+        // TaskWatchdog (verifyRelayShadow) instead of inline on every activation
     } else {
         LOG_WARNING("Failed to acquire IO expander mutex in activateButton()");
         // Even if mutex fails, we've already updated state and lastActionTime
@@ -912,7 +649,7 @@ void CarWashController::activateButton(int buttonIndex, TriggerType triggerType)
     }
     config.tokens--;
 
-    // publishActionEvent(buttonIndex, ACTION_START, triggerType);
+    publishActionEvent(buttonIndex, ACTION_START, triggerType);
 }
 
 void CarWashController::tokenExpired() {
@@ -940,10 +677,9 @@ void CarWashController::tokenExpired() {
         
         // Turn off relay if any was active
         if (activeButton >= 0) {
-            extern IoExpander ioExpander;
-            if (xIoExpanderMutex != NULL && xSemaphoreTake(xIoExpanderMutex, pdMS_TO_TICKS(100)) == pdTRUE) {
-                ioExpander.setRelay(RELAY_INDICES[activeButton], false);
-                xSemaphoreGive(xIoExpanderMutex);
+            if (xIoExpanderMutex != NULL && profiledTake(xIoExpanderMutex, pdMS_TO_TICKS(100), PROFILED_MUTEX_IO_EXPANDER) == pdTRUE) {
+                io.setRelay(RELAY_INDICES[activeButton], false);
+                profiledGive(xIoExpanderMutex, PROFILED_MUTEX_IO_EXPANDER);
             }
         }
         activeButton = -1;
@@ -955,10 +691,9 @@ void CarWashController::tokenExpired() {
     
     // No more tokens while RUNNING - turn off relay and finish
     if (activeButton >= 0) {
-        extern IoExpander ioExpander;
-        if (xIoExpanderMutex != NULL && xSemaphoreTake(xIoExpanderMutex, pdMS_TO_TICKS(100)) == pdTRUE) {
-            ioExpander.setRelay(RELAY_INDICES[activeButton], false);
-            xSemaphoreGive(xIoExpanderMutex);
+        if (xIoExpanderMutex != NULL && profiledTake(xIoExpanderMutex, pdMS_TO_TICKS(100), PROFILED_MUTEX_IO_EXPANDER) == pdTRUE) {
+            io.setRelay(RELAY_INDICES[activeButton], false);
+            profiledGive(xIoExpanderMutex, PROFILED_MUTEX_IO_EXPANDER);
         } else {
             LOG_WARNING("Failed to acquire IO expander mutex in tokenExpired()");
         }
@@ -969,80 +704,111 @@ void CarWashController::tokenExpired() {
     stopMachine(AUTOMATIC);
 }
 
-void CarWashController::handleCoinAcceptor() {
-    // Get reference to the IO expander
-    extern IoExpander ioExpander;
+void CarWashController::handleInputEvents() {
+#ifdef COIN_PCNT_PIN
+    // The PCNT coin input is wired to bay 0's acceptor
+    if (bay == 0) {
+        handleCoinCounter();
+    }
+#endif
+
+    // Drain coin and button events in the order they were captured, so a coin
+    // that creates a session is applied before a button pressed right after it
+    InputEvent event;
+    while (io.nextInputEvent(event)) {
+        // Any event may change state or lastActionTime
+        timersDirty = true;
+        
+        // Cost accounting: capture delay (ms resolution), handling time, bus transactions
+        unsigned long handlingStart = micros();
+        uint32_t delayUs = (uint32_t)(millis() - event.timestamp) * 1000;
+        uint32_t busOpsBefore = Profiler::getEventTaskBusOps();
+        
+        if (event.type == INPUT_EVENT_COIN) {
+            // Always handle coins - coins can create anonymous sessions when machine is not loaded
+            handleCoinAcceptor(event);
+        } else if (event.type == INPUT_EVENT_BUTTON_PRESS) {
+            // Only handle buttons when machine is loaded (buttons require a loaded session)
+            if (config.isLoaded) {
+                handleButtons(event);
+            } else {
+                LOG_DEBUG("Button %d press skipped - machine not loaded. Coins can still be inserted to create anonymous session.", 
+                         event.id + 1);
+            }
+        }
+        
+        Profiler::recordEvent(event.type == INPUT_EVENT_COIN ? PROFILED_EVENT_COIN : PROFILED_EVENT_BUTTON,
+                              delayUs, (uint32_t)(micros() - handlingStart),
+                              Profiler::getEventTaskBusOps() - busOpsBefore);
+    }
+}
+
+void CarWashController::handleCoinAcceptor(const InputEvent& event) {
+    // The InputReader task already skipped the startup period and validated
+    // the pulse (stable reads, latch, cooldown); use the edge timestamp
+    unsigned long currentTime = event.timestamp;
+    LOG_INFO("COIN: *** Validated coin signal detected! *** (time: %lu ms)", currentTime);
+    
+    // Additional cooldown check in case the InputReader cooldown wasn't enough
+    unsigned long timeSinceLastCoin = currentTime - lastCoinProcessedTime;
+    if (timeSinceLastCoin > COIN_COOLDOWN_MS) {
+        LOG_INFO("COIN: *** Processing validated coin insertion ***");
+        processCoinInsertion(currentTime);
+    } else {
+        LOG_WARNING("COIN: Ignoring - within controller cooldown (%lu ms < %lu ms)",
+                timeSinceLastCoin, COIN_COOLDOWN_MS);
+    }
+}
 
+#ifdef COIN_PCNT_PIN
+void CarWashController::handleCoinCounter() {
     // Get current time for all timing operations
     unsigned long currentTime = millis();
     
     // Skip startup period to avoid false triggers
-    // Use the configurable constant from constants.h
-    static bool startupPeriod = true;
-    static unsigned long startupBeginTime = 0;
-    if (startupPeriod) {
-        if (startupBeginTime == 0) {
-            startupBeginTime = currentTime;
-            LOG_INFO("COIN: Startup period started at %lu ms (will monitor after %lu ms)", 
-                    currentTime, COIN_STARTUP_DELAY);
-        }
-        // Check elapsed time since startup
-        unsigned long elapsedSinceStartup;
-        if (currentTime >= startupBeginTime) {
-            elapsedSinceStartup = currentTime - startupBeginTime;
-        } else {
-            // Handle millis() overflow
-            elapsedSinceStartup = (0xFFFFFFFFUL - startupBeginTime) + currentTime + 1;
-        }
-        
-        if (elapsedSinceStartup < COIN_STARTUP_DELAY) {
+    // Use the configurable constant from constants.h (measured from power-on)
+    if (coinCounterStartup) {
+        if (currentTime < COIN_STARTUP_DELAY) {
             return;  // Silently skip during startup
         }
-        startupPeriod = false;
+        coinCounterStartup = false;
+        // Drop anything counted while the acceptor was powering up
+        coinCounter.takeDelta();
+        coinRejectsLogged = coinCounter.getRejectedCount();
         LOG_INFO("COIN: Startup period over, now actively monitoring");
     }
     
-    // PRIMARY: Check if the TaskCoinDetector detected a validated coin signal
-    // The TaskCoinDetector now does all the heavy lifting with mutex protection
-    // and multi-read validation, so we only need to process the flag here
-    if (ioExpander.isCoinSignalDetected()) {
-        LOG_INFO("COIN: *** Validated coin signal detected! *** (time: %lu ms)", currentTime);
-        
-        // Clear the flag first to prevent re-processing
-        if (xIoExpanderMutex != NULL && xSemaphoreTake(xIoExpanderMutex, pdMS_TO_TICKS(50)) == pdTRUE) {
-            ioExpander.clearCoinSignalFlag();
-            xSemaphoreGive(xIoExpanderMutex);
-        } else {
-            // If we can't get the mutex, still clear the flag directly
-            // This is safe because clearCoinSignalFlag only writes to a volatile bool
-            ioExpander.clearCoinSignalFlag();
-        }
-        
-        // Additional cooldown check in case TaskCoinDetector's cooldown wasn't enough
-        unsigned long timeSinceLastCoin = currentTime - lastCoinProcessedTime;
-        if (timeSinceLastCoin > COIN_COOLDOWN_MS) {
-            LOG_INFO("COIN: *** Processing validated coin insertion ***");
-            processCoinInsertion(currentTime);
-        } else {
-            LOG_WARNING("COIN: Ignoring - within controller cooldown (%lu ms < %lu ms)",
-                    timeSinceLastCoin, COIN_COOLDOWN_MS);
-        }
-        
+    // HARDWARE PATH: the counter times every pulse on its edge interrupt and
+    // only accepts those of at least COIN_MIN_PULSE_WIDTH_MS, so relay
+    // transients and contact bounce never get here and every accepted pulse
+    // is a coin, however long the loop slept before this read
+    uint32_t rejected = coinCounter.getRejectedCount();
+    if (rejected != coinRejectsLogged) {
+        LOG_WARNING("COIN: %lu pulse(s) shorter than %lu ms rejected (PCNT edges: %lu)",
+                    (unsigned long)(rejected - coinRejectsLogged), COIN_MIN_PULSE_WIDTH_MS,
+                    (unsigned long)coinCounter.getEdgeCount());
+        coinRejectsLogged = rejected;
+    }
+
+    uint32_t pulses = coinCounter.takeDelta();
+    if (pulses == 0) {
         return;
     }
-    
-    // Periodic debug logging (reduced frequency)
-    static unsigned long lastDebugTime = 0;
-    if (currentTime - lastDebugTime > 10000) {  // Every 10 seconds
-        lastDebugTime = currentTime;
-        unsigned long timeSinceLastCoin = currentTime - lastCoinProcessedTime;
-        LOG_DEBUG("COIN: Status - LastCoin=%lu ms ago, Cooldown=%lu ms", 
-                timeSinceLastCoin, COIN_COOLDOWN_MS);
+    LOG_INFO("COIN: %lu pulse(s) accepted by the coin counter (total: %lu)",
+             (unsigned long)pulses, (unsigned long)coinCounter.getAcceptedCount());
+    // Earlier pulses of this read are rebuilt from the running total so the
+    // trace keeps one record per coin
+    uint32_t total = coinCounter.getAcceptedCount();
+    for (uint32_t i = pulses; i > 0; i--) {
+        Trace::record(TRACE_COIN, bay, 1, total - (i - 1));
+        processCoinInsertion(currentTime);
     }
 }
+#endif
 
 // Helper method to handle the business logic of a coin insertion
 void CarWashController::processCoinInsertion(unsigned long currentTime) {
+    timersDirty = true;
     LOG_INFO("COIN: ========================================");
     LOG_INFO("COIN: *** COIN DETECTED AND PROCESSED! ***");
     LOG_INFO("COIN: Time: %lu ms", currentTime);
@@ -1079,29 +845,31 @@ void CarWashController::processCoinInsertion(unsigned long currentTime) {
         char sessionIdBuffer[30];
         sprintf(sessionIdBuffer, "manual_%lu", currentTime);
         
-        config.sessionId = String(sessionIdBuffer);
+        config.sessionId = sessionIdBuffer;
         config.userId = "unknown";
-        config.userName = "";
+        config.userName.clear();
         config.physicalTokens = 1;
         config.tokens = 1;
         config.isLoaded = true;
         tokensConsumedCount = 0;
         
-        currentState = STATE_IDLE;
+        setState(STATE_IDLE);
         gracePeriodStartTime = currentTime; // Start 30-second grace period
         gracePeriodActive = true;
-        digitalWrite(LED_PIN_INIT, HIGH);
+        if (bay == 0) {
+            digitalWrite(LED_PIN_INIT, HIGH);
+        }
         
         LOG_INFO("COIN: Anonymous session created - sessionId='%s', userId='unknown', tokens=%d, state=IDLE", 
                 config.sessionId.c_str(), config.tokens);
         LOG_INFO("COIN: Grace period started - 30 seconds to press button");
     }
     
-    // DISABLED - BLE ONLY MODE (no MQTT)
-    // publishCoinInsertedEvent();
+    publishCoinInsertedEvent();
 }
 
 void CarWashController::autoConsumeToken() {
+    timersDirty = true;
     if (config.tokens <= 0) {
         LOG_WARNING("autoConsumeToken called but no tokens available - ending session");
         stopMachine(AUTOMATIC);
@@ -1121,7 +889,7 @@ void CarWashController::autoConsumeToken() {
     // Stay in IDLE state with fresh 2-minute countdown
     // NEW SESSION TIMEOUT: Start a fresh 2-minute countdown (not based on previous token usage)
     // After this 2 minutes, tokenExpired() will end the session
-    currentState = STATE_IDLE;
+    setState(STATE_IDLE);
     tokenStartTime = millis();
     tokenTimeElapsed = 0;  // Fresh start - full 2 minutes
     gracePeriodActive = false;
@@ -1134,6 +902,7 @@ void CarWashController::autoConsumeToken() {
 }
 
 void CarWashController::consumeNextToken() {
+    timersDirty = true;
     if (config.tokens <= 0) {
         LOG_WARNING("consumeNextToken called but no tokens available");
         return;
@@ -1160,15 +929,16 @@ void CarWashController::consumeNextToken() {
     LOG_INFO("Next token consumed: tokens_left=%d, state remains=%d, activeButton=%d", 
              config.tokens, currentState, activeButton);
     
-    // // Publish continuation event based on state
-    // if (previousState == STATE_RUNNING && activeButton >= 0) {
-    //     publishActionEvent(activeButton, ACTION_RESUME, AUTOMATIC);
-    // } else if (previousState == STATE_PAUSED) {
-    //     publishActionEvent(activeButton >= 0 ? activeButton : -1, ACTION_PAUSE, AUTOMATIC);
-    // }
+    // Publish continuation event based on state
+    if (previousState == STATE_RUNNING && activeButton >= 0) {
+        publishActionEvent(activeButton, ACTION_RESUME, AUTOMATIC);
+    } else if (previousState == STATE_PAUSED) {
+        publishActionEvent(activeButton >= 0 ? activeButton : -1, ACTION_PAUSE, AUTOMATIC);
+    }
 }
 
 void CarWashController::switchFunction(int newButtonIndex) {
+    timersDirty = true;
     if (currentState != STATE_RUNNING) {
         LOG_WARNING("switchFunction called but not in RUNNING state");
         return;
@@ -1176,29 +946,33 @@ void CarWashController::switchFunction(int newButtonIndex) {
     
     LOG_INFO("Switching from button %d to button %d", activeButton + 1, newButtonIndex + 1);
     
-    extern IoExpander ioExpander;
-    
-    if (xIoExpanderMutex != NULL && xSemaphoreTake(xIoExpanderMutex, pdMS_TO_TICKS(100)) == pdTRUE) {
-        // Turn off the current relay if there is one
+    if (xIoExpanderMutex != NULL && profiledTake(xIoExpanderMutex, pdMS_TO_TICKS(100), PROFILED_MUTEX_IO_EXPANDER) == pdTRUE) {
+        // Old relay off and new relay on in one write, so there is no
+        // window with both relays on (or both off) between transactions
+        io.beginRelayBatch();
         if (activeButton >= 0) {
-            ioExpander.setRelay(RELAY_INDICES[activeButton], false);
-            LOG_INFO("Deactivated relay %d (button %d)", activeButton + 1, activeButton + 1);
+            io.setRelay(RELAY_INDICES[activeButton], false);
         }
+        io.setRelay(RELAY_INDICES[newButtonIndex], true);
+        bool committed = io.commitRelayBatch();
         
-        // Turn on the new relay
-        ioExpander.setRelay(RELAY_INDICES[newButtonIndex], true);
-        LOG_INFO("Activated relay %d (button %d)", newButtonIndex + 1, newButtonIndex + 1);
+        profiledGive(xIoExpanderMutex, PROFILED_MUTEX_IO_EXPANDER);
         
-        xSemaphoreGive(xIoExpanderMutex);
+        if (committed) {
+            LOG_INFO("Switched relay %d -> %d (button %d -> %d)", activeButton + 1, newButtonIndex + 1,
+                     activeButton + 1, newButtonIndex + 1);
+        } else {
+            LOG_ERROR("Failed to switch relay %d -> %d", activeButton + 1, newButtonIndex + 1);
+        }
     } else {
         LOG_WARNING("Failed to acquire IO expander mutex in switchFunction()");
         return;
     }
     
-    // // Publish stop event for old button if there was one
-    // if (activeButton >= 0) {
-    //     publishActionEvent(activeButton, ACTION_STOP, MANUAL);
-    // }
+    // Publish stop event for old button if there was one
+    if (activeButton >= 0) {
+        publishActionEvent(activeButton, ACTION_STOP, MANUAL);
+    }
     
     // Update active button
     activeButton = newButtonIndex;
@@ -1211,7 +985,7 @@ void CarWashController::switchFunction(int newButtonIndex) {
     lastActionTime = millis();
     
     // Publish start event for new button
-    // publishActionEvent(newButtonIndex, ACTION_START, MANUAL);
+    publishActionEvent(newButtonIndex, ACTION_START, MANUAL);
     
     LOG_INFO("Function switched successfully - now running button %d", newButtonIndex + 1);
 }
@@ -1236,62 +1010,335 @@ unsigned long CarWashController::getInactivityTimeout() const {
 void CarWashController::update() {
     unsigned long currentTime = millis();
     
-    // Periodic timeout debugging logs (every 5 seconds)
-    static unsigned long lastTimeoutLogTime = 0;
-    unsigned long logElapsed;
-    if (lastTimeoutLogTime == 0 || currentTime >= lastTimeoutLogTime) {
-        logElapsed = currentTime - lastTimeoutLogTime;
+    // Re-arm session deadlines after state transitions (also covers transitions
+    // made from other tasks, e.g. BLE loading a session via handleMqttMessage)
+    if (timersDirty) {
+        timersDirty = false;
+        rescheduleTimers();
+    }
+    
+    // Fire expired session deadlines (grace period, inactivity, token expiry).
+    // In the common case nothing is due and this is a single comparison.
+    if (timers.isDue(currentTime)) {
+        runExpiredTimers(currentTime);
+    }
+    
+    // Coin and button events queued by the InputReader task
+    handleInputEvents();
+    
+    // Requests made from other tasks (network task, MQTT commands)
+    if (simulatedCoinRequested) {
+        simulatedCoinRequested = false;
+        processCoinInsertion(currentTime);
+    }
+    if (setupEventRequested) {
+        setupEventRequested = false;
+        publishActionEvent(-1, ACTION_SETUP, AUTOMATIC);
+    }
+    
+    // Changed state fields go out right away; a full keyframe on the heartbeat
+    // (or when /get_state was received)
+    publishStateChanges(currentTime);
+    
+    // Hand the display task what it should show, if that changed
+    publishDisplaySnapshot();
+}
+
+bool CarWashController::buildDisplaySnapshot(DisplaySnapshot& snapshot) {
+    snapshot.state = currentState;
+    snapshot.secondsLeft = 0;
+    snapshot.tokenHundredths = 0;
+    if (currentState == STATE_FREE) {
+        return true;
+    }
+    
+    unsigned long tokenTimeSeconds = TOKEN_TIME / 1000;
+    int tokensLeft = config.tokens > 0 ? config.tokens : 0;
+    unsigned long secondsLeft = getSecondsLeft();
+    unsigned long secondsInCurrentToken = 0;
+    
+    if (currentState == STATE_IDLE && getGracePeriodSecondsLeft() > 0) {
+        // Grace period: no token countdown is running yet (tokenStartTime is 0),
+        // show full tokens and full time
+        secondsLeft = tokensLeft * tokenTimeSeconds;
+    } else if (currentState == STATE_IDLE && secondsLeft == 0) {
+        // Grace period JUST expired but the 2-minute countdown hasn't started yet;
+        // keep the previous display for a cycle to avoid showing a double-counted
+        // token value
+        return false;
     } else {
-        logElapsed = (0xFFFFFFFFUL - lastTimeoutLogTime) + currentTime + 1;
+        // secondsLeft = currentTokenRemaining + (tokensLeft * tokenTimeSeconds)
+        unsigned long futureTokensTime = tokensLeft * tokenTimeSeconds;
+        if (secondsLeft > futureTokensTime) {
+            secondsInCurrentToken = secondsLeft - futureTokensTime;
+        }
     }
     
-    if (logElapsed >= 5000) { // Log every 5 seconds
-        // Log token timeout variables
-        if ((currentState == STATE_RUNNING || currentState == STATE_PAUSED) && tokenStartTime != 0) {
-            unsigned long totalElapsedTime;
-            unsigned long runningTime;
-            if (currentState == STATE_RUNNING) {
-                if (currentTime >= tokenStartTime) {
-                    runningTime = currentTime - tokenStartTime;
-                } else {
-                    runningTime = (0xFFFFFFFFUL - tokenStartTime) + currentTime + 1;
-                }
-                totalElapsedTime = tokenTimeElapsed + runningTime;
-            } else { // STATE_PAUSED
-                totalElapsedTime = tokenTimeElapsed;
-            }
-            
-            bool tokenExpired = (totalElapsedTime >= TOKEN_TIME);
-            // LOG_INFO("[TOKEN_TIMEOUT] state=%d, tokenStartTime=%lu, tokenTimeElapsed=%lu, currentTime=%lu, runningTime=%lu, totalElapsedTime=%lu, TOKEN_TIME=%lu, expired=%d",
-            //         currentState, tokenStartTime, tokenTimeElapsed, currentTime, 
-            //         (currentState == STATE_RUNNING) ? runningTime : 0UL, 
-            //         totalElapsedTime, TOKEN_TIME, tokenExpired ? 1 : 0);
+    // Tokens as fixed point: whole tokens + fraction of the current token
+    // (e.g. 2 tokens of 120 s with 60 s used -> 150 = "01.50")
+    unsigned long hundredths = (unsigned long)tokensLeft * 100;
+    if (secondsInCurrentToken > 0 && tokenTimeSeconds > 0) {
+        hundredths += (secondsInCurrentToken * 100 + tokenTimeSeconds / 2) / tokenTimeSeconds;
+    }
+    
+    snapshot.secondsLeft = (uint16_t)std::min(secondsLeft, 9999UL);
+    snapshot.tokenHundredths = (uint16_t)std::min(hundredths, 9999UL);
+    return true;
+}
+
+void CarWashController::publishDisplaySnapshot() {
+    if (displayMailbox == NULL) {
+        return;
+    }
+    
+    DisplaySnapshot snapshot;
+    if (!buildDisplaySnapshot(snapshot)) {
+        return;
+    }
+    if (displaySnapshotSent &&
+        snapshot.state == lastDisplaySnapshot.state &&
+        snapshot.secondsLeft == lastDisplaySnapshot.secondsLeft &&
+        snapshot.tokenHundredths == lastDisplaySnapshot.tokenHundredths) {
+        return;
+    }
+    
+    // Mailbox semantics: the display only ever needs the latest snapshot
+    xQueueOverwrite(displayMailbox, &snapshot);
+    lastDisplaySnapshot = snapshot;
+    displaySnapshotSent = true;
+}
+
+void CarWashController::setState(MachineState state) {
+    Trace::record(TRACE_STATE, Trace::withBay(bay, (uint8_t)currentState), (uint16_t)state, (uint32_t)config.tokens);
+    currentState = state;
+}
+
+bool CarWashController::getDisplaySnapshot(DisplaySnapshot& snapshot) const {
+    if (!displaySnapshotSent) {
+        return false;
+    }
+    snapshot = lastDisplaySnapshot;
+    return true;
+}
+
+uint16_t CarWashController::collectDirtyStateFields() {
+    StateSnapshot& last = lastObservedState;
+    uint16_t fields = 0;
+
+    if (last.state != currentState) {
+        fields |= FIELD_STATE;
+        last.state = currentState;
+    }
+    if (last.tokens != config.tokens) {
+        fields |= FIELD_TOKENS;
+        last.tokens = config.tokens;
+    }
+    if (last.physicalTokens != config.physicalTokens) {
+        fields |= FIELD_PHYSICAL_TOKENS;
+        last.physicalTokens = config.physicalTokens;
+    }
+    if (last.activeButton != activeButton) {
+        fields |= FIELD_ACTIVE_BUTTON;
+        last.activeButton = activeButton;
+    }
+    if (last.gracePeriodActive != gracePeriodActive || last.gracePeriodStartTime != gracePeriodStartTime) {
+        fields |= FIELD_GRACE_PERIOD;
+        last.gracePeriodActive = gracePeriodActive;
+        last.gracePeriodStartTime = gracePeriodStartTime;
+    }
+    if (last.isLoaded != config.isLoaded) {
+        fields |= FIELD_LOADED;
+        last.isLoaded = config.isLoaded;
+    }
+    // Session strings only change on init/stop; compare them last
+    if (last.sessionId != config.sessionId || last.userId != config.userId) {
+        fields |= FIELD_SESSION;
+        last.sessionId = config.sessionId;
+        last.userId = config.userId;
+    }
+    return fields;
+}
+
+void CarWashController::publishStateChanges(unsigned long currentTime) {
+    // Without a publisher every message would be built only to be rejected;
+    // keyframeRequested is still set, so the first one out is a keyframe
+    if (!hasMqttPublisher()) {
+        return;
+    }
+    pendingStateFields |= collectDirtyStateFields();
+
+    bool keyframeDue = keyframeRequested || (currentTime - lastKeyframeTime >= STATE_KEYFRAME_INTERVAL);
+    if (pendingStateFields == 0 && !keyframeDue) {
+        return;
+    }
+    if (statePublishRetryAt != 0 && (long)(currentTime - statePublishRetryAt) < 0) {
+        return;
+    }
+    statePublishRetryAt = 0;
+
+    if (keyframeDue) {
+        // A keyframe carries every field, so it also settles pending deltas
+        if (publishState(FIELD_ALL, true)) {
+            keyframeRequested = false;
+            lastKeyframeTime = currentTime;
+            lastStatePublishTime = currentTime;
+            pendingStateFields = 0;
         } else {
-            // LOG_INFO("[TOKEN_TIMEOUT] state=%d, tokenStartTime=%lu (not active)", currentState, tokenStartTime);
+            statePublishRetryAt = currentTime + STATE_PUBLISH_RETRY_MS;
         }
-        
-        // Log user inactivity timeout variables
-        if (currentState != STATE_FREE && config.isLoaded) {
-            unsigned long elapsedTime;
-            if (currentTime >= lastActionTime) {
-                elapsedTime = currentTime - lastActionTime;
+        return;
+    }
+
+    if (currentTime - lastStatePublishTime < STATE_DELTA_MIN_INTERVAL) {
+        return;
+    }
+    if (publishState(pendingStateFields, false)) {
+        lastStatePublishTime = currentTime;
+        pendingStateFields = 0;
+    } else {
+        // Fields stay dirty and go out with the next successful delta
+        statePublishRetryAt = currentTime + STATE_PUBLISH_RETRY_MS;
+    }
+}
+
+bool CarWashController::publishState(uint16_t fields, bool keyframe) {
+    // The previous document was destroyed when the last call returned
+    stateAllocator.reset();
+    JsonDocument doc(&stateAllocator);
+    doc["machine_id"] = bayMachineId(bay);
+    char timestamp[ISO_TIMESTAMP_SIZE];
+    formatTimestamp(timestamp, sizeof(timestamp));
+    doc["timestamp"] = timestamp;
+    doc["seq"] = stateSequence;
+    doc["keyframe"] = keyframe;
+
+    if (fields & FIELD_STATE) {
+        doc["state"] = getMachineStateString(currentState);
+        doc["seconds_left"] = getSecondsLeft();
+    }
+    if (fields & FIELD_LOADED) {
+        doc["is_loaded"] = config.isLoaded;
+    }
+    if (fields & FIELD_SESSION) {
+        doc["session_id"] = config.sessionId.c_str();
+        doc["user_id"] = config.userId.c_str();
+        doc["user_name"] = config.userName.c_str();
+    }
+    if (fields & FIELD_TOKENS) {
+        doc["tokens"] = config.tokens;
+    }
+    if (fields & FIELD_PHYSICAL_TOKENS) {
+        doc["physical_tokens"] = config.physicalTokens;
+    }
+    if (fields & FIELD_ACTIVE_BUTTON) {
+        doc["active_button"] = activeButton;
+    }
+    if (fields & FIELD_GRACE_PERIOD) {
+        doc["grace_period_active"] = gracePeriodActive;
+        doc["grace_period_seconds_left"] = getGracePeriodSecondsLeft();
+    }
+
+    if (doc.overflowed()) {
+        LOG_WARNING("State message does not fit its %u-byte arena", (unsigned int)STATE_ARENA_SIZE);
+        return false;
+    }
+
+    // PubSubClient only publishes QoS0, so a delta lost in transit is not
+    // redelivered. The publisher requests a keyframe whenever it drops a state
+    // message and every bay sends one after a reconnect; seq exposes the gap.
+    if (!queueMqttDocument(TOPIC_STATE, doc, QOS0_AT_MOST_ONCE, false)) {
+        return false;
+    }
+    stateSequence++;
+    LOG_DEBUG("State %s queued (fields 0x%02X, seq %u)", keyframe ? "keyframe" : "delta",
+              fields, (unsigned int)(stateSequence - 1));
+    return true;
+}
+
+void CarWashController::publishStats() {
+    char timestamp[ISO_TIMESTAMP_SIZE];
+    formatTimestamp(timestamp, sizeof(timestamp));
+
+    // Summary, histograms, then task batches: one part per message
+    JsonDocument doc;
+    uint8_t part = 0;
+    for (;; part++) {
+        doc.clear();
+        doc["machine_id"] = bayMachineId(bay);
+        doc["timestamp"] = timestamp;
+        doc["part"] = part;
+        if (!Profiler::buildStatsPart(doc, part)) {
+            break;
+        }
+        if (!queueMqttDocument(TOPIC_STATS, doc, QOS0_AT_MOST_ONCE, false)) {
+            LOG_WARNING("Failed to queue stats part %u", part);
+            return;
+        }
+    }
+    LOG_DEBUG("Stats queued in %u messages", part);
+}
+
+void CarWashController::rescheduleTimers() {
+    // Grace period (IDLE or PAUSED): 30 seconds from gracePeriodStartTime
+    if (gracePeriodActive && gracePeriodStartTime != 0 && gracePeriodStartTime != graceExpiryHandledAt) {
+        timers.armAt(TIMER_GRACE_PERIOD, gracePeriodStartTime + GRACE_PERIOD_TIMEOUT);
+    } else {
+        timers.cancel(TIMER_GRACE_PERIOD);
+    }
+    
+    // Inactivity safety net: only applies when IDLE or PAUSED (not actively RUNNING)
+    if ((currentState == STATE_IDLE || currentState == STATE_PAUSED) && config.isLoaded) {
+        timers.armAt(TIMER_INACTIVITY, lastActionTime + getInactivityTimeout());
+    } else {
+        timers.cancel(TIMER_INACTIVITY);
+    }
+    
+    // Token expiration for IDLE (with consumed token), RUNNING, or PAUSED states
+    if ((currentState == STATE_IDLE || currentState == STATE_RUNNING || currentState == STATE_PAUSED) && tokenStartTime != 0) {
+        unsigned long remaining = (tokenTimeElapsed >= TOKEN_TIME) ? 0 : TOKEN_TIME - tokenTimeElapsed;
+        if (currentState == STATE_PAUSED && gracePeriodActive) {
+            // Grace period is active - token time is frozen at tokenTimeElapsed
+            if (remaining == 0) {
+                timers.armAt(TIMER_TOKEN, millis());
             } else {
-                elapsedTime = (0xFFFFFFFFUL - lastActionTime) + currentTime + 1;
+                timers.cancel(TIMER_TOKEN);
             }
-            
-            unsigned long inactivityTimeout = getInactivityTimeout();
-            bool inactivityExpired = (elapsedTime >= inactivityTimeout);
-            // LOG_INFO("[INACTIVITY_TIMEOUT] state=%d, isLoaded=%d, lastActionTime=%lu, currentTime=%lu, elapsedTime=%lu, inactivityTimeout=%lu, expired=%d",
-            //         currentState, config.isLoaded ? 1 : 0, lastActionTime, currentTime, 
-            //         elapsedTime, inactivityTimeout, inactivityExpired ? 1 : 0);
         } else {
-            // LOG_INFO("[INACTIVITY_TIMEOUT] state=%d, isLoaded=%d (not active)", currentState, config.isLoaded ? 1 : 0);
+            timers.armAt(TIMER_TOKEN, tokenStartTime + remaining);
+        }
+    } else {
+        timers.cancel(TIMER_TOKEN);
+    }
+}
+
+void CarWashController::runExpiredTimers(unsigned long currentTime) {
+    // Bounded so a deadline that is re-armed in the past cannot spin here
+    for (uint8_t i = 0; i < DeadlineScheduler::MAX_TIMERS * 2; i++) {
+        int8_t id = timers.popExpired(currentTime);
+        if (id == DeadlineScheduler::NO_TIMER) {
+            break;
         }
         
-        lastTimeoutLogTime = currentTime;
+        switch (id) {
+            case TIMER_GRACE_PERIOD:
+                onGracePeriodExpired(currentTime);
+                break;
+            case TIMER_INACTIVITY:
+                onInactivityTimeout(currentTime);
+                break;
+            case TIMER_TOKEN:
+                onTokenTimeExpired(currentTime);
+                break;
+        }
+        
+        // Handlers change state; arm whatever deadlines the new state needs
+        timersDirty = false;
+        rescheduleTimers();
+        currentTime = millis();
     }
-    
-    // PRIORITY 0: Check grace period expiration
+}
+
+void CarWashController::onGracePeriodExpired(unsigned long currentTime) {
     // NEW SESSION TIMEOUT LOGIC:
     // Grace period (30 seconds) is followed by a fresh 2-minute token consumption period.
     // After 2:30 total inactivity, session ends and user loses ALL remaining tokens.
@@ -1299,178 +1346,74 @@ void CarWashController::update() {
     // Grace period is active in two states:
     // 1. IDLE: After 30 seconds, start consuming a FRESH 2-minute token (stay in IDLE)
     // 2. PAUSED: After 30 seconds, start consuming a FRESH 2-minute token (stay in PAUSED)
-    if (gracePeriodActive && gracePeriodStartTime != 0) {
-        unsigned long gracePeriodElapsed;
-        if (currentTime >= gracePeriodStartTime) {
-            gracePeriodElapsed = currentTime - gracePeriodStartTime;
-        } else {
-            gracePeriodElapsed = (0xFFFFFFFFUL - gracePeriodStartTime) + currentTime + 1;
-        }
+    unsigned long gracePeriodElapsed = currentTime - gracePeriodStartTime;
+    graceExpiryHandledAt = gracePeriodStartTime;
+    
+    if (currentState == STATE_IDLE && config.isLoaded && config.tokens > 0) {
+        LOG_INFO("Grace period expired in IDLE (%lu ms >= %lu ms), starting 2-minute inactivity countdown", 
+                 gracePeriodElapsed, GRACE_PERIOD_TIMEOUT);
+        autoConsumeToken();
+    } else if (currentState == STATE_PAUSED && config.isLoaded) {
+        LOG_INFO("Grace period expired in PAUSED (%lu ms >= %lu ms), starting 2-minute inactivity countdown", 
+                 gracePeriodElapsed, GRACE_PERIOD_TIMEOUT);
+        gracePeriodActive = false;
+        gracePeriodStartTime = 0;
         
-        if (gracePeriodElapsed >= GRACE_PERIOD_TIMEOUT) {
-            if (currentState == STATE_IDLE && config.isLoaded && config.tokens > 0) {
-                LOG_INFO("Grace period expired in IDLE (%lu ms >= %lu ms), starting 2-minute inactivity countdown", 
-                         gracePeriodElapsed, GRACE_PERIOD_TIMEOUT);
-                autoConsumeToken();
-                // Don't return - continue with normal update cycle
-            } else if (currentState == STATE_PAUSED && config.isLoaded) {
-                LOG_INFO("Grace period expired in PAUSED (%lu ms >= %lu ms), starting 2-minute inactivity countdown", 
-                         gracePeriodElapsed, GRACE_PERIOD_TIMEOUT);
-                gracePeriodActive = false;
-                gracePeriodStartTime = 0;
-                
-                // NEW: Start a FRESH 2-minute countdown, not continue partial token
-                // This ensures the user always has exactly 2:30 total (30s grace + 2min)
-                // before session ends, regardless of how much token time was used before pause
-                tokenTimeElapsed = 0;  // Reset accumulated time
-                tokenStartTime = currentTime;  // Start fresh countdown
-                
-                // If user has tokens, consume one for this 2-minute countdown
-                if (config.tokens > 0) {
-                    if (config.physicalTokens > 0) {
-                        config.physicalTokens--;
-                    }
-                    config.tokens--;
-                    tokensConsumedCount++;
-                    LOG_INFO("Consumed 1 token for inactivity countdown - %d tokens remaining", config.tokens);
-                }
-                
-                LOG_INFO("2-minute inactivity countdown started - session will end at 2:30 total inactivity");
-            } else if (currentState == STATE_PAUSED && config.isLoaded && config.tokens == 0) {
-                // No tokens left while paused - end session immediately
-                LOG_INFO("Grace period expired in PAUSED with no tokens remaining - ending session");
-                stopMachine(AUTOMATIC);
-                return;
+        // NEW: Start a FRESH 2-minute countdown, not continue partial token
+        // This ensures the user always has exactly 2:30 total (30s grace + 2min)
+        // before session ends, regardless of how much token time was used before pause
+        tokenTimeElapsed = 0;  // Reset accumulated time
+        tokenStartTime = currentTime;  // Start fresh countdown
+        
+        // If user has tokens, consume one for this 2-minute countdown
+        if (config.tokens > 0) {
+            if (config.physicalTokens > 0) {
+                config.physicalTokens--;
             }
-        }
-    }
-    
-    // PRIORITY 1: Check inactivity timeout (safety net)
-    // NEW SESSION TIMEOUT LOGIC:
-    // Inactivity timeout only applies when machine is IDLE or PAUSED (not actively RUNNING)
-    // The primary timeout mechanism is: 30s grace period + 2min token expiration
-    // This inactivity check is a safety net that ensures session ends even if token logic fails
-    //
-    // When RUNNING, user is actively using the machine - no inactivity timeout
-    // When IDLE or PAUSED, user has 30s grace + 2min before session ends
-    if ((currentState == STATE_IDLE || currentState == STATE_PAUSED) && config.isLoaded) {
-        // Handle potential millis() overflow (wraps every ~50 days)
-        unsigned long elapsedTime;
-        if (currentTime >= lastActionTime) {
-            elapsedTime = currentTime - lastActionTime;
-        } else {
-            // Overflow occurred - calculate correctly
-            elapsedTime = (0xFFFFFFFFUL - lastActionTime) + currentTime + 1;
+            config.tokens--;
+            tokensConsumedCount++;
+            LOG_INFO("Consumed 1 token for inactivity countdown - %d tokens remaining", config.tokens);
         }
         
-        unsigned long inactivityTimeout = getInactivityTimeout();  // Returns SESSION_END_TIMEOUT (150s)
-        if (elapsedTime >= inactivityTimeout) {
-            LOG_INFO("Inactivity timeout reached (%lu ms >= %lu ms), ending session", elapsedTime, inactivityTimeout);
-            LOG_INFO("User loses %d remaining tokens due to inactivity", config.tokens);
-            stopMachine(AUTOMATIC);
-            // Return immediately after logout to ensure state change is processed
-            return;
-        }
+        LOG_INFO("2-minute inactivity countdown started - session will end at 2:30 total inactivity");
+    } else if (currentState == STATE_PAUSED && config.isLoaded && config.tokens == 0) {
+        // No tokens left while paused - end session immediately
+        LOG_INFO("Grace period expired in PAUSED with no tokens remaining - ending session");
+        stopMachine(AUTOMATIC);
     }
-    
+}
 
-    
-    // Always handle coin acceptor - coins can create anonymous sessions when machine is not loaded
-    handleCoinAcceptor();
-    
-    // Only handle buttons when machine is loaded (buttons require a loaded session)
-    if (config.isLoaded) {
-        handleButtons();
-    } else {
-        // Log when buttons are skipped (only in debug mode to avoid spam)
-        static unsigned long lastSkipLog = 0;
-        if (currentTime - lastSkipLog > 5000) { // Log every 5 seconds max
-            LOG_DEBUG("Skipping button handling - machine not loaded (isLoaded=%d, timestamp empty=%d). Coins can still be inserted to create anonymous session.", 
-                     config.isLoaded, config.timestamp.length() == 0);
-            lastSkipLog = currentTime;
-        }
+void CarWashController::onInactivityTimeout(unsigned long currentTime) {
+    // Safety net: ensures the session ends even if token logic fails
+    unsigned long elapsedTime = currentTime - lastActionTime;
+    unsigned long inactivityTimeout = getInactivityTimeout();  // Returns SESSION_END_TIMEOUT (150s)
+    LOG_INFO("Inactivity timeout reached (%lu ms >= %lu ms), ending session", elapsedTime, inactivityTimeout);
+    LOG_INFO("User loses %d remaining tokens due to inactivity", config.tokens);
+    stopMachine(AUTOMATIC);
+}
+
+void CarWashController::onTokenTimeExpired(unsigned long currentTime) {
+    unsigned long totalElapsedTime = tokenTimeElapsed;
+    if (!(currentState == STATE_PAUSED && gracePeriodActive)) {
+        totalElapsedTime += currentTime - tokenStartTime;
     }
-    
-    currentTime = millis();
-    
-    // Check token expiration for IDLE (with consumed token), RUNNING, or PAUSED states
-    if ((currentState == STATE_IDLE || currentState == STATE_RUNNING || currentState == STATE_PAUSED) && tokenStartTime != 0) {
-        unsigned long totalElapsedTime;
-        if (currentState == STATE_RUNNING) {
-            // Handle potential millis() overflow
-            unsigned long runningTime;
-            if (currentTime >= tokenStartTime) {
-                runningTime = currentTime - tokenStartTime;
-            } else {
-                // Overflow occurred - calculate correctly
-                runningTime = (0xFFFFFFFFUL - tokenStartTime) + currentTime + 1;
-            }
-            totalElapsedTime = tokenTimeElapsed + runningTime;
-        } else if (currentState == STATE_IDLE) {
-            // In IDLE with an active token (grace period expired), token time counts down
-            unsigned long idleTime;
-            if (currentTime >= tokenStartTime) {
-                idleTime = currentTime - tokenStartTime;
-            } else {
-                // Overflow occurred - calculate correctly
-                idleTime = (0xFFFFFFFFUL - tokenStartTime) + currentTime + 1;
-            }
-            totalElapsedTime = tokenTimeElapsed + idleTime;
-        } else { // STATE_PAUSED
-            // When paused with grace period active, elapsed time is frozen at tokenTimeElapsed
-            // When paused with grace period expired, token time counts down
-            if (gracePeriodActive) {
-                // Grace period is active - token time is frozen
-                totalElapsedTime = tokenTimeElapsed;
-            } else {
-                // Grace period expired - token time counts down
-                unsigned long pausedTime;
-                if (currentTime >= tokenStartTime) {
-                    pausedTime = currentTime - tokenStartTime;
-                } else {
-                    // Overflow occurred - calculate correctly
-                    pausedTime = (0xFFFFFFFFUL - tokenStartTime) + currentTime + 1;
-                }
-                totalElapsedTime = tokenTimeElapsed + pausedTime;
-            }
-        }
-        
-        if (totalElapsedTime >= TOKEN_TIME) {
-            LOG_INFO("Token time expired (%lu ms >= %lu ms), calling tokenExpired()", totalElapsedTime, TOKEN_TIME);
-            tokenExpired();
-            // Re-check inactivity timeout after token expires (user might be logged out)
-            // CRITICAL: Re-capture currentTime after tokenExpired() as it may have taken time
-            currentTime = millis();
-            if (currentState != STATE_FREE && config.isLoaded) {
-                // Handle potential millis() overflow
-                unsigned long elapsedTime;
-                if (currentTime >= lastActionTime) {
-                    elapsedTime = currentTime - lastActionTime;
-                } else {
-                    // Overflow occurred - calculate correctly
-                    elapsedTime = (0xFFFFFFFFUL - lastActionTime) + currentTime + 1;
-                }
-                unsigned long inactivityTimeout = getInactivityTimeout();
-                if (elapsedTime >= inactivityTimeout) {
-                    LOG_INFO("Inactivity timeout also reached after token expiry, logging out (%lu ms >= %lu ms)", 
-                             elapsedTime, inactivityTimeout);
-                    stopMachine(AUTOMATIC);
-                    return;
-                }
-            }
-        }
+    LOG_INFO("Token time expired (%lu ms >= %lu ms), calling tokenExpired()", totalElapsedTime, TOKEN_TIME);
+    tokenExpired();
+}
+
+bool CarWashController::waitForInput(TickType_t timeout) {
+    // Never sleep past the next session deadline
+    unsigned long untilDeadline = timers.msUntilNext(millis());
+    if (untilDeadline != DeadlineScheduler::NEVER && pdMS_TO_TICKS(untilDeadline) < timeout) {
+        timeout = pdMS_TO_TICKS(untilDeadline);
     }
-    
-    // NOTE: Periodic state publishing has been removed.
-    // State is now published on demand with high priority when:
-    // - A message is received on /init topic
-    // - A message is received on /get_state topic
+    return io.waitForInputEvent(timeout);
 }
 
 void CarWashController::publishMachineSetupActionEvent() {
-    // DISABLED - BLE ONLY MODE (no MQTT)
-    // This function is kept for API compatibility but does nothing
-    LOG_DEBUG("publishMachineSetupActionEvent called but MQTT is disabled");
+    // Called from the network task after (re)connecting: the event is built
+    // on the controller task, which owns the session fields and the arena
+    setupEventRequested = true;
 }
 
 unsigned long CarWashController::getSecondsLeft() {
@@ -1488,24 +1431,12 @@ unsigned long CarWashController::getSecondsLeft() {
     unsigned long totalElapsedTime;
 
     if (currentState == STATE_RUNNING) {
-        // Handle potential millis() overflow
-        unsigned long runningTime;
-        if (currentTime >= tokenStartTime) {
-            runningTime = currentTime - tokenStartTime;
-        } else {
-            // Overflow occurred - calculate correctly
-            runningTime = (0xFFFFFFFFUL - tokenStartTime) + currentTime + 1;
-        }
+        // Unsigned subtraction stays correct across a millis() wrap
+        unsigned long runningTime = currentTime - tokenStartTime;
         totalElapsedTime = tokenTimeElapsed + runningTime;
     } else if (currentState == STATE_IDLE) {
         // In IDLE with an active token (grace period expired), token time counts down
-        unsigned long idleTime;
-        if (currentTime >= tokenStartTime) {
-            idleTime = currentTime - tokenStartTime;
-        } else {
-            // Overflow occurred - calculate correctly
-            idleTime = (0xFFFFFFFFUL - tokenStartTime) + currentTime + 1;
-        }
+        unsigned long idleTime = currentTime - tokenStartTime;
         totalElapsedTime = tokenTimeElapsed + idleTime;
     } else { // PAUSED
         // When paused with grace period active, elapsed time is frozen at tokenTimeElapsed
@@ -1515,13 +1446,7 @@ unsigned long CarWashController::getSecondsLeft() {
             totalElapsedTime = tokenTimeElapsed;
         } else {
             // Grace period expired - token time counts down
-            unsigned long pausedTime;
-            if (currentTime >= tokenStartTime) {
-                pausedTime = currentTime - tokenStartTime;
-            } else {
-                // Overflow occurred - calculate correctly
-                pausedTime = (0xFFFFFFFFUL - tokenStartTime) + currentTime + 1;
-            }
+            unsigned long pausedTime = currentTime - tokenStartTime;
             totalElapsedTime = tokenTimeElapsed + pausedTime;
         }
     }
@@ -1542,35 +1467,81 @@ unsigned long CarWashController::getSecondsLeft() {
     return totalRemainingMs / 1000;
 }
 
+size_t CarWashController::formatTimestamp(char* buffer, size_t size) {
+    // Default timestamp (no wall clock in this build; millis() is used for relative time tracking)
+    static const char DEFAULT_TIMESTAMP[] = "2000-01-01T00:00:00.000Z";
+    if (buffer == NULL || size < sizeof(DEFAULT_TIMESTAMP)) {
+        if (buffer != NULL && size > 0) buffer[0] = '\0';
+        return 0;
+    }
+    return (size_t)snprintf(buffer, size, "%s", DEFAULT_TIMESTAMP);
+}
+
 String CarWashController::getTimestamp() {
-    // Return default timestamp (using millis() for relative time tracking)
-    return "2000-01-01T00:00:00.000Z";
+    char timestamp[ISO_TIMESTAMP_SIZE];
+    formatTimestamp(timestamp, sizeof(timestamp));
+    return String(timestamp);
 }
 
 void CarWashController::publishCoinInsertedEvent() {
-    // DISABLED - BLE ONLY MODE (no MQTT)
-    // This function is kept for API compatibility but does nothing
-    LOG_DEBUG("publishCoinInsertedEvent called but MQTT is disabled");
+    publishActionEvent(-1, ACTION_TOKEN_INSERTED, MANUAL);
 }
 
-// Debug method to directly simulate a coin insertion
+void CarWashController::publishActionEvent(int buttonIndex, MachineAction machineAction, TriggerType triggerType) {
+    // Nothing would send it (BLE only build)
+    if (!hasMqttPublisher()) {
+        return;
+    }
+
+    // Never called while a state message is being built (both run on the controller task)
+    stateAllocator.reset();
+    JsonDocument doc(&stateAllocator);
+    doc["machine_id"] = bayMachineId(bay);
+    char timestamp[ISO_TIMESTAMP_SIZE];
+    formatTimestamp(timestamp, sizeof(timestamp));
+    doc["timestamp"] = timestamp;
+    doc["action"] = getMachineActionString(machineAction);
+    doc["trigger"] = triggerType == AUTOMATIC ? "AUTOMATIC" : "MANUAL";
+    if (buttonIndex >= 0) {
+        doc["button"] = buttonIndex;
+    }
+    if (machineAction != ACTION_SETUP) {
+        doc["session_id"] = config.sessionId.c_str();
+        doc["user_id"] = config.userId.c_str();
+        doc["tokens"] = config.tokens;
+        doc["physical_tokens"] = config.physicalTokens;
+    }
+
+    if (doc.overflowed()) {
+        LOG_WARNING("Action message does not fit its %u-byte arena", (unsigned int)STATE_ARENA_SIZE);
+        return;
+    }
+
+    // Billing is reconciled from these: critical, so they are stored in the
+    // flash outbox and only acknowledged there once published
+    if (!queueMqttDocument(TOPIC_ACTION, doc, QOS1_AT_LEAST_ONCE, true)) {
+        LOG_WARNING("Failed to queue %s action event", getMachineActionString(machineAction));
+        return;
+    }
+    LOG_DEBUG("Action %s queued (button %d)", getMachineActionString(machineAction), buttonIndex);
+}
+
+// Debug method to simulate a coin insertion; credited on the controller task
 void CarWashController::simulateCoinInsertion() {
-    processCoinInsertion(millis());
+    simulatedCoinRequested = true;
 }
 
 void CarWashController::printRelayStates() {
-    extern IoExpander ioExpander;
-    
-    if (xIoExpanderMutex != NULL && xSemaphoreTake(xIoExpanderMutex, pdMS_TO_TICKS(100)) == pdTRUE) {
+    if (xIoExpanderMutex != NULL && profiledTake(xIoExpanderMutex, pdMS_TO_TICKS(100), PROFILED_MUTEX_IO_EXPANDER) == pdTRUE) {
         // Read output states
-        uint8_t relayStatePort1 = ioExpander.readRegister(OUTPUT_PORT1);
-        uint8_t relayStatePort0 = ioExpander.readRegister(OUTPUT_PORT0);
+        uint8_t relayStatePort1 = io.readRegister(OUTPUT_PORT1);
+        uint8_t relayStatePort0 = io.readRegister(OUTPUT_PORT0);
         
         // Read configuration registers to verify port setup
-        uint8_t configPort0 = ioExpander.readRegister(CONFIG_PORT0);
-        uint8_t configPort1 = ioExpander.readRegister(CONFIG_PORT1);
+        uint8_t configPort0 = io.readRegister(CONFIG_PORT0);
+        uint8_t configPort1 = io.readRegister(CONFIG_PORT1);
         
-        xSemaphoreGive(xIoExpanderMutex);
+        profiledGive(xIoExpanderMutex, PROFILED_MUTEX_IO_EXPANDER);
         
         LOG_INFO("=== RELAY STATES & CONFIGURATION ===");
         LOG_INFO("Port 0 Output Value: 0x%02X (binary: %d%d%d%d%d%d%d%d)",
@@ -1643,14 +1614,8 @@ unsigned long CarWashController::getTimeToInactivityTimeout() const {
     }
     
     unsigned long currentTime = millis();
-    // Handle potential millis() overflow (wraps every ~50 days)
-    unsigned long elapsedTime;
-    if (currentTime >= lastActionTime) {
-        elapsedTime = currentTime - lastActionTime;
-    } else {
-        // Overflow occurred - calculate correctly
-        elapsedTime = (0xFFFFFFFFUL - lastActionTime) + currentTime + 1;
-    }
+    // Unsigned subtraction stays correct across a millis() wrap (every ~50 days)
+    unsigned long elapsedTime = currentTime - lastActionTime;
     
     // Get dynamic inactivity timeout based on tokens
     unsigned long inactivityTimeout = getInactivityTimeout();
@@ -1672,13 +1637,7 @@ unsigned long CarWashController::getGracePeriodSecondsLeft() const {
     }
     
     unsigned long currentTime = millis();
-    unsigned long elapsed;
-    if (currentTime >= gracePeriodStartTime) {
-        elapsed = currentTime - gracePeriodStartTime;
-    } else {
-        // Handle millis() overflow
-        elapsed = (0xFFFFFFFFUL - gracePeriodStartTime) + currentTime + 1;
-    }
+    unsigned long elapsed = currentTime - gracePeriodStartTime;
     
     // Return 0 if grace period has expired
     if (elapsed >= GRACE_PERIOD_TIMEOUT) {
@@ -1694,15 +1653,69 @@ unsigned long CarWashController::getGracePeriodSecondsLeft() const {
 
 /**
  * Helper method to queue MQTT messages for the dedicated publisher task
- * 
- * DISABLED - BLE ONLY MODE (no MQTT)
- * This function is kept for API compatibility but does nothing
+ *
+ * Critical messages are appended to the flash outbox when it is ready.
+ * Otherwise the payload is copied into a message pool block and its handle
+ * queued on xMqttPublishQueue. Returns false when neither took it, and
+ * always in BLE only builds (ENABLE_MQTT=0), which have no publisher.
  */
-bool CarWashController::queueMqttMessage(const char* topic, const char* payload, uint8_t qos, bool isCritical) {
-    // MQTT is disabled - BLE only mode
+bool CarWashController::queueMqttMessage(MqttTopicId topic, const char* payload, uint8_t qos, bool isCritical) {
+    return queueMqttPayload(topic, reinterpret_cast<const uint8_t*>(payload), strlen(payload), qos, isCritical);
+}
+
+bool CarWashController::queueMqttDocument(MqttTopicId topic, const JsonDocument& doc, uint8_t qos, bool isCritical) {
+    uint8_t buffer[MQTT_MESSAGE_MAX_SIZE];
+    size_t length = encodePayload(doc, buffer, sizeof(buffer));
+    if (length == 0) {
+        LOG_WARNING("Failed to encode %s payload for %s", wireFormatName(getWireFormat()), mqttTopic(topic, bay));
+        return false;
+    }
+    return queueMqttPayload(topic, buffer, length, qos, isCritical);
+}
+
+bool CarWashController::hasMqttPublisher() const {
+#if ENABLE_MQTT
+    return xMqttPublishQueue != NULL;
+#else
+    // BLE only build: queueMqttPayload() rejects everything
+    return false;
+#endif
+}
+
+bool CarWashController::queueMqttPayload(MqttTopicId topic, const uint8_t* payload, size_t length, uint8_t qos, bool isCritical) {
+#if ENABLE_MQTT
+    // Critical messages are stored in the flash outbox first; the publisher
+    // replays it and acknowledges each batch once it is published
+    if (isCritical && mqttOutbox.isReady()) {
+        if (mqttOutbox.append(mqttTopic(topic, bay), payload, length, qos)) {
+            Trace::record(TRACE_MQTT_ENQUEUE, topic, (uint16_t)length, MQTT_INVALID_HANDLE);
+            return true;
+        }
+        LOG_WARNING("MQTT outbox rejected a message to %s, queueing it in RAM", mqttTopic(topic, bay));
+    }
+    
+    // Copy the payload once into a pool block; the queue only carries the handle
+    MqttMessageHandle handle = mqttMessagePool.create(topic, bay, payload, length, qos, isCritical);
+    if (handle == MQTT_INVALID_HANDLE) {
+        Trace::record(TRACE_MQTT_DROP, topic, (uint16_t)length, TRACE_DROP_POOL_FULL);
+        LOG_WARNING("MQTT message pool exhausted, dropping message to %s", mqttTopic(topic, bay));
+        return false;
+    }
+    if (xMqttPublishQueue == NULL || xQueueSendToBack(xMqttPublishQueue, &handle, 0) != pdTRUE) {
+        mqttMessagePool.release(handle);
+        Trace::record(TRACE_MQTT_DROP, topic, (uint16_t)length, TRACE_DROP_QUEUE_FULL);
+        LOG_WARNING("MQTT publish queue full, dropping message to %s", mqttTopic(topic, bay));
+        return false;
+    }
+    Trace::record(TRACE_MQTT_ENQUEUE, topic, (uint16_t)length, handle);
+    return true;
+#else
+    // BLE only build: no pool or publish queue to take the message
     (void)topic;
     (void)payload;
+    (void)length;
     (void)qos;
     (void)isCritical;
     return false;
+#endif
 }
\ No newline at end of file
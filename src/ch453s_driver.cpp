@@ -1,22 +1,75 @@
 #include "ch453s_driver.h"
 #include "logger.h"
+#include "profiler.h"
 
-// 7-segment patterns for digits 0-9 and some characters
-// Bit order: DP G F E D C B A (active high, common cathode)
-// Based on CH453 datasheet: SEG7=DP, SEG6-0 = G-A segments
-const uint8_t CH453SDriver::SEGMENTS[] = {
-    0x3F,  // 0: A B C D E F
-    0x06,  // 1: B C
-    0x5B,  // 2: A B D E G
-    0x4F,  // 3: A B C D G
-    0x66,  // 4: B C F G
-    0x6D,  // 5: A C D F G
-    0x7D,  // 6: A C D E F G
-    0x07,  // 7: A B C
-    0x7F,  // 8: A B C D E F G
-    0x6F,  // 9: A B C D F G
+// Storage for SEGMENTS (the table itself is in the header, usable in constant expressions)
+constexpr uint8_t CH453SDriver::SEGMENTS[];
+
+// ============ Compile-time segment tables ============
+// Rendering is table lookups only: no float math and no per-digit division
+// beyond one split into digit pairs (a division by a constant, compiled to a multiply)
+
+// Two digits packed as [low byte = tens][high byte = ones]
+static constexpr uint16_t pairSegments(uint8_t n) {
+    return (uint16_t)(CH453SDriver::SEGMENTS[n / 10] | (CH453SDriver::SEGMENTS[n % 10] << 8));
+}
+
+#define PAIR_ROW(t) \
+    pairSegments(t##0), pairSegments(t##1), pairSegments(t##2), pairSegments(t##3), pairSegments(t##4), \
+    pairSegments(t##5), pairSegments(t##6), pairSegments(t##7), pairSegments(t##8), pairSegments(t##9)
+
+// "00".."99" -> segment patterns of both digits
+static constexpr uint16_t DIGIT_PAIRS[100] = {
+    pairSegments(0), pairSegments(1), pairSegments(2), pairSegments(3), pairSegments(4),
+    pairSegments(5), pairSegments(6), pairSegments(7), pairSegments(8), pairSegments(9),
+    PAIR_ROW(1), PAIR_ROW(2), PAIR_ROW(3), PAIR_ROW(4),
+    PAIR_ROW(5), PAIR_ROW(6), PAIR_ROW(7), PAIR_ROW(8), PAIR_ROW(9)
 };
 
+#undef PAIR_ROW
+
+// Character -> segment pattern (7-bit ASCII; unknown characters are blank)
+static constexpr uint8_t charSegments(char c) {
+    return (c >= '0' && c <= '9') ? CH453SDriver::SEGMENTS[c - '0'] :
+           c == '-' ? 0x40 :               // G segment only
+           c == '_' ? 0x08 :               // D segment only
+           (c == 'A' || c == 'a') ? 0x77 :
+           c == 'b' ? 0x7C :
+           c == 'C' ? 0x39 :
+           c == 'c' ? 0x58 :
+           c == 'd' ? 0x5E :
+           (c == 'E' || c == 'e') ? 0x79 :
+           (c == 'F' || c == 'f') ? 0x71 :
+           c == 'H' ? 0x76 :
+           c == 'h' ? 0x74 :
+           (c == 'I' || c == 'i') ? 0x06 :
+           (c == 'J' || c == 'j') ? 0x1E :
+           (c == 'L' || c == 'l') ? 0x38 :
+           c == 'n' ? 0x54 :
+           c == 'o' ? 0x5C :
+           (c == 'P' || c == 'p') ? 0x73 :
+           c == 'r' ? 0x50 :
+           (c == 'S' || c == 's') ? 0x6D :
+           c == 't' ? 0x78 :
+           c == 'U' ? 0x3E :
+           c == 'u' ? 0x1C :
+           (c == 'Y' || c == 'y') ? 0x6E :
+           0x00;                            // ' ' and anything else: all off
+}
+
+#define CHAR_ROW(r) \
+    charSegments(r * 16 + 0), charSegments(r * 16 + 1), charSegments(r * 16 + 2), charSegments(r * 16 + 3), \
+    charSegments(r * 16 + 4), charSegments(r * 16 + 5), charSegments(r * 16 + 6), charSegments(r * 16 + 7), \
+    charSegments(r * 16 + 8), charSegments(r * 16 + 9), charSegments(r * 16 + 10), charSegments(r * 16 + 11), \
+    charSegments(r * 16 + 12), charSegments(r * 16 + 13), charSegments(r * 16 + 14), charSegments(r * 16 + 15)
+
+static constexpr uint8_t CHAR_SEGMENTS[128] = {
+    CHAR_ROW(0), CHAR_ROW(1), CHAR_ROW(2), CHAR_ROW(3),
+    CHAR_ROW(4), CHAR_ROW(5), CHAR_ROW(6), CHAR_ROW(7)
+};
+
+#undef CHAR_ROW
+
 // I2C pins for software I2C
 static uint8_t _sdaPin = 21;
 static uint8_t _sclPin = 22;
@@ -25,7 +78,10 @@ static uint8_t _sclPin = 22;
 static const int I2C_DELAY = 5;
 
 CH453SDriver::CH453SDriver(TwoWire& wire)
-    : _wire(wire), _i2cMutex(NULL), _brightness(8), _displayOn(false) {
+    : _wire(wire), _i2cMutex(NULL), _brightness(8), _displayOn(false),
+      _knownMask(0), _digitWrites(0) {
+    memset(_frame, 0, sizeof(_frame));
+    memset(_shadow, 0, sizeof(_shadow));
 }
 
 // ============ Software I2C Implementation ============
@@ -106,6 +162,7 @@ static bool i2c_write_byte(uint8_t data) {
 // Send a CH453 command using software I2C
 // Format: START + cmdByte + dataByte + STOP
 static bool ch453_send(uint8_t cmdByte, uint8_t dataByte) {
+    unsigned long start = micros();
     i2c_start();
     
     bool ack1 = i2c_write_byte(cmdByte);
@@ -113,6 +170,7 @@ static bool ch453_send(uint8_t cmdByte, uint8_t dataByte) {
     
     i2c_stop();
     
+    Profiler::recordBusOp(PROFILED_OP_CH453_SEND, (uint32_t)(micros() - start), ack1 && ack2);
     return ack1 && ack2;
 }
 
@@ -192,6 +250,11 @@ bool CH453SDriver::begin(uint8_t brightness) {
         delay(5);
     }
     
+    // Every digit register is now blank
+    memset(_frame, 0, sizeof(_frame));
+    memset(_shadow, 0, sizeof(_shadow));
+    _knownMask = 0xFFFF;
+    
     _displayOn = true;
     LOG_INFO("=== CH453 Init complete ===");
     
@@ -218,7 +281,7 @@ void CH453SDriver::scanI2CBus() {
 bool CH453SDriver::sendSystemCommand(uint8_t cmd) {
     bool hasMutex = false;
     if (_i2cMutex != NULL) {
-        if (xSemaphoreTake(_i2cMutex, pdMS_TO_TICKS(100)) == pdTRUE) {
+        if (profiledTake(_i2cMutex, pdMS_TO_TICKS(100), PROFILED_MUTEX_I2C) == pdTRUE) {
             hasMutex = true;
         } else {
             return false;
@@ -229,7 +292,7 @@ bool CH453SDriver::sendSystemCommand(uint8_t cmd) {
     bool result = ch453_send(0x48, cmd);
     
     if (hasMutex) {
-        xSemaphoreGive(_i2cMutex);
+        profiledGive(_i2cMutex, PROFILED_MUTEX_I2C);
     }
     
     return result;
@@ -243,7 +306,7 @@ bool CH453SDriver::writeDigitData(uint8_t digit, uint8_t segmentData) {
     
     bool hasMutex = false;
     if (_i2cMutex != NULL) {
-        if (xSemaphoreTake(_i2cMutex, pdMS_TO_TICKS(100)) == pdTRUE) {
+        if (profiledTake(_i2cMutex, pdMS_TO_TICKS(100), PROFILED_MUTEX_I2C) == pdTRUE) {
             hasMutex = true;
         } else {
             return false;
@@ -252,8 +315,18 @@ bool CH453SDriver::writeDigitData(uint8_t digit, uint8_t segmentData) {
     
     bool result = ch453_send(cmdByte, segmentData);
     
+    // Keep the framebuffer in step with direct writes
+    _frame[digit] = segmentData;
+    _shadow[digit] = segmentData;
+    if (result) {
+        _knownMask |= (1 << digit);
+    } else {
+        _knownMask &= ~(1 << digit);
+    }
+    _digitWrites++;
+    
     if (hasMutex) {
-        xSemaphoreGive(_i2cMutex);
+        profiledGive(_i2cMutex, PROFILED_MUTEX_I2C);
     }
     
     return result;
@@ -288,71 +361,99 @@ bool CH453SDriver::sendCH453Command(uint16_t cmd) {
 }
 
 uint8_t CH453SDriver::getSegmentPattern(char c) {
-    if (c >= '0' && c <= '9') {
-        return SEGMENTS[c - '0'];
+    return ((uint8_t)c < 128) ? CHAR_SEGMENTS[(uint8_t)c] : 0x00;
+}
+
+void CH453SDriver::stageDigit(uint8_t digit, uint8_t segments) {
+    if (digit >= DIGIT_REGISTERS) return;
+    _frame[digit] = segments;
+}
+
+bool CH453SDriver::flush() {
+    // Collect the digits that differ from what the chip holds
+    uint16_t dirty = 0;
+    for (uint8_t digit = 0; digit < DIGIT_REGISTERS; digit++) {
+        if (!(_knownMask & (1 << digit)) || _frame[digit] != _shadow[digit]) {
+            dirty |= (1 << digit);
+        }
+    }
+    if (dirty == 0) {
+        return true;
+    }
+    
+    // One mutex hold for the whole burst
+    bool hasMutex = false;
+    if (_i2cMutex != NULL) {
+        if (profiledTake(_i2cMutex, pdMS_TO_TICKS(100), PROFILED_MUTEX_I2C) == pdTRUE) {
+            hasMutex = true;
+        } else {
+            return false;  // Everything stays dirty for the next flush
+        }
     }
     
-    switch (c) {
-        case '-': return 0x40;  // G segment only
-        case '_': return 0x08;  // D segment only
-        case ' ': return 0x00;  // All off
-        case 'A': case 'a': return 0x77;
-        case 'b': return 0x7C;
-        case 'C': return 0x39;
-        case 'c': return 0x58;
-        case 'd': return 0x5E;
-        case 'E': case 'e': return 0x79;
-        case 'F': case 'f': return 0x71;
-        case 'H': return 0x76;
-        case 'h': return 0x74;
-        case 'I': case 'i': return 0x06;
-        case 'J': case 'j': return 0x1E;
-        case 'L': case 'l': return 0x38;
-        case 'n': return 0x54;
-        case 'o': return 0x5C;
-        case 'P': case 'p': return 0x73;
-        case 'r': return 0x50;
-        case 'S': case 's': return 0x6D;
-        case 't': return 0x78;
-        case 'U': return 0x3E;
-        case 'u': return 0x1C;
-        case 'Y': case 'y': return 0x6E;
-        default: return 0x00;
+    bool allWritten = true;
+    for (uint8_t digit = 0; digit < DIGIT_REGISTERS; digit++) {
+        if (!(dirty & (1 << digit))) continue;
+        
+        // Datasheet section 6.2: byte1 is 011[DIG_ADDR]0B => 0x60,0x62,...,0x7E
+        if (ch453_send(0x60 + (digit << 1), _frame[digit])) {
+            _shadow[digit] = _frame[digit];
+            _knownMask |= (1 << digit);
+        } else {
+            // NACK: we don't know what the chip latched, retry next flush
+            _knownMask &= ~(1 << digit);
+            allWritten = false;
+        }
+        _digitWrites++;
     }
+    
+    if (hasMutex) {
+        profiledGive(_i2cMutex, PROFILED_MUTEX_I2C);
+    }
+    
+    return allWritten;
+}
+
+void CH453SDriver::invalidate() {
+    _knownMask = 0;
 }
 
-void CH453SDriver::setDigit(uint8_t digit, uint8_t segments) {
-    if (digit > 15) return;
-    writeDigitData(digit, segments);
+bool CH453SDriver::setDigit(uint8_t digit, uint8_t segments) {
+    if (digit > 15) return false;
+    stageDigit(digit, segments);
+    return flush();
 }
 
-void CH453SDriver::setCharacter(uint8_t digit, char character, bool decimal) {
+bool CH453SDriver::setCharacter(uint8_t digit, char character, bool decimal) {
     uint8_t pattern = getSegmentPattern(character);
     if (decimal) {
         pattern |= 0x80;  // Set decimal point bit (DP = SEG7)
     }
-    setDigit(digit, pattern);
+    return setDigit(digit, pattern);
 }
 
-void CH453SDriver::clear() {
+bool CH453SDriver::clear() {
     for (uint8_t i = 0; i < 8; i++) {
-        setDigit(i, 0x00);
+        stageDigit(i, 0x00);
     }
+    return flush();
 }
 
-void CH453SDriver::clearTop() {
+bool CH453SDriver::clearTop() {
     for (uint8_t i = 0; i < 4; i++) {
-        setDigit(i, 0x00);
+        stageDigit(i, 0x00);
     }
+    return flush();
 }
 
-void CH453SDriver::clearBottom() {
+bool CH453SDriver::clearBottom() {
     for (uint8_t i = 4; i < 8; i++) {
-        setDigit(i, 0x00);
+        stageDigit(i, 0x00);
     }
+    return flush();
 }
 
-void CH453SDriver::displayTopNumber(uint16_t value, bool leadingZeros) {
+bool CH453SDriver::displayTopNumber(uint16_t value, bool leadingZeros) {
     // Display time in MM.SS format (Minutes:Seconds)
     // value is in seconds (e.g., 120 seconds = 02:00 = 2 minutes, 0 seconds)
     // 
@@ -360,15 +461,11 @@ void CH453SDriver::displayTopNumber(uint16_t value, bool leadingZeros) {
     
     if (value > 5999) value = 5999;  // Max 99:59 (99 minutes 59 seconds)
     
-    // Convert seconds to MM.SS
+    // Convert seconds to MM.SS (one division by a constant, then table lookups)
     uint8_t minutes = value / 60;
-    uint8_t seconds = value % 60;
-    
-    // Extract individual digits
-    uint8_t minuteTens = minutes / 10;      // Tens of minutes (0-9)
-    uint8_t minuteOnes = minutes % 10;      // Ones of minutes (0-9)
-    uint8_t secondTens = seconds / 10;      // Tens of seconds (0-5)
-    uint8_t secondOnes = seconds % 10;      // Ones of seconds (0-9)
+    uint8_t seconds = value - minutes * 60;
+    uint16_t minutePair = DIGIT_PAIRS[minutes];
+    uint16_t secondPair = DIGIT_PAIRS[seconds];
     
     // Physical digit order:
     // BOTTOM display: DIG4, DIG5, DIG6, DIG7 (left to right)
@@ -379,63 +476,65 @@ void CH453SDriver::displayTopNumber(uint16_t value, bool leadingZeros) {
     // - DIG5: minute ones + decimal point
     // - DIG6: second tens
     // - DIG7: second ones
-    if (!leadingZeros && minuteTens == 0) {
-        setDigit(4, 0x00);
+    if (!leadingZeros && minutes < 10) {
+        stageDigit(4, 0x00);
     } else {
-        setDigit(4, SEGMENTS[minuteTens]);
+        stageDigit(4, minutePair & 0xFF);
     }
-    setDigit(5, SEGMENTS[minuteOnes] | 0x80);
-    setDigit(6, SEGMENTS[secondTens]);
-    setDigit(7, SEGMENTS[secondOnes]);
+    stageDigit(5, (minutePair >> 8) | 0x80);
+    stageDigit(6, secondPair & 0xFF);
+    stageDigit(7, secondPair >> 8);
+    
+    // Usually only the seconds digit changed, so this is a single write
+    return flush();
 }
 
-void CH453SDriver::displayBottomDecimal(float value, uint8_t decimalPlaces) {
+bool CH453SDriver::displayBottomDecimal(float value, uint8_t decimalPlaces) {
+    // Float entry point kept for compatibility; rendering is fixed point
+    (void)decimalPlaces;  // Always TT.UU on a 4-digit module
+    if (value < 0) value = 0;
+    if (value > 99.99f) value = 99.99f;
+    return displayBottomFixed((uint16_t)(value * 100.0f + 0.5f));
+}
+
+bool CH453SDriver::displayBottomFixed(uint16_t hundredths) {
     // Display token count as decimal (e.g., 1.00 tokens)
     // Format: "TT.UU" (two digits, decimal point, two digits)
     // Examples:
-    // - 1.00 -> "01.00"
-    // - 0.99 -> "00.99"
+    // - 100 -> "01.00"
+    // - 99 -> "00.99"
     //
     // SWAPPED: Now displays on TOP display (digits 0-3) to show COINS on top
     
-    if (value < 0) value = 0;
     // Clamp to what fits in TT.UU (00.00 to 99.99)
-    if (value > 99.99f) value = 99.99f;
-
-    // Respect decimalPlaces if caller passes it, but default behavior is 2dp.
-    // (In practice we want 2dp for tokens on a 4-digit module.)
-    uint8_t dp = (decimalPlaces >= 2) ? 2 : 2;
-
-    // Scale to integer representation (e.g., 1.00 -> 100, 0.99 -> 99)
-    uint16_t scaledValue = (uint16_t)(value * 100.0f + 0.5f);
-    uint8_t intPart = (scaledValue / 100) % 100;     // 0-99
-    uint8_t fracPart = scaledValue % 100;            // 0-99
-
-    uint8_t tens = intPart / 10;
-    uint8_t ones = intPart % 10;
-    uint8_t tenths = fracPart / 10;
-    uint8_t hundredths = fracPart % 10;
-
+    if (hundredths > 9999) hundredths = 9999;
+    
+    uint8_t intPart = hundredths / 100;
+    uint16_t intPair = DIGIT_PAIRS[intPart];
+    uint16_t fracPair = DIGIT_PAIRS[hundredths - intPart * 100];
+    
     // Physical digit order: TOP display is DIG0, DIG1, DIG2, DIG3 (left to right)
     // We want: [tens][ones].[tenths][hundredths]
-    setDigit(0, SEGMENTS[tens]);
-    setDigit(1, SEGMENTS[ones] | 0x80);  // decimal point after ones
-    setDigit(2, SEGMENTS[tenths]);
-    setDigit(3, SEGMENTS[hundredths]);
+    stageDigit(0, intPair & 0xFF);
+    stageDigit(1, (intPair >> 8) | 0x80);  // decimal point after ones
+    stageDigit(2, fracPair & 0xFF);
+    stageDigit(3, fracPair >> 8);
+    return flush();
 }
 
-void CH453SDriver::displayDashes(bool top) {
+bool CH453SDriver::displayDashes(bool top) {
     uint8_t dashPattern = 0x40;  // G segment = dash
     
     if (top) {
         for (uint8_t i = 0; i < 4; i++) {
-            setDigit(i, dashPattern);
+            stageDigit(i, dashPattern);
         }
     } else {
         for (uint8_t i = 4; i < 8; i++) {
-            setDigit(i, dashPattern);
+            stageDigit(i, dashPattern);
         }
     }
+    return flush();
 }
 
 void CH453SDriver::setDisplayOn(bool on) {
@@ -445,22 +544,23 @@ void CH453SDriver::setDisplayOn(bool on) {
     _displayOn = on;
 }
 
-void CH453SDriver::testDigitOrder() {
+bool CH453SDriver::testDigitOrder() {
     // Test function to verify digit order
     // Displays "0123" on top and "4567" on bottom
     LOG_INFO("Testing digit order - Top: 0123, Bottom: 4567");
     
     // Top display
     // With current mapping, TOP left-to-right is DIG0..DIG3
-    setDigit(0, SEGMENTS[0]);  // leftmost
-    setDigit(1, SEGMENTS[1]);
-    setDigit(2, SEGMENTS[2]);
-    setDigit(3, SEGMENTS[3]);  // rightmost
+    stageDigit(0, SEGMENTS[0]);  // leftmost
+    stageDigit(1, SEGMENTS[1]);
+    stageDigit(2, SEGMENTS[2]);
+    stageDigit(3, SEGMENTS[3]);  // rightmost
     
     // Bottom display
     // BOTTOM left-to-right is DIG4..DIG7
-    setDigit(4, SEGMENTS[4]);  // leftmost
-    setDigit(5, SEGMENTS[5]);
-    setDigit(6, SEGMENTS[6]);
-    setDigit(7, SEGMENTS[7]);  // rightmost
+    stageDigit(4, SEGMENTS[4]);  // leftmost
+    stageDigit(5, SEGMENTS[5]);
+    stageDigit(6, SEGMENTS[6]);
+    stageDigit(7, SEGMENTS[7]);  // rightmost
+    return flush();
 }
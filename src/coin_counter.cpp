@@ -0,0 +1,119 @@
+#include "coin_counter.h"
+#include "constants.h"
+#include <esp_timer.h>
+
+CoinPulseCounter::CoinPulseCounter(int pin, pcnt_unit_t unit)
+    : _pin(pin), _unit(unit), _initialized(false), _lastCount(0), _edgeCount(0), _takenCount(0),
+      _wakeTask(NULL), _pulseStartUs(0), _inPulse(false), _acceptedCount(0), _rejectedCount(0),
+      _wakePending(false) {
+}
+
+bool CoinPulseCounter::begin() {
+    // Acceptor output is open-collector, idle HIGH
+    pinMode(_pin, INPUT_PULLUP);
+
+    pcnt_config_t config = {};
+    config.pulse_gpio_num = _pin;
+    config.ctrl_gpio_num = PCNT_PIN_NOT_USED;
+    config.lctrl_mode = PCNT_MODE_KEEP;
+    config.hctrl_mode = PCNT_MODE_KEEP;
+    config.pos_mode = PCNT_COUNT_DIS;    // Pulse end (LOW->HIGH) ignored
+    config.neg_mode = PCNT_COUNT_INC;    // Pulse start (HIGH->LOW) = one coin
+    config.counter_h_lim = COUNTER_LIMIT;
+    config.counter_l_lim = 0;
+    config.unit = _unit;
+    config.channel = PCNT_CHANNEL_0;
+
+    esp_err_t err = pcnt_unit_config(&config);
+    if (err != ESP_OK) {
+        LOG_ERROR("COIN PCNT: unit config failed on GPIO %d: %s", _pin, esp_err_to_name(err));
+        return false;
+    }
+
+    // The hardware filter cannot reach COIN_MIN_PULSE_WIDTH_MS; it only rejects
+    // sub-13us spikes. The edge count is diagnostics; onEdge() counts the coins
+    pcnt_set_filter_value(_unit, FILTER_MAX_APB_CYCLES);
+    pcnt_filter_enable(_unit);
+
+    pcnt_counter_pause(_unit);
+    pcnt_counter_clear(_unit);
+    pcnt_counter_resume(_unit);
+
+    _lastCount = 0;
+    _edgeCount = 0;
+    _takenCount = 0;
+    _inPulse = false;
+    _acceptedCount = 0;
+    _rejectedCount = 0;
+    _wakePending = false;
+    _initialized = true;
+
+    // PCNT carries no timestamps, so coins are timed and counted on a GPIO
+    // interrupt on the same pin
+    attachInterruptArg(digitalPinToInterrupt(_pin), onEdge, this, CHANGE);
+
+    LOG_INFO("COIN PCNT: timing coin pulses on GPIO %d (edges on unit %d, filter %u APB cycles, min pulse %lu ms)",
+             _pin, _unit, FILTER_MAX_APB_CYCLES, COIN_MIN_PULSE_WIDTH_MS);
+    return true;
+}
+
+uint32_t CoinPulseCounter::takeDelta() {
+    if (!_initialized) return 0;
+
+    // Single aligned 32-bit read; onEdge() only ever increments it
+    uint32_t accepted = _acceptedCount;
+    uint32_t delta = accepted - _takenCount;
+    _takenCount = accepted;
+    return delta;
+}
+
+uint32_t CoinPulseCounter::getEdgeCount() {
+    if (!_initialized) return 0;
+
+    int16_t count = 0;
+    if (pcnt_get_counter_value(_unit, &count) != ESP_OK) {
+        return _edgeCount;
+    }
+
+    // Counter resets to 0 when it reaches COUNTER_LIMIT
+    if (count >= _lastCount) {
+        _edgeCount += count - _lastCount;
+    } else {
+        _edgeCount += (COUNTER_LIMIT - _lastCount) + count;
+    }
+    _lastCount = count;
+    return _edgeCount;
+}
+
+bool CoinPulseCounter::takeWake() {
+    if (!_wakePending) return false;
+    _wakePending = false;
+    return true;
+}
+
+void IRAM_ATTR CoinPulseCounter::onEdge(void* arg) {
+    CoinPulseCounter* self = static_cast<CoinPulseCounter*>(arg);
+    // Only IRAM-safe calls here: digitalRead()/micros() may live in flash
+    uint32_t now = (uint32_t)esp_timer_get_time();
+
+    // Pulse start; a bounce on the leading edge restarts the measurement
+    if (gpio_get_level((gpio_num_t)self->_pin) == 0) {
+        self->_pulseStartUs = now;
+        self->_inPulse = true;
+        return;
+    }
+
+    if (!self->_inPulse) return;
+    self->_inPulse = false;
+    if (now - self->_pulseStartUs < COIN_MIN_PULSE_WIDTH_MS * 1000UL) {
+        self->_rejectedCount++;
+        return;
+    }
+    self->_acceptedCount++;
+
+    if (self->_wakeTask == NULL) return;
+    self->_wakePending = true;
+    BaseType_t higherPriorityTaskWoken = pdFALSE;
+    vTaskNotifyGiveFromISR(self->_wakeTask, &higherPriorityTaskWoken);
+    portYIELD_FROM_ISR(higherPriorityTaskWoken);
+}
@@ -1,35 +1,135 @@
 #include "constants.h"
+#include "wire_format.h"
+#include <atomic>
+#include <string.h>
+#include <freertos/FreeRTOS.h>
 
-// MQTT Topics - will be loaded dynamically from BLE config
-String MACHINE_ID = "99";  // Default value
+static const char* const TOPIC_SUFFIXES[TOPIC_COUNT] = {
+    "init", "config", "action", "state", "command", "get_state", "stats", "trace"
+};
 
-// Function definitions
-String buildTopicName(const String& machineId, const char* eventType, const String& environment) {
-    String prefix;
-    if (environment == "local") {
-        prefix = "local/";
-    } else {
-        prefix = "machines/";
+// One row per bay and MqttTopicId, each bay sharing its "<root>/<machine id>/"
+// prefix. updateMQTTTopics() runs on the BLE, MQTT and console paths while
+// every bay task reads topics, so it fills the inactive copy and publishes it
+// with one index store: readers never see a half-written table, and pointers
+// they already hold stay valid until the table is rebuilt a second time.
+struct TopicTable {
+    char topics[BAY_COUNT][TOPIC_COUNT][MQTT_TOPIC_MAX_LENGTH + 1];
+    uint8_t lengths[BAY_COUNT][TOPIC_COUNT];
+    uint8_t prefixLengths[BAY_COUNT];
+    char machineIds[BAY_COUNT][MQTT_TOPIC_MAX_LENGTH + 1];
+};
+static TopicTable topicTables[2];
+static std::atomic<uint8_t> activeTopicTable(0);
+static portMUX_TYPE topicTableLock = portMUX_INITIALIZER_UNLOCKED;  // Serializes rebuilds
+
+static const TopicTable& currentTopics() {
+    return topicTables[activeTopicTable.load(std::memory_order_acquire)];
+}
+
+// Plain copies only: this runs inside the rebuild spinlock
+static void fillTopicTable(TopicTable& table, const char* machineId, size_t idLength, const char* root) {
+    size_t rootLength = strlen(root);
+    for (uint8_t bay = 0; bay < BAY_COUNT; bay++) {
+        // Extra bays append "-<bay>" to the machine ID
+        char* id = table.machineIds[bay];
+        size_t bayIdLength = idLength;
+        memcpy(id, machineId, idLength);
+        if (bay > 0) {
+            id[bayIdLength++] = '-';
+            id[bayIdLength++] = (char)('0' + bay);
+        }
+        id[bayIdLength] = '\0';
+
+        size_t prefixLength = rootLength + bayIdLength + 1;
+        for (uint8_t topic = 0; topic < TOPIC_COUNT; topic++) {
+            char* out = table.topics[bay][topic];
+            size_t suffixLength = strlen(TOPIC_SUFFIXES[topic]);
+            memcpy(out, root, rootLength);
+            memcpy(out + rootLength, id, bayIdLength);
+            out[prefixLength - 1] = '/';
+            memcpy(out + prefixLength, TOPIC_SUFFIXES[topic], suffixLength + 1);
+            table.lengths[bay][topic] = (uint8_t)(prefixLength + suffixLength);
+        }
+        table.prefixLengths[bay] = (uint8_t)prefixLength;
+    }
+}
+
+static bool buildTopicTable(const String& machineId, const String& environment) {
+    const char* root = environment == "local" ? "local/" : "machines/";
+    size_t idLength = machineId.length() + (BAY_COUNT > 1 ? 2 : 0);
+    size_t prefixLength = strlen(root) + idLength + 1;
+    if (prefixLength + strlen("get_state") > MQTT_TOPIC_MAX_LENGTH) {
+        LOG_ERROR("Machine ID too long for MQTT topics (%u chars), keeping previous topics",
+                  (unsigned int)machineId.length());
+        return false;
     }
-    return prefix + machineId + "/" + eventType;
+    portENTER_CRITICAL(&topicTableLock);
+    uint8_t next = activeTopicTable.load(std::memory_order_relaxed) ^ 1;
+    fillTopicTable(topicTables[next], machineId.c_str(), machineId.length(), root);
+    activeTopicTable.store(next, std::memory_order_release);
+    portEXIT_CRITICAL(&topicTableLock);
+    return true;
+}
+
+// Default topics (factory machine ID), replaced once the stored ID is loaded
+static bool buildDefaultTopics() {
+    fillTopicTable(topicTables[0], "99", 2, "machines/");
+    return true;
 }
+static const bool defaultTopicsBuilt = buildDefaultTopics();
 
 void updateMQTTTopics(const String& machineId, const String& environment) {
-    MACHINE_ID = machineId;
-    INIT_TOPIC = buildTopicName(MACHINE_ID, "init", environment);
-    CONFIG_TOPIC = buildTopicName(MACHINE_ID, "config", environment);
-    ACTION_TOPIC = buildTopicName(MACHINE_ID, "action", environment);
-    STATE_TOPIC = buildTopicName(MACHINE_ID, "state", environment);
-    COMMAND_TOPIC = buildTopicName(MACHINE_ID, "command", environment);
-    GET_STATE_TOPIC = buildTopicName(MACHINE_ID, "get_state", environment);
+    buildTopicTable(machineId, environment);
     
-    LOG_INFO("MQTT topics updated for machine ID: %s, environment: %s", MACHINE_ID.c_str(), environment.c_str());
+    // Payload encoding is chosen per environment
+    loadWireFormat(environment);
+    
+    LOG_INFO("MQTT topics updated for machine ID: %s, environment: %s, bays: %d",
+             bayMachineId(0), environment.c_str(), BAY_COUNT);
+}
+
+const char* bayMachineId(uint8_t bay) {
+    return currentTopics().machineIds[bay < BAY_COUNT ? bay : 0];
 }
 
-// MQTT Topics - initialized with default, will be updated dynamically
-String INIT_TOPIC = buildTopicName(MACHINE_ID, "init", "prod");
-String CONFIG_TOPIC = buildTopicName(MACHINE_ID, "config", "prod");
-String ACTION_TOPIC = buildTopicName(MACHINE_ID, "action", "prod");
-String STATE_TOPIC = buildTopicName(MACHINE_ID, "state", "prod");
-String COMMAND_TOPIC = buildTopicName(MACHINE_ID, "command", "prod");
-String GET_STATE_TOPIC = buildTopicName(MACHINE_ID, "get_state", "prod");
\ No newline at end of file
+const char* mqttTopic(MqttTopicId id, uint8_t bay) {
+    return id < TOPIC_COUNT && bay < BAY_COUNT ? currentTopics().topics[bay][id] : "";
+}
+
+size_t mqttTopicLength(MqttTopicId id, uint8_t bay) {
+    return id < TOPIC_COUNT && bay < BAY_COUNT ? currentTopics().lengths[bay][id] : 0;
+}
+
+MqttTopicId classifyTopic(const char* topic, uint8_t* bay) {
+    if (topic == NULL) {
+        return TOPIC_UNKNOWN;
+    }
+    // One snapshot for the whole lookup, in case a rebuild publishes mid-way
+    const TopicTable& table = currentTopics();
+    // Prefixes end in '/', so "<id>/" never matches another bay's "<id>-<n>/"
+    uint8_t match = 0;
+    while (match < BAY_COUNT && strncmp(topic, table.topics[match][0], table.prefixLengths[match]) != 0) {
+        match++;
+    }
+    if (match == BAY_COUNT) {
+        return TOPIC_UNKNOWN;
+    }
+    if (bay != NULL) {
+        *bay = match;
+    }
+    const char* suffix = topic + table.prefixLengths[match];
+    size_t length = strlen(suffix);
+
+    // Suffix lengths are unique except state/stats/trace and config/action
+    MqttTopicId id;
+    switch (length) {
+        case 4: id = TOPIC_INIT; break;
+        case 5: id = suffix[0] == 't' ? TOPIC_TRACE : (suffix[4] == 'e' ? TOPIC_STATE : TOPIC_STATS); break;
+        case 6: id = suffix[0] == 'c' ? TOPIC_CONFIG : TOPIC_ACTION; break;
+        case 7: id = TOPIC_COMMAND; break;
+        case 9: id = TOPIC_GET_STATE; break;
+        default: return TOPIC_UNKNOWN;
+    }
+    return memcmp(suffix, TOPIC_SUFFIXES[id], length) == 0 ? id : TOPIC_UNKNOWN;
+}
@@ -0,0 +1,76 @@
+#include "deadline_scheduler.h"
+
+DeadlineScheduler::DeadlineScheduler() : _next(NO_TIMER) {
+    for (uint8_t i = 0; i < MAX_TIMERS; i++) {
+        _deadline[i] = 0;
+        _armed[i] = false;
+    }
+}
+
+void DeadlineScheduler::armAt(uint8_t id, unsigned long deadline) {
+    if (id >= MAX_TIMERS) return;
+
+    bool changed = !_armed[id] || _deadline[id] != deadline;
+    _deadline[id] = deadline;
+    _armed[id] = true;
+
+    if (!changed) return;
+
+    // Only a full rescan when the cached earliest timer moved later
+    if (_next == NO_TIMER || (long)(deadline - _deadline[_next]) < 0) {
+        _next = id;
+    } else if (_next == (int8_t)id) {
+        recomputeNext();
+    }
+}
+
+void DeadlineScheduler::cancel(uint8_t id) {
+    if (id >= MAX_TIMERS || !_armed[id]) return;
+
+    _armed[id] = false;
+    if (_next == (int8_t)id) {
+        recomputeNext();
+    }
+}
+
+void DeadlineScheduler::cancelAll() {
+    for (uint8_t i = 0; i < MAX_TIMERS; i++) {
+        _armed[i] = false;
+    }
+    _next = NO_TIMER;
+}
+
+bool DeadlineScheduler::isDue(unsigned long now) const {
+    return _next != NO_TIMER && reached(now, _deadline[_next]);
+}
+
+int8_t DeadlineScheduler::popExpired(unsigned long now) {
+    if (!isDue(now)) {
+        return NO_TIMER;
+    }
+
+    int8_t id = _next;
+    _armed[id] = false;
+    recomputeNext();
+    return id;
+}
+
+unsigned long DeadlineScheduler::msUntilNext(unsigned long now) const {
+    if (_next == NO_TIMER) {
+        return NEVER;
+    }
+    if (reached(now, _deadline[_next])) {
+        return 0;
+    }
+    return _deadline[_next] - now;
+}
+
+void DeadlineScheduler::recomputeNext() {
+    _next = NO_TIMER;
+    for (uint8_t i = 0; i < MAX_TIMERS; i++) {
+        if (!_armed[i]) continue;
+        if (_next == NO_TIMER || (long)(_deadline[i] - _deadline[_next]) < 0) {
+            _next = i;
+        }
+    }
+}
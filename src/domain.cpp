@@ -1,7 +1,7 @@
 #include "domain.h"
 
 // Function definitions
-String getMachineActionString(MachineAction action) {
+const char* getMachineActionString(MachineAction action) {
     switch (action) {
         case ACTION_SETUP: return "SETUP";
         case ACTION_START: return "START";
@@ -13,7 +13,7 @@ String getMachineActionString(MachineAction action) {
     }
 }
 
-String getMachineStateString(MachineState state) {
+const char* getMachineStateString(MachineState state) {
     switch (state) {
         case STATE_FREE: return "FREE";
         case STATE_IDLE: return "IDLE";
@@ -0,0 +1,49 @@
+#include "input_event_queue.h"
+
+InputEventQueue::InputEventQueue()
+    : _head(0), _tail(0), _consumer(NULL), _dropped(0) {
+}
+
+bool InputEventQueue::push(const InputEvent& event) {
+    uint32_t head = _head.load(std::memory_order_relaxed);
+    uint32_t tail = _tail.load(std::memory_order_acquire);
+
+    if (head - tail >= CAPACITY) {
+        _dropped++;
+        return false;
+    }
+
+    _events[head & (CAPACITY - 1)] = event;
+    // Publish the slot before the consumer can see the new head
+    _head.store(head + 1, std::memory_order_release);
+
+    if (_consumer != NULL) {
+        xTaskNotifyGive(_consumer);
+    }
+    return true;
+}
+
+bool InputEventQueue::pop(InputEvent& event) {
+    uint32_t tail = _tail.load(std::memory_order_relaxed);
+    uint32_t head = _head.load(std::memory_order_acquire);
+
+    if (tail == head) {
+        return false;
+    }
+
+    event = _events[tail & (CAPACITY - 1)];
+    _tail.store(tail + 1, std::memory_order_release);
+    return true;
+}
+
+bool InputEventQueue::wait(TickType_t timeout) {
+    if (size() > 0) {
+        return true;
+    }
+    ulTaskNotifyTake(pdTRUE, timeout);
+    return size() > 0;
+}
+
+uint32_t InputEventQueue::size() const {
+    return _head.load(std::memory_order_acquire) - _tail.load(std::memory_order_acquire);
+}
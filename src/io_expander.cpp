@@ -1,10 +1,17 @@
 #include "io_expander.h"
 #include "utilities.h"
+#include "profiler.h"
+#include "trace.h"
+#include <driver/gpio.h>
+#include <esp_sleep.h>
+#include <hal/gpio_ll.h>
 
 IoExpander::IoExpander(uint8_t address, int sdaPin, int sclPin, int intPin)
     : _address(address), _sdaPin(sdaPin), _sclPin(sclPin), _intPin(intPin), 
-      _initialized(false), _lastInterruptTime(0), _coinSignalDetected(false),
-      _buttonDetected(false), _detectedButtonId(255), _intCnt(0), _portVal(0) {
+      _initialized(false), _traceBay(0),
+      _captureTask(NULL), _lastEdgeTime(0), _lastEdgeMicros(0), _edgeCount(0), _lastCapturedPort(0xFF),
+      _outputShadow(0x00), _batchValue(0x00), _batchActive(false), _verifyRelayWrites(false),
+      _intCnt(0), _portVal(0xFF) {
     // Initialize button timing arrays
     for (int i = 0; i < 6; i++) {
         _lastButtonTime[i] = 0;
@@ -15,9 +22,11 @@ bool IoExpander::begin() {
     // Initialize I2C
     Wire.begin(_sdaPin, _sclPin);
     
-    // Set INT pin as input with pullup
-    pinMode(_intPin, INPUT_PULLUP);
-    LOG_DEBUG("INT pin configured");
+    // Set INT pin as input with pullup (extra bays may have no INT line)
+    if (hasInputInterrupt()) {
+        pinMode(_intPin, INPUT_PULLUP);
+        LOG_DEBUG("INT pin configured");
+    }
     
     // Check if device is responding
     Wire.beginTransmission(_address);
@@ -50,17 +59,27 @@ void IoExpander::writeRegister(uint8_t reg, uint8_t value) {
     
     if (error != 0) {
         LOG_ERROR("Error writing to register 0x%02X: Error code %d", reg, error);
+    } else if (reg == OUTPUT_PORT1) {
+        _outputShadow = value;
     }
 }
 
 uint8_t IoExpander::readRegister(uint8_t reg) {
-    if (!_initialized) return 0;
-    
-    // Add more debugging for INPUT_PORT0 reads
-    bool isInputPortRead = (reg == INPUT_PORT0);
-    // if (isInputPortRead) {
-    //     LOG_DEBUG("Reading INPUT_PORT0...");
-    // }
+    uint8_t value = 0;
+    readRegister(reg, value);
+    return value;
+}
+
+bool IoExpander::readRegister(uint8_t reg, uint8_t& value) {
+    unsigned long start = micros();
+    bool ok = transferRead(reg, value);
+    Profiler::recordBusOp(PROFILED_OP_IOX_READ, (uint32_t)(micros() - start), ok);
+    return ok;
+}
+
+bool IoExpander::transferRead(uint8_t reg, uint8_t& value) {
+    value = 0;
+    if (!_initialized) return false;
     
     Wire.beginTransmission(_address);
     Wire.write(reg);
@@ -68,26 +87,17 @@ uint8_t IoExpander::readRegister(uint8_t reg) {
     
     if (error != 0) {
         LOG_ERROR("Error setting register to read 0x%02X: Error code %d", reg, error);
-        return 0;
+        return false;
     }
     
-    uint8_t bytesReceived = Wire.requestFrom(_address, 1);
+    uint8_t bytesReceived = Wire.requestFrom(_address, (uint8_t)1);
     if (bytesReceived != 1) {
         LOG_ERROR("Error reading from register 0x%02X: Requested 1 byte, received %d", reg, bytesReceived);
-        return 0;
+        return false;
     }
     
-    uint8_t value = Wire.read();
-    
-    // if (isInputPortRead) {
-    //     LOG_DEBUG("Value: 0x%02X | Binary: %d%d%d%d%d%d%d%d", value,
-    //            (value & 0x80) ? 1 : 0, (value & 0x40) ? 1 : 0,
-    //            (value & 0x20) ? 1 : 0, (value & 0x10) ? 1 : 0,
-    //            (value & 0x08) ? 1 : 0, (value & 0x04) ? 1 : 0,
-    //            (value & 0x02) ? 1 : 0, (value & 0x01) ? 1 : 0);
-    // }
-    
-    return value;
+    value = Wire.read();
+    return true;
 }
 
 void IoExpander::setRelay(uint8_t relay, bool state) {
@@ -98,34 +108,85 @@ void IoExpander::setRelay(uint8_t relay, bool state) {
     
     LOG_DEBUG("Setting relay %d to %s", relay, state ? "ON" : "OFF");
     
-    uint8_t relayState = readRegister(OUTPUT_PORT1);
-    LOG_DEBUG("Relay port state before change: 0x%02X", relayState);
+    uint8_t relayState = _batchActive ? _batchValue : _outputShadow;
+    uint8_t newRelayState = state ? (relayState | (1 << relay)) : (relayState & ~(1 << relay));
+    Trace::record(TRACE_RELAY, Trace::withBay(_traceBay, relay), state ? 1 : 0, newRelayState);
+    
+    if (_batchActive) {
+        // Applied on commitRelayBatch()
+        _batchValue = newRelayState;
+        return;
+    }
+    
+    if (newRelayState == _outputShadow) {
+        LOG_DEBUG("Relay %d already %s, no write needed", relay, state ? "ON" : "OFF");
+        return;
+    }
     
-    uint8_t newRelayState;
-    if (state) {
-        // Turn ON relay
-        newRelayState = relayState | (1 << relay);
-        LOG_DEBUG("Setting bit %d (mask 0x%02X) to turn relay ON", relay, (1 << relay));
-    } else {
-        // Turn OFF relay
-        newRelayState = relayState & ~(1 << relay);
-        LOG_DEBUG("Clearing bit %d (mask 0x%02X) to turn relay OFF", relay, (1 << relay));
+    writeRelayPort(newRelayState);
+}
+
+void IoExpander::beginRelayBatch() {
+    if (_batchActive) {
+        LOG_WARNING("Relay batch already open - continuing it");
+        return;
+    }
+    _batchActive = true;
+    _batchValue = _outputShadow;
+}
+
+bool IoExpander::commitRelayBatch() {
+    if (!_batchActive) {
+        LOG_WARNING("commitRelayBatch() called without beginRelayBatch()");
+        return false;
+    }
+    _batchActive = false;
+    
+    if (_batchValue == _outputShadow) {
+        return true;
+    }
+    
+    return writeRelayPort(_batchValue);
+}
+
+bool IoExpander::writeRelayPort(uint8_t value) {
+    LOG_DEBUG("Writing relay port: 0x%02X -> 0x%02X", _outputShadow, value);
+    
+    // One write for the whole mask: every relay changes in the same bus transaction
+    uint8_t expected = value;
+    writeRegister(OUTPUT_PORT1, value);
+    
+    if (_outputShadow != expected) {
+        LOG_ERROR("Failed to write relay port 0x%02X (shadow still 0x%02X)", expected, _outputShadow);
+        return false;
     }
     
-    LOG_DEBUG("Writing new relay state: 0x%02X", newRelayState);
-    writeRegister(OUTPUT_PORT1, newRelayState);
+    if (_verifyRelayWrites) {
+        uint8_t verifyState;
+        if (!readRegister(OUTPUT_PORT1, verifyState) || verifyState != expected) {
+            LOG_ERROR("Relay port verify failed! Wrote 0x%02X, read back 0x%02X", expected, verifyState);
+            return false;
+        }
+    }
+    
+    return true;
+}
+
+bool IoExpander::verifyRelayShadow() {
+    if (!_initialized) return false;
     
-    // Verify the change
-    uint8_t verifyState = readRegister(OUTPUT_PORT1);
-    bool changeVerified = (state && (verifyState & (1 << relay))) || 
-                          (!state && !(verifyState & (1 << relay)));
+    uint8_t actual;
+    if (!readRegister(OUTPUT_PORT1, actual)) {
+        return false;
+    }
     
-    if (changeVerified) {
-        LOG_DEBUG("Relay %d successfully set to %s", relay, state ? "ON" : "OFF");
-    } else {
-        LOG_ERROR("Failed to set relay %d to %s! Current state: 0x%02X", 
-                 relay, state ? "ON" : "OFF", verifyState);
+    if (actual == _outputShadow) {
+        return true;
     }
+    
+    LOG_ERROR("Relay port mismatch! Shadow 0x%02X, device 0x%02X - rewriting", _outputShadow, actual);
+    writeRegister(OUTPUT_PORT1, _outputShadow);
+    return false;
 }
 
 bool IoExpander::readButton(uint8_t button) {
@@ -216,8 +277,7 @@ void IoExpander::configurePortAsOutput(uint8_t port, uint8_t mask) {
 bool IoExpander::toggleRelay(uint8_t relay) {
     if (!_initialized || relay > 7) return false;
     
-    uint8_t relayState = readRegister(OUTPUT_PORT1);
-    bool newState = !(relayState & (1 << relay));
+    bool newState = !(_outputShadow & (1 << relay));
     
     setRelay(relay, newState);
     return newState;
@@ -229,6 +289,8 @@ void IoExpander::printDebugInfo() {
         return;
     }
     
+#if LOG_COMPILE_LEVEL >= 4
+    // Everything below is LOG_DEBUG: skip the register reads when it is compiled out
     LOG_DEBUG("==== IO Expander Debug Info ====");
     
     // Read and print all button states
@@ -248,7 +310,10 @@ void IoExpander::printDebugInfo() {
             (relayState & 0x02) ? 1 : 0, (relayState & 0x01) ? 1 : 0);
     
     // Check INT pin state
-    LOG_DEBUG("INT Pin State: %s", digitalRead(_intPin) ? "HIGH" : "LOW");
+    if (hasInputInterrupt()) {
+        LOG_DEBUG("INT Pin State: %s", digitalRead(_intPin) ? "HIGH" : "LOW");
+    }
+#endif
 }
 
 void IoExpander::enableInterrupt(uint8_t port, uint8_t pinMask) {
@@ -273,123 +338,108 @@ void IoExpander::enableInterrupt(uint8_t port, uint8_t pinMask) {
     // This is crucial for interrupt detection to work properly
     uint8_t inputReg = (port == 0) ? INPUT_PORT0 : INPUT_PORT1;
     uint8_t initialValue = readRegister(inputReg);
+    if (port == 0) {
+        _lastCapturedPort = initialValue;
+    }
     
     LOG_DEBUG("Initial port %d value: 0x%02X", port, initialValue);
 }
 
-void IoExpander::setInterruptCallback(std::function<void(uint8_t)> callback) {
-    _interruptCallback = callback;
+void IRAM_ATTR IoExpander::onIntPinLow(void* arg) {
+    IoExpander* self = static_cast<IoExpander*>(arg);
+    // One-shot: INT stays LOW until PORT0 is read, captureInput() re-arms
+    gpio_ll_intr_disable(&GPIO, (gpio_num_t)self->_intPin);
+    self->_lastEdgeTime = millis();
+    self->_lastEdgeMicros = micros();
+    self->_edgeCount++;
+    
+    BaseType_t higherPriorityTaskWoken = pdFALSE;
+    if (self->_captureTask != NULL) {
+        vTaskNotifyGiveFromISR(self->_captureTask, &higherPriorityTaskWoken);
+    }
+    portYIELD_FROM_ISR(higherPriorityTaskWoken);
 }
 
-void IoExpander::handleInterrupt() {
-    if (!_initialized) return;
-    
-    unsigned long currentTime = millis();
-    
-    // Simple debounce - ignore interrupts that happen too quickly
-    if (currentTime - _lastInterruptTime < DEBOUNCE_INTERVAL) {
-        return;
+bool IoExpander::enableInputCapture(TaskHandle_t readerTask) {
+    if (!hasInputInterrupt()) {
+        LOG_INFO("IO expander 0x%02X has no INT line - input is polled", _address);
+        return false;
     }
-
-    // The TCA9535 interrupt is active LOW, so we check if the pin is LOW
-    if (digitalRead(_intPin) == LOW) {
-        _intCnt++;
-        // Read the input port to see what changed
-        LOG_DEBUG("IntPin:%d, cnt:%d", digitalRead(_intPin), _intCnt);
-        uint8_t portValue = readRegister(INPUT_PORT0);
-        
-        // LOG_DEBUG("Interrupt detected! Port 0 Value: 0x%02X", portValue);
-        
-        uint8_t coinSigBit = (portValue & (1 << COIN_SIG));
-        bool coinSigActive = (coinSigBit != 0);
-        
-        LOG_DEBUG("IO EXP: Interrupt handler - Port0=0x%02X, COIN_SIG bit=%d, active=%s", 
-                portValue, coinSigBit ? 1 : 0, coinSigActive ? "YES" : "NO");
-        
-        // If coin signal is active (3.3V), set the flag
-        if (coinSigActive) {
-            bool wasSet = _coinSignalDetected;
-            _coinSignalDetected = true;
-            if (!wasSet) {
-                LOG_INFO("IO EXP: Coin signal detected in interrupt handler! SIG=ACTIVE (3.3V), flag SET");
-            }
-        } else {
-            LOG_DEBUG("IO EXP: Coin signal not active in interrupt (bit=0, LOW)");
-        }
-        
-        // If we have a callback registered, call it with the port value
-        if (_interruptCallback) {
-            _interruptCallback(portValue);
-        }
-        
-        // Update last interrupt time
-        _lastInterruptTime = currentTime;
+    if (!_initialized || readerTask == NULL) {
+        LOG_ERROR("Cannot enable input capture: initialized=%d, task=%s",
+                 _initialized, readerTask ? "set" : "NULL");
+        return false;
     }
+    
+    _captureTask = readerTask;
+    
+    // TCA9535 INT is open-drain, active LOW, and released when the changed port is read.
+    // It is level-triggered rather than falling-edge so it can also wake the
+    // chip from light sleep: on the ESP32 a GPIO wake source shares the pin's
+    // interrupt type, and an edge that happens while asleep would be lost.
+    attachInterruptArg(digitalPinToInterrupt(_intPin), onIntPinLow, this, ONLOW);
+    gpio_wakeup_enable((gpio_num_t)_intPin, GPIO_INTR_LOW_LEVEL);
+    esp_sleep_enable_gpio_wakeup();
+    
+    LOG_INFO("Input capture enabled on INT pin %d (light-sleep wake source)", _intPin);
+    return true;
 }
 
-bool IoExpander::isCoinSignalDetected() {
-    return _coinSignalDetected;
+bool IoExpander::waitForInputEdge(TickType_t timeout) {
+    return ulTaskNotifyTake(pdTRUE, timeout) > 0;
 }
 
-void IoExpander::setCoinSignal(uint8_t sign) {
-    bool oldState = _coinSignalDetected;
-    if (sign) {
-        _coinSignalDetected = true;
-        if (!oldState) {
-            LOG_INFO("IO EXP: Coin signal flag SET (was %s, now SET)", oldState ? "SET" : "CLEAR");
-        }
-    } else {
-        _coinSignalDetected = false;
-        if (oldState) {
-            LOG_INFO("IO EXP: Coin signal flag CLEARED (was %s, now CLEAR)", oldState ? "SET" : "CLEAR");
-        }
+bool IoExpander::captureInput(InputCapture& capture, bool fromInterrupt) {
+    uint8_t portValue;
+    if (!readRegister(INPUT_PORT0, portValue)) {
+        return false;  // INT still asserted; leave the ISR disarmed until a read succeeds
     }
-}
-
-void IoExpander::clearCoinSignalFlag() {
-    bool oldState = _coinSignalDetected;
-    _coinSignalDetected = false;
-    if (oldState) {
-        LOG_INFO("IO EXP: Coin signal flag CLEARED (was SET, now CLEAR)");
+    
+    // The read released INT, so the level interrupt can be re-armed
+    if (_captureTask != NULL) {
+        gpio_intr_enable((gpio_num_t)_intPin);
     }
+    
+    capture.portValue = portValue;
+    capture.changedMask = portValue ^ _lastCapturedPort;
+    capture.timestamp = fromInterrupt ? _lastEdgeTime : millis();
+    capture.fromInterrupt = fromInterrupt;
+    
+    _lastCapturedPort = portValue;
+    _portVal = portValue;
+    return true;
 }
 
-// Button detection methods implementation
-bool IoExpander::isButtonDetected() {
-    return _buttonDetected;
-}
-
-uint8_t IoExpander::getDetectedButtonId() {
-    return _detectedButtonId;
+bool IoExpander::postCoinEvent(unsigned long timestamp) {
+    InputEvent event = { INPUT_EVENT_COIN, 0, timestamp };
+    if (!_events.push(event)) {
+        LOG_ERROR("IO EXP: Input event queue full - coin event dropped!");
+        return false;
+    }
+    return true;
 }
 
-void IoExpander::setButtonFlag(uint8_t buttonId, bool state) {
-    if (buttonId < 6) {
-        unsigned long currentTime = millis();
-        unsigned long timeSinceLastPress = currentTime - _lastButtonTime[buttonId];
-        // Simple debouncing - only set if enough time has passed
-        if (state && (timeSinceLastPress > DEBOUNCE_INTERVAL)) {
-            // CRITICAL FIX: Allow setting flag for the same button even if flag is already set
-            // This enables pause/resume functionality - same button can be pressed multiple times
-            // Also allow setting flag if no flag is currently set (for different buttons)
-            if (!_buttonDetected || _detectedButtonId == buttonId) {
-                _buttonDetected = true;
-                _detectedButtonId = buttonId;
-                _lastButtonTime[buttonId] = currentTime;
-                LOG_INFO("Button %d flag set (debounced, time since last: %lu ms)", 
-                        buttonId + 1, timeSinceLastPress);
-            } else {
-                LOG_DEBUG("Button %d flag already set (previous button %d), not overwriting", 
-                         buttonId + 1, _detectedButtonId + 1);
-            }
-        } else if (state) {
-            LOG_DEBUG("Button %d press ignored - too soon (debounce: %lu ms since last, need %lu ms)", 
-                     buttonId + 1, timeSinceLastPress, DEBOUNCE_INTERVAL);
-        }
+bool IoExpander::postButtonPress(uint8_t buttonId, unsigned long timestamp) {
+    if (buttonId >= 6) {
+        return false;
+    }
+    
+    unsigned long timeSinceLastPress = timestamp - _lastButtonTime[buttonId];
+    // Simple debouncing - only queue if enough time has passed
+    if (timeSinceLastPress <= DEBOUNCE_INTERVAL) {
+        LOG_DEBUG("Button %d press ignored - too soon (debounce: %lu ms since last, need %lu ms)", 
+                 buttonId + 1, timeSinceLastPress, DEBOUNCE_INTERVAL);
+        return false;
     }
+    _lastButtonTime[buttonId] = timestamp;
+    
+    InputEvent event = { INPUT_EVENT_BUTTON_PRESS, buttonId, timestamp };
+    if (!_events.push(event)) {
+        LOG_WARNING("Input event queue full - button %d press dropped", buttonId + 1);
+        return false;
+    }
+    
+    LOG_INFO("Button %d press queued (debounced, time since last: %lu ms)", 
+            buttonId + 1, timeSinceLastPress);
+    return true;
 }
-
-void IoExpander::clearButtonFlag() {
-    _buttonDetected = false;
-    _detectedButtonId = 255; // Invalid button ID
-}
\ No newline at end of file
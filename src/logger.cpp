@@ -1,10 +1,18 @@
 #include "../include/logger.h"
-#include <stdarg.h>
+#include <string.h>
+#include <new>
 
 LogLevel Logger::currentLevel = LOG_DEBUG;
 bool Logger::initialized = false;
 const char* Logger::levelNames[] = {"NONE", "ERROR", "WARNING", "INFO", "DEBUG"};
 
+Logger::Record* Logger::ring = NULL;
+uint32_t Logger::ringMask = 0;
+std::atomic<uint32_t> Logger::enqueuePos(0);
+uint32_t Logger::dequeuePos = 0;
+std::atomic<uint32_t> Logger::droppedCount(0);
+TaskHandle_t Logger::drainTask = NULL;
+
 void Logger::init(LogLevel level, unsigned long baudRate) {
     if (!initialized) {
         Serial.begin(baudRate);
@@ -15,95 +23,364 @@ void Logger::init(LogLevel level, unsigned long baudRate) {
 }
 
 void Logger::setLogLevel(LogLevel level) {
+    if ((int)level < LOG_NONE || (int)level > LOG_DEBUG) {
+        log(LOG_WARNING, "Ignoring invalid log level %d", (int)level);
+        return;
+    }
     currentLevel = level;
     log(LOG_INFO, "Log level changed to: %s", levelNames[level]);
+    if ((int)level > LOG_COMPILE_LEVEL) {
+        // LOG_COMPILE_LEVEL is a build flag and may be outside the enum
+        log(LOG_WARNING, "Messages above %s were compiled out (LOG_COMPILE_LEVEL=%d)",
+            LOG_COMPILE_LEVEL >= LOG_NONE && LOG_COMPILE_LEVEL <= LOG_DEBUG ?
+                levelNames[LOG_COMPILE_LEVEL] : "?", LOG_COMPILE_LEVEL);
+    }
 }
 
 LogLevel Logger::getLogLevel() {
     return currentLevel;
 }
 
-void Logger::getTimestamp(char* buffer, size_t bufferSize) {
+void Logger::getTimestamp(uint32_t ms, char* buffer, size_t bufferSize) {
     // Use uptime from millis()
-    unsigned long totalSeconds = millis() / 1000;
+    unsigned long totalSeconds = ms / 1000;
     unsigned long hours = totalSeconds / 3600;
     unsigned long minutes = (totalSeconds % 3600) / 60;
     unsigned long seconds = totalSeconds % 60;
-    
+
     snprintf(buffer, bufferSize, "+%02lu:%02lu:%02lu", hours, minutes, seconds);
 }
 
-void Logger::error(const char* format, ...) {
-    if (currentLevel >= LOG_ERROR) {
-        char timestamp[16];
-        getTimestamp(timestamp, sizeof(timestamp));
-        
-        va_list args;
-        va_start(args, format);
-        Serial.printf("[%s] [ERROR] ", timestamp);
-        char buffer[256];
-        vsnprintf(buffer, sizeof(buffer), format, args);
-        Serial.println(buffer);
-        va_end(args);
+bool Logger::startAsync(UBaseType_t priority, BaseType_t core) {
+    if (drainTask != NULL) {
+        return true;
+    }
+
+    // The ring is large, prefer PSRAM when the board has it
+    size_t bytes = sizeof(Record) * LOG_RING_CAPACITY;
+    void* memory = psramFound() ? ps_malloc(bytes) : malloc(bytes);
+    if (memory == NULL) {
+        LOG_ERROR("Logger: failed to allocate %u byte ring, staying synchronous", (unsigned int)bytes);
+        return false;
+    }
+
+    ring = static_cast<Record*>(memory);
+    ringMask = LOG_RING_CAPACITY - 1;
+    for (uint32_t i = 0; i < LOG_RING_CAPACITY; i++) {
+        new (&ring[i].sequence) std::atomic<uint32_t>(i);
+    }
+    enqueuePos.store(0, std::memory_order_relaxed);
+    dequeuePos = 0;
+
+    BaseType_t created = xTaskCreatePinnedToCore(
+        drainTaskMain,                // Task function
+        "LogDrain",                   // Task name
+        4096,                         // Stack size (bytes) - line buffer + snprintf
+        NULL,                         // Task parameters
+        priority,                     // Priority (1 = lowest - output only)
+        &drainTask,                   // Task handle
+        core                          // Core
+    );
+    if (created != pdPASS) {
+        drainTask = NULL;
+        ring = NULL;
+        free(memory);
+        LOG_ERROR("Logger: failed to create drain task, staying synchronous");
+        return false;
+    }
+
+    LOG_INFO("Logger: async mode enabled (%u records, %u bytes)",
+             (unsigned int)LOG_RING_CAPACITY, (unsigned int)bytes);
+    return true;
+}
+
+bool Logger::flush(TickType_t timeout) {
+    if (drainTask == NULL) {
+        return true;
+    }
+    TickType_t start = xTaskGetTickCount();
+    while (dequeuePos != enqueuePos.load(std::memory_order_acquire)) {
+        if ((xTaskGetTickCount() - start) >= timeout) {
+            return false;
+        }
+        xTaskNotifyGive(drainTask);
+        vTaskDelay(pdMS_TO_TICKS(5));
+    }
+    return true;
+}
+
+void Logger::emit(LogLevel level, const char* format, const LogArg* args, uint8_t argc) {
+    uint32_t timestamp = millis();
+
+    if (drainTask != NULL) {
+        if (!enqueue(level, timestamp, format, args, argc)) {
+            droppedCount.fetch_add(1, std::memory_order_relaxed);
+        }
+        return;
+    }
+
+    writeLine(level, timestamp, format, args, argc);
+}
+
+bool Logger::enqueue(LogLevel level, uint32_t timestamp, const char* format, const LogArg* args, uint8_t argc) {
+    // Claim a slot (bounded MPMC sequence ring, any task may log)
+    Record* record;
+    uint32_t pos = enqueuePos.load(std::memory_order_relaxed);
+    for (;;) {
+        record = &ring[pos & ringMask];
+        uint32_t seq = record->sequence.load(std::memory_order_acquire);
+        int32_t diff = (int32_t)(seq - pos);
+        if (diff == 0) {
+            if (enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            return false;  // Ring full - never wait for the UART
+        } else {
+            pos = enqueuePos.load(std::memory_order_relaxed);
+        }
+    }
+
+    record->timestamp = timestamp;
+    record->format = format;
+    record->level = (uint8_t)level;
+
+    if (argc > LOG_MAX_ARGS) {
+        // Too many arguments to capture: format now into the string pool
+        formatArgs(record->strings, sizeof(record->strings), format, args, argc);
+        record->format = "%s";
+        record->args[0] = LogArg(static_cast<const char*>(record->strings));
+        record->argc = 1;
+    } else {
+        // Copy the raw arguments; %s text is copied because callers pass
+        // String::c_str() temporaries that are gone by the time we drain
+        size_t used = 0;
+        for (uint8_t i = 0; i < argc; i++) {
+            record->args[i] = args[i];
+            if (args[i].kind == LogArg::STRING && args[i].s != NULL) {
+                char* dest = record->strings + used;
+                size_t room = sizeof(record->strings) - used;
+                if (room > 1) {
+                    size_t len = strnlen(args[i].s, room - 1);
+                    memcpy(dest, args[i].s, len);
+                    dest[len] = '\0';
+                    used += len + 1;
+                } else {
+                    dest = record->strings + sizeof(record->strings) - 1;
+                    *dest = '\0';
+                }
+                record->args[i].s = dest;
+            }
+        }
+        record->argc = argc;
     }
+
+    record->sequence.store(pos + 1, std::memory_order_release);
+    xTaskNotifyGive(drainTask);
+    return true;
 }
 
-void Logger::warning(const char* format, ...) {
-    if (currentLevel >= LOG_WARNING) {
-        char timestamp[16];
-        getTimestamp(timestamp, sizeof(timestamp));
-        
-        va_list args;
-        va_start(args, format);
-        Serial.printf("[%s] [WARNING] ", timestamp);
-        char buffer[256];
-        vsnprintf(buffer, sizeof(buffer), format, args);
-        Serial.println(buffer);
-        va_end(args);
+bool Logger::drainOne() {
+    Record* record = &ring[dequeuePos & ringMask];
+    if (record->sequence.load(std::memory_order_acquire) != dequeuePos + 1) {
+        return false;
     }
+
+    writeLine((LogLevel)record->level, record->timestamp, record->format, record->args, record->argc);
+
+    record->sequence.store(dequeuePos + ringMask + 1, std::memory_order_release);
+    dequeuePos++;
+    return true;
 }
 
-void Logger::info(const char* format, ...) {
-    if (currentLevel >= LOG_INFO) {
-        char timestamp[16];
-        getTimestamp(timestamp, sizeof(timestamp));
-        
-        va_list args;
-        va_start(args, format);
-        Serial.printf("[%s] [INFO] ", timestamp);
-        char buffer[256];
-        vsnprintf(buffer, sizeof(buffer), format, args);
-        Serial.println(buffer);
-        va_end(args);
+/**
+ * FreeRTOS Task: Log Drain
+ * Formats queued log records and writes them to the UART
+ * Priority: 1 (lowest - output only)
+ */
+void Logger::drainTaskMain(void* parameter) {
+    (void)parameter;
+    uint32_t reportedDrops = 0;
+
+    for (;;) {
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(1000));
+
+        while (drainOne()) {
+        }
+
+        uint32_t dropped = droppedCount.load(std::memory_order_relaxed);
+        if (dropped != reportedDrops) {
+            char timestamp[16];
+            getTimestamp(millis(), timestamp, sizeof(timestamp));
+            Serial.printf("[%s] [WARNING] Logger ring full, %lu messages dropped (total: %lu)\r\n",
+                          timestamp, (unsigned long)(dropped - reportedDrops), (unsigned long)dropped);
+            reportedDrops = dropped;
+        }
     }
 }
 
-void Logger::debug(const char* format, ...) {
-    if (currentLevel >= LOG_DEBUG) {
-        char timestamp[16];
-        getTimestamp(timestamp, sizeof(timestamp));
-        
-        va_list args;
-        va_start(args, format);
-        Serial.printf("[%s] [DEBUG] ", timestamp);
-        char buffer[256];
-        vsnprintf(buffer, sizeof(buffer), format, args);
-        Serial.println(buffer);
-        va_end(args);
+void Logger::writeLine(LogLevel level, uint32_t timestamp, const char* format, const LogArg* args, uint8_t argc) {
+    char line[LOG_LINE_LENGTH];
+    char stamp[16];
+    getTimestamp(timestamp, stamp, sizeof(stamp));
+
+    int header = snprintf(line, sizeof(line), "[%s] [%s] ", stamp, levelNames[level]);
+    if (header < 0 || header >= (int)sizeof(line)) {
+        header = 0;
     }
+    formatArgs(line + header, sizeof(line) - header, format, args, argc);
+    Serial.println(line);
 }
 
-void Logger::log(LogLevel level, const char* format, ...) {
-    if (currentLevel >= level && level > LOG_NONE) {
-        char timestamp[16];
-        getTimestamp(timestamp, sizeof(timestamp));
-        
-        va_list args;
-        va_start(args, format);
-        Serial.printf("[%s] [%s] ", timestamp, levelNames[level]);
-        char buffer[256];
-        vsnprintf(buffer, sizeof(buffer), format, args);
-        Serial.println(buffer);
-        va_end(args);
-    }
-}
\ No newline at end of file
+size_t Logger::formatArgs(char* out, size_t size, const char* format, const LogArg* args, uint8_t argc) {
+    if (size == 0) {
+        return 0;
+    }
+
+    size_t pos = 0;
+    uint8_t next = 0;
+    const char* p = format;
+
+    while (*p != '\0' && pos + 1 < size) {
+        if (*p != '%') {
+            out[pos++] = *p++;
+            continue;
+        }
+        if (p[1] == '%') {
+            out[pos++] = '%';
+            p += 2;
+            continue;
+        }
+
+        // Parse one conversion: %[flags][width][.precision][length]type,
+        // expanding a '*' width or precision from the next int argument
+        const char* start = p++;
+        char spec[24];
+        size_t specLen = 0;
+        bool usable = true;
+        spec[specLen++] = '%';
+        while (*p != '\0' && strchr("-+ #0", *p) != NULL) {
+            if (specLen < sizeof(spec) - 1) spec[specLen++] = *p;
+            else usable = false;
+            p++;
+        }
+        for (int field = 0; field < 2; field++) {
+            if (field == 1) {
+                if (*p != '.') break;
+                p++;
+            }
+            if (*p == '*') {
+                p++;
+                if (next >= argc) {
+                    usable = false;
+                    continue;
+                }
+                long long star = args[next].kind == LogArg::UNSIGNED ? (long long)args[next].u : args[next].i;
+                next++;
+                if (field == 1 && star < 0) {
+                    continue;  // Negative precision means none
+                }
+                int n = snprintf(spec + specLen, sizeof(spec) - specLen, field == 1 ? ".%d" : "%d", (int)star);
+                if (n < 0 || (size_t)n >= sizeof(spec) - specLen) usable = false;
+                else specLen += (size_t)n;
+                continue;
+            }
+            if (field == 1) {
+                if (specLen < sizeof(spec) - 1) spec[specLen++] = '.';
+                else usable = false;
+            }
+            while (*p >= '0' && *p <= '9') {
+                if (specLen < sizeof(spec) - 1) spec[specLen++] = *p;
+                else usable = false;
+                p++;
+            }
+        }
+        int longs = 0;
+        bool sized = false;
+        while (*p == 'h' || *p == 'l' || *p == 'z' || *p == 'j' || *p == 't' || *p == 'L') {
+            if (*p == 'l') longs++;
+            if (*p == 'z' || *p == 't') sized = true;
+            if (*p == 'j') longs = 2;
+            if (specLen < sizeof(spec) - 1) spec[specLen++] = *p;
+            else usable = false;
+            p++;
+        }
+        char type = *p;
+        if (type == '\0') {
+            break;
+        }
+        p++;
+        if (specLen < sizeof(spec) - 1) spec[specLen++] = type;
+        else usable = false;
+
+        if (!usable || next >= argc) {
+            // Unsupported spec or missing argument: copy it verbatim
+            size_t rawLen = (size_t)(p - start);
+            size_t n = rawLen < size - 1 - pos ? rawLen : size - 1 - pos;
+            memcpy(out + pos, start, n);
+            pos += n;
+            continue;
+        }
+        spec[specLen] = '\0';
+
+        const LogArg& arg = args[next++];
+        long long sv = arg.kind == LogArg::FLOAT ? (long long)arg.d : arg.i;
+        unsigned long long uv = arg.kind == LogArg::FLOAT ? (unsigned long long)arg.d : arg.u;
+        char* dest = out + pos;
+        size_t room = size - pos;
+        int n = 0;
+
+        switch (type) {
+            case 'd':
+            case 'i':
+                if (longs >= 2) n = snprintf(dest, room, spec, sv);
+                else if (longs == 1) n = snprintf(dest, room, spec, (long)sv);
+                else n = snprintf(dest, room, spec, (int)sv);
+                break;
+            case 'u':
+            case 'x':
+            case 'X':
+            case 'o':
+                if (longs >= 2) n = snprintf(dest, room, spec, uv);
+                else if (longs == 1) n = snprintf(dest, room, spec, (unsigned long)uv);
+                else if (sized) n = snprintf(dest, room, spec, (size_t)uv);
+                else n = snprintf(dest, room, spec, (unsigned int)uv);
+                break;
+            case 'c':
+                n = snprintf(dest, room, spec, (int)sv);
+                break;
+            case 'f':
+            case 'F':
+            case 'e':
+            case 'E':
+            case 'g':
+            case 'G':
+            case 'a':
+            case 'A':
+                n = snprintf(dest, room, spec,
+                             arg.kind == LogArg::FLOAT ? arg.d :
+                             arg.kind == LogArg::SIGNED ? (double)arg.i : (double)arg.u);
+                break;
+            case 's':
+                if (arg.kind == LogArg::STRING || arg.kind == LogArg::POINTER) {
+                    n = snprintf(dest, room, spec, arg.s != NULL ? arg.s : "(null)");
+                } else {
+                    n = snprintf(dest, room, "%s", "(?)");
+                }
+                break;
+            case 'p':
+                n = snprintf(dest, room, spec, arg.p);
+                break;
+            default:
+                n = snprintf(dest, room, "%s", "(?)");
+                break;
+        }
+
+        if (n > 0) {
+            pos += (size_t)n < room ? (size_t)n : room - 1;
+        }
+    }
+
+    out[pos] = '\0';
+    return pos;
+}
@@ -3,7 +3,12 @@
 #include <Preferences.h>
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
+#include <freertos/event_groups.h>
 #include "mqtt_lte_client.h"
+#include "mqtt_message_pool.h"
+#include "mqtt_outbox.h"
+#include "mqtt_inbound.h"
+#include "wire_format.h"
 #include "io_expander.h"
 #include "utilities.h"
 #include "constants.h"
@@ -12,11 +17,19 @@
 #include "display_manager.h"
 #include "ble_config_manager.h"
 #include "ble_machine_loader.h"
+#include "profiler.h"
+#include "power_manager.h"
+#include "trace.h"
+#ifdef COIN_PCNT_PIN
+#include "coin_counter.h"
+#endif
 
-// LTE/MQTT functionality commented out - using BLE only
-// #include "certs/AmazonRootCA.h"
-// #include "certs/AWSClientCertificate.h"
-// #include "certs/AWSClientPrivateKey.h"
+// LTE/MQTT is only built with ENABLE_MQTT (see constants.h); otherwise BLE only
+#if ENABLE_MQTT
+#include "certs/AmazonRootCA.h"
+#include "certs/AWSClientCertificate.h"
+#include "certs/AWSClientPrivateKey.h"
+#endif
 
 // Wire1 is already defined in the ESP32 Arduino framework
 
@@ -32,16 +45,40 @@ const char gprsUser[] = "";
 const char gprsPass[] = "";
 const char pin[] = "0281";
 
-// Create MQTT LTE client
+// Create MQTT LTE client (one modem and TLS session for every bay)
 MqttLteClient mqttClient(SerialAT, MODEM_PWRKEY, MODEM_DTR, MODEM_FLIGHT, MODEM_TX, MODEM_RX);
 
-// Create IO Expander
+// Create IO Expander (bay 0; extra bays allocate theirs in setup())
 IoExpander ioExpander(TCA9535_ADDR, I2C_SDA_PIN, I2C_SCL_PIN, INT_PIN);
 
+#ifdef COIN_PCNT_PIN
+// Hardware coin pulse counter on a direct GPIO
+CoinPulseCounter coinCounter(COIN_PCNT_PIN);
+#endif
 
-// Create controller
+
+// Create controller (bay 0's: BLE loader, LED and display)
 CarWashController* controller;
 
+// One IO expander / controller pair per bay (BAY_COUNT, see constants.h).
+// The controllers share mqttClient, the message pool and xMqttPublishQueue;
+// each message carries its bay, so the publisher resolves that bay's topics.
+struct Bay {
+  uint8_t id;
+  IoExpander* io;
+  CarWashController* controller;
+  TaskHandle_t inputReaderHandle;
+  TaskHandle_t controllerHandle;  // NULL for bay 0 (runs in loop())
+  
+  // Coin/button capture state, owned by the bay's InputReader task
+  uint8_t coinLowReads;           // Consecutive LOW samples
+  bool coinTriggered;             // Latch armed: suppress detection until idle HIGH
+  unsigned long lastCoinTransition;
+  bool coinDetectorStarted;
+  uint8_t lastPortValue;          // All buttons released initially (active LOW)
+};
+Bay bays[BAY_COUNT];
+
 // Create display manager
 DisplayManager* display;
 
@@ -51,202 +88,259 @@ BLEConfigManager* bleConfigManager;
 // Create BLE machine loader
 BLEMachineLoader* bleMachineLoader;
 
-// FreeRTOS task handles
-TaskHandle_t TaskCoinDetectorHandle = NULL;
-TaskHandle_t TaskButtonDetectorHandle = NULL;
+// FreeRTOS task handles (InputReader and bay controller handles live in bays[])
 TaskHandle_t TaskNetworkManagerHandle = NULL;
 TaskHandle_t TaskWatchdogHandle = NULL;
 TaskHandle_t TaskDisplayUpdateHandle = NULL;
 TaskHandle_t TaskMqttPublisherHandle = NULL;
 
 // FreeRTOS mutexes for shared resources
-SemaphoreHandle_t xIoExpanderMutex = NULL;
+SemaphoreHandle_t xIoExpanderMutex = NULL;  // Wire bus, shared by every bay's IO expander
 SemaphoreHandle_t xControllerMutex = NULL;
 SemaphoreHandle_t xI2CMutex = NULL;  // For Wire1 (LCD)
 
 // FreeRTOS queue for MQTT message publishing
 QueueHandle_t xMqttPublishQueue = NULL;
 
+// One-slot mailbox: latest DisplaySnapshot from bay 0's controller (the
+// CH453 has a fixed bus address, so only bay 0 has a display)
+QueueHandle_t xDisplayMailbox = NULL;
+
+// Boot init graph: each step sets its bit once it has finished (even if the
+// peripheral failed, which is logged) so dependents wait on readiness
+// instead of sleeping for a fixed time and never hang on a missing device.
+//
+//   loop task (core 1): IO expanders -> InputReaders -> controllers (+ bay tasks)
+//   InitWire1 (core 0): Wire1 -> CH453 display
+//   InitBle   (core 0): waits for controller -> BLE machine loader
+EventGroupHandle_t xBootEvents = NULL;
+#define BOOT_IO_READY            (1 << 0)  // Every bay's TCA9535 configured, coin/button capture running
+#define BOOT_CONTROLLER_READY    (1 << 1)  // controller (and every bays[].controller) != NULL
+#define BOOT_DISPLAY_READY       (1 << 2)  // Wire1 up, display != NULL
+#define BOOT_BLE_READY           (1 << 3)  // bleMachineLoader set (if BLE came up)
+#define BOOT_RESET_WINDOW_CLOSED (1 << 4)  // Double-reset flag cleared, LED released
+#define BOOT_ALL_READY (BOOT_IO_READY | BOOT_CONTROLLER_READY | BOOT_DISPLAY_READY | \
+                        BOOT_BLE_READY | BOOT_RESET_WINDOW_CLOSED)
+
+// Trace timestamp of a capture: the INT edge, or now for poll samples
+static uint32_t captureMicros(const Bay& bay, const InputCapture& capture) {
+  return (uint32_t)(capture.fromInterrupt ? bay.io->getLastEdgeMicros() : micros());
+}
+
+// Fallback poll interval; a bay without an INT line is always polled fast
+static TickType_t inputPollTicks(const Bay& bay) {
+  return bay.io->hasInputInterrupt() ? PowerManager::inputPollTicks() : pdMS_TO_TICKS(INPUT_POLL_NO_INT_MS);
+}
+
 /**
- * FreeRTOS Task: Coin Detector (Improved Version with Mutex Protection)
+ * Coin consumer for the input capture reader
  *
- * This task monitors the coin acceptor signal pin (COIN_SIG) for state changes.
- * Uses mutex-protected polling with consecutive-LOW validation to catch short pulses.
+ * Validates the COIN_SIG bit of each captured PORT0 sample (every bay except
+ * bay 0 in PCNT builds, where bay 0's coins are counted in hardware).
  *
  * Detection Logic:
- * - Polls PORT0 register every COIN_POLL_INTERVAL_MS with mutex protection
- * - Requires COIN_STABLE_READS_REQUIRED consecutive LOW reads (coin present)
- * - Sets coin signal flag for controller to process
+ * - Requires COIN_STABLE_READS_REQUIRED consecutive LOW samples (coin present)
+ * - Queues a coin event for the controller to process
  * - Uses a triggered latch so one pulse cannot generate multiple detections
+ * - Ignores the line until COIN_STARTUP_DELAY after boot, then arms the latch
+ *   if the line is LOW (acceptor not powered up yet, line floating)
  *
- * Fixes for missed coin detection:
- * - Fast 5ms polling catches 30-50ms acceptor pulses reliably
- * - Consecutive-LOW counter does not reset on brief HIGH bounces mid-pulse
- * - Removed INT_PIN dependency (was triggering on button presses too)
- * - Added mutex protection for thread-safe IO expander access
+ * Returns true while a LOW pulse is still being validated, so the reader
+ * confirms it with COIN_POLL_INTERVAL_MS follow-up samples.
  */
-void TaskCoinDetector(void *pvParameters) {
-  const TickType_t xDelay = COIN_POLL_INTERVAL_MS / portTICK_PERIOD_MS;
+static bool processCoinCapture(Bay& bay, const InputCapture& capture) {
+  // LOW = coin present (active), HIGH = no coin
+  bool coinLow = ((capture.portValue & (1 << COIN_SIG)) == 0);
 
-  uint8_t lowReads = 0;                     // Consecutive LOW reads
-  bool triggered = true;                    // Latch armed: suppress detection
-                                            // until we observe an idle HIGH first.
-                                            // This prevents a false "coin" at boot
-                                            // when the acceptor hasn't powered up
-                                            // and the line floats LOW.
-  unsigned long lastTransition = 0;         // For cooldown validation
-  unsigned long startTime = millis();       // Track startup for delay
-  bool started = false;
+  // Skip coin detection during startup period to prevent false triggers
+  if (!bay.coinDetectorStarted) {
+    if (capture.timestamp < COIN_STARTUP_DELAY) {  // millis() since power-on
+      return false;
+    }
+    bay.coinDetectorStarted = true;
 
-  // Wait for IO expander to be initialized
-  vTaskDelay(1000 / portTICK_PERIOD_MS);
+    // If LOW, keep the latch armed so we ignore the level until the
+    // acceptor pulls the line HIGH (idle). If already HIGH, clear the
+    // latch so the first real pulse counts.
+    bay.coinTriggered = coinLow;
+    LOG_INFO("Bay %d coin detector active (initial COIN_SIG=%s, latch=%s)", bay.id,
+             coinLow ? "LOW" : "HIGH",
+             bay.coinTriggered ? "ARMED (waiting for idle HIGH)" : "READY");
+    return false;
+  }
 
-  LOG_INFO("Coin detector task started");
+  if (!coinLow) {
+    bay.coinLowReads = 0;
+    bay.coinTriggered = false;
+    return false;
+  }
 
-  for(;;) {
-    unsigned long now = millis();
-
-    // Skip coin detection during startup period to prevent false triggers
-    if (!started) {
-      if (now - startTime >= COIN_STARTUP_DELAY) {
-        started = true;
-
-        // Sample initial line state. If LOW, keep `triggered` armed so we
-        // ignore the level until the acceptor pulls the line HIGH (idle).
-        // If already HIGH, clear the latch so the first real pulse counts.
-        if (xSemaphoreTake(xIoExpanderMutex, pdMS_TO_TICKS(50)) == pdTRUE) {
-          uint8_t pv = ioExpander.readRegister(INPUT_PORT0);
-          xSemaphoreGive(xIoExpanderMutex);
-          bool initialLow = ((pv & (1 << COIN_SIG)) == 0);
-          triggered = initialLow;
-          LOG_INFO("Coin detector active (initial COIN_SIG=%s, latch=%s)",
-                   initialLow ? "LOW" : "HIGH",
-                   triggered ? "ARMED (waiting for idle HIGH)" : "READY");
-        } else {
-          LOG_INFO("Coin detector active (initial read failed, latch ARMED)");
-        }
-      }
-      vTaskDelay(xDelay);
-      continue;
-    }
+  bay.coinLowReads++;
 
-    // Read port value with mutex protection (short timeout for fast retry)
-    uint8_t portVal = 0;
-    if (xSemaphoreTake(xIoExpanderMutex, pdMS_TO_TICKS(10)) == pdTRUE) {
-      portVal = ioExpander.readRegister(INPUT_PORT0);
-      xSemaphoreGive(xIoExpanderMutex);
-    } else {
-      vTaskDelay(xDelay);
-      continue;
+  if (bay.coinLowReads >= COIN_STABLE_READS_REQUIRED && !bay.coinTriggered) {
+    unsigned long elapsed = capture.timestamp - bay.lastCoinTransition;
+
+    if (bay.lastCoinTransition == 0 || elapsed > COIN_COOLDOWN_MS) {
+      bay.io->postCoinEvent(capture.timestamp);
+      bay.io->_intCnt++;
+      Trace::recordAt(captureMicros(bay, capture), TRACE_COIN, bay.id, 0, (uint32_t)bay.io->_intCnt);
+      bay.lastCoinTransition = capture.timestamp;
+      bay.coinTriggered = true;
+      LOG_INFO("COIN DETECTED #%d (bay %d)", bay.io->_intCnt, bay.id);
     }
+  }
 
-    // LOW = coin present (active), HIGH = no coin
-    bool coinLow = ((portVal & (1 << COIN_SIG)) == 0);
+  return !bay.coinTriggered;
+}
 
-    if (coinLow) {
-      lowReads++;
+/**
+ * Button consumer for the input capture reader
+ *
+ * Detects button press events (HIGH->LOW transition, buttons are active LOW)
+ * in each captured PORT0 sample and queues debounced button press events
+ * for the controller to process.
+ */
+static void processButtonCapture(Bay& bay, const InputCapture& capture) {
+  uint8_t lastPortValue = bay.lastPortValue;
 
-      if (lowReads >= COIN_STABLE_READS_REQUIRED && !triggered) {
-        unsigned long elapsed = now - lastTransition;
+  if (capture.portValue == lastPortValue) {
+    return;
+  }
 
-        if (lastTransition == 0 || elapsed > COIN_COOLDOWN_MS) {
-          ioExpander.setCoinSignal(1);
-          ioExpander._intCnt++;
-          lastTransition = now;
-          triggered = true;
-          LOG_INFO("COIN DETECTED #%d", ioExpander._intCnt);
-        }
-      }
+  // Check each button for press events (transition from HIGH to LOW)
+  for (int i = 0; i < NUM_BUTTONS; i++) {
+    int buttonPin;
+    if (i < NUM_BUTTONS - 1) {
+      buttonPin = BUTTON_INDICES[i]; // Function buttons 1-5
     } else {
-      lowReads = 0;
-      triggered = false;
+      buttonPin = STOP_BUTTON_PIN;   // Stop button (BUTTON6)
     }
 
-    vTaskDelay(xDelay);
+    bool currentButtonPressed = !(capture.portValue & (1 << buttonPin));
+    bool lastButtonPressed = !(lastPortValue & (1 << buttonPin));
+
+    if (currentButtonPressed != lastButtonPressed) {
+      Trace::recordAt(captureMicros(bay, capture), TRACE_BUTTON, Trace::withBay(bay.id, (uint8_t)i),
+                      currentButtonPressed ? 1 : 0, 0);
+    }
+
+    // Detect button press (transition from released to pressed)
+    if (currentButtonPressed && !lastButtonPressed) {
+      LOG_INFO("Button %d transition detected: HIGH->LOW (pressed, bay %d)", i + 1, bay.id);
+      bay.io->postButtonPress(i, capture.timestamp);
+    } else if (!currentButtonPressed && lastButtonPressed) {
+      // Button released - log for debugging
+      LOG_DEBUG("Button %d transition detected: LOW->HIGH (released)", i + 1);
+    }
+  }
+
+  if (ENABLE_BUTTON_DIAGNOSTICS) {
+    LOG_INFO("[BUTTON DIAG] Bay %d PORT0 0x%02X -> 0x%02X (%s)", bay.id, lastPortValue, capture.portValue,
+             capture.fromInterrupt ? "INT" : "poll");
   }
+
+  bay.lastPortValue = capture.portValue;
 }
 
 /**
- * FreeRTOS Task: Button Detector
- * 
- * This task monitors all button pins (BUTTON1-6) for press events.
- * It runs independently with faster polling for responsive button detection.
- * 
- * Detection Logic:
- * - Monitors INT_PIN (active LOW when button state changes)
- * - Reads PORT0 register to get current button states
- * - Detects button press events (HIGH->LOW transition, buttons are active LOW)
- * - Sets button flags with debouncing for controller to process
- * 
- * Thread Safety:
- * - Uses mutex protection when accessing ioExpander
+ * FreeRTOS Task: Input Reader (one per bay, pvParameters = Bay*)
+ *
+ * Single owner of the bay's INPUT_PORT0 reads. Replaces the separate 5ms coin and
+ * 10ms button polling tasks, which together issued ~300 I2C reads/second.
+ *
+ * Capture Logic:
+ * - Sleeps until the TCA9535 INT line falls (any PORT0 input changed)
+ * - Does one mutex-protected PORT0 read per edge, timestamped at the edge
+ * - Fans the sample out to the coin and button consumers
+ * - Falls back to a poll every INPUT_FALLBACK_POLL_MS in case an edge is missed
+ *   (every INPUT_POLL_NO_INT_MS for a bay whose INT line is not wired)
+ * - While a coin pulse is being validated, re-samples every COIN_POLL_INTERVAL_MS
+ *
+ * Priority: 2 (Above the controller loop so edges are captured promptly)
  */
-void TaskButtonDetector(void *pvParameters) {
-    const TickType_t xDelay = 10 / portTICK_PERIOD_MS; // 10ms for very responsive button detection
-    uint8_t lastPortValue = 0xFF; // All buttons released initially (active LOW)
-    
-    // Wait for IO expander to be initialized
-    vTaskDelay(1000 / portTICK_PERIOD_MS);
-    
-    LOG_INFO("Button detector task started");
-    
-    if (ENABLE_BUTTON_DIAGNOSTICS) {
-        LOG_INFO("[BUTTON DIAG] Button detector task initialized");
+void TaskInputReader(void *pvParameters) {
+  Bay& bay = *static_cast<Bay*>(pvParameters);
+  const TickType_t xConfirmWait = pdMS_TO_TICKS(COIN_POLL_INTERVAL_MS);
+  TickType_t xWait = inputPollTicks(bay);
+
+  // Created once the IO expander is configured, so capture starts right away
+
+  if (!bay.io->enableInputCapture(xTaskGetCurrentTaskHandle())) {
+    LOG_WARNING("Bay %d input capture unavailable - running on fallback poll only", bay.id);
+  }
+
+  LOG_INFO("Bay %d input reader task started (fallback poll: %lu ms, %lu ms in low-power mode)", bay.id,
+           bay.io->hasInputInterrupt() ? INPUT_FALLBACK_POLL_MS : INPUT_POLL_NO_INT_MS,
+           bay.io->hasInputInterrupt() ? INPUT_LOWPOWER_POLL_MS : INPUT_POLL_NO_INT_MS);
+
+  for(;;) {
+    bool fromInterrupt = bay.io->waitForInputEdge(xWait);
+    bool wokeInLowPower = PowerManager::isLowPower();
+    if (fromInterrupt) {
+      // Restore full rate before validating the pulse
+      PowerManager::noteActivity();
     }
-    
-    for(;;) {
-        // CRITICAL FIX: Poll continuously, not just when INT_PIN is LOW
-        // The interrupt pin may not fire reliably, so we poll every cycle
-        // This ensures button presses are detected immediately
-        uint8_t currentPortValue = 0;
-        
-        // Protect IO expander access with mutex
-        // Reduced timeout to 20ms for faster failure and better responsiveness
-        if (xSemaphoreTake(xIoExpanderMutex, pdMS_TO_TICKS(20)) == pdTRUE) {
-            currentPortValue = ioExpander.readRegister(INPUT_PORT0);
-            
-            // Check if any button state changed
-            if (currentPortValue != lastPortValue) {
-                
-                // Check each button for press events (transition from HIGH to LOW)
-                for (int i = 0; i < NUM_BUTTONS; i++) {
-                    int buttonPin;
-                    if (i < NUM_BUTTONS - 1) {
-                        buttonPin = BUTTON_INDICES[i]; // Function buttons 1-5
-                    } else {
-                        buttonPin = STOP_BUTTON_PIN;   // Stop button (BUTTON6)
-                    }
-                    
-                    bool currentButtonPressed = !(currentPortValue & (1 << buttonPin));
-                    bool lastButtonPressed = !(lastPortValue & (1 << buttonPin));
-                    
-                    // Detect button press (transition from released to pressed)
-                    if (currentButtonPressed && !lastButtonPressed) {
-                        LOG_INFO("Button %d transition detected: HIGH->LOW (pressed)", i + 1);
-                        ioExpander.setButtonFlag(i, true);
-                    } else if (!currentButtonPressed && lastButtonPressed) {
-                        // Button released - log for debugging
-                        LOG_DEBUG("Button %d transition detected: LOW->HIGH (released)", i + 1);
-                    }
-                }
-                
-                lastPortValue = currentPortValue;
-            }
-            
-            xSemaphoreGive(xIoExpanderMutex);
-        } else {
-            // Mutex contention is normal - no logging needed
-        }
-        // Removed warning log to reduce overhead - mutex contention is normal
-        
-        vTaskDelay(xDelay); // Wait 10ms before next check
+
+    InputCapture capture;
+    bool captured = false;
+    if (profiledTake(xIoExpanderMutex, pdMS_TO_TICKS(10), PROFILED_MUTEX_IO_EXPANDER) == pdTRUE) {
+      captured = bay.io->captureInput(capture, fromInterrupt);
+      profiledGive(xIoExpanderMutex, PROFILED_MUTEX_IO_EXPANDER);
+    }
+
+    if (!captured) {
+      // Mutex contention or bus error - retry soon so an edge isn't lost
+      xWait = xConfirmWait;
+      continue;
+    }
+
+    if (fromInterrupt) {
+      Profiler::recordInputWake(wokeInLowPower ? PROFILED_WAKE_LOW_POWER : PROFILED_WAKE_FULL_RATE,
+                                (uint32_t)(micros() - bay.io->getLastEdgeMicros()));
+    } else if (capture.changedMask != 0 && !bay.io->hasInputInterrupt()) {
+      // No INT edge to do it for a polled bay
+      PowerManager::noteActivity();
     }
+
+#ifdef COIN_PCNT_PIN
+    // Bay 0's coins are counted by the PCNT peripheral; only buttons come from its PORT0
+    bool coinPending = bay.id != 0 && processCoinCapture(bay, capture);
+#else
+    bool coinPending = processCoinCapture(bay, capture);
+#endif
+    processButtonCapture(bay, capture);
+
+    xWait = coinPending ? xConfirmWait : inputPollTicks(bay);
+  }
+}
+
+/**
+ * FreeRTOS Task: Bay Controller (bays 1..BAY_COUNT-1, pvParameters = Bay*)
+ *
+ * Runs an extra bay's controller the way loop() runs bay 0's: drain the
+ * input events queued by the bay's InputReader, fire session deadlines and
+ * queue state messages, then sleep until the next event or deadline.
+ *
+ * Priority: 1 (same as loop(), below the InputReaders); pinned to the bay's
+ * core next to its InputReader
+ */
+void TaskBayController(void *pvParameters) {
+  Bay& bay = *static_cast<Bay*>(pvParameters);
+  
+  // Events posted before this point wait in the queue
+  bay.io->setInputEventConsumer(xTaskGetCurrentTaskHandle());
+  LOG_INFO("Bay %d controller task started on core %d", bay.id, xPortGetCoreID());
+  
+  for(;;) {
+    bay.controller->update();
+    bay.controller->waitForInput(PowerManager::idleWaitTicks());
+  }
 }
 
 /**
  * FreeRTOS Task: Network Manager
  * 
- * COMMENTED OUT - Using BLE only, no LTE/MQTT
+ * Only built with ENABLE_MQTT (BLE only otherwise)
  * 
  * This task handles all network and MQTT operations to prevent blocking the main loop.
  * It manages:
@@ -257,7 +351,25 @@ void TaskButtonDetector(void *pvParameters) {
  * 
  * Priority: 2 (Medium priority - important but not critical like hardware tasks)
  */
-/* DISABLED - BLE ONLY MODE
+#if ENABLE_MQTT
+static const char* bringUpPathName(MqttLteClient::BringUpPath path) {
+    switch (path) {
+        case MqttLteClient::BRINGUP_WARM_ATTACHED: return "warm, still attached";
+        case MqttLteClient::BRINGUP_WARM_REGISTERED: return "warm, re-attached";
+        case MqttLteClient::BRINGUP_COLD: return "cold boot";
+        default: return "failed";
+    }
+}
+
+// State goes out at QoS0: after a reconnect every bay resends it in full
+static void requestStateKeyframes() {
+    for (uint8_t i = 0; i < BAY_COUNT; i++) {
+        if (bays[i].controller != NULL) {
+            bays[i].controller->requestKeyframe();
+        }
+    }
+}
+
 void TaskNetworkManager(void *pvParameters) {
     // SMART CONNECTIVITY CHECKING: Check less frequently when things are working
     // Network checks are now handled by smart checking in mqtt_lte_client
@@ -268,6 +380,9 @@ void TaskNetworkManager(void *pvParameters) {
     const TickType_t xMqttCheckDelay = pdMS_TO_TICKS(15000);      // Check MQTT every 15 seconds (reduced frequency)
     const TickType_t xReconnectDelay = pdMS_TO_TICKS(60000);     // Reconnect attempt interval
     
+    // Recovery backoff: retry quickly after a drop, slow down while it keeps failing
+    unsigned long retryDelay = NETWORK_RETRY_MIN_MS;
+    
     unsigned long lastNetworkCheck = 0;
     unsigned long lastConnectionAttempt = 0;
     unsigned long lastMqttReconnectAttempt = 0;
@@ -278,8 +393,8 @@ void TaskNetworkManager(void *pvParameters) {
         LOG_INFO("Network manager task started");
     }
     
-    // Wait a bit for system to initialize
-    vTaskDelay(2000 / portTICK_PERIOD_MS);
+    // Wait for the controller (modem bring-up already ran in setup)
+    xEventGroupWaitBits(xBootEvents, BOOT_CONTROLLER_READY, pdFALSE, pdTRUE, portMAX_DELAY);
     
     for(;;) {
         unsigned long currentTime = millis();
@@ -287,7 +402,7 @@ void TaskNetworkManager(void *pvParameters) {
         // SMART CONNECTIVITY CHECKING: Adaptive check interval based on connection state
         // Check less frequently when connected to reduce mutex contention
         TickType_t networkCheckInterval = wasNetworkConnected ? 
-            xNetworkCheckDelayConnected : xNetworkCheckDelayDisconnected;
+            xNetworkCheckDelayConnected : min(xNetworkCheckDelayDisconnected, pdMS_TO_TICKS(retryDelay));
         
         // Check network status periodically - reduced frequency when connected
         // The mqtt_lte_client now handles smart checking based on publish failures
@@ -305,8 +420,8 @@ void TaskNetworkManager(void *pvParameters) {
                     LOG_WARNING("Lost cellular network connection");
                 }
                 
-                // Only attempt reconnection every 60 seconds
-                if (currentTime - lastConnectionAttempt > 60000) {
+                // Attempt reconnection on the backoff schedule
+                if (currentTime - lastConnectionAttempt > retryDelay) {
                     lastConnectionAttempt = currentTime;
                     
                     if (ENABLE_NETWORK_MANAGER_DIAGNOSTICS) {
@@ -319,7 +434,8 @@ void TaskNetworkManager(void *pvParameters) {
                     // Try to recover the modem connection
                     if (mqttClient.begin(apn, gprsUser, gprsPass, pin)) {
                         if (ENABLE_NETWORK_MANAGER_DIAGNOSTICS) {
-                            LOG_INFO("Successfully reconnected to cellular network!");
+                            LOG_INFO("Successfully reconnected to cellular network (%s, %lu ms)",
+                                     bringUpPathName(mqttClient.getBringUpPath()), mqttClient.getBringUpDuration());
                         }
                         
                         // Validate IP address
@@ -330,7 +446,8 @@ void TaskNetworkManager(void *pvParameters) {
                             if (ENABLE_NETWORK_MANAGER_DIAGNOSTICS) {
                                 LOG_ERROR("Invalid IP address: %s - skipping MQTT connection attempt", ip.c_str());
                             }
-                            vTaskDelay(10000 / portTICK_PERIOD_MS); // Wait 10s before retry
+                            vTaskDelay(pdMS_TO_TICKS(retryDelay));
+                            retryDelay = min(retryDelay * 2, NETWORK_RETRY_MAX_MS);
                             continue; // Skip to next iteration
                         }
                         
@@ -351,28 +468,36 @@ void TaskNetworkManager(void *pvParameters) {
                             if (ENABLE_NETWORK_MANAGER_DIAGNOSTICS) {
                                 LOG_INFO("MQTT broker connection restored!");
                             }
+                            retryDelay = NETWORK_RETRY_MIN_MS;
                             
-                            mqttClient.subscribe(INIT_TOPIC.c_str());
-                            mqttClient.subscribe(CONFIG_TOPIC.c_str());
-                            mqttClient.subscribe(COMMAND_TOPIC.c_str());
-                            mqttClient.subscribe(GET_STATE_TOPIC.c_str());
+                            for (uint8_t i = 0; i < BAY_COUNT; i++) {
+                                mqttClient.subscribe(mqttTopic(TOPIC_INIT, i));
+                                mqttClient.subscribe(mqttTopic(TOPIC_CONFIG, i));
+                                mqttClient.subscribe(mqttTopic(TOPIC_COMMAND, i));
+                                mqttClient.subscribe(mqttTopic(TOPIC_GET_STATE, i));
+                            }
+                            requestStateKeyframes();
                             
                             // Notify that we're back online
                             if (controller) {
                                 vTaskDelay(4000 / portTICK_PERIOD_MS);
-                                controller->publishMachineSetupActionEvent();
+                                for (uint8_t i = 0; i < BAY_COUNT; i++) {
+                                    bays[i].controller->publishMachineSetupActionEvent();
+                                }
                             }
                         } else {
                             if (ENABLE_NETWORK_MANAGER_DIAGNOSTICS) {
                                 LOG_ERROR("Failed to connect to MQTT broker after network recovery");
                             }
-                            vTaskDelay(30000 / portTICK_PERIOD_MS); // Wait 30s after SSL failure
+                            vTaskDelay(pdMS_TO_TICKS(retryDelay)); // Back off after SSL failure
+                            retryDelay = min(retryDelay * 2, NETWORK_RETRY_MAX_MS);
                         }
                     } else {
                         if (ENABLE_NETWORK_MANAGER_DIAGNOSTICS) {
                             LOG_ERROR("Failed to reconnect to cellular network");
                         }
-                        vTaskDelay(10000 / portTICK_PERIOD_MS); // Wait 10s before retry
+                        vTaskDelay(pdMS_TO_TICKS(retryDelay));
+                        retryDelay = min(retryDelay * 2, NETWORK_RETRY_MAX_MS);
                     }
                 }
             } else {
@@ -388,6 +513,9 @@ void TaskNetworkManager(void *pvParameters) {
                         // Yield before reconnection attempt (SSL operations can block)
                         vTaskDelay(pdMS_TO_TICKS(50));
                         mqttClient.reconnect();
+                        if (mqttClient.isConnected()) {
+                            requestStateKeyframes();
+                        }
                     }
                 }
             }
@@ -433,47 +561,49 @@ void TaskNetworkManager(void *pvParameters) {
         vTaskDelay(pdMS_TO_TICKS(200));  // Increased to 200ms to give more time for IDLE task
     }
 }
-*/ // END DISABLED - BLE ONLY MODE
+#endif // ENABLE_MQTT
 
 /**
  * FreeRTOS Task: Display Update
  * 
- * This task handles LCD display updates independently to ensure reliable refresh rate.
- * Updates the display at least once per second, or more frequently for dynamic content
- * like countdown timers.
+ * This task renders the 7-segment displays. It blocks on xDisplayMailbox and
+ * only wakes when the controller pushes a changed DisplaySnapshot: about once
+ * per second while time counts down, and not at all while the machine is FREE.
+ * If a frame did not reach the CH453 (mutex timeout, NACK) it renders the same
+ * snapshot again every DISPLAY_RETRY_INTERVAL_MS until it does.
+ * It never reads controller state directly.
  * 
  * Priority: 3 (Medium-high priority - ensures display stays responsive)
  */
 void TaskDisplayUpdate(void *pvParameters) {
-    const TickType_t xDisplayDelay = pdMS_TO_TICKS(500); // Update every 500ms for smooth countdowns
-    unsigned long lastForcedUpdate = 0;
+    DisplaySnapshot snapshot;
+    bool haveSnapshot = false;
+    bool frameDirty = false;
     
     LOG_INFO("Display update task started");
     
-    // Wait for controller and display to be initialized
-    vTaskDelay(2000 / portTICK_PERIOD_MS);
+    // Wait for Wire1 and the CH453 to be initialized (InitWire1 task)
+    xEventGroupWaitBits(xBootEvents, BOOT_DISPLAY_READY, pdFALSE, pdTRUE, portMAX_DELAY);
     
     for(;;) {
-        if (display && controller) {
-            // Update display - mutex protection is handled inside DisplayManager
-            display->update(controller);
-            
-            // Force update at least once per second even if throttled internally
-            unsigned long now = millis();
-            if (now - lastForcedUpdate >= 1000) {
-                lastForcedUpdate = now;
-                // Force a refresh by clearing lastUpdateTime (handled in display->update)
-            }
+        TickType_t wait = frameDirty ? pdMS_TO_TICKS(DISPLAY_RETRY_INTERVAL_MS) : portMAX_DELAY;
+        if (xQueueReceive(xDisplayMailbox, &snapshot, wait) == pdTRUE) {
+            haveSnapshot = true;
+        } else if (!frameDirty) {
+            continue;
         }
         
-        vTaskDelay(xDisplayDelay);
+        // Mutex protection is handled inside the display driver
+        if (haveSnapshot && display) {
+            frameDirty = !display->render(snapshot);
+        }
     }
 }
 
 /**
  * FreeRTOS Task: MQTT Publisher
  * 
- * COMMENTED OUT - Using BLE only, no LTE/MQTT
+ * Only built with ENABLE_MQTT (BLE only otherwise)
  * 
  * This task handles all MQTT message publishing in a dedicated task to prevent
  * blocking the main loop and other critical tasks. It:
@@ -484,16 +614,78 @@ void TaskDisplayUpdate(void *pvParameters) {
  * 
  * Priority: 2 (Medium priority - important for data delivery)
  */
-/* DISABLED - BLE ONLY MODE
+#if ENABLE_MQTT
+// Publish callback for outbox replay (stops the batch on the first failure)
+static bool publishOutboxRecord(const char* topic, const uint8_t* payload, size_t length, uint8_t qos, void* context) {
+    (void)context;
+    return mqttClient.publishNonBlocking(topic, payload, length, qos, 50);
+}
+
+// Trace a message the publisher gives up on. A lost state delta leaves the
+// backend behind until the next keyframe, so ask that bay for one now (state
+// dropped while offline is covered by the keyframes sent on reconnect).
+static void noteDroppedMessage(const MqttMessage* msg, TraceDropReason reason) {
+    Trace::record(TRACE_MQTT_DROP, msg->topicId, msg->payloadLength, reason);
+    if (msg->topicId == TOPIC_STATE && reason != TRACE_DROP_DISCONNECTED &&
+        msg->bay < BAY_COUNT && bays[msg->bay].controller != NULL) {
+        bays[msg->bay].controller->requestKeyframe();
+    }
+}
+
+// Collect a burst from the queue (up to MQTT_BATCH_MAX_MESSAGES or until the
+// linger window closes) and publish it with one lock acquire / TLS write.
+// Unsent messages go back to the front of the queue in their original order.
+static size_t publishQueuedBurst() {
+    MqttMessageHandle handles[MQTT_BATCH_MAX_MESSAGES];
+    MqttMessage* messages[MQTT_BATCH_MAX_MESSAGES];
+    size_t count = 0;
+    const TickType_t linger = pdMS_TO_TICKS(MQTT_BATCH_LINGER_MS);
+    TickType_t lingerStart = xTaskGetTickCount();
+    
+    while (count < MQTT_BATCH_MAX_MESSAGES) {
+        TickType_t elapsed = xTaskGetTickCount() - lingerStart;
+        TickType_t wait = (elapsed < linger) ? (linger - elapsed) : 0;
+        if (xQueueReceive(xMqttPublishQueue, &handles[count], wait) != pdTRUE) {
+            break;
+        }
+        messages[count] = mqttMessagePool.get(handles[count]);
+        if (messages[count] != NULL) {
+            count++;
+        }
+    }
+    
+    size_t sent = mqttClient.publishBatch(messages, count, 50);
+    for (size_t i = 0; i < sent; i++) {
+        Trace::record(TRACE_MQTT_PUBLISH, messages[i]->topicId, messages[i]->payloadLength,
+                      millis() - messages[i]->timestamp);
+        mqttMessagePool.release(handles[i]);
+    }
+    for (size_t i = count; i > sent; i--) {
+        if (xQueueSendToFront(xMqttPublishQueue, &handles[i - 1], 0) != pdTRUE) {
+            MqttMessage* msg = messages[i - 1];
+            if (!msg->isCritical || !mqttOutbox.append(msg->topic(), (const uint8_t*)msg->payload(), msg->payloadLength, msg->qos)) {
+                noteDroppedMessage(msg, TRACE_DROP_QUEUE_FULL);
+                LOG_WARNING("Queue full, dropping unsent burst message: %s", msg->topic());
+            }
+            mqttMessagePool.release(handles[i - 1]);
+        }
+    }
+    
+    if (sent > 0) {
+        LOG_DEBUG("Published MQTT burst: %u/%u messages", (unsigned int)sent, (unsigned int)count);
+    }
+    return sent;
+}
+
 void TaskMqttPublisher(void *pvParameters) {
     const TickType_t xQueueWaitTime = pdMS_TO_TICKS(100);  // Wait up to 100ms for messages
     const int MAX_RETRY_COUNT = 3;  // Maximum retry attempts for critical messages
-    MqttMessage msg;
+    MqttMessageHandle handle;
     
     LOG_INFO("MQTT Publisher task started");
     
-    // Wait for MQTT client to be initialized
-    vTaskDelay(3000 / portTICK_PERIOD_MS);
+    // Wait for the controller (MQTT client is initialized in setup)
+    xEventGroupWaitBits(xBootEvents, BOOT_CONTROLLER_READY, pdFALSE, pdTRUE, portMAX_DELAY);
     
     // Statistics counters
     unsigned long messagesPublished = 0;
@@ -505,23 +697,47 @@ void TaskMqttPublisher(void *pvParameters) {
     int currentRetryCount = 0;
     
     for(;;) {
+        // Drain the flash outbox first so critical events go out in order after an outage
+        if (mqttOutbox.getPendingCount() > 0 && mqttClient.isConnected()) {
+            mqttOutbox.replay(publishOutboxRecord, NULL, MQTT_OUTBOX_REPLAY_BATCH);
+        }
+        mqttOutbox.flushIfDue(millis());
+        
         // Check if there are messages waiting - process them quickly if queue is building up
         UBaseType_t queueDepth = 0;
         if (xMqttPublishQueue != NULL) {
             queueDepth = uxQueueMessagesWaiting(xMqttPublishQueue);
         }
         
+        // Backlog: send it in coalesced bursts; on a failed burst fall through to
+        // the single-message path below, which owns retry accounting
+        if (queueDepth > 1 && mqttClient.isConnected()) {
+            size_t burst = publishQueuedBurst();
+            messagesPublished += burst;
+            if (burst > 0) {
+                vTaskDelay(pdMS_TO_TICKS(10));  // Let loop() take the MQTT mutex between bursts
+                continue;
+            }
+        }
+        
         // Try to receive a message from the queue
         // Use shorter timeout if queue is building up to process faster
         // Reduced threshold from 10 to 3 to catch queue buildup earlier
         TickType_t waitTime = (queueDepth > 3) ? pdMS_TO_TICKS(5) : xQueueWaitTime;
-        if (xQueueReceive(xMqttPublishQueue, &msg, waitTime) == pdTRUE) {
+        if (xQueueReceive(xMqttPublishQueue, &handle, waitTime) == pdTRUE) {
+            // The queue only carries the handle; the message stays in its pool block
+            MqttMessage* msg = mqttMessagePool.get(handle);
+            if (msg == NULL) {
+                LOG_ERROR("Invalid MQTT message handle: 0x%04X", handle);
+                continue;
+            }
+            
             // Check if this is a retry of the same message
-            bool isRetry = (msg.timestamp == lastMessageTimestamp);
+            bool isRetry = (msg->timestamp == lastMessageTimestamp);
             if (!isRetry) {
                 // New message - reset retry counter
                 currentRetryCount = 0;
-                lastMessageTimestamp = msg.timestamp;
+                lastMessageTimestamp = msg->timestamp;
             }
             // Note: retry count is incremented when re-queuing, not here
             
@@ -530,11 +746,14 @@ void TaskMqttPublisher(void *pvParameters) {
                 // CRITICAL FIX: Use shorter timeout (50ms) to prevent blocking loop()
                 // If mutex is held by loop(), we'll fail fast and retry
                 // This prevents the publisher from monopolizing the mutex
-                bool published = mqttClient.publishNonBlocking(msg.topic, msg.payload, msg.qos, 50);
+                bool published = mqttClient.publishNonBlocking(msg->topic(), (const uint8_t*)msg->payload(),
+                                                               msg->payloadLength, msg->qos, 50);
                 
                 if (published) {
                     messagesPublished++;
-                    LOG_DEBUG("Published MQTT message to %s (QoS: %d)", msg.topic, msg.qos);
+                    Trace::record(TRACE_MQTT_PUBLISH, msg->topicId, msg->payloadLength, millis() - msg->timestamp);
+                    LOG_DEBUG("Published MQTT message to %s (QoS: %d)", msg->topic(), msg->qos);
+                    mqttMessagePool.release(handle);
                     // Reset retry tracking on success
                     lastMessageTimestamp = 0;
                     currentRetryCount = 0;
@@ -545,9 +764,9 @@ void TaskMqttPublisher(void *pvParameters) {
                     if (currentRetryCount < MAX_RETRY_COUNT) {
                         // Try to re-queue for retry (put back at front for faster retry)
                         if (uxQueueSpacesAvailable(xMqttPublishQueue) > 0) {
-                            if (xQueueSendToFront(xMqttPublishQueue, &msg, 0) == pdTRUE) {
+                            if (xQueueSendToFront(xMqttPublishQueue, &handle, 0) == pdTRUE) {
                                 currentRetryCount++;  // Increment retry count when re-queuing
-                                if (msg.isCritical) {
+                                if (msg->isCritical) {
                                     LOG_INFO("Re-queued critical message for retry (%d/%d) - mutex may have been busy", 
                                             currentRetryCount, MAX_RETRY_COUNT);
                                 } else {
@@ -555,66 +774,68 @@ void TaskMqttPublisher(void *pvParameters) {
                                             currentRetryCount, MAX_RETRY_COUNT);
                                 }
                                 // Update lastMessageTimestamp so we recognize this as a retry next time
-                                lastMessageTimestamp = msg.timestamp;
+                                lastMessageTimestamp = msg->timestamp;
                                 // CRITICAL: Longer delay (200ms) to give loop() priority to acquire mutex
                                 // This prevents publisher from immediately re-acquiring and blocking loop()
                                 vTaskDelay(pdMS_TO_TICKS(200));
                             } else {
                                 messagesDropped++;
+                                noteDroppedMessage(msg, TRACE_DROP_QUEUE_FULL);
+                                mqttMessagePool.release(handle);
                                 LOG_WARNING("Failed to re-queue message");
                             }
                         } else {
                             messagesDropped++;
+                            noteDroppedMessage(msg, TRACE_DROP_QUEUE_FULL);
+                            mqttMessagePool.release(handle);
                             LOG_WARNING("Queue full, cannot retry message");
                         }
                     } else {
-                        // Max retries reached
-                        messagesDropped++;
-                        if (msg.isCritical) {
+                        // Max retries reached - critical messages fall back to the flash outbox
+                        if (msg->isCritical && mqttOutbox.append(msg->topic(), (const uint8_t*)msg->payload(),
+                                                                 msg->payloadLength, msg->qos)) {
+                            LOG_INFO("Critical message moved to outbox after %d retries: %s", 
+                                    currentRetryCount, msg->topic());
+                        } else if (msg->isCritical) {
+                            messagesDropped++;
+                            noteDroppedMessage(msg, TRACE_DROP_RETRIES);
                             LOG_WARNING("Critical message dropped after %d retries: %s", 
-                                       currentRetryCount, msg.topic);
+                                       currentRetryCount, msg->topic());
                         } else {
+                            messagesDropped++;
+                            noteDroppedMessage(msg, TRACE_DROP_RETRIES);
                             LOG_DEBUG("Non-critical message dropped after %d retries: %s", 
-                                     currentRetryCount, msg.topic);
+                                     currentRetryCount, msg->topic());
                         }
+                        mqttMessagePool.release(handle);
                         // Reset retry tracking
                         lastMessageTimestamp = 0;
                         currentRetryCount = 0;
                     }
                 }
             } else {
-                // MQTT not connected - buffer critical messages only
-                if (msg.isCritical && currentRetryCount < MAX_RETRY_COUNT) {
-                    // Try to re-queue critical messages if there's space
-                    if (uxQueueSpacesAvailable(xMqttPublishQueue) > (MQTT_QUEUE_SIZE / 4)) {
-                        // Only buffer if queue is less than 75% full
-                        if (xQueueSendToBack(xMqttPublishQueue, &msg, 0) == pdTRUE) {
-                            LOG_DEBUG("Buffered critical message (MQTT disconnected, retry %d/%d)", 
-                                     currentRetryCount + 1, MAX_RETRY_COUNT);
-                        } else {
-                            messagesDropped++;
-                            LOG_WARNING("Failed to buffer critical message");
-                        }
+                // MQTT not connected - persist critical messages to the flash outbox
+                // (replayed in bulk on reconnect, survives reboots)
+                if (msg->isCritical) {
+                    if (mqttOutbox.append(msg->topic(), (const uint8_t*)msg->payload(), msg->payloadLength, msg->qos)) {
+                        LOG_DEBUG("Stored critical message in outbox (MQTT disconnected, %lu pending)", 
+                                 (unsigned long)mqttOutbox.getPendingCount());
                     } else {
                         messagesDropped++;
-                        LOG_WARNING("Queue too full (>75%%), dropping message to prevent overflow");
-                        lastMessageTimestamp = 0;
-                        currentRetryCount = 0;
+                        noteDroppedMessage(msg, TRACE_DROP_DISCONNECTED);
+                        LOG_WARNING("Failed to store critical message, dropping: %s", msg->topic());
                     }
                 } else {
-                    // Non-critical or max retries reached
                     messagesDropped++;
-                    if (msg.isCritical) {
-                        LOG_WARNING("Critical message dropped (disconnected, max retries)");
-                    } else {
-                        LOG_DEBUG("Non-critical message dropped (MQTT disconnected)");
-                    }
-                    lastMessageTimestamp = 0;
-                    currentRetryCount = 0;
+                    noteDroppedMessage(msg, TRACE_DROP_DISCONNECTED);
+                    LOG_DEBUG("Non-critical message dropped (MQTT disconnected)");
                 }
+                mqttMessagePool.release(handle);
+                lastMessageTimestamp = 0;
+                currentRetryCount = 0;
                 
-                // Wait longer when disconnected to reduce queue pressure
-                vTaskDelay(pdMS_TO_TICKS(2000));
+                // Short delay only: messages no longer circulate through the queue while offline
+                vTaskDelay(pdMS_TO_TICKS(100));
             }
             
             // Re-check queue depth after processing (message was dequeued, so depth decreased)
@@ -656,13 +877,13 @@ void TaskMqttPublisher(void *pvParameters) {
             lastStatsLog = now;
             UBaseType_t currentQueueDepth = (xMqttPublishQueue != NULL) ? 
                 uxQueueMessagesWaiting(xMqttPublishQueue) : 0;
-            LOG_INFO("MQTT Publisher stats: Published=%lu, Dropped=%lu, Queue=%d/%d", 
+            LOG_INFO("MQTT Publisher stats: Published=%lu, Dropped=%lu, Queue=%d/%d, Outbox=%lu", 
                     messagesPublished, messagesDropped, 
-                    currentQueueDepth, MQTT_QUEUE_SIZE);
+                    currentQueueDepth, MQTT_QUEUE_SIZE, (unsigned long)mqttOutbox.getPendingCount());
         }
     }
 }
-*/ // END DISABLED - BLE ONLY MODE
+#endif // ENABLE_MQTT
 
 /**
  * FreeRTOS Task: System Watchdog
@@ -680,33 +901,43 @@ void TaskWatchdog(void *pvParameters) {
     
     LOG_INFO("Watchdog task started");
     
-    // Wait for all tasks to be created
-    vTaskDelay(3000 / portTICK_PERIOD_MS);
+    // Wait for the boot init graph, then report how long it took (or what is stuck)
+    EventBits_t bootBits = xEventGroupWaitBits(xBootEvents, BOOT_ALL_READY, pdFALSE, pdTRUE,
+                                               pdMS_TO_TICKS(BOOT_INIT_TIMEOUT_MS));
+    if ((bootBits & BOOT_ALL_READY) == BOOT_ALL_READY) {
+        LOG_INFO("Boot complete in %lu ms", millis());
+    } else {
+        LOG_WARNING("Boot incomplete after %lu ms: io=%d controller=%d display=%d ble=%d reset_window=%d",
+                    millis(), (bootBits & BOOT_IO_READY) != 0, (bootBits & BOOT_CONTROLLER_READY) != 0,
+                    (bootBits & BOOT_DISPLAY_READY) != 0, (bootBits & BOOT_BLE_READY) != 0,
+                    (bootBits & BOOT_RESET_WINDOW_CLOSED) != 0);
+    }
     
     for(;;) {
-        // Check coin detector task
-        if (TaskCoinDetectorHandle != NULL) {
-            eTaskState coinTaskState = eTaskGetState(TaskCoinDetectorHandle);
-            if (coinTaskState == eDeleted || coinTaskState == eInvalid) {
-                LOG_ERROR("Coin detector task died! State: %d", coinTaskState);
-                // Task crashed - would need to restart, but for now just log
-            } else {
-                UBaseType_t stackHighWater = uxTaskGetStackHighWaterMark(TaskCoinDetectorHandle);
-                if (stackHighWater < 512) { // Less than 256 bytes free
-                    LOG_WARNING("Coin detector task stack low: %d bytes remaining", stackHighWater);
+        // Check each bay's input reader and controller tasks
+        for (uint8_t i = 0; i < BAY_COUNT; i++) {
+            Bay& bay = bays[i];
+            if (bay.inputReaderHandle != NULL) {
+                eTaskState inputTaskState = eTaskGetState(bay.inputReaderHandle);
+                if (inputTaskState == eDeleted || inputTaskState == eInvalid) {
+                    LOG_ERROR("Bay %d input reader task died! State: %d", bay.id, inputTaskState);
+                    // Task crashed - would need to restart, but for now just log
+                } else {
+                    UBaseType_t stackHighWater = uxTaskGetStackHighWaterMark(bay.inputReaderHandle);
+                    if (stackHighWater < 512) {
+                        LOG_WARNING("Bay %d input reader task stack low: %d bytes remaining", bay.id, stackHighWater);
+                    }
                 }
             }
-        }
-        
-        // Check button detector task
-        if (TaskButtonDetectorHandle != NULL) {
-            eTaskState buttonTaskState = eTaskGetState(TaskButtonDetectorHandle);
-            if (buttonTaskState == eDeleted || buttonTaskState == eInvalid) {
-                LOG_ERROR("Button detector task died! State: %d", buttonTaskState);
-            } else {
-                UBaseType_t stackHighWater = uxTaskGetStackHighWaterMark(TaskButtonDetectorHandle);
-                if (stackHighWater < 512) {
-                    LOG_WARNING("Button detector task stack low: %d bytes remaining", stackHighWater);
+            if (bay.controllerHandle != NULL) {
+                eTaskState controllerTaskState = eTaskGetState(bay.controllerHandle);
+                if (controllerTaskState == eDeleted || controllerTaskState == eInvalid) {
+                    LOG_ERROR("Bay %d controller task died! State: %d", bay.id, controllerTaskState);
+                } else {
+                    UBaseType_t stackHighWater = uxTaskGetStackHighWaterMark(bay.controllerHandle);
+                    if (stackHighWater < 1024) {
+                        LOG_WARNING("Bay %d controller task stack low: %d bytes remaining", bay.id, stackHighWater);
+                    }
                 }
             }
         }
@@ -737,6 +968,25 @@ void TaskWatchdog(void *pvParameters) {
             }
         }
         
+        // Periodic relay read-back (setRelay no longer verifies inline), one bay per take
+        for (uint8_t i = 0; i < BAY_COUNT; i++) {
+            IoExpander* io = bays[i].io;
+            if (io == NULL || xIoExpanderMutex == NULL ||
+                profiledTake(xIoExpanderMutex, pdMS_TO_TICKS(100), PROFILED_MUTEX_IO_EXPANDER) != pdTRUE) {
+                continue;
+            }
+            uint8_t configPort1 = io->readRegister(CONFIG_PORT1);
+            bool relaysOk = io->verifyRelayShadow();
+            profiledGive(xIoExpanderMutex, PROFILED_MUTEX_IO_EXPANDER);
+            
+            if (configPort1 != 0x00) {
+                LOG_ERROR("Bay %d port 1 config drifted: 0x%02X (should be 0x00 for all outputs)", i, configPort1);
+            }
+            if (!relaysOk) {
+                LOG_WARNING("Bay %d relay output register did not match shadow", i);
+            }
+        }
+        
         // Monitor MQTT queue depth
         if (xMqttPublishQueue != NULL) {
             UBaseType_t queueDepth = uxQueueMessagesWaiting(xMqttPublishQueue);
@@ -745,6 +995,9 @@ void TaskWatchdog(void *pvParameters) {
             }
         }
         
+        // Refresh profiler statistics (bus call rates cover one watchdog period)
+        Profiler::sample();
+        
         // Monitor heap usage
         size_t freeHeap = ESP.getFreeHeap();
         size_t minFreeHeap = ESP.getMinFreeHeap();
@@ -766,67 +1019,90 @@ void TaskWatchdog(void *pvParameters) {
     }
 }
 
-/* DISABLED - BLE ONLY MODE
+#if ENABLE_MQTT
+// Pending dump_trace request: records + 1, set by mqtt_callback and
+// consumed by loop() (0 = none)
+static volatile uint32_t mqttTraceRequest = 0;
+
 void mqtt_callback(char *topic, byte *payload, unsigned int len) {
     // MQTT message received - handled by controller
     
+    // One prefix compare per bay and a switch on the suffix; no String compares
+    uint8_t bayId = 0;
+    MqttTopicId topicId = classifyTopic(topic, &bayId);
+    if (topicId == TOPIC_UNKNOWN) {
+        LOG_WARNING("Message on unknown topic: %s", topic);
+        return;
+    }
+    // Session and test commands go to the bay whose topic they arrived on;
+    // device-wide commands (log level, stats, config) behave the same on any bay
+    Bay& bay = bays[bayId];
+
     // Handle command topic specially for changing log level or debug commands
-    if (String(topic) == COMMAND_TOPIC) {
-        // Parse command JSON
-        StaticJsonDocument<256> doc;
-        DeserializationError error = deserializeJson(doc, payload, len);
+    if (topicId == TOPIC_COMMAND) {
+        // Parse command (JSON or MessagePack) into the fixed inbound arena;
+        // fields are read as const char* views, never copied into Strings
+        if (!mqttInbound.parse(payload, len)) {
+            return;
+        }
+        JsonDocument& doc = mqttInbound.doc();
+        const char* command = doc["command"] | (const char*)NULL;
+        if (command == NULL) {
+            LOG_WARNING("Command message without \"command\" field");
+            return;
+        }
         
-        if (!error && doc.containsKey("command")) {
-            String command = doc["command"].as<String>();
-            
-            if (command == "set_log_level" && doc.containsKey("level")) {
-                String level = doc["level"].as<String>();
-                
-                if (level == "DEBUG") {
+        switch (parseMqttCommand(command)) {
+            case MQTT_COMMAND_SET_LOG_LEVEL: {
+                const char* level = doc["level"] | "";
+                if (strcmp(level, "DEBUG") == 0) {
                     controller->setLogLevel(LOG_DEBUG);
-                } else if (level == "INFO") {
+                } else if (strcmp(level, "INFO") == 0) {
                     controller->setLogLevel(LOG_INFO);
-                } else if (level == "WARNING") {
+                } else if (strcmp(level, "WARNING") == 0) {
                     controller->setLogLevel(LOG_WARNING);
-                } else if (level == "ERROR") {
-                } else if (level == "NONE") {
+                } else if (strcmp(level, "ERROR") == 0) {
+                    controller->setLogLevel(LOG_ERROR);
+                } else if (strcmp(level, "NONE") == 0) {
                     controller->setLogLevel(LOG_NONE);
                 }
+                break;
             }
             // Add test command for simulating coin insertion
-            else if (command == "simulate_coin") {
-                LOG_INFO("Received command to simulate coin insertion");
-                controller->simulateCoinInsertion();
-            }
+            case MQTT_COMMAND_SIMULATE_COIN:
+                LOG_INFO("Received command to simulate coin insertion (bay %d)", bay.id);
+                bay.controller->simulateCoinInsertion();
+                break;
             // Add advanced coin signal simulation options
-            else if (command == "test_coin_signal" && doc.containsKey("pattern")) {
-                String pattern = doc["pattern"].as<String>();
-                LOG_INFO("Testing coin acceptor with pattern: %s", pattern.c_str());
-                
-                extern IoExpander ioExpander;
+            case MQTT_COMMAND_TEST_COIN_SIGNAL: {
+                const char* pattern = doc["pattern"] | (const char*)NULL;
+                if (pattern == NULL) {
+                    break;
+                }
+                LOG_INFO("Testing bay %d coin acceptor with pattern: %s", bay.id, pattern);
                 
-                if (pattern == "high_low_high") {
+                if (strcmp(pattern, "high_low_high") == 0) {
                     // Simulate a SIG pin toggling HIGH->LOW->HIGH
                     LOG_INFO("Simulating HIGH->LOW->HIGH pattern");
                     // We can't directly set input pins, so this is for testing only
-                    controller->simulateCoinInsertion();
+                    bay.controller->simulateCoinInsertion();
                 }
-                else if (pattern == "toggle") {
+                else if (strcmp(pattern, "toggle") == 0) {
                     // Just toggle the coin trigger function
                     LOG_INFO("Simply toggling the coin detector");
-                    controller->simulateCoinInsertion();
+                    bay.controller->simulateCoinInsertion();
                 }
-                else if (pattern == "counter") {
+                else if (strcmp(pattern, "counter") == 0) {
                     // Trigger based on CNT pin
                     LOG_INFO("Simulating coin counter pulse");
-                    controller->simulateCoinInsertion();
+                    bay.controller->simulateCoinInsertion();
                 }
-                else if (pattern == "debug") {
+                else if (strcmp(pattern, "debug") == 0) {
                     // Special diagnostic mode to read the raw coin signals
                     LOG_INFO("=== COIN ACCEPTOR DIAGNOSTIC ===");
                     
                     // Read raw port value
-                    uint8_t rawPortValue0 = ioExpander.readRegister(INPUT_PORT0);
+                    uint8_t rawPortValue0 = bay.io->readRegister(INPUT_PORT0);
                     
                     // Log the raw values in different formats
                     LOG_INFO("Raw port value: 0x%02X | Binary: %d%d%d%d%d%d%d%d", 
@@ -853,21 +1129,41 @@ void mqtt_callback(char *topic, byte *payload, unsigned int len) {
                     LOG_INFO("- Default state (no coin): Pin pulled HIGH (bit=1) = INACTIVE");
                     LOG_INFO("- Coin inserted: Pin connected to ground/LOW (bit=0) = ACTIVE");
                 }
+                break;
             }
+            // Stream the event trace on the trace topic from loop(), e.g.
+            // {"command": "dump_trace", "records": 2000} (missing/0 = whole ring)
+            case MQTT_COMMAND_DUMP_TRACE:
+                mqttTraceRequest = (uint32_t)(doc["records"] | 0) + 1;
+                LOG_INFO("Trace dump requested on %s", mqttTopic(TOPIC_TRACE));
+                break;
+            // Task stack, heap and bus latency statistics (log + STATS_TOPIC)
+            // {"command": "stats", "reset": true} zeroes the latency counters afterwards
+            case MQTT_COMMAND_STATS:
+                Profiler::sample();
+                Profiler::printStats();
+                if (bay.controller) {
+                    bay.controller->publishStats();
+                }
+                if (doc["reset"] | false) {
+                    Profiler::resetLatencyStats();
+                }
+                break;
             // Add debug command to print IO expander state
-            else if (command == "debug_io") {
-                LOG_INFO("Printing IO expander debug info");
-                extern IoExpander ioExpander;
-                ioExpander.printDebugInfo();
+            case MQTT_COMMAND_DEBUG_IO: {
+                LOG_INFO("Printing bay %d IO expander debug info (0x%02X)", bay.id, bay.io->getAddress());
+                bay.io->printDebugInfo();
+                break;
             }
             // Add command to get network diagnostics
-            else if (command == "debug_network") {
+            case MQTT_COMMAND_DEBUG_NETWORK: {
                 LOG_INFO("Printing network diagnostics");
                 extern MqttLteClient mqttClient;
                 mqttClient.printNetworkDiagnostics();
+                break;
             }
             // Add command to get BLE configuration status
-            else if (command == "debug_ble") {
+            case MQTT_COMMAND_DEBUG_BLE: {
                 LOG_INFO("=== Configuration Status ===");
                 extern BLEConfigManager* bleConfigManager;
                 
@@ -880,16 +1176,22 @@ void mqtt_callback(char *topic, byte *payload, unsigned int len) {
                 
                 LOG_INFO("Stored Machine Number: %s", storedMachineNum.c_str());
                 LOG_INFO("Stored Environment: %s", storedEnv.c_str());
-                LOG_INFO("Current MACHINE_ID: %s", MACHINE_ID.c_str());
+                LOG_INFO("Current machine ID: %s (%d bays)", bayMachineId(0), BAY_COUNT);
                 LOG_INFO("Current AWS_CLIENT_ID: %s", AWS_CLIENT_ID.c_str());
                 LOG_INFO("BLE Status: %s", bleConfigManager && bleConfigManager->isInitialized() ? "Active" : "Deinitialized (saves memory)");
                 LOG_INFO("Free Heap: %d bytes", ESP.getFreeHeap());
+                LOG_INFO("Inbound arena peak: %u of %u bytes",
+                         (unsigned int)mqttInbound.getArenaPeak(), (unsigned int)MqttInboundDocument::ARENA_SIZE);
                 LOG_INFO("============================");
+                break;
             }
             // Add command to remotely update machine number (for authorized users)
-            else if (command == "set_machine_number" && doc.containsKey("number")) {
-                String newNumber = doc["number"].as<String>();
-                LOG_INFO("Remote machine number change requested: %s", newNumber.c_str());
+            case MQTT_COMMAND_SET_MACHINE_NUMBER: {
+                const char* newNumber = doc["number"] | (const char*)NULL;
+                if (newNumber == NULL) {
+                    break;
+                }
+                LOG_INFO("Remote machine number change requested: %s", newNumber);
                 
                 // Update directly in Preferences (BLE might be deinitialized)
                 Preferences updatePrefs;
@@ -903,22 +1205,26 @@ void mqtt_callback(char *topic, byte *payload, unsigned int len) {
                 updatePrefs.end();
                 
                 if (written > 0) {
-                    LOG_INFO("Machine number updated successfully in storage: %s", newNumber.c_str());
+                    LOG_INFO("Machine number updated successfully in storage: %s", newNumber);
                     LOG_INFO("*** RESTART REQUIRED FOR CHANGES TO TAKE EFFECT ***");
                     
                     // Update runtime variables (will be lost on restart, but good for immediate use)
-                    updateMQTTTopics(newNumber, currentEnv);
+                    updateMQTTTopics(String(newNumber), currentEnv);
                     AWS_CLIENT_ID = String("fullwash-machine-") + newNumber;
                     LOG_INFO("AWS Client ID updated to: %s", AWS_CLIENT_ID.c_str());
                     LOG_INFO("NOTE: Restart device to fully apply changes");
                 } else {
                     LOG_ERROR("Failed to update machine number in storage");
                 }
+                break;
             }
             // Add command to remotely update environment (for authorized users)
-            else if (command == "set_environment" && doc.containsKey("environment")) {
-                String newEnv = doc["environment"].as<String>();
-                LOG_INFO("Remote environment change requested: %s", newEnv.c_str());
+            case MQTT_COMMAND_SET_ENVIRONMENT: {
+                const char* newEnv = doc["environment"] | (const char*)NULL;
+                if (newEnv == NULL) {
+                    break;
+                }
+                LOG_INFO("Remote environment change requested: %s", newEnv);
                 
                 // Update directly in Preferences (BLE might be deinitialized)
                 Preferences updatePrefs;
@@ -932,22 +1238,26 @@ void mqtt_callback(char *topic, byte *payload, unsigned int len) {
                 updatePrefs.end();
                 
                 if (written > 0) {
-                    LOG_INFO("Environment updated successfully in storage: %s", newEnv.c_str());
+                    LOG_INFO("Environment updated successfully in storage: %s", newEnv);
                     LOG_INFO("*** RESTART REQUIRED FOR CHANGES TO TAKE EFFECT ***");
                     
                     // Update runtime variables (will be lost on restart, but good for immediate use)
-                    updateMQTTTopics(currentMachineNum, newEnv);
+                    updateMQTTTopics(currentMachineNum, String(newEnv));
                     LOG_INFO("NOTE: Restart device to fully apply changes");
                 } else {
                     LOG_ERROR("Failed to update environment in storage");
                 }
+                break;
             }
+            default:
+                LOG_WARNING("Unknown command: %s", command);
+                break;
         }
-    } else if (controller) {
-        controller->handleMqttMessage(topic, payload, len);
+    } else if (bay.controller) {
+        bay.controller->handleMqttMessage(topicId, payload, len);
     }
 }
-*/ // END DISABLED - BLE ONLY MODE
+#endif // ENABLE_MQTT
 
 // =============================================================================
 // DOUBLE-TAP RESET DETECTION FOR FACTORY RESET
@@ -1006,12 +1316,42 @@ void performFactoryReset() {
 }
 
 /**
- * Check for double-tap reset and handle the reset window.
- * Must be called at the very beginning of setup().
+ * FreeRTOS Task: Double-reset window
+ *
+ * Blinks the LED fast for DOUBLE_RESET_WINDOW_MS while boot carries on, then
+ * clears the flag so the next reset is a normal one. A second reset inside
+ * the window still finds the flag set and triggers the factory reset.
+ */
+void TaskResetWindow(void *pvParameters) {
+  unsigned long startTime = millis();
+  bool ledState = true;
+  while (millis() - startTime < DOUBLE_RESET_WINDOW_MS) {
+    digitalWrite(LED_PIN, ledState);
+    ledState = !ledState;
+    vTaskDelay(pdMS_TO_TICKS(150));  // Fast blink to indicate reset window is active
+  }
+  
+  // Window passed without second reset - clear the flag
+  Preferences resetPrefs;
+  resetPrefs.begin(DOUBLE_RESET_NAMESPACE, false);
+  resetPrefs.putBool(DOUBLE_RESET_FLAG_KEY, false);
+  resetPrefs.end();
+  
+  // Turn LED back on and hand it to the loop() status pattern
+  digitalWrite(LED_PIN, HIGH);
+  LOG_INFO("Double-reset window closed");
+  xEventGroupSetBits(xBootEvents, BOOT_RESET_WINDOW_CLOSED);
+  vTaskDelete(NULL);
+}
+
+/**
+ * Check for double-tap reset and open the reset window.
+ * Must be called at the very beginning of setup(). The window itself runs
+ * in TaskResetWindow so it does not hold up the rest of the boot.
  * 
  * @return true if normal boot should continue, false if factory reset was triggered
  */
-bool checkDoubleResetAndWait() {
+bool checkDoubleReset() {
   Preferences resetPrefs;
   resetPrefs.begin(DOUBLE_RESET_NAMESPACE, false);
   
@@ -1030,45 +1370,229 @@ bool checkDoubleResetAndWait() {
   resetPrefs.putBool(DOUBLE_RESET_FLAG_KEY, true);
   resetPrefs.end();
   
-  // Visual feedback: fast blink during reset window
   pinMode(LED_PIN, OUTPUT);
   Serial.println("Double-reset window active (press RESET again within 3s for factory reset)...");
+  if (xTaskCreatePinnedToCore(TaskResetWindow, "ResetWindow", RESET_WINDOW_STACK_SIZE,
+                              NULL, 1, NULL, 0) != pdPASS) {
+    // Never leave the flag set, or the next ordinary reset would wipe the config
+    resetPrefs.begin(DOUBLE_RESET_NAMESPACE, false);
+    resetPrefs.putBool(DOUBLE_RESET_FLAG_KEY, false);
+    resetPrefs.end();
+    xEventGroupSetBits(xBootEvents, BOOT_RESET_WINDOW_CLOSED);
+  }
   
-  // Wait for the reset window with LED blinking
-  unsigned long startTime = millis();
-  bool ledState = true;
-  while (millis() - startTime < DOUBLE_RESET_WINDOW_MS) {
-    digitalWrite(LED_PIN, ledState);
-    ledState = !ledState;
-    delay(150);  // Fast blink to indicate reset window is active
+  return true;  // Continue with normal setup
+}
+
+/**
+ * FreeRTOS Task: Wire1 init (boot only)
+ *
+ * Brings up Wire1 and the CH453 display on core 0 while the loop task
+ * configures the IO expander on Wire, then publishes the display and exits.
+ */
+void TaskInitWire1(void *pvParameters) {
+  LOG_INFO("Initializing Wire1 (I2C) for 7-segment display...");
+  Wire1.begin(DISPLAY_SDA_PIN, DISPLAY_SCL_PIN);
+  Wire1.setClock(100000); // Set I2C clock to 100kHz (standard mode)
+  
+  DisplayManager* manager = new DisplayManager(DISPLAY_SDA_PIN, DISPLAY_SCL_PIN);
+  // Set I2C mutex for display manager
+  manager->setI2CMutex(xI2CMutex);
+  display = manager;
+  
+  xEventGroupSetBits(xBootEvents, BOOT_DISPLAY_READY);
+  vTaskDelete(NULL);
+}
+
+/**
+ * FreeRTOS Task: BLE init (boot only)
+ *
+ * Starts the BLE stack (the slowest init step) on core 0 as soon as the
+ * controller exists. loop() only sees bleMachineLoader once begin() is done.
+ */
+void TaskInitBle(void *pvParameters) {
+  String* machineNum = static_cast<String*>(pvParameters);
+  
+  xEventGroupWaitBits(xBootEvents, BOOT_CONTROLLER_READY, pdFALSE, pdTRUE, portMAX_DELAY);
+  
+  // Initialize BLE Machine Loader for direct machine loading
+  LOG_INFO("Initializing BLE Machine Loader...");
+  // Every bay can be loaded ("LOAD<bay>|token", tokens signed for the bay's ID)
+  CarWashController* bayControllers[BAY_COUNT];
+  for (uint8_t i = 0; i < BAY_COUNT; i++) {
+    bayControllers[i] = bays[i].controller;
   }
+  BLEMachineLoader* loader = new BLEMachineLoader();
+  if (loader->begin(*machineNum, bayControllers, BAY_COUNT)) {
+    LOG_INFO("BLE Machine Loader initialized successfully!");
+    LOG_INFO("Device name: FullWash-%s", machineNum->c_str());
+    LOG_INFO("Machine will advertise via BLE when FREE");
+    bleMachineLoader = loader;
+  } else {
+    LOG_ERROR("Failed to initialize BLE Machine Loader");
+  }
+  delete machineNum;
   
-  // Window passed without second reset - clear the flag
-  resetPrefs.begin(DOUBLE_RESET_NAMESPACE, false);
-  resetPrefs.putBool(DOUBLE_RESET_FLAG_KEY, false);
-  resetPrefs.end();
+  xEventGroupSetBits(xBootEvents, BOOT_BLE_READY);
+  vTaskDelete(NULL);
+}
+
+// Rapid LED toggles loop() still owes for a bay 0 expander that failed to
+// start (set by setup(), shown once the double-reset window closes)
+static uint8_t ioErrorBlinksLeft = 0;
+
+/**
+ * Bring up one bay's TCA9535 and its InputReader task
+ *
+ * Port 0 (buttons, coin) as inputs with INT on the coin bits, port 1
+ * (relays) as outputs, all relays OFF. Returns false if the expander does
+ * not answer; the bay's controller still runs, without inputs or relays.
+ */
+static bool startBayIo(Bay& bay) {
+  IoExpander& io = *bay.io;
   
-  // Turn LED back on to show normal boot
-  digitalWrite(LED_PIN, HIGH);
-  Serial.println("Double-reset window closed. Continuing normal boot...");
+  LOG_INFO("Trying to initialize bay %d TCA9535 (0x%02X)...", bay.id, io.getAddress());
+  if (!io.begin()) {
+    LOG_ERROR("Failed to initialize bay %d TCA9535!", bay.id);
+    return false;
+  }
+  LOG_INFO("TCA9535 initialization successful!");
   
-  return true;  // Continue with normal setup
+  // Configure Port 0 (buttons) as inputs (1 = input, 0 = output)
+  io.configurePortAsInput(0, 0xFF);
+  
+  // Configure Port 1 (relays) as outputs (1 = input, 0 = output)
+  io.configurePortAsOutput(1, 0xFF);
+  
+  // Initialize all relays to OFF state
+  io.writeRegister(OUTPUT_PORT1, 0x00);
+  
+  // Verify Port 1 configuration
+  uint8_t configPort1Verify = io.readRegister(CONFIG_PORT1);
+  LOG_INFO("Port 1 Configuration Register: 0x%02X (should be 0x00 for all outputs)", configPort1Verify);
+  if (configPort1Verify != 0x00) {
+      LOG_ERROR("WARNING: Port 1 not fully configured as outputs! Some pins may be inputs.");
+      LOG_ERROR("Port 1 Config: 0x%02X (binary: %d%d%d%d%d%d%d%d)", 
+               configPort1Verify,
+               (configPort1Verify & 0x80) ? 1 : 0, (configPort1Verify & 0x40) ? 1 : 0,
+               (configPort1Verify & 0x20) ? 1 : 0, (configPort1Verify & 0x10) ? 1 : 0,
+               (configPort1Verify & 0x08) ? 1 : 0, (configPort1Verify & 0x04) ? 1 : 0,
+               (configPort1Verify & 0x02) ? 1 : 0, (configPort1Verify & 0x01) ? 1 : 0);
+  }
+  
+  // Verify initial relay state
+  uint8_t initialRelayState = io.readRegister(OUTPUT_PORT1);
+  LOG_INFO("Initial Port 1 Output State: 0x%02X (all relays should be OFF)", initialRelayState);
+  
+  // Enable interrupt for coin acceptor pins
+  LOG_INFO("Enabling interrupt for coin acceptor (COIN_SIG on bit %d)...", COIN_SIG);
+  io.enableInterrupt(0, 0xc0); // Enable interrupt for upper bits including COIN_SIG
+  
+  // Configure interrupt pin
+  if (BAY_INT_PINS[bay.id] >= 0) {
+    pinMode(BAY_INT_PINS[bay.id], INPUT_PULLUP);
+    LOG_INFO("Interrupt pin %d configured with pull-up", BAY_INT_PINS[bay.id]);
+  } else {
+    LOG_INFO("No interrupt pin - PORT0 polled every %lu ms", INPUT_POLL_NO_INT_MS);
+  }
+  
+  // Read initial state
+  uint8_t initialPortValue = io.readRegister(INPUT_PORT0);
+  LOG_INFO("Initial port value: 0x%02X", initialPortValue);
+  LOG_INFO("Initial COIN_SIG state: %d", (initialPortValue & (1 << COIN_SIG)) ? 1 : 0);
+  
+  LOG_INFO("TCA9535 fully initialized. Ready to control relays and read buttons.");
+  
+  // Create FreeRTOS task for interrupt-driven coin and button capture
+  LOG_INFO("Creating FreeRTOS input reader task for coin and button detection...");
+  
+  char name[16];
+  snprintf(name, sizeof(name), bay.id == 0 ? "InputReader" : "InputReader%d", bay.id);
+  int core = BAY_TASK_CORES[bay.id];
+  xTaskCreatePinnedToCore(
+      TaskInputReader,            // Task function
+      name,                       // Task name
+      INPUT_READER_STACK_SIZE,    // Stack size (bytes)
+      &bay,                       // Task parameters
+      2,                          // Priority (above loop so INT edges are serviced promptly)
+      &bay.inputReaderHandle,     // Task handle
+      core < 0 ? tskNO_AFFINITY : core
+  );
+  
+  Profiler::registerTask(bay.inputReaderHandle, INPUT_READER_STACK_SIZE);
+  LOG_INFO("Input reader task created successfully!");
+  LOG_INFO("=== BAY %d READY FOR COIN DETECTION ===", bay.id);
+  return true;
+}
+
+// Extra bays run their controller on a task pinned next to their InputReader
+static void startBayController(Bay& bay) {
+  char name[16];
+  snprintf(name, sizeof(name), "Bay%d", bay.id);
+  int core = BAY_TASK_CORES[bay.id];
+  if (xTaskCreatePinnedToCore(TaskBayController, name, BAY_CONTROLLER_STACK_SIZE, &bay, 1,
+                              &bay.controllerHandle, core < 0 ? tskNO_AFFINITY : core) != pdPASS) {
+    LOG_ERROR("Failed to create bay %d controller task - bay disabled", bay.id);
+    return;
+  }
+  Profiler::registerTask(bay.controllerHandle, BAY_CONTROLLER_STACK_SIZE);
 }
 
 void setup() {
   // Initialize serial FIRST for debug output during double-reset detection
   Serial.begin(115200);
-  delay(100);  // Brief delay for serial to stabilize
+  
+  // Boot readiness bits and the shared-bus mutexes have no dependencies and
+  // are needed by every init step, so they come first
+  xBootEvents = xEventGroupCreate();
+  xIoExpanderMutex = xSemaphoreCreateMutex();
+  xControllerMutex = xSemaphoreCreateMutex();
+  xI2CMutex = xSemaphoreCreateMutex();  // For Wire1 (LCD)
+  
+  // Bay 0 uses the board's TCA9535; extra bays get theirs on the same Wire bus
+  for (uint8_t i = 0; i < BAY_COUNT; i++) {
+    Bay& bay = bays[i];
+    bay.id = i;
+    bay.io = i == 0 ? &ioExpander
+                    : new IoExpander(BAY_EXPANDER_ADDRESSES[i], I2C_SDA_PIN, I2C_SCL_PIN, BAY_INT_PINS[i]);
+    bay.io->setTraceBay(i);
+    bay.controller = NULL;
+    bay.inputReaderHandle = NULL;
+    bay.controllerHandle = NULL;
+    bay.coinLowReads = 0;
+    bay.coinTriggered = true;
+    bay.lastCoinTransition = 0;
+    bay.coinDetectorStarted = false;
+    bay.lastPortValue = 0xFF;
+  }
   
   // =========================================================================
   // DOUBLE-TAP RESET DETECTION - Must be FIRST thing in setup!
   // Press reset twice within 3 seconds to trigger factory reset
+  // (the window runs in the background; boot does not wait for it)
   // =========================================================================
-  checkDoubleResetAndWait();
+  checkDoubleReset();
   
   // Initialize Logger with default log level (after double-reset check)
   Logger::init(DEFAULT_LOG_LEVEL, 115200);
-  delay(500); // Brief delay after logger init
+  
+  if (xBootEvents == NULL || xIoExpanderMutex == NULL || xControllerMutex == NULL || xI2CMutex == NULL) {
+    LOG_ERROR("Failed to create boot event group or mutexes!");
+  }
+  
+  // Move UART output to the LogDrain task so input/display tasks never block on Serial
+  Logger::startAsync();
+  
+  // Task/heap/mutex statistics for the "stats" console and MQTT command
+  Profiler::begin();
+  Profiler::registerTask(xTaskGetCurrentTaskHandle(), getArduinoLoopTaskStackSize());
+  Profiler::setEventTask(xTaskGetCurrentTaskHandle());  // loop() drains the input events
+  
+  // Binary event trace ("trace" console command, dump_trace, BLE TRACE)
+  Trace::begin();
+  
+  // DFS / light sleep for the low-power FREE mode (starts at full rate)
+  PowerManager::begin();
   
   LOG_INFO("Starting fullwash-pcb-firmware...");
   
@@ -1134,131 +1658,84 @@ void setup() {
   LOG_INFO("AWS Client ID set to: %s", AWS_CLIENT_ID.c_str());
   LOG_INFO("====================================");
   
-  // Set up the built-in LED
+  // Set up the built-in LED (blinking while the reset window is open)
   pinMode(LED_PIN, OUTPUT);
-  digitalWrite(LED_PIN, HIGH); // Turn ON LED to show power
   
-  // Initialize the I/O expander
-  LOG_INFO("Trying to initialize TCA9535...");
-  bool initSuccess = ioExpander.begin();
+  // Wire1 (display) comes up on core 0 alongside the IO expander on Wire
+  xDisplayMailbox = xQueueCreate(1, sizeof(DisplaySnapshot));
+  if (xDisplayMailbox == NULL) {
+    LOG_ERROR("Failed to create display mailbox!");
+  }
+  if (xTaskCreatePinnedToCore(TaskInitWire1, "InitWire1", INIT_WIRE1_STACK_SIZE,
+                              NULL, 3, NULL, 0) != pdPASS) {
+    LOG_ERROR("Failed to create Wire1 init task - display disabled");
+    xEventGroupSetBits(xBootEvents, BOOT_DISPLAY_READY);
+  }
   
-  if (!initSuccess) {
-    LOG_ERROR("Failed to initialize TCA9535!");
-    LOG_WARNING("Will continue without initialization. Check connections.");
-    
-    // Blink LED rapidly to indicate error
-    for (int i = 0; i < 10; i++) {
-      digitalWrite(LED_PIN, !digitalRead(LED_PIN));
-      delay(100);
-    }
-    
-    // Continue anyway - don't get stuck in a loop
-  } else {
-    LOG_INFO("TCA9535 initialization successful!");
-    
-    // Configure Port 0 (buttons) as inputs (1 = input, 0 = output)
-    ioExpander.configurePortAsInput(0, 0xFF);
-    
-    // Configure Port 1 (relays) as outputs (1 = input, 0 = output)
-    ioExpander.configurePortAsOutput(1, 0xFF);
-    
-    // Initialize all relays to OFF state
-    ioExpander.writeRegister(OUTPUT_PORT1, 0x00);
-    
-    // Verify Port 1 configuration
-    uint8_t configPort1Verify = ioExpander.readRegister(CONFIG_PORT1);
-    LOG_INFO("Port 1 Configuration Register: 0x%02X (should be 0x00 for all outputs)", configPort1Verify);
-    if (configPort1Verify != 0x00) {
-        LOG_ERROR("WARNING: Port 1 not fully configured as outputs! Some pins may be inputs.");
-        LOG_ERROR("Port 1 Config: 0x%02X (binary: %d%d%d%d%d%d%d%d)", 
-                 configPort1Verify,
-                 (configPort1Verify & 0x80) ? 1 : 0, (configPort1Verify & 0x40) ? 1 : 0,
-                 (configPort1Verify & 0x20) ? 1 : 0, (configPort1Verify & 0x10) ? 1 : 0,
-                 (configPort1Verify & 0x08) ? 1 : 0, (configPort1Verify & 0x04) ? 1 : 0,
-                 (configPort1Verify & 0x02) ? 1 : 0, (configPort1Verify & 0x01) ? 1 : 0);
-    }
-    
-    // Verify initial relay state
-    uint8_t initialRelayState = ioExpander.readRegister(OUTPUT_PORT1);
-    LOG_INFO("Initial Port 1 Output State: 0x%02X (all relays should be OFF)", initialRelayState);
-    
-    // Enable interrupt for coin acceptor pins
-    LOG_INFO("Enabling interrupt for coin acceptor (COIN_SIG on bit %d)...", COIN_SIG);
-    ioExpander.enableInterrupt(0, 0xc0); // Enable interrupt for upper bits including COIN_SIG
-    
-    // Configure interrupt pin
-    pinMode(INT_PIN, INPUT_PULLUP);
-    LOG_INFO("Interrupt pin %d configured with pull-up", INT_PIN);
-    
-    // Read initial state
-    uint8_t initialPortValue = ioExpander.readRegister(INPUT_PORT0);
-    LOG_INFO("Initial port value: 0x%02X", initialPortValue);
-    LOG_INFO("Initial COIN_SIG state: %d", (initialPortValue & (1 << COIN_SIG)) ? 1 : 0);
-    
-    LOG_INFO("TCA9535 fully initialized. Ready to control relays and read buttons.");
-    
-  // Initialize FreeRTOS mutexes for shared resources
-  LOG_INFO("Initializing FreeRTOS mutexes...");
-  xIoExpanderMutex = xSemaphoreCreateMutex();
-  xControllerMutex = xSemaphoreCreateMutex();
-  xI2CMutex = xSemaphoreCreateMutex();  // For Wire1 (LCD)
+  // BLE starts on core 0 as soon as the controller exists
+  if (xTaskCreatePinnedToCore(TaskInitBle, "InitBle", INIT_BLE_STACK_SIZE,
+                              new String(machineNum), 1, NULL, 0) != pdPASS) {
+    LOG_ERROR("Failed to create BLE init task - BLE disabled");
+    xEventGroupSetBits(xBootEvents, BOOT_BLE_READY);
+  }
   
-  if (xIoExpanderMutex == NULL || xControllerMutex == NULL || xI2CMutex == NULL) {
-        LOG_ERROR("Failed to create mutexes!");
-    } else {
-        LOG_INFO("Mutexes created successfully");
-    }
-    
-    // Initialize FreeRTOS queue for MQTT message publishing
-    LOG_INFO("Initializing MQTT publish queue...");
-    xMqttPublishQueue = xQueueCreate(MQTT_QUEUE_SIZE, sizeof(MqttMessage));
-    
-    if (xMqttPublishQueue == NULL) {
-        LOG_ERROR("Failed to create MQTT publish queue!");
-    } else {
-        LOG_INFO("MQTT publish queue created successfully (size: %d)", MQTT_QUEUE_SIZE);
+  // Input events wake the loop task (setup() and loop() share it); events
+  // captured before the controller exists wait in the queue. Extra bays'
+  // controller tasks register themselves when they start.
+  ioExpander.setInputEventConsumer(xTaskGetCurrentTaskHandle());
+  
+  // Initialize the I/O expanders, bay 0 first
+  for (uint8_t i = 0; i < BAY_COUNT; i++) {
+    if (!startBayIo(bays[i]) && i == 0) {
+      LOG_WARNING("Will continue without initialization. Check connections.");
+      
+      // loop() blinks the LED rapidly to indicate the error; boot carries on
+      ioErrorBlinksLeft = 10;
     }
-    
-    // Create FreeRTOS tasks for dedicated interrupt handling
-    LOG_INFO("Creating FreeRTOS tasks for coin and button detection...");
-    
-    xTaskCreate(
-        TaskCoinDetector,           // Task function
-        "CoinDetection",            // Task name
-        4096,                       // Stack size (increased from 2048 to prevent overflow)
-        NULL,                       // Task parameters
-        1,                          // Priority
-        &TaskCoinDetectorHandle     // Task handle
-    );
-    
-    xTaskCreate(
-        TaskButtonDetector,         // Task function
-        "ButtonDetector",           // Task name (for debugging)
-        4096,                       // Stack size (bytes)
-        NULL,                       // Task parameters
-        1,                          // Priority (5 = highest priority for immediate button response)
-        &TaskButtonDetectorHandle   // Task handle
-    );
-    
-    LOG_INFO("Coin detection task created successfully!");
-    LOG_INFO("=== READY FOR COIN DETECTION ===");
-    LOG_INFO("Insert coins to test detection...");
   }
-  // Initialize Wire1 for the 7-segment display
-  LOG_INFO("Initializing Wire1 (I2C) for 7-segment display...");
-  Wire1.begin(DISPLAY_SDA_PIN, DISPLAY_SCL_PIN);
-  Wire1.setClock(100000); // Set I2C clock to 100kHz (standard mode)
+  xEventGroupSetBits(xBootEvents, BOOT_IO_READY);
   
-  // Initialize the controller
-  controller = new CarWashController(mqttClient);
+#if ENABLE_MQTT
+  // Initialize FreeRTOS queue for MQTT message publishing
+  LOG_INFO("Initializing MQTT publish queue...");
+  // Messages are stored in the pool; the queue only carries 2-byte handles
+  if (!mqttMessagePool.begin()) {
+    LOG_ERROR("Failed to create MQTT message pool!");
+  }
+  // Recover the critical-message outbox (read-only until something is stored)
+  mqttOutbox.begin();
+  xMqttPublishQueue = xQueueCreate(MQTT_QUEUE_SIZE, sizeof(MqttMessageHandle));
   
-  // Initialize the 7-segment display
-  display = new DisplayManager(DISPLAY_SDA_PIN, DISPLAY_SCL_PIN);
-  // Set I2C mutex for display manager
-  display->setI2CMutex(xI2CMutex);
+  if (xMqttPublishQueue == NULL) {
+    LOG_ERROR("Failed to create MQTT publish queue!");
+  } else {
+    LOG_INFO("MQTT publish queue created successfully (size: %d, pool blocks: %u)",
+             MQTT_QUEUE_SIZE, mqttMessagePool.getCapacity());
+  }
+#endif // ENABLE_MQTT
+  
+#ifdef COIN_PCNT_PIN
+  // Hardware coin counting (independent of the IO expander); its edge
+  // interrupt times each pulse and wakes the loop task, which runs bay 0's
+  // controller, once one is accepted
+  coinCounter.setWakeTask(xTaskGetCurrentTaskHandle());
+  if (!coinCounter.begin()) {
+    LOG_ERROR("Failed to start PCNT coin counter on GPIO %d - coins will not be counted!", COIN_PCNT_PIN);
+  }
+#endif
+
+  // Initialize the controllers (bay 0's feeds the display)
+  for (uint8_t i = 0; i < BAY_COUNT; i++) {
+    bays[i].controller = new CarWashController(mqttClient, i, *bays[i].io, i == 0 ? xDisplayMailbox : NULL);
+  }
+  controller = bays[0].controller;
+  for (uint8_t i = 1; i < BAY_COUNT; i++) {
+    startBayController(bays[i]);
+  }
+  xEventGroupSetBits(xBootEvents, BOOT_CONTROLLER_READY);
+  LOG_INFO("%d controller(s) ready at %lu ms - insert coins to test detection...", BAY_COUNT, millis());
   
-  // MQTT initialization commented out - using BLE only
-  /* DISABLED - BLE ONLY MODE
+#if ENABLE_MQTT
   // Initialize MQTT client with callback
   mqttClient.setCallback(mqtt_callback);
   mqttClient.setBufferSize(512);
@@ -1266,6 +1743,8 @@ void setup() {
   // Initialize modem and connect to network (in setup, network task will handle reconnections)
   LOG_INFO("Initializing modem and connecting to network...");
   if (mqttClient.begin(apn, gprsUser, gprsPass, pin)) {
+    LOG_INFO("Network up (%s, %lu ms, operator: %s)", bringUpPathName(mqttClient.getBringUpPath()),
+             mqttClient.getBringUpDuration(), mqttClient.getOperatorName());
     // Configure SSL certificates
     mqttClient.setCACert(AmazonRootCA);
     mqttClient.setCertificate(AWSClientCertificate);
@@ -1276,95 +1755,182 @@ void setup() {
     if (mqttClient.connect(AWS_BROKER, AWS_BROKER_PORT, AWS_CLIENT_ID.c_str())) {
       LOG_INFO("Connected to MQTT broker!");
       
-      mqttClient.subscribe(INIT_TOPIC.c_str());
-      mqttClient.subscribe(CONFIG_TOPIC.c_str());
-      mqttClient.subscribe(COMMAND_TOPIC.c_str());
-      mqttClient.subscribe(GET_STATE_TOPIC.c_str());
+      // Every bay's topics share this session
+      for (uint8_t i = 0; i < BAY_COUNT; i++) {
+        mqttClient.subscribe(mqttTopic(TOPIC_INIT, i));
+        mqttClient.subscribe(mqttTopic(TOPIC_CONFIG, i));
+        mqttClient.subscribe(mqttTopic(TOPIC_COMMAND, i));
+        mqttClient.subscribe(mqttTopic(TOPIC_GET_STATE, i));
+      }
       
       delay(4000);
       LOG_INFO("Publishing Setup Action Event...");
-      controller->publishMachineSetupActionEvent();
+      for (uint8_t i = 0; i < BAY_COUNT; i++) {
+        bays[i].controller->publishMachineSetupActionEvent();
+      }
     } else {
       LOG_ERROR("Failed to connect to MQTT broker");
     }
   } else {
     LOG_ERROR("Failed to initialize modem");
   }
-  */ // END DISABLED - BLE ONLY MODE
-  
-  // Initialize BLE Machine Loader for direct machine loading
-  LOG_INFO("Initializing BLE Machine Loader...");
-  bleMachineLoader = new BLEMachineLoader();
-  if (bleMachineLoader->begin(machineNum, controller)) {
-    LOG_INFO("BLE Machine Loader initialized successfully!");
-    LOG_INFO("Device name: FullWash-%s", machineNum.c_str());
-    LOG_INFO("Machine will advertise via BLE when FREE");
-  } else {
-    LOG_ERROR("Failed to initialize BLE Machine Loader");
-  }
   
-  // Network Manager task commented out - using BLE only
-  /* DISABLED - BLE ONLY MODE
   // Create Network Manager task (handles all network/MQTT operations)
   LOG_INFO("Creating Network Manager task...");
   xTaskCreatePinnedToCore(
       TaskNetworkManager,           // Task function
       "NetworkManager",             // Task name
-      16384,                        // Stack size (bytes) - SSL/TLS requires large stack (16KB)
+      NETWORK_MANAGER_STACK_SIZE,   // Stack size (bytes) - SSL/TLS requires large stack (16KB)
       NULL,                         // Task parameters
       2,                            // Priority (2 = medium priority)
       &TaskNetworkManagerHandle,    // Task handle
       1                             // Pin to core 1 (APP CPU)
   );
-  */ // END DISABLED - BLE ONLY MODE
+  Profiler::registerTask(TaskNetworkManagerHandle, NETWORK_MANAGER_STACK_SIZE);
+#endif // ENABLE_MQTT
   
   // Create Watchdog task (monitors system health)
   LOG_INFO("Creating Watchdog task...");
   xTaskCreatePinnedToCore(
       TaskWatchdog,                 // Task function
       "Watchdog",                   // Task name
-      2048,                         // Stack size (bytes)
+      WATCHDOG_STACK_SIZE,          // Stack size (bytes)
       NULL,                         // Task parameters
       1,                            // Priority (1 = lowest priority - monitoring only)
       &TaskWatchdogHandle,          // Task handle
       1                             // Pin to core 1 (APP CPU)
   );
+  Profiler::registerTask(TaskWatchdogHandle, WATCHDOG_STACK_SIZE);
   
   // Create Display Update task (handles LCD refresh independently)
   LOG_INFO("Creating Display Update task...");
   xTaskCreatePinnedToCore(
       TaskDisplayUpdate,            // Task function
       "DisplayUpdate",              // Task name
-      4096,                         // Stack size (bytes) - needs more for String operations
+      DISPLAY_UPDATE_STACK_SIZE,    // Stack size (bytes) - needs more for String operations
       NULL,                         // Task parameters
       3,                            // Priority (3 = medium-high, same as coin detector)
       &TaskDisplayUpdateHandle,     // Task handle
       0                             // Pin to core 0 (PRO CPU) - keep display responsive
   );
+  Profiler::registerTask(TaskDisplayUpdateHandle, DISPLAY_UPDATE_STACK_SIZE);
   
-  // MQTT Publisher task commented out - using BLE only
-  /* DISABLED - BLE ONLY MODE
+#if ENABLE_MQTT
   // Create MQTT Publisher task (handles all MQTT publishing)
   LOG_INFO("Creating MQTT Publisher task...");
   xTaskCreatePinnedToCore(
       TaskMqttPublisher,            // Task function
       "MqttPublisher",              // Task name
-      8192,                         // Stack size (bytes) - needs space for MQTT operations
+      MQTT_PUBLISHER_STACK_SIZE,    // Stack size (bytes) - needs space for MQTT operations
       NULL,                         // Task parameters
       2,                            // Priority (2 = SAME as NetworkManager, not higher - prevents monopolizing mutex)
       &TaskMqttPublisherHandle,     // Task handle
       1                             // Pin to core 1 (APP CPU) - same as network operations
   );
-  */ // END DISABLED - BLE ONLY MODE
+  Profiler::registerTask(TaskMqttPublisherHandle, MQTT_PUBLISHER_STACK_SIZE);
+#endif // ENABLE_MQTT
   
-  LOG_INFO("All FreeRTOS tasks created successfully");
+  LOG_INFO("All FreeRTOS tasks created successfully (display and BLE finish in the background)");
+}
+
+/**
+ * Serial console: line-based debug commands typed on the USB serial port
+ * - "stats": task stack, heap and bus latency statistics
+ * - "stats reset": zero the mutex/bus latency counters
+ */
+// Trace dumps in progress; loop() streams a few blocks per pass so a full
+// ring never stalls the controller
+static TraceCursor consoleTraceCursor;
+#if ENABLE_MQTT
+static TraceCursor mqttTraceCursor;
+#endif
+
+// One "#TRACE <hex>" line per block, written with a single Serial.write so
+// log lines from the drain task never land inside it
+static void streamTraceToConsole() {
+  uint8_t block[Trace::BLOCK_HEADER_SIZE + TRACE_SERIAL_BLOCK_RECORDS * sizeof(TraceRecord)];
+  char line[8 + sizeof(block) * 2 + 3];
+  static const char HEX_DIGITS[] = "0123456789abcdef";
   
-  // Final blink pattern to indicate setup complete
-  for (int i = 0; i < 2; i++) {
-    digitalWrite(LED_PIN, LOW);
-    delay(200);
-    digitalWrite(LED_PIN, HIGH);
-    delay(200);
+  for (uint8_t i = 0; i < TRACE_SERIAL_BLOCKS_PER_PASS && consoleTraceCursor.active; i++) {
+    size_t length = Trace::readDump(consoleTraceCursor, block, sizeof(block), TRACE_SERIAL_BLOCK_RECORDS);
+    if (length == 0) {
+      break;
+    }
+    size_t pos = 0;
+    memcpy(line, "#TRACE ", 7);
+    pos = 7;
+    for (size_t b = 0; b < length; b++) {
+      line[pos++] = HEX_DIGITS[block[b] >> 4];
+      line[pos++] = HEX_DIGITS[block[b] & 0x0F];
+    }
+    line[pos++] = '\r';
+    line[pos++] = '\n';
+    Serial.write(reinterpret_cast<const uint8_t*>(line), pos);
+  }
+}
+
+#if ENABLE_MQTT
+// Binary blocks on the trace topic, requested with the dump_trace command
+static void streamTraceToMqtt() {
+  uint32_t request = mqttTraceRequest;
+  if (request != 0) {
+    mqttTraceRequest = 0;
+    Trace::startDump(mqttTraceCursor, request - 1);
+  }
+  if (!mqttTraceCursor.active || !controller) {
+    return;
+  }
+  uint8_t block[Trace::BLOCK_HEADER_SIZE + TRACE_MQTT_BLOCK_RECORDS * sizeof(TraceRecord)];
+  for (uint8_t i = 0; i < TRACE_MQTT_BLOCKS_PER_PASS && mqttTraceCursor.active; i++) {
+    TraceCursor before = mqttTraceCursor;
+    size_t length = Trace::readDump(mqttTraceCursor, block, sizeof(block), TRACE_MQTT_BLOCK_RECORDS);
+    if (length == 0) {
+      break;
+    }
+    if (!controller->queueMqttPayload(TOPIC_TRACE, block, length, QOS0_AT_MOST_ONCE, false)) {
+      // Pool or queue full: retry this block on the next pass
+      mqttTraceCursor = before;
+      break;
+    }
+  }
+}
+#endif // ENABLE_MQTT
+
+static void handleSerialConsole() {
+  static char line[32];
+  static size_t length = 0;
+  
+  while (Serial.available() > 0) {
+    int c = Serial.read();
+    if (c != '\n' && c != '\r') {
+      if (length < sizeof(line) - 1) {
+        line[length++] = (char)c;
+      }
+      continue;
+    }
+    if (length == 0) {
+      continue;
+    }
+    line[length] = '\0';
+    length = 0;
+    
+    if (strcmp(line, "stats") == 0) {
+      Profiler::sample();
+      Profiler::printStats();
+      LOG_INFO("Power: %s, entered low-power mode %lu times, %lu ms total",
+               PowerManager::isLowPower() ? "low-power" : "full rate",
+               (unsigned long)PowerManager::getLowPowerEntries(), PowerManager::getLowPowerTime());
+    } else if (strcmp(line, "stats reset") == 0) {
+      Profiler::resetLatencyStats();
+      LOG_INFO("Latency statistics reset");
+    } else if (strcmp(line, "trace") == 0 || strcmp(line, "trace all") == 0) {
+      // Decode with tools/trace_decode.py on the captured serial log
+      Trace::startDump(consoleTraceCursor, line[5] == '\0' ? TRACE_CONSOLE_DEFAULT_RECORDS : 0);
+      LOG_INFO("Trace dump: %lu records", (unsigned long)(consoleTraceCursor.end - consoleTraceCursor.next));
+    } else {
+      LOG_INFO("Unknown console command: %s (try \"stats\" or \"trace\")", line);
+    }
   }
 }
 
@@ -1384,9 +1950,9 @@ void loop() {
     lastBleUpdate = currentTime;
     bleMachineLoader->update();
     
-    // Manage BLE advertising based on machine state
+    // Manage BLE advertising based on machine state (any bay left to load)
     if (controller) {
-      bool isMachineFree = (controller->getCurrentState() == STATE_FREE);
+      bool isMachineFree = bleMachineLoader->isAnyBayFree();
       
       // Start advertising when machine becomes FREE
       if (isMachineFree && !lastMachineFree) {
@@ -1403,31 +1969,51 @@ void loop() {
     }
   }
   
-  // NOTE: Network operations disabled - using BLE only
+  // NOTE: Network operations run on TaskNetworkManager (ENABLE_MQTT builds only)
+  
+  handleSerialConsole();
+  streamTraceToConsole();
+#if ENABLE_MQTT
+  streamTraceToMqtt();
+#endif
   
     // Periodic check (no logging to reduce overhead)
     if (currentTime - lastIoDebugCheck > 4000) {  // Every 4 seconds
         lastIoDebugCheck = currentTime;
     }
 
-  // NOTE: Interrupt handling is now done by FreeRTOS tasks (TaskCoinDetector and TaskButtonDetector)
-  // The old ioExpander.handleInterrupt() call is no longer needed
+  // NOTE: Interrupt handling is now done by the TaskInputReader FreeRTOS task
   
-  // Run controller update - now processes flags set by FreeRTOS tasks
-  // CRITICAL: Call update() continuously for responsive button handling
-  // Removed timing check to ensure update() runs as frequently as possible
-  // This ensures button flags are processed immediately when set
-if (controller) {
+  // Run bay 0's controller update - drains input events queued by its
+  // InputReader task (the other bays run on their own tasks)
+  if (controller) {
       controller->update();
   }
   
+  // Packed BLE status goes out right after the update that changed it,
+  // instead of waiting for the 1 s bleMachineLoader->update()
+  if (bleMachineLoader) {
+      bleMachineLoader->publishStatus();
+      bleMachineLoader->streamTrace();
+  }
+  
   
   // NOTE: Display updates are now handled by TaskDisplayUpdate FreeRTOS task
-  // Removed from main loop to ensure consistent refresh rate
+  // The controller pushes display snapshots from update() via xDisplayMailbox
   
   // Handle LED indicator
   // Simple pattern for BLE mode
-  if (controller && controller->isMachineLoaded()) {
+  if ((xEventGroupGetBits(xBootEvents) & BOOT_RESET_WINDOW_CLOSED) == 0) {
+    // TaskResetWindow owns the LED until the double-reset window closes
+  } else if (ioErrorBlinksLeft > 0) {
+    // Rapid blink when bay 0's IO expander failed to start
+    if (currentTime - lastLedToggle > 100) {
+      lastLedToggle = currentTime;
+      ledState = !ledState;
+      digitalWrite(LED_PIN, ledState);
+      ioErrorBlinksLeft--;
+    }
+  } else if (controller && controller->isMachineLoaded()) {
     // Solid LED when machine is loaded
     digitalWrite(LED_PIN, HIGH);
     ledState = HIGH;
@@ -1447,8 +2033,34 @@ if (controller) {
     }
   }
   
-  // Use FreeRTOS delay to yield to other tasks without blocking
-  // This allows FreeRTOS to schedule button/coin detector tasks and network tasks
-  // 1 tick = typically 10ms, but we use 1ms to ensure frequent updates
-  vTaskDelay(pdMS_TO_TICKS(1));
+  // Low-power FREE mode once every bay is FREE with no BLE client for a
+  // while; any bay's InputReader leaves it on the next coin/button edge
+  if (controller) {
+    bool allFree = true;
+    for (uint8_t i = 0; i < BAY_COUNT; i++) {
+      allFree = allFree && bays[i].controller->getCurrentState() == STATE_FREE;
+    }
+#ifdef COIN_PCNT_PIN
+    // Bay 0's counted coins skip the InputReader, so leave low power here (the
+    // ISR cannot take the PowerManager mutex)
+    if (coinCounter.takeWake()) {
+      PowerManager::noteActivity();
+    }
+#endif
+    PowerManager::update(allFree && !(bleMachineLoader && bleMachineLoader->isConnected()));
+  }
+  
+  // Sleep until the InputReader queues a coin/button event, or until the
+  // next housekeeping tick (timeouts, LED pattern, BLE state); only yield
+  // for a tick while a trace dump is streaming
+  bool tracing = consoleTraceCursor.active || (bleMachineLoader && bleMachineLoader->isStreamingTrace());
+#if ENABLE_MQTT
+  tracing = tracing || mqttTraceCursor.active;
+#endif
+  TickType_t wait = tracing ? 1 : PowerManager::idleWaitTicks();
+  if (controller) {
+    controller->waitForInput(wait);
+  } else {
+    vTaskDelay(wait);
+  }
 }
\ No newline at end of file
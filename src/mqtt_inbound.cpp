@@ -0,0 +1,114 @@
+#include "mqtt_inbound.h"
+#include "wire_format.h"
+#include "logger.h"
+
+MqttInboundDocument mqttInbound;
+
+ArenaAllocator::ArenaAllocator(uint8_t* buffer, size_t size)
+    : _buffer(buffer), _size(size), _used(0), _peak(0), _last(NULL) {
+}
+
+void* ArenaAllocator::allocate(size_t size) {
+    size_t needed = HEADER_SIZE + align(size);
+    if (needed > _size - _used) {
+        return NULL;  // ArduinoJson reports NoMemory
+    }
+    void* ptr = _buffer + _used + HEADER_SIZE;
+    blockSize(ptr) = size;
+    _used += needed;
+    if (_used > _peak) {
+        _peak = _used;
+    }
+    _last = ptr;
+    return ptr;
+}
+
+void ArenaAllocator::deallocate(void* ptr) {
+    if (ptr != NULL && ptr == _last) {
+        _used = (static_cast<uint8_t*>(ptr) - _buffer) - HEADER_SIZE;
+        _last = NULL;
+    }
+}
+
+void* ArenaAllocator::reallocate(void* ptr, size_t newSize) {
+    if (ptr == NULL) {
+        return allocate(newSize);
+    }
+    if (ptr == _last) {
+        // Grow or shrink in place (string building, shrinkToFit)
+        size_t offset = static_cast<uint8_t*>(ptr) - _buffer;
+        if (align(newSize) > _size - offset) {
+            return NULL;
+        }
+        blockSize(ptr) = newSize;
+        _used = offset + align(newSize);
+        if (_used > _peak) {
+            _peak = _used;
+        }
+        return ptr;
+    }
+    size_t oldSize = blockSize(ptr);
+    void* moved = allocate(newSize);
+    if (moved != NULL) {
+        memcpy(moved, ptr, oldSize < newSize ? oldSize : newSize);
+    }
+    return moved;
+}
+
+void ArenaAllocator::reset() {
+    _used = 0;
+    _last = NULL;
+}
+
+MqttInboundDocument::MqttInboundDocument()
+    : _allocator(_arena, sizeof(_arena)), _doc(&_allocator) {
+}
+
+bool MqttInboundDocument::parse(const uint8_t* payload, size_t length) {
+    _doc.clear();
+    _allocator.reset();
+
+    if (length > MAX_PAYLOAD) {
+        LOG_WARNING("Rejected %u-byte payload (max %u)", (unsigned int)length, (unsigned int)MAX_PAYLOAD);
+        return false;
+    }
+    DeserializationError error = decodePayload(_doc, payload, length);
+    if (error) {
+        LOG_ERROR("Failed to parse %s payload: %s", isMsgPackPayload(payload, length) ? "MessagePack" : "JSON",
+                  error.c_str());
+        return false;
+    }
+    return true;
+}
+
+uint32_t commandHashOf(const char* name) {
+    uint32_t hash = 2166136261u;
+    for (; *name != '\0'; name++) {
+        hash = (hash ^ (uint8_t)*name) * 16777619u;
+    }
+    return hash;
+}
+
+// Confirms a hash match so names outside the table never alias a command
+static MqttCommand confirm(const char* name, const char* expected, MqttCommand command) {
+    return strcmp(name, expected) == 0 ? command : MQTT_COMMAND_UNKNOWN;
+}
+
+MqttCommand parseMqttCommand(const char* name) {
+    if (name == NULL) {
+        return MQTT_COMMAND_UNKNOWN;
+    }
+    switch (commandHashOf(name)) {
+        case commandHash("set_log_level"):      return confirm(name, "set_log_level", MQTT_COMMAND_SET_LOG_LEVEL);
+        case commandHash("simulate_coin"):      return confirm(name, "simulate_coin", MQTT_COMMAND_SIMULATE_COIN);
+        case commandHash("test_coin_signal"):   return confirm(name, "test_coin_signal", MQTT_COMMAND_TEST_COIN_SIGNAL);
+        case commandHash("stats"):              return confirm(name, "stats", MQTT_COMMAND_STATS);
+        case commandHash("debug_io"):           return confirm(name, "debug_io", MQTT_COMMAND_DEBUG_IO);
+        case commandHash("debug_network"):      return confirm(name, "debug_network", MQTT_COMMAND_DEBUG_NETWORK);
+        case commandHash("debug_ble"):          return confirm(name, "debug_ble", MQTT_COMMAND_DEBUG_BLE);
+        case commandHash("set_machine_number"): return confirm(name, "set_machine_number", MQTT_COMMAND_SET_MACHINE_NUMBER);
+        case commandHash("set_environment"):    return confirm(name, "set_environment", MQTT_COMMAND_SET_ENVIRONMENT);
+        case commandHash("dump_trace"):         return confirm(name, "dump_trace", MQTT_COMMAND_DUMP_TRACE);
+        default:                                return MQTT_COMMAND_UNKNOWN;
+    }
+}
@@ -1,5 +1,6 @@
 #include "mqtt_lte_client.h"
 #include "constants.h"
+#include <Preferences.h>
 #include <freertos/semphr.h>
 
 MqttLteClient::MqttLteClient(HardwareSerial& modemSerial, int pwrKeyPin, int dtrPin, int flightPin, 
@@ -16,27 +17,45 @@ MqttLteClient::MqttLteClient(HardwareSerial& modemSerial, int pwrKeyPin, int dtr
     // ESP32 task watchdog is ~5 seconds, so keep SSL operations well under that
     _sslClient->setTimeout(4000);  // 4 second timeout for SSL operations (safe for watchdog)
     
-    _mqttClient = new PubSubClient(*_sslClient);
+    _batchClient = new BatchingClient(*_sslClient);
+    _mqttClient = new PubSubClient(*_batchClient);
     _mqttClient->setSocketTimeout(4);  // 4 second timeout for socket operations
 
-    _subscribedTopics.reserve(5);
+    _subscribedTopics.reserve(4 * BAY_COUNT + 1);  // init/config/command/get_state per bay
 }
 
+// Last good network settings survive reboots so a cold bring-up can skip
+// modem writes that force a re-scan (AT+CNMP is stored in the modem's NVM)
+static const char* MODEM_PREFS_NAMESPACE = "modem";
+static const char* MODEM_PREFS_APN = "apn";
+static const char* MODEM_PREFS_OPERATOR = "operator";
+static const char* MODEM_PREFS_MODE_SET = "mode_set";
+
 bool MqttLteClient::begin(const char* apn, const char* user, const char* pass, const char* pin) {
     _apn = apn;
     _user = user;
     _pass = pass;
     _pin = pin;
     
+    unsigned long start = millis();
+    _bringUpPath = BRINGUP_FAILED;
+    loadNetworkCache();
+    
     // Initialize modem serial
     _modemSerial.begin(115200, SERIAL_8N1, _txPin, _rxPin);
-    delay(1000);
+    configureControlPins();
     
-    // Power on the modem with improved sequence
-    powerOnModem();
+    // Fast path: after an ESP32 reset or brownout the modem is often still
+    // powered and registered. A PWRKEY pulse would switch it OFF, so probe first.
+    bool modemInitialized = testModemAT(MODEM_WARM_PROBE_MS) && warmAttach();
     
-    // Try to initialize and connect the modem
-    bool modemInitialized = initModemAndConnectNetwork();
+    if (!modemInitialized) {
+        // Power on the modem with improved sequence
+        powerOnModem();
+        
+        // Try to initialize and connect the modem
+        modemInitialized = initModemAndConnectNetwork();
+    }
     
     if (!modemInitialized) {
         Serial.flush();
@@ -49,11 +68,12 @@ bool MqttLteClient::begin(const char* apn, const char* user, const char* pass, c
         modemInitialized = initModemAndConnectNetwork();
     }
     
+    _bringUpMs = millis() - start;
     _initialized = modemInitialized;
     return _initialized;
 }
 
-void MqttLteClient::powerOnModem() {
+void MqttLteClient::configureControlPins() {
     // Configure control pins
     pinMode(_pwrKeyPin, OUTPUT);
     pinMode(_dtrPin, OUTPUT);
@@ -62,10 +82,13 @@ void MqttLteClient::powerOnModem() {
     // CRITICAL FIX: Ensure proper DTR and Flight pin states
     // DTR LOW = active (modem stays awake)
     // Flight HIGH = flight mode disabled (radio active)
+    digitalWrite(_pwrKeyPin, LOW);  // PWRKEY released (no power toggle)
     digitalWrite(_dtrPin, LOW);     // Keep modem awake
     digitalWrite(_flightPin, HIGH); // Disable flight mode
     delay(100); // Let pins stabilize
-    
+}
+
+void MqttLteClient::powerOnModem() {
     // SIM7600G power on sequence (based on datasheet)
     digitalWrite(_pwrKeyPin, LOW);  // Ensure PWRKEY starts LOW
     delay(1000);
@@ -75,25 +98,27 @@ void MqttLteClient::powerOnModem() {
     
     digitalWrite(_pwrKeyPin, LOW);  // Release PWRKEY
     
-    delay(10000);  // Wait longer for the modem to boot
-    
-    clearModemBuffer();
-    
-    // Test AT command communication
-    bool atSuccess = testModemAT();
+    // Poll until the modem answers instead of a fixed boot delay
+    bool atSuccess = waitForModemReady(MODEM_BOOT_TIMEOUT_MS);
     
     if (!atSuccess) {
         // Alternative power on sequence sometimes needed for SIM7600
         digitalWrite(_pwrKeyPin, HIGH);
         delay(3000);
         digitalWrite(_pwrKeyPin, LOW);
-        delay(5000);
         
-        clearModemBuffer();
-        
-        // Test AT command again
-        atSuccess = testModemAT();
+        atSuccess = waitForModemReady(MODEM_BOOT_TIMEOUT_MS / 2);
+    }
+}
+
+bool MqttLteClient::waitForModemReady(unsigned long timeoutMs) {
+    unsigned long start = millis();
+    while (millis() - start < timeoutMs) {
+        if (testModemAT(MODEM_WARM_PROBE_MS)) {
+            return true;
+        }
     }
+    return false;
 }
 
 void MqttLteClient::clearModemBuffer() {
@@ -103,33 +128,49 @@ void MqttLteClient::clearModemBuffer() {
     }
 }
 
-bool MqttLteClient::testModemAT() {
+bool MqttLteClient::testModemAT(unsigned long timeoutMs) {
     clearModemBuffer();
     
-    // Flush any pending data
-    while (_modemSerial.available()) {
-        _modemSerial.read();
-    }
-    
     // Send AT command
     _modemSerial.println("AT");
     
-    // Wait for response
+    // Wait for response, returning as soon as OK arrives
     unsigned long start = millis();
-    String response = "";
+    char window[3] = {0, 0, 0};
     
-    while (millis() - start < 3000) {
+    while (millis() - start < timeoutMs) {
         if (_modemSerial.available()) {
-            char c = _modemSerial.read();
-            response += c;
+            window[0] = window[1];
+            window[1] = (char)_modemSerial.read();
+            if (window[0] == 'O' && window[1] == 'K') {
+                return true;
+            }
+        } else {
+            delay(5);
         }
     }
     
-    if (response.indexOf("OK") != -1) {
+    return false;
+}
+
+bool MqttLteClient::warmAttach() {
+    clearModemBuffer();
+    
+    // Still attached with a data session: just adopt it
+    if (_modem->isGprsConnected() && isValidIP(_modem->localIP().toString())) {
+        _networkConnected = true;
+        _bringUpPath = BRINGUP_WARM_ATTACHED;
         return true;
-    } else {
-        return false;
     }
+    
+    // Registered but the PDP context is gone: re-open it
+    if (_modem->isNetworkConnected() && finishAttach()) {
+        _bringUpPath = BRINGUP_WARM_REGISTERED;
+        return true;
+    }
+    
+    // Powered but not registered: full initialization without the power cycle
+    return false;
 }
 
 bool MqttLteClient::initModemAndConnectNetwork() {
@@ -162,12 +203,12 @@ bool MqttLteClient::initModemAndConnectNetwork() {
         }
     }
     
-    // Get modem info
-    String modemInfo = _modem->getModemInfo();
-    
-    // Set network mode to automatic (2G/3G/4G)
-    String networkMode;
-    networkMode = _modem->setNetworkMode(2);
+    // Set network mode to automatic (2G/3G/4G). Writing CNMP makes the modem
+    // re-scan, so only do it once per APN (the setting survives power cycles).
+    if (!_networkModeApplied) {
+        _modem->setNetworkMode(2);
+        _networkModeApplied = true;
+    }
     
     if (_pin && _modem->getSimStatus() != 3) {
         _modem->simUnlock(_pin);
@@ -182,6 +223,14 @@ bool MqttLteClient::initModemAndConnectNetwork() {
         return false;
     }
     
+    if (!finishAttach()) {
+        return false;
+    }
+    _bringUpPath = BRINGUP_COLD;
+    return true;
+}
+
+bool MqttLteClient::finishAttach() {
     // Connect to GPRS
     if (!_modem->gprsConnect(_apn, _user, _pass)) {
         return false;
@@ -213,12 +262,52 @@ bool MqttLteClient::initModemAndConnectNetwork() {
         }
         
         _networkConnected = true;
+        saveNetworkCache();
         return true;
     } else {
         return false;
     }
 }
 
+void MqttLteClient::loadNetworkCache() {
+    Preferences prefs;
+    prefs.begin(MODEM_PREFS_NAMESPACE, true);
+    String apn = prefs.getString(MODEM_PREFS_APN, "");
+    bool modeSet = prefs.getBool(MODEM_PREFS_MODE_SET, false);
+    String op = prefs.getString(MODEM_PREFS_OPERATOR, "");
+    prefs.end();
+    
+    // A different APN means a different SIM/provider: start from scratch
+    bool sameApn = _apn != NULL && apn == _apn;
+    _networkModeApplied = sameApn && modeSet;
+    strncpy(_cachedOperator, sameApn ? op.c_str() : "", sizeof(_cachedOperator) - 1);
+    _cachedOperator[sizeof(_cachedOperator) - 1] = '\0';
+}
+
+void MqttLteClient::saveNetworkCache() {
+    String op = _modem->getOperator();
+    bool changed = strcmp(op.c_str(), _cachedOperator) != 0;
+    
+    Preferences prefs;
+    prefs.begin(MODEM_PREFS_NAMESPACE, true);
+    bool stale = prefs.getString(MODEM_PREFS_APN, "") != _apn ||
+                 prefs.getBool(MODEM_PREFS_MODE_SET, false) != _networkModeApplied;
+    prefs.end();
+    
+    // Only write NVS when something changed (every warm re-attach ends here)
+    if (!changed && !stale) {
+        return;
+    }
+    strncpy(_cachedOperator, op.c_str(), sizeof(_cachedOperator) - 1);
+    _cachedOperator[sizeof(_cachedOperator) - 1] = '\0';
+    
+    prefs.begin(MODEM_PREFS_NAMESPACE, false);
+    prefs.putString(MODEM_PREFS_APN, _apn);
+    prefs.putBool(MODEM_PREFS_MODE_SET, _networkModeApplied);
+    prefs.putString(MODEM_PREFS_OPERATOR, _cachedOperator);
+    prefs.end();
+}
+
 void MqttLteClient::setCACert(const char* caCert) {
     // These operations are quick, but use timeout for consistency
     if (_mutex) {
@@ -412,6 +501,10 @@ bool MqttLteClient::publish(const char* topic, const char* payload, const uint8_
 }
 
 bool MqttLteClient::publishNonBlocking(const char* topic, const char* payload, const uint8_t qos, TickType_t timeoutMs) {
+    return publishNonBlocking(topic, reinterpret_cast<const uint8_t*>(payload), strlen(payload), qos, timeoutMs);
+}
+
+bool MqttLteClient::publishNonBlocking(const char* topic, const uint8_t* payload, size_t length, const uint8_t qos, TickType_t timeoutMs) {
     // Try to acquire mutex with timeout - if we can't get it immediately, skip publish
     // This prevents blocking critical operations like button handling
     if (_mutex) {
@@ -427,7 +520,7 @@ bool MqttLteClient::publishNonBlocking(const char* topic, const char* payload, c
     // Just try to publish if already connected
     bool ok = false;
     if (_mqttClient->connected()) {
-        ok = _mqttClient->publish(topic, payload);
+        ok = _mqttClient->publish(topic, payload, length);
         if (!ok) {
             notifyPublishFailure();  // Track failure for smart connectivity checking
         } else {
@@ -442,6 +535,55 @@ bool MqttLteClient::publishNonBlocking(const char* topic, const char* payload, c
     return ok;
 }
 
+size_t MqttLteClient::publishBatch(MqttMessage* const* messages, size_t count, TickType_t timeoutMs) {
+    if (count == 0) {
+        return 0;
+    }
+    
+    // One lock acquire for the whole burst
+    if (_mutex) {
+        if (xSemaphoreTakeRecursive(_mutex, pdMS_TO_TICKS(timeoutMs)) != pdTRUE) {
+            return 0;
+        }
+    }
+    
+    size_t committed = 0;  // Messages whose bytes were handed to the TLS layer
+    if (_mqttClient->connected()) {
+        size_t accepted = 0;
+        uint32_t flushes = _batchClient->getFlushCount();
+        
+        _batchClient->beginBatch();
+        for (size_t i = 0; i < count; i++) {
+            bool ok = _mqttClient->publish(messages[i]->topic(),
+                                           reinterpret_cast<const uint8_t*>(messages[i]->payload()),
+                                           messages[i]->payloadLength);
+            // An early (size threshold) flush carried every message before this one
+            if (_batchClient->getFlushCount() != flushes) {
+                flushes = _batchClient->getFlushCount();
+                committed = i;
+            }
+            if (!ok) {
+                break;
+            }
+            accepted = i + 1;
+        }
+        if (_batchClient->endBatch()) {
+            committed = accepted;
+        }
+        
+        if (committed < count) {
+            notifyPublishFailure();  // Track failure for smart connectivity checking
+        } else {
+            _consecutivePublishFailures = 0;
+        }
+    } else {
+        notifyPublishFailure();  // Track failure even when not connected
+    }
+    
+    if (_mutex) xSemaphoreGiveRecursive(_mutex);
+    return committed;
+}
+
 bool MqttLteClient::subscribe(const char* topic) {
     // CRITICAL FIX: Use timeout instead of portMAX_DELAY to prevent deadlock
     if (_mutex) {
@@ -632,7 +774,6 @@ bool MqttLteClient::isConnected() {
 
 bool MqttLteClient::isNetworkConnected() {
     static bool lastNetworkState = false;
-    static unsigned long lastStateChange = 0;
     static unsigned long lastCheckTime = 0;
     
     if (_modem) {
@@ -675,10 +816,7 @@ bool MqttLteClient::isNetworkConnected() {
         
         // Detect network state changes
         if (lastNetworkState != currentState) {
-            unsigned long timeSinceLastChange = now - lastStateChange;
-            
             lastNetworkState = currentState;
-            lastStateChange = now;
         }
         
         _networkConnected = currentState;
@@ -0,0 +1,163 @@
+#include "mqtt_message_pool.h"
+#include "constants.h"
+#include "logger.h"
+#include <string.h>
+
+MqttMessagePool mqttMessagePool;
+
+// Guards the slab free lists (held for a few instructions only)
+static portMUX_TYPE poolLock = portMUX_INITIALIZER_UNLOCKED;
+
+MqttMessagePool::MqttMessagePool()
+    : _arena(NULL),
+      _inPsram(false),
+      _allocationFailures(0) {
+    for (uint8_t c = 0; c < CLASS_COUNT; c++) {
+        _slabs[c].blocks = NULL;
+        _slabs[c].freeList = NULL;
+        _slabs[c].blockSize = 0;
+        _slabs[c].count = 0;
+        _slabs[c].freeTop = 0;
+    }
+}
+
+bool MqttMessagePool::begin() {
+    if (_arena != NULL) {
+        return true;
+    }
+
+    // Without PSRAM keep a quarter of the blocks so TLS still has internal heap
+    _inPsram = psramFound();
+    uint16_t divisor = _inPsram ? 1 : 4;
+
+    size_t arenaBytes = 0;
+    size_t indexCount = 0;
+    for (uint8_t c = 0; c < CLASS_COUNT; c++) {
+        _slabs[c].blockSize = MQTT_POOL_BLOCK_SIZES[c];
+        _slabs[c].count = MQTT_POOL_BLOCK_COUNTS[c] / divisor;
+        arenaBytes += (size_t)_slabs[c].blockSize * _slabs[c].count;
+        indexCount += _slabs[c].count;
+    }
+
+    _arena = static_cast<uint8_t*>(_inPsram ? ps_malloc(arenaBytes) : malloc(arenaBytes));
+    uint16_t* indices = static_cast<uint16_t*>(malloc(indexCount * sizeof(uint16_t)));
+    if (_arena == NULL || indices == NULL) {
+        LOG_ERROR("MQTT message pool: failed to allocate %u byte arena", (unsigned int)arenaBytes);
+        free(_arena);
+        free(indices);
+        _arena = NULL;
+        return false;
+    }
+
+    uint8_t* block = _arena;
+    for (uint8_t c = 0; c < CLASS_COUNT; c++) {
+        Slab& slab = _slabs[c];
+        slab.blocks = block;
+        slab.freeList = indices;
+        for (uint16_t i = 0; i < slab.count; i++) {
+            slab.freeList[i] = slab.count - 1 - i;
+        }
+        slab.freeTop = slab.count;
+        block += (size_t)slab.blockSize * slab.count;
+        indices += slab.count;
+    }
+
+    LOG_INFO("MQTT message pool ready: %u blocks, %u bytes in %s",
+             getCapacity(), (unsigned int)arenaBytes, _inPsram ? "PSRAM" : "internal RAM");
+    return true;
+}
+
+MqttMessageHandle MqttMessagePool::create(MqttTopicId topic, uint8_t bay, const char* payload, uint8_t qos,
+                                          bool isCritical) {
+    if (payload == NULL) {
+        return MQTT_INVALID_HANDLE;
+    }
+    return create(topic, bay, reinterpret_cast<const uint8_t*>(payload), strlen(payload), qos, isCritical);
+}
+
+MqttMessageHandle MqttMessagePool::create(MqttTopicId topic, uint8_t bay, const uint8_t* payload,
+                                          size_t payloadLength, uint8_t qos, bool isCritical) {
+    if (_arena == NULL || topic >= TOPIC_COUNT || bay >= BAY_COUNT || payload == NULL) {
+        return MQTT_INVALID_HANDLE;
+    }
+
+    // The topic still goes out with the packet, so it counts against the limit
+    size_t topicLength = mqttTopicLength(topic, bay);
+    if (topicLength + payloadLength > (size_t)MQTT_MESSAGE_MAX_SIZE) {
+        LOG_WARNING("MQTT message too large for pool (%u bytes): %s",
+                    (unsigned int)(topicLength + payloadLength), mqttTopic(topic, bay));
+        return MQTT_INVALID_HANDLE;
+    }
+    size_t needed = sizeof(MqttMessage) + payloadLength + 1;
+
+    // Take the smallest class that fits, falling back to larger ones when empty
+    uint8_t sizeClass = CLASS_COUNT;
+    uint16_t index = 0;
+    portENTER_CRITICAL(&poolLock);
+    for (uint8_t c = 0; c < CLASS_COUNT; c++) {
+        if (_slabs[c].blockSize >= needed && _slabs[c].freeTop > 0) {
+            sizeClass = c;
+            index = _slabs[c].freeList[--_slabs[c].freeTop];
+            break;
+        }
+    }
+    if (sizeClass == CLASS_COUNT) {
+        _allocationFailures++;
+    }
+    portEXIT_CRITICAL(&poolLock);
+
+    if (sizeClass == CLASS_COUNT) {
+        return MQTT_INVALID_HANDLE;
+    }
+
+    MqttMessageHandle handle = (MqttMessageHandle)((sizeClass << CLASS_SHIFT) | index);
+    MqttMessage* msg = get(handle);
+    msg->timestamp = millis();
+    msg->payloadLength = (uint16_t)payloadLength;
+    msg->topicId = (uint8_t)topic;
+    msg->bay = bay;
+    msg->qos = qos;
+    msg->isCritical = isCritical;
+    char* data = reinterpret_cast<char*>(msg + 1);
+    memcpy(data, payload, payloadLength);
+    data[payloadLength] = '\0';
+    return handle;
+}
+
+MqttMessage* MqttMessagePool::get(MqttMessageHandle handle) const {
+    uint8_t sizeClass = handle >> CLASS_SHIFT;
+    uint16_t index = handle & INDEX_MASK;
+    if (handle == MQTT_INVALID_HANDLE || sizeClass >= CLASS_COUNT || index >= _slabs[sizeClass].count) {
+        return NULL;
+    }
+    const Slab& slab = _slabs[sizeClass];
+    return reinterpret_cast<MqttMessage*>(slab.blocks + (size_t)index * slab.blockSize);
+}
+
+void MqttMessagePool::release(MqttMessageHandle handle) {
+    if (get(handle) == NULL) {
+        return;
+    }
+    Slab& slab = _slabs[handle >> CLASS_SHIFT];
+    portENTER_CRITICAL(&poolLock);
+    if (slab.freeTop < slab.count) {
+        slab.freeList[slab.freeTop++] = handle & INDEX_MASK;
+    }
+    portEXIT_CRITICAL(&poolLock);
+}
+
+uint16_t MqttMessagePool::getCapacity() const {
+    uint16_t total = 0;
+    for (uint8_t c = 0; c < CLASS_COUNT; c++) {
+        total += _slabs[c].count;
+    }
+    return total;
+}
+
+uint16_t MqttMessagePool::getInUse() const {
+    uint16_t inUse = 0;
+    for (uint8_t c = 0; c < CLASS_COUNT; c++) {
+        inUse += _slabs[c].count - _slabs[c].freeTop;
+    }
+    return inUse;
+}
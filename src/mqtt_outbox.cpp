@@ -0,0 +1,410 @@
+#include "mqtt_outbox.h"
+#include "constants.h"
+#include "logger.h"
+#include <esp_rom_crc.h>
+#include <string.h>
+
+#if ENABLE_MQTT
+// Staging and replay buffers are only reserved in builds that publish
+MqttOutbox mqttOutbox;
+#endif
+
+MqttOutbox::MqttOutbox()
+    : _partition(NULL),
+      _sectorCount(0),
+      _lock(NULL),
+      _headSector(0),
+      _headOffset(0),
+      _headSectorSequence(0),
+      _stagingLength(0),
+      _stagedSince(0),
+      _replaySector(0),
+      _replayOffset(0),
+      _nextSequence(1),
+      _ackedSequence(0),
+      _pendingCount(0),
+      _droppedCount(0) {
+}
+
+bool MqttOutbox::begin(const char* partitionLabel) {
+    if (_lock == NULL) {
+        _lock = xSemaphoreCreateMutex();
+    }
+    _partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, partitionLabel);
+    if (_partition == NULL) {
+        LOG_WARNING("MQTT outbox: partition '%s' not found, critical messages will not survive reboots",
+                    partitionLabel);
+        return false;
+    }
+
+    _sectorCount = _partition->size / SECTOR_SIZE;
+    if (_sectorCount < 2) {
+        LOG_ERROR("MQTT outbox: partition '%s' too small (%u bytes)", partitionLabel, (unsigned int)_partition->size);
+        _partition = NULL;
+        return false;
+    }
+
+    // Sector sequences increase by one per sector written, so the valid
+    // sectors form one run in ring order from the oldest to the newest
+    bool found = false;
+    uint16_t newest = 0;
+    uint16_t oldest = 0;
+    uint32_t newestSequence = 0;
+    uint32_t oldestSequence = 0xFFFFFFFFUL;
+    for (uint16_t s = 0; s < _sectorCount; s++) {
+        SectorHeader header;
+        if (!readSectorHeader(s, header)) {
+            continue;
+        }
+        found = true;
+        if (header.sequence >= newestSequence) {
+            newestSequence = header.sequence;
+            newest = s;
+        }
+        if (header.sequence < oldestSequence) {
+            oldestSequence = header.sequence;
+            oldest = s;
+        }
+    }
+
+    if (!found) {
+        // Blank (or foreign) partition: start a fresh log in sector 0
+        SectorHeader header = { SECTOR_MAGIC, 1 };
+        if (esp_partition_erase_range(_partition, 0, SECTOR_SIZE) != ESP_OK ||
+            esp_partition_write(_partition, 0, &header, sizeof(header)) != ESP_OK) {
+            LOG_ERROR("MQTT outbox: failed to format partition '%s'", partitionLabel);
+            _partition = NULL;
+            return false;
+        }
+        _headSector = 0;
+        _headOffset = sizeof(SectorHeader);
+        _headSectorSequence = 1;
+        _replaySector = 0;
+        _replayOffset = sizeof(SectorHeader);
+        LOG_INFO("MQTT outbox: formatted %u sectors on '%s'", _sectorCount, partitionLabel);
+        return true;
+    }
+
+    // First pass: highest data/ack sequence and the head write position
+    uint32_t maxData = 0;
+    uint32_t maxAck = 0;
+    uint32_t unused = 0;
+    for (uint16_t s = 0; s < _sectorCount; s++) {
+        SectorHeader header;
+        if (!readSectorHeader(s, header)) {
+            continue;
+        }
+        size_t end = scanSector(s, maxData, maxAck, 0xFFFFFFFFUL, unused);
+        if (s == newest) {
+            _headOffset = end;
+        }
+    }
+
+    // Second pass: records newer than the last acknowledgement
+    uint32_t pending = 0;
+    for (uint16_t s = 0; s < _sectorCount; s++) {
+        SectorHeader header;
+        if (readSectorHeader(s, header)) {
+            uint32_t ignoredData = 0;
+            uint32_t ignoredAck = 0;
+            scanSector(s, ignoredData, ignoredAck, maxAck, pending);
+        }
+    }
+
+    _headSector = newest;
+    _headSectorSequence = newestSequence;
+    _replaySector = oldest;
+    _replayOffset = sizeof(SectorHeader);
+    _nextSequence = (maxData > maxAck ? maxData : maxAck) + 1;
+    _ackedSequence = maxAck;
+    _pendingCount = pending;
+
+    LOG_INFO("MQTT outbox recovered: %lu pending message(s), next seq %lu, acked %lu",
+             (unsigned long)_pendingCount, (unsigned long)_nextSequence, (unsigned long)_ackedSequence);
+    return true;
+}
+
+bool MqttOutbox::append(const char* topic, const uint8_t* payload, size_t length, uint8_t qos) {
+    if (_partition == NULL || topic == NULL || payload == NULL) {
+        return false;
+    }
+    xSemaphoreTake(_lock, portMAX_DELAY);
+    bool staged = stage(RECORD_DATA, _nextSequence, topic, payload, length, qos);
+    if (staged) {
+        _nextSequence++;
+        _pendingCount++;
+    }
+    xSemaphoreGive(_lock);
+    if (!staged) {
+        LOG_WARNING("MQTT outbox: failed to store message for %s", topic);
+    }
+    return staged;
+}
+
+bool MqttOutbox::flush() {
+    if (_partition == NULL) {
+        return true;
+    }
+    xSemaphoreTake(_lock, portMAX_DELAY);
+    bool written = writeStaged();
+    xSemaphoreGive(_lock);
+    return written;
+}
+
+bool MqttOutbox::flushIfDue(unsigned long now) {
+    if (_partition == NULL) {
+        return true;
+    }
+    xSemaphoreTake(_lock, portMAX_DELAY);
+    bool written = _stagingLength == 0 || now - _stagedSince < FLUSH_INTERVAL_MS || writeStaged();
+    xSemaphoreGive(_lock);
+    return written;
+}
+
+bool MqttOutbox::writeStaged() {
+    if (_stagingLength == 0) {
+        return true;
+    }
+
+    if (_headOffset + _stagingLength > SECTOR_SIZE) {
+        if (!advanceSector()) {
+            return false;
+        }
+    }
+
+    esp_err_t err = esp_partition_write(_partition, (size_t)_headSector * SECTOR_SIZE + _headOffset,
+                                        _staging, _stagingLength);
+    if (err != ESP_OK) {
+        // The region may be partially programmed: retire this sector and retry in the next one
+        LOG_ERROR("MQTT outbox: flash write failed (%s)", esp_err_to_name(err));
+        _headOffset = SECTOR_SIZE;
+        return false;
+    }
+
+    _headOffset += _stagingLength;
+    _stagingLength = 0;
+    return true;
+}
+
+size_t MqttOutbox::replay(PublishFn publish, void* context, size_t maxMessages) {
+    if (_partition == NULL || publish == NULL || _pendingCount == 0) {
+        return 0;
+    }
+    xSemaphoreTake(_lock, portMAX_DELAY);
+    if (!writeStaged()) {
+        xSemaphoreGive(_lock);
+        return 0;
+    }
+
+    size_t sent = 0;
+    uint32_t lastHandled = _ackedSequence;
+
+    while (sent < maxMessages) {
+        bool atHead = (_replaySector == _headSector);
+        if (atHead && _replayOffset >= _headOffset) {
+            break;
+        }
+
+        RecordHeader header;
+        if (!readRecordHeader(_replaySector, _replayOffset, header)) {
+            if (atHead) {
+                break;
+            }
+            _replaySector = (_replaySector + 1) % _sectorCount;
+            _replayOffset = sizeof(SectorHeader);
+            continue;
+        }
+
+        if (header.type == RECORD_DATA && header.sequence > lastHandled) {
+            size_t dataLength = (size_t)header.topicLength + 1 + header.payloadLength + 1;
+            bool valid = dataLength <= sizeof(_replayBuffer) &&
+                         esp_partition_read(_partition,
+                                            (size_t)_replaySector * SECTOR_SIZE + _replayOffset + sizeof(RecordHeader),
+                                            _replayBuffer, dataLength) == ESP_OK &&
+                         esp_rom_crc32_le(0, (const uint8_t*)_replayBuffer, dataLength) == header.crc &&
+                         _replayBuffer[header.topicLength] == '\0' &&
+                         _replayBuffer[dataLength - 1] == '\0';
+
+            if (valid) {
+                const char* topic = _replayBuffer;
+                const uint8_t* payload = reinterpret_cast<const uint8_t*>(_replayBuffer + header.topicLength + 1);
+                // Appends go on while publishing; only replay() touches _replayBuffer
+                uint16_t sector = _replaySector;
+                xSemaphoreGive(_lock);
+                bool published = publish(topic, payload, header.payloadLength, header.qos, context);
+                xSemaphoreTake(_lock, portMAX_DELAY);
+                if (!published) {
+                    break;  // Retry this record on the next replay
+                }
+                sent++;
+                if (_replaySector != sector) {
+                    // The ring wrapped onto this sector meanwhile: its records were
+                    // counted as dropped and the cursor already moved past them
+                    lastHandled = header.sequence;
+                    continue;
+                }
+            } else {
+                _droppedCount++;
+                LOG_WARNING("MQTT outbox: skipping corrupt record seq %lu", (unsigned long)header.sequence);
+            }
+            lastHandled = header.sequence;
+            if (_pendingCount > 0) {
+                _pendingCount--;
+            }
+        }
+
+        _replayOffset += recordSize(header);
+    }
+
+    // One ACK record per batch keeps flash writes proportional to batches, not messages
+    if (lastHandled != _ackedSequence) {
+        _ackedSequence = lastHandled;
+        if (stage(RECORD_ACK, lastHandled, NULL, NULL, 0, 0)) {
+            writeStaged();
+        }
+    }
+    xSemaphoreGive(_lock);
+
+    if (sent > 0) {
+        LOG_INFO("MQTT outbox: replayed %u message(s), %lu still pending",
+                 (unsigned int)sent, (unsigned long)_pendingCount);
+    }
+    return sent;
+}
+
+size_t MqttOutbox::recordSize(const RecordHeader& header) {
+    size_t dataLength = 0;
+    if (header.type == RECORD_DATA) {
+        dataLength = (size_t)header.topicLength + 1 + header.payloadLength + 1;
+    }
+    return sizeof(RecordHeader) + ((dataLength + 3) & ~(size_t)3);
+}
+
+bool MqttOutbox::readSectorHeader(uint16_t sector, SectorHeader& header) const {
+    if (esp_partition_read(_partition, (size_t)sector * SECTOR_SIZE, &header, sizeof(header)) != ESP_OK) {
+        return false;
+    }
+    return header.magic == SECTOR_MAGIC && header.sequence != 0xFFFFFFFFUL;
+}
+
+bool MqttOutbox::readRecordHeader(uint16_t sector, size_t offset, RecordHeader& header) const {
+    if (offset + sizeof(RecordHeader) > SECTOR_SIZE) {
+        return false;
+    }
+    if (esp_partition_read(_partition, (size_t)sector * SECTOR_SIZE + offset, &header, sizeof(header)) != ESP_OK) {
+        return false;
+    }
+    if (header.magic != RECORD_MAGIC || (header.type != RECORD_DATA && header.type != RECORD_ACK)) {
+        return false;
+    }
+    return offset + recordSize(header) <= SECTOR_SIZE;
+}
+
+size_t MqttOutbox::scanSector(uint16_t sector, uint32_t& maxData, uint32_t& maxAck,
+                              uint32_t pendingAbove, uint32_t& pending) const {
+    size_t offset = sizeof(SectorHeader);
+    while (offset + sizeof(RecordHeader) <= SECTOR_SIZE) {
+        RecordHeader header;
+        if (!readRecordHeader(sector, offset, header)) {
+            // Erased flash ends the sector; anything else is a torn write,
+            // so treat the sector as full rather than append after garbage
+            if (esp_partition_read(_partition, (size_t)sector * SECTOR_SIZE + offset,
+                                   &header, sizeof(header)) == ESP_OK && header.magic == 0xFFFF) {
+                return offset;
+            }
+            return SECTOR_SIZE;
+        }
+        if (header.type == RECORD_DATA) {
+            if (header.sequence > maxData) maxData = header.sequence;
+            if (header.sequence > pendingAbove) pending++;
+        } else if (header.sequence > maxAck) {
+            maxAck = header.sequence;
+        }
+        offset += recordSize(header);
+    }
+    return offset;
+}
+
+bool MqttOutbox::stage(RecordType type, uint32_t sequence, const char* topic, const uint8_t* payload, size_t length, uint8_t qos) {
+    if (type == RECORD_DATA && length > STAGING_SIZE) {
+        return false;
+    }
+
+    RecordHeader header;
+    header.magic = RECORD_MAGIC;
+    header.type = type;
+    header.qos = qos;
+    header.sequence = sequence;
+    header.topicLength = type == RECORD_DATA ? (uint16_t)strlen(topic) : 0;
+    header.payloadLength = type == RECORD_DATA ? (uint16_t)length : 0;
+    header.crc = 0;
+
+    size_t size = recordSize(header);
+    if (size > STAGING_SIZE || size > SECTOR_SIZE - sizeof(SectorHeader)) {
+        return false;
+    }
+
+    // Staged records are written in one go and never straddle a sector
+    if (_stagingLength + size > STAGING_SIZE || _headOffset + _stagingLength + size > SECTOR_SIZE) {
+        if (!writeStaged()) {
+            return false;
+        }
+    }
+    if (_headOffset + size > SECTOR_SIZE) {
+        if (!advanceSector()) {
+            return false;
+        }
+    }
+
+    uint8_t* record = _staging + _stagingLength;
+    memset(record, 0, size);
+    if (type == RECORD_DATA) {
+        char* data = reinterpret_cast<char*>(record + sizeof(RecordHeader));
+        memcpy(data, topic, header.topicLength + 1);
+        memcpy(data + header.topicLength + 1, payload, header.payloadLength);
+        data[header.topicLength + 1 + header.payloadLength] = '\0';
+        header.crc = esp_rom_crc32_le(0, (const uint8_t*)data, header.topicLength + 1 + header.payloadLength + 1);
+    }
+    memcpy(record, &header, sizeof(header));
+
+    if (_stagingLength == 0) {
+        _stagedSince = millis();
+    }
+    _stagingLength += size;
+    return true;
+}
+
+bool MqttOutbox::advanceSector() {
+    uint16_t next = (_headSector + 1) % _sectorCount;
+
+    // Reclaiming a sector drops whatever it still holds unacknowledged
+    SectorHeader header;
+    if (readSectorHeader(next, header)) {
+        uint32_t maxData = 0;
+        uint32_t maxAck = 0;
+        uint32_t lost = 0;
+        scanSector(next, maxData, maxAck, _ackedSequence, lost);
+        if (lost > 0) {
+            _droppedCount += lost;
+            _pendingCount = _pendingCount > lost ? _pendingCount - lost : 0;
+            LOG_WARNING("MQTT outbox full: overwriting %lu unsent message(s)", (unsigned long)lost);
+        }
+        if (_replaySector == next) {
+            _replaySector = (next + 1) % _sectorCount;
+            _replayOffset = sizeof(SectorHeader);
+        }
+    }
+
+    header.magic = SECTOR_MAGIC;
+    header.sequence = _headSectorSequence + 1;
+    if (esp_partition_erase_range(_partition, (size_t)next * SECTOR_SIZE, SECTOR_SIZE) != ESP_OK ||
+        esp_partition_write(_partition, (size_t)next * SECTOR_SIZE, &header, sizeof(header)) != ESP_OK) {
+        LOG_ERROR("MQTT outbox: failed to prepare sector %u", next);
+        return false;
+    }
+
+    _headSector = next;
+    _headSectorSequence = header.sequence;
+    _headOffset = sizeof(SectorHeader);
+    return true;
+}
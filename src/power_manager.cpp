@@ -0,0 +1,140 @@
+#include "power_manager.h"
+#include "constants.h"
+#include "logger.h"
+
+SemaphoreHandle_t PowerManager::lock = NULL;
+volatile bool PowerManager::lowPower = false;
+volatile unsigned long PowerManager::lastActivity = 0;
+unsigned long PowerManager::lowPowerSince = 0;
+unsigned long PowerManager::lowPowerTotal = 0;
+uint32_t PowerManager::entries = 0;
+#if CONFIG_PM_ENABLE
+esp_pm_lock_handle_t PowerManager::cpuLock = NULL;
+esp_pm_lock_handle_t PowerManager::noSleepLock = NULL;
+#endif
+
+void PowerManager::begin() {
+    if (lock != NULL) {
+        return;
+    }
+    lock = xSemaphoreCreateMutex();
+    lastActivity = millis();
+
+#if CONFIG_PM_ENABLE
+    esp_pm_config_esp32_t config = {};
+    config.max_freq_mhz = LOW_POWER_MAX_FREQ_MHZ;
+    config.min_freq_mhz = LOW_POWER_MIN_FREQ_MHZ;
+#if CONFIG_FREERTOS_USE_TICKLESS_IDLE
+    config.light_sleep_enable = true;
+#endif
+    esp_err_t err = esp_pm_configure(&config);
+    if (err != ESP_OK) {
+        LOG_WARNING("Power management unavailable (err %d) - low-power mode only throttles tasks", err);
+        return;
+    }
+
+    // Held whenever the machine is not in low-power mode
+    if (esp_pm_lock_create(ESP_PM_CPU_FREQ_MAX, 0, "active", &cpuLock) != ESP_OK ||
+        esp_pm_lock_create(ESP_PM_NO_LIGHT_SLEEP, 0, "active_nosleep", &noSleepLock) != ESP_OK) {
+        LOG_ERROR("Failed to create power management locks");
+        cpuLock = NULL;
+        noSleepLock = NULL;
+        return;
+    }
+    esp_pm_lock_acquire(cpuLock);
+    esp_pm_lock_acquire(noSleepLock);
+#if CONFIG_FREERTOS_USE_TICKLESS_IDLE
+    LOG_INFO("Power management: %d-%d MHz, light sleep in low-power mode",
+             LOW_POWER_MIN_FREQ_MHZ, LOW_POWER_MAX_FREQ_MHZ);
+#else
+    LOG_INFO("Power management: %d-%d MHz (no tickless idle - light sleep disabled)",
+             LOW_POWER_MIN_FREQ_MHZ, LOW_POWER_MAX_FREQ_MHZ);
+#endif
+#else
+    LOG_INFO("Power management not compiled in - low-power mode only throttles tasks");
+#endif
+}
+
+void PowerManager::update(bool idle) {
+    if (lock == NULL) {
+        return;
+    }
+    if (!idle) {
+        noteActivity();
+        return;
+    }
+    if (lowPower || millis() - lastActivity < LOW_POWER_ENTRY_DELAY_MS) {
+        return;
+    }
+    xSemaphoreTake(lock, portMAX_DELAY);
+    // Re-check: an edge may have arrived since the test above
+    if (!lowPower && millis() - lastActivity >= LOW_POWER_ENTRY_DELAY_MS) {
+        enterLocked();
+    }
+    xSemaphoreGive(lock);
+}
+
+void PowerManager::noteActivity() {
+    lastActivity = millis();
+    if (!lowPower || lock == NULL) {
+        return;
+    }
+    xSemaphoreTake(lock, portMAX_DELAY);
+    if (lowPower) {
+        exitLocked();
+    }
+    xSemaphoreGive(lock);
+}
+
+TickType_t PowerManager::inputPollTicks() {
+    return pdMS_TO_TICKS(lowPower ? INPUT_LOWPOWER_POLL_MS : INPUT_FALLBACK_POLL_MS);
+}
+
+TickType_t PowerManager::idleWaitTicks() {
+    return pdMS_TO_TICKS(lowPower ? CONTROLLER_LOWPOWER_WAIT_MS : CONTROLLER_IDLE_WAIT_MS);
+}
+
+unsigned long PowerManager::getLowPowerTime() {
+    if (lock == NULL) {
+        return 0;
+    }
+    xSemaphoreTake(lock, portMAX_DELAY);
+    unsigned long total = lowPowerTotal;
+    if (lowPower) {
+        total += millis() - lowPowerSince;
+    }
+    xSemaphoreGive(lock);
+    return total;
+}
+
+void PowerManager::enterLocked() {
+    lowPower = true;
+    lowPowerSince = millis();
+    entries++;
+#if CONFIG_PM_ENABLE
+    if (cpuLock != NULL) {
+#ifndef COIN_PCNT_PIN
+        // The PCNT unit is clock-gated in light sleep and would miss pulses,
+        // so hardware coin counting builds only scale the CPU down
+        esp_pm_lock_release(noSleepLock);
+#endif
+        esp_pm_lock_release(cpuLock);
+    }
+#endif
+    LOG_INFO("Entering low-power FREE mode (idle %lu ms)", millis() - lastActivity);
+}
+
+void PowerManager::exitLocked() {
+#if CONFIG_PM_ENABLE
+    if (cpuLock != NULL) {
+        esp_pm_lock_acquire(cpuLock);
+#ifndef COIN_PCNT_PIN
+        esp_pm_lock_acquire(noSleepLock);
+#endif
+    }
+#endif
+    lowPower = false;
+    unsigned long period = millis() - lowPowerSince;
+    lowPowerTotal += period;
+    LOG_INFO("Leaving low-power FREE mode after %lu ms", period);
+}
@@ -0,0 +1,536 @@
+#include "profiler.h"
+#include "logger.h"
+#include <esp_freertos_hooks.h>
+
+SemaphoreHandle_t Profiler::sampleLock = NULL;
+Profiler::Registration Profiler::registrations[PROFILER_MAX_TASKS];
+uint8_t Profiler::registrationCount = 0;
+Profiler::TaskSample Profiler::tasks[PROFILER_MAX_TASKS];
+uint8_t Profiler::taskCount = 0;
+unsigned long Profiler::lastSampleTime = 0;
+TickType_t Profiler::lastSampleTick = 0;
+volatile uint32_t Profiler::idleCalls[portNUM_PROCESSORS];
+uint32_t Profiler::idleCallsSampled[portNUM_PROCESSORS];
+int8_t Profiler::coreLoad[portNUM_PROCESSORS];
+Profiler::MutexStats Profiler::mutexStats[PROFILED_MUTEX_COUNT];
+Profiler::BusOpStats Profiler::busOpStats[PROFILED_OP_COUNT];
+uint32_t Profiler::busOpSampledCount[PROFILED_OP_COUNT];
+Profiler::EventStats Profiler::eventStats[PROFILED_EVENT_COUNT];
+Profiler::Histogram Profiler::inputWake[PROFILED_WAKE_COUNT];
+TaskHandle_t Profiler::eventTask = NULL;
+volatile uint32_t Profiler::eventTaskBusOps = 0;
+unsigned long Profiler::heldSince[PROFILED_MUTEX_COUNT];
+
+// Guards mutexStats/busOpStats/eventStats/inputWake (updated from every task that touches a bus)
+static portMUX_TYPE latencyStatsLock = portMUX_INITIALIZER_UNLOCKED;
+
+static const char* const MUTEX_NAMES[PROFILED_MUTEX_COUNT] = { "io_expander", "i2c" };
+static const char* const OP_NAMES[PROFILED_OP_COUNT] = { "iox_read", "rtc_read", "ch453_send" };
+static const char* const EVENT_NAMES[PROFILED_EVENT_COUNT] = { "coin", "button" };
+static const char* const WAKE_NAMES[PROFILED_WAKE_COUNT] = { "full_rate", "low_power" };
+
+#if configUSE_TRACE_FACILITY
+// Only touched by sample() with sampleLock held (too large for task stacks)
+static TaskStatus_t statusBuffer[PROFILER_MAX_TASKS];
+#endif
+
+void Profiler::begin() {
+    if (sampleLock == NULL) {
+        memset(coreLoad, -1, sizeof(coreLoad));
+        sampleLock = xSemaphoreCreateMutex();
+        esp_register_freertos_idle_hook_for_cpu(countIdleCore0, 0);
+#if portNUM_PROCESSORS > 1
+        esp_register_freertos_idle_hook_for_cpu(countIdleCore1, 1);
+#endif
+    }
+}
+
+// Returning true lets the idle task wait for the next interrupt, so each
+// call is one wake-up of an otherwise idle core
+bool Profiler::countIdleCore0() {
+    idleCalls[0] = idleCalls[0] + 1;
+    return true;
+}
+
+bool Profiler::countIdleCore1() {
+#if portNUM_PROCESSORS > 1
+    idleCalls[1] = idleCalls[1] + 1;
+#endif
+    return true;
+}
+
+int8_t Profiler::getCoreLoad(uint8_t core) {
+    return core < portNUM_PROCESSORS ? coreLoad[core] : -1;
+}
+
+void Profiler::registerTask(TaskHandle_t handle, uint32_t stackSize) {
+    if (handle == NULL || sampleLock == NULL) {
+        return;
+    }
+    xSemaphoreTake(sampleLock, portMAX_DELAY);
+    for (uint8_t i = 0; i < registrationCount; i++) {
+        if (registrations[i].handle == handle) {
+            registrations[i].stackSize = stackSize;
+            xSemaphoreGive(sampleLock);
+            return;
+        }
+    }
+    if (registrationCount < PROFILER_MAX_TASKS) {
+        registrations[registrationCount].handle = handle;
+        registrations[registrationCount].stackSize = stackSize;
+        registrationCount++;
+    }
+    xSemaphoreGive(sampleLock);
+}
+
+// Copied: the TCB (and its name) is freed if the task is deleted
+static void copyName(Profiler::TaskSample& task, const char* name) {
+    strncpy(task.name, name != NULL ? name : "?", sizeof(task.name) - 1);
+    task.name[sizeof(task.name) - 1] = '\0';
+}
+
+uint32_t Profiler::stackSizeOf(TaskHandle_t handle) {
+    for (uint8_t i = 0; i < registrationCount; i++) {
+        if (registrations[i].handle == handle) {
+            return registrations[i].stackSize;
+        }
+    }
+    return 0;
+}
+
+void Profiler::sample() {
+    if (sampleLock == NULL) {
+        return;
+    }
+    xSemaphoreTake(sampleLock, portMAX_DELAY);
+
+#if configUSE_TRACE_FACILITY
+    UBaseType_t count = uxTaskGetSystemState(statusBuffer, PROFILER_MAX_TASKS, NULL);
+    if (count == 0) {
+        // More tasks than PROFILER_MAX_TASKS: the kernel fills nothing
+        LOG_WARNING("Profiler: more than %d tasks, sample skipped", PROFILER_MAX_TASKS);
+        xSemaphoreGive(sampleLock);
+        return;
+    }
+
+    taskCount = 0;
+    for (UBaseType_t i = 0; i < count; i++) {
+        const TaskStatus_t& status = statusBuffer[i];
+        TaskSample& task = tasks[taskCount++];
+        task.handle = status.xHandle;
+        copyName(task, status.pcTaskName);
+        task.stackFree = status.usStackHighWaterMark;
+        task.stackSize = stackSizeOf(status.xHandle);
+        task.priority = (uint8_t)status.uxCurrentPriority;
+#if configTASKLIST_INCLUDE_COREID
+        task.core = status.xCoreID == tskNO_AFFINITY ? -1 : (int8_t)status.xCoreID;
+#else
+        task.core = -1;
+#endif
+    }
+#else
+    // No trace facility: only the tasks registered from setup()
+    taskCount = 0;
+    for (uint8_t i = 0; i < registrationCount; i++) {
+        TaskHandle_t handle = registrations[i].handle;
+        eTaskState state = eTaskGetState(handle);
+        if (state == eDeleted || state == eInvalid) {
+            continue;
+        }
+        TaskSample& task = tasks[taskCount++];
+        task.handle = handle;
+        copyName(task, pcTaskGetName(handle));
+        task.stackFree = uxTaskGetStackHighWaterMark(handle);
+        task.stackSize = registrations[i].stackSize;
+        task.priority = 0;
+        task.core = -1;
+    }
+#endif
+
+    // Bus call rates since the previous sample
+    unsigned long now = millis();
+    unsigned long elapsed = now - lastSampleTime;
+    portENTER_CRITICAL(&latencyStatsLock);
+    for (uint8_t op = 0; op < PROFILED_OP_COUNT; op++) {
+        uint32_t calls = busOpStats[op].latency.count;
+        if (lastSampleTime != 0 && elapsed > 0) {
+            busOpStats[op].perSecond = (uint32_t)(((uint64_t)(calls - busOpSampledCount[op]) * 1000) / elapsed);
+        }
+        busOpSampledCount[op] = calls;
+    }
+    portEXIT_CRITICAL(&latencyStatsLock);
+
+    // Core load from idle wake-ups per tick since the previous sample
+    TickType_t tick = xTaskGetTickCount();
+    TickType_t ticks = tick - lastSampleTick;
+    for (uint8_t core = 0; core < portNUM_PROCESSORS; core++) {
+        uint32_t calls = idleCalls[core];
+        if (lastSampleTime != 0 && ticks > 0) {
+            uint32_t idle = calls - idleCallsSampled[core];
+            coreLoad[core] = idle >= ticks ? 0 : (int8_t)(100 - (uint64_t)idle * 100 / ticks);
+        }
+        idleCallsSampled[core] = calls;
+    }
+
+    lastSampleTime = now;
+    lastSampleTick = tick;
+    xSemaphoreGive(sampleLock);
+}
+
+void Profiler::addSample(Histogram& histogram, uint32_t us) {
+    // floor(log4(us)): two bits per bucket
+    uint8_t bucket = us < 4 ? 0 : (uint8_t)((31 - __builtin_clz(us)) / 2);
+    if (bucket >= PROFILER_HISTOGRAM_BUCKETS) {
+        bucket = PROFILER_HISTOGRAM_BUCKETS - 1;
+    }
+    histogram.buckets[bucket]++;
+    histogram.count++;
+    histogram.totalUs += us;
+    if (us > histogram.maxUs) {
+        histogram.maxUs = us;
+    }
+}
+
+void Profiler::recordMutexWait(ProfiledMutex mutex, uint32_t waitUs, bool acquired) {
+    if (mutex >= PROFILED_MUTEX_COUNT) {
+        return;
+    }
+    portENTER_CRITICAL(&latencyStatsLock);
+    MutexStats& stats = mutexStats[mutex];
+    if (acquired) {
+        stats.acquired++;
+    } else {
+        stats.timeouts++;
+    }
+    addSample(stats.wait, waitUs);
+    portEXIT_CRITICAL(&latencyStatsLock);
+}
+
+void Profiler::recordMutexHold(ProfiledMutex mutex, uint32_t holdUs) {
+    if (mutex >= PROFILED_MUTEX_COUNT) {
+        return;
+    }
+    portENTER_CRITICAL(&latencyStatsLock);
+    addSample(mutexStats[mutex].hold, holdUs);
+    portEXIT_CRITICAL(&latencyStatsLock);
+}
+
+void Profiler::recordBusOp(ProfiledBusOp op, uint32_t durationUs, bool ok) {
+    if (op >= PROFILED_OP_COUNT) {
+        return;
+    }
+    portENTER_CRITICAL(&latencyStatsLock);
+    if (!ok) {
+        busOpStats[op].failures++;
+    }
+    addSample(busOpStats[op].latency, durationUs);
+    portEXIT_CRITICAL(&latencyStatsLock);
+    if (eventTask != NULL && xTaskGetCurrentTaskHandle() == eventTask) {
+        eventTaskBusOps = eventTaskBusOps + 1;  // Only the event task writes this
+    }
+}
+
+void Profiler::recordEvent(ProfiledEvent event, uint32_t delayUs, uint32_t handlingUs, uint32_t busOps) {
+    if (event >= PROFILED_EVENT_COUNT) {
+        return;
+    }
+    portENTER_CRITICAL(&latencyStatsLock);
+    EventStats& stats = eventStats[event];
+    addSample(stats.delay, delayUs);
+    addSample(stats.handling, handlingUs);
+    stats.busOps += busOps;
+    if (busOps > stats.maxBusOps) {
+        stats.maxBusOps = busOps;
+    }
+    portEXIT_CRITICAL(&latencyStatsLock);
+}
+
+void Profiler::recordInputWake(ProfiledWake mode, uint32_t latencyUs) {
+    if (mode >= PROFILED_WAKE_COUNT) {
+        return;
+    }
+    portENTER_CRITICAL(&latencyStatsLock);
+    addSample(inputWake[mode], latencyUs);
+    portEXIT_CRITICAL(&latencyStatsLock);
+}
+
+Profiler::MutexStats Profiler::getMutexStats(ProfiledMutex mutex) {
+    MutexStats stats = {};
+    if (mutex < PROFILED_MUTEX_COUNT) {
+        portENTER_CRITICAL(&latencyStatsLock);
+        stats = mutexStats[mutex];
+        portEXIT_CRITICAL(&latencyStatsLock);
+    }
+    return stats;
+}
+
+Profiler::BusOpStats Profiler::getBusOpStats(ProfiledBusOp op) {
+    BusOpStats stats = {};
+    if (op < PROFILED_OP_COUNT) {
+        portENTER_CRITICAL(&latencyStatsLock);
+        stats = busOpStats[op];
+        portEXIT_CRITICAL(&latencyStatsLock);
+    }
+    return stats;
+}
+
+Profiler::EventStats Profiler::getEventStats(ProfiledEvent event) {
+    EventStats stats = {};
+    if (event < PROFILED_EVENT_COUNT) {
+        portENTER_CRITICAL(&latencyStatsLock);
+        stats = eventStats[event];
+        portEXIT_CRITICAL(&latencyStatsLock);
+    }
+    return stats;
+}
+
+Profiler::Histogram Profiler::getInputWake(ProfiledWake mode) {
+    Histogram histogram = {};
+    if (mode < PROFILED_WAKE_COUNT) {
+        portENTER_CRITICAL(&latencyStatsLock);
+        histogram = inputWake[mode];
+        portEXIT_CRITICAL(&latencyStatsLock);
+    }
+    return histogram;
+}
+
+void Profiler::resetLatencyStats() {
+    portENTER_CRITICAL(&latencyStatsLock);
+    memset(mutexStats, 0, sizeof(mutexStats));
+    memset(busOpStats, 0, sizeof(busOpStats));
+    memset(busOpSampledCount, 0, sizeof(busOpSampledCount));
+    memset(eventStats, 0, sizeof(eventStats));
+    memset(inputWake, 0, sizeof(inputWake));
+    portEXIT_CRITICAL(&latencyStatsLock);
+}
+
+// "n p50<=X p99<=Y max Z" from a histogram (percentiles at bucket upper bounds)
+static void formatHistogram(const Profiler::Histogram& histogram, char* out, size_t size) {
+    if (histogram.count == 0) {
+        snprintf(out, size, "n=0");
+        return;
+    }
+    uint32_t p50 = 0;
+    uint32_t p99 = 0;
+    uint32_t seen = 0;
+    for (uint8_t b = 0; b < PROFILER_HISTOGRAM_BUCKETS; b++) {
+        uint32_t upper = b + 1 < PROFILER_HISTOGRAM_BUCKETS ? (1UL << (2 * (b + 1))) : histogram.maxUs;
+        seen += histogram.buckets[b];
+        if (p50 == 0 && (uint64_t)seen * 2 >= histogram.count) p50 = upper;
+        if (p99 == 0 && (uint64_t)seen * 100 >= (uint64_t)histogram.count * 99) p99 = upper;
+    }
+    snprintf(out, size, "n=%lu avg %lu p50<%lu p99<%lu max %lu us",
+             (unsigned long)histogram.count, (unsigned long)(histogram.totalUs / histogram.count),
+             (unsigned long)p50, (unsigned long)p99, (unsigned long)histogram.maxUs);
+}
+
+void Profiler::printStats() {
+    if (sampleLock == NULL) {
+        return;
+    }
+    xSemaphoreTake(sampleLock, portMAX_DELAY);
+
+    LOG_INFO("=== Task Stats (%lu ms since sample) ===", millis() - lastSampleTime);
+    LOG_INFO("%-16s %4s %4s %13s", "Task", "Core", "Prio", "Stack free");
+    for (uint8_t i = 0; i < taskCount; i++) {
+        const TaskSample& task = tasks[i];
+        char core[4];
+        if (task.core >= 0) {
+            snprintf(core, sizeof(core), "%d", task.core);
+        } else {
+            strcpy(core, "-");
+        }
+        if (task.stackSize > 0) {
+            LOG_INFO("%-16s %4s %4u %6u/%-6u", task.name, core, task.priority,
+                     (unsigned int)task.stackFree, (unsigned int)task.stackSize);
+        } else {
+            LOG_INFO("%-16s %4s %4u %6u", task.name, core, task.priority,
+                     (unsigned int)task.stackFree);
+        }
+    }
+    if (coreLoad[0] >= 0) {
+        char load[40];
+        size_t used = 0;
+        for (uint8_t core = 0; core < portNUM_PROCESSORS && used < sizeof(load); core++) {
+            used += snprintf(load + used, sizeof(load) - used, "%score %u %d%%",
+                             core > 0 ? ", " : "", core, coreLoad[core]);
+        }
+        LOG_INFO("CPU load: %s", load);
+    }
+    xSemaphoreGive(sampleLock);
+
+    LOG_INFO("Heap: %u free, %u min free, %u largest block",
+             ESP.getFreeHeap(), ESP.getMinFreeHeap(), ESP.getMaxAllocHeap());
+    if (psramFound()) {
+        LOG_INFO("PSRAM: %u free of %u", ESP.getFreePsram(), ESP.getPsramSize());
+    }
+
+    char text[80];
+    for (uint8_t m = 0; m < PROFILED_MUTEX_COUNT; m++) {
+        MutexStats stats = getMutexStats((ProfiledMutex)m);
+        LOG_INFO("Mutex %-12s %lu taken, %lu timeouts", MUTEX_NAMES[m],
+                 (unsigned long)stats.acquired, (unsigned long)stats.timeouts);
+        formatHistogram(stats.wait, text, sizeof(text));
+        LOG_INFO("  wait %s", text);
+        formatHistogram(stats.hold, text, sizeof(text));
+        LOG_INFO("  hold %s", text);
+    }
+    for (uint8_t op = 0; op < PROFILED_OP_COUNT; op++) {
+        BusOpStats stats = getBusOpStats((ProfiledBusOp)op);
+        formatHistogram(stats.latency, text, sizeof(text));
+        LOG_INFO("Bus %-10s %lu/s, %lu failures, %s", OP_NAMES[op], (unsigned long)stats.perSecond,
+                 (unsigned long)stats.failures, text);
+    }
+    for (uint8_t e = 0; e < PROFILED_EVENT_COUNT; e++) {
+        EventStats stats = getEventStats((ProfiledEvent)e);
+        uint32_t count = stats.handling.count;
+        LOG_INFO("Event %-6s bus ops avg %lu.%02lu max %lu", EVENT_NAMES[e],
+                 (unsigned long)(count > 0 ? stats.busOps / count : 0),
+                 (unsigned long)(count > 0 ? ((uint64_t)stats.busOps * 100 / count) % 100 : 0),
+                 (unsigned long)stats.maxBusOps);
+        formatHistogram(stats.delay, text, sizeof(text));
+        LOG_INFO("  delay    %s", text);
+        formatHistogram(stats.handling, text, sizeof(text));
+        LOG_INFO("  handling %s", text);
+    }
+    for (uint8_t w = 0; w < PROFILED_WAKE_COUNT; w++) {
+        Histogram histogram = getInputWake((ProfiledWake)w);
+        formatHistogram(histogram, text, sizeof(text));
+        LOG_INFO("Input wake %-9s %s", WAKE_NAMES[w], text);
+    }
+    LOG_INFO("========================================");
+}
+
+// Histogram as [count per bucket...]; trailing empty buckets are omitted
+static void addHistogram(JsonObject parent, const char* key, const Profiler::Histogram& histogram) {
+    uint8_t used = PROFILER_HISTOGRAM_BUCKETS;
+    while (used > 0 && histogram.buckets[used - 1] == 0) {
+        used--;
+    }
+    JsonArray buckets = parent[key].to<JsonArray>();
+    for (uint8_t b = 0; b < used; b++) {
+        buckets.add(histogram.buckets[b]);
+    }
+}
+
+void Profiler::buildSummary(JsonDocument& doc) {
+    xSemaphoreTake(sampleLock, portMAX_DELAY);
+    doc["sample_age_ms"] = millis() - lastSampleTime;
+    doc["task_count"] = taskCount;
+    if (coreLoad[0] >= 0) {
+        JsonArray load = doc["cpu_load"].to<JsonArray>();  // Percent per core
+        for (uint8_t core = 0; core < portNUM_PROCESSORS; core++) {
+            load.add(coreLoad[core]);
+        }
+    }
+    xSemaphoreGive(sampleLock);
+
+    JsonObject heap = doc["heap"].to<JsonObject>();
+    heap["free"] = ESP.getFreeHeap();
+    heap["min_free"] = ESP.getMinFreeHeap();
+    heap["largest_block"] = ESP.getMaxAllocHeap();
+    if (psramFound()) {
+        heap["psram_free"] = ESP.getFreePsram();
+    }
+
+    JsonObject mutexes = doc["mutexes"].to<JsonObject>();
+    for (uint8_t m = 0; m < PROFILED_MUTEX_COUNT; m++) {
+        MutexStats stats = getMutexStats((ProfiledMutex)m);
+        JsonObject entry = mutexes[MUTEX_NAMES[m]].to<JsonObject>();
+        entry["acquired"] = stats.acquired;
+        entry["timeouts"] = stats.timeouts;
+        entry["max_wait_us"] = stats.wait.maxUs;
+        entry["max_hold_us"] = stats.hold.maxUs;
+    }
+    JsonObject ops = doc["bus"].to<JsonObject>();
+    for (uint8_t op = 0; op < PROFILED_OP_COUNT; op++) {
+        BusOpStats stats = getBusOpStats((ProfiledBusOp)op);
+        JsonObject entry = ops[OP_NAMES[op]].to<JsonObject>();
+        entry["calls"] = stats.latency.count;
+        entry["per_s"] = stats.perSecond;
+        entry["failures"] = stats.failures;
+    }
+}
+
+void Profiler::buildMutexHistograms(JsonDocument& doc) {
+    doc["bucket_base"] = 4;  // Bucket b counts [4^b, 4^(b+1)) us
+    JsonObject mutexes = doc["mutexes"].to<JsonObject>();
+    for (uint8_t m = 0; m < PROFILED_MUTEX_COUNT; m++) {
+        MutexStats stats = getMutexStats((ProfiledMutex)m);
+        JsonObject entry = mutexes[MUTEX_NAMES[m]].to<JsonObject>();
+        addHistogram(entry, "wait", stats.wait);
+        addHistogram(entry, "hold", stats.hold);
+    }
+}
+
+void Profiler::buildBusHistograms(JsonDocument& doc) {
+    doc["bucket_base"] = 4;
+    JsonObject ops = doc["bus"].to<JsonObject>();
+    for (uint8_t op = 0; op < PROFILED_OP_COUNT; op++) {
+        BusOpStats stats = getBusOpStats((ProfiledBusOp)op);
+        JsonObject entry = ops[OP_NAMES[op]].to<JsonObject>();
+        addHistogram(entry, "latency", stats.latency);
+    }
+}
+
+void Profiler::buildEventStats(JsonDocument& doc) {
+    doc["bucket_base"] = 4;
+    JsonObject events = doc["events"].to<JsonObject>();
+    for (uint8_t e = 0; e < PROFILED_EVENT_COUNT; e++) {
+        EventStats stats = getEventStats((ProfiledEvent)e);
+        JsonObject entry = events[EVENT_NAMES[e]].to<JsonObject>();
+        entry["count"] = stats.handling.count;
+        entry["bus_ops"] = stats.busOps;
+        entry["max_bus_ops"] = stats.maxBusOps;
+        addHistogram(entry, "delay", stats.delay);
+        addHistogram(entry, "handling", stats.handling);
+    }
+}
+
+void Profiler::buildWakeStats(JsonDocument& doc) {
+    doc["bucket_base"] = 4;
+    JsonObject wake = doc["input_wake"].to<JsonObject>();
+    for (uint8_t w = 0; w < PROFILED_WAKE_COUNT; w++) {
+        Histogram histogram = getInputWake((ProfiledWake)w);
+        JsonObject entry = wake[WAKE_NAMES[w]].to<JsonObject>();
+        entry["count"] = histogram.count;
+        entry["max_us"] = histogram.maxUs;
+        addHistogram(entry, "latency", histogram);
+    }
+}
+
+bool Profiler::buildTasks(JsonDocument& doc, uint8_t firstTask) {
+    xSemaphoreTake(sampleLock, portMAX_DELAY);
+    if (firstTask >= taskCount) {
+        xSemaphoreGive(sampleLock);
+        return false;
+    }
+    JsonArray taskArray = doc["tasks"].to<JsonArray>();
+    for (uint8_t i = firstTask; i < taskCount && i < firstTask + TASKS_PER_PART; i++) {
+        TaskSample& task = tasks[i];
+        JsonObject entry = taskArray.add<JsonObject>();
+        entry["name"] = task.name;  // char[] is copied: the sample may change after unlock
+        entry["core"] = task.core;
+        entry["prio"] = task.priority;
+        entry["stack_free"] = task.stackFree;
+        if (task.stackSize > 0) {
+            entry["stack_size"] = task.stackSize;
+        }
+    }
+    xSemaphoreGive(sampleLock);
+    return true;
+}
+
+bool Profiler::buildStatsPart(JsonDocument& doc, uint8_t part) {
+    if (sampleLock == NULL) {
+        return false;
+    }
+    switch (part) {
+        case 0: buildSummary(doc); return true;
+        case 1: buildMutexHistograms(doc); return true;
+        case 2: buildBusHistograms(doc); return true;
+        case 3: buildEventStats(doc); return true;
+        case 4: buildWakeStats(doc); return true;
+        default: return buildTasks(doc, (uint8_t)((part - 5) * TASKS_PER_PART));
+    }
+}
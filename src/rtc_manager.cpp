@@ -1,8 +1,14 @@
 #include "rtc_manager.h"
+#include "profiler.h"
+
+// Guards the cached clock fields (read from any task that formats a timestamp)
+static portMUX_TYPE rtcCacheLock = portMUX_INITIALIZER_UNLOCKED;
 
 RTCManager::RTCManager(uint8_t address, TwoWire* wireInterface)
     : _address(address), _wire(wireInterface), _initialized(false),
-      _lastReadMillis(0), _lastReadTime(0), _i2cMutex(NULL) {
+      _lastReadMillis(0), _lastReadTime(0), _i2cMutex(NULL),
+      _lastResyncMillis(0), _resyncIntervalMs(DEFAULT_RESYNC_INTERVAL_MS),
+      _driftBaseTime(0), _driftBaseMillis(0), _driftPpm(0), _lastServedMs(0) {
 }
 
 void RTCManager::setI2CMutex(SemaphoreHandle_t mutex) {
@@ -23,7 +29,7 @@ bool RTCManager::begin() {
     // Check if RTC is responding (during initialization, mutex may not be set yet, so check first)
     bool mutexTaken = false;
     if (_i2cMutex != NULL) {
-        mutexTaken = (xSemaphoreTake(_i2cMutex, pdMS_TO_TICKS(100)) == pdTRUE);
+        mutexTaken = (profiledTake(_i2cMutex, pdMS_TO_TICKS(100), PROFILED_MUTEX_I2C) == pdTRUE);
         if (!mutexTaken) {
             LOG_WARNING("Failed to acquire I2C mutex during RTC initialization");
         }
@@ -33,7 +39,7 @@ bool RTCManager::begin() {
     uint8_t error = _wire->endTransmission();
     
     if (mutexTaken && _i2cMutex != NULL) {
-        xSemaphoreGive(_i2cMutex);
+        profiledGive(_i2cMutex, PROFILED_MUTEX_I2C);
     }
     
     if (error != 0) {
@@ -69,7 +75,11 @@ bool RTCManager::begin() {
         if (currentTime < 1577836800UL) { // 2020-01-01 00:00:00 UTC
             LOG_WARNING("RTC time seems too old (before 2020). Time needs to be set.");
         } else {
-            LOG_INFO("RTC time is valid: %s", getTimestamp().c_str());
+            // Prime the cached clock
+            resync();
+            char timestamp[ISO_TIMESTAMP_SIZE];
+            formatTimestamp(timestamp, sizeof(timestamp));
+            LOG_INFO("RTC time is valid: %s", timestamp);
         }
     } else {
         LOG_WARNING("Failed to read RTC time during initialization");
@@ -92,7 +102,7 @@ bool RTCManager::writeRegister(uint8_t reg, uint8_t value) {
     // Protect I2C access with mutex (shared with LCD)
     bool mutexTaken = false;
     if (_i2cMutex != NULL) {
-        mutexTaken = (xSemaphoreTake(_i2cMutex, pdMS_TO_TICKS(100)) == pdTRUE);
+        mutexTaken = (profiledTake(_i2cMutex, pdMS_TO_TICKS(100), PROFILED_MUTEX_I2C) == pdTRUE);
         if (!mutexTaken) {
             LOG_WARNING("Failed to acquire I2C mutex for RTC write");
             return false;
@@ -105,7 +115,7 @@ bool RTCManager::writeRegister(uint8_t reg, uint8_t value) {
     uint8_t error = _wire->endTransmission();
     
     if (mutexTaken && _i2cMutex != NULL) {
-        xSemaphoreGive(_i2cMutex);
+        profiledGive(_i2cMutex, PROFILED_MUTEX_I2C);
     }
     
     if (error != 0) {
@@ -122,7 +132,7 @@ uint8_t RTCManager::readRegister(uint8_t reg) {
     // Protect I2C access with mutex (shared with LCD)
     bool mutexTaken = false;
     if (_i2cMutex != NULL) {
-        mutexTaken = (xSemaphoreTake(_i2cMutex, pdMS_TO_TICKS(100)) == pdTRUE);
+        mutexTaken = (profiledTake(_i2cMutex, pdMS_TO_TICKS(100), PROFILED_MUTEX_I2C) == pdTRUE);
         if (!mutexTaken) {
             // Don't log here - this method may be called from getDateTime()
             // which is called from Logger::getTimestamp(), causing recursion
@@ -149,19 +159,26 @@ uint8_t RTCManager::readRegister(uint8_t reg) {
     }
     
     if (mutexTaken && _i2cMutex != NULL) {
-        xSemaphoreGive(_i2cMutex);
+        profiledGive(_i2cMutex, PROFILED_MUTEX_I2C);
     }
     
     return result;
 }
 
 bool RTCManager::readRegisters(uint8_t reg, uint8_t* buffer, uint8_t length) {
+    unsigned long start = micros();
+    bool success = readRegistersLocked(reg, buffer, length);
+    Profiler::recordBusOp(PROFILED_OP_RTC_READ, (uint32_t)(micros() - start), success);
+    return success;
+}
+
+bool RTCManager::readRegistersLocked(uint8_t reg, uint8_t* buffer, uint8_t length) {
     if (!_initialized || !buffer) return false;
     
     // Protect I2C access with mutex (shared with LCD)
     bool mutexTaken = false;
     if (_i2cMutex != NULL) {
-        mutexTaken = (xSemaphoreTake(_i2cMutex, pdMS_TO_TICKS(100)) == pdTRUE);
+        mutexTaken = (profiledTake(_i2cMutex, pdMS_TO_TICKS(100), PROFILED_MUTEX_I2C) == pdTRUE);
         if (!mutexTaken) {
             // Don't log here - this method is called from getDateTime()
             // which is called from Logger::getTimestamp(), causing recursion
@@ -191,7 +208,7 @@ bool RTCManager::readRegisters(uint8_t reg, uint8_t* buffer, uint8_t length) {
     }
     
     if (mutexTaken && _i2cMutex != NULL) {
-        xSemaphoreGive(_i2cMutex);
+        profiledGive(_i2cMutex, PROFILED_MUTEX_I2C);
     }
     
     return success;
@@ -203,7 +220,7 @@ bool RTCManager::writeRegisters(uint8_t reg, const uint8_t* buffer, uint8_t leng
     // Protect I2C access with mutex (shared with LCD)
     bool mutexTaken = false;
     if (_i2cMutex != NULL) {
-        mutexTaken = (xSemaphoreTake(_i2cMutex, pdMS_TO_TICKS(100)) == pdTRUE);
+        mutexTaken = (profiledTake(_i2cMutex, pdMS_TO_TICKS(100), PROFILED_MUTEX_I2C) == pdTRUE);
         if (!mutexTaken) {
             LOG_WARNING("Failed to acquire I2C mutex for RTC write");
             return false;
@@ -220,7 +237,7 @@ bool RTCManager::writeRegisters(uint8_t reg, const uint8_t* buffer, uint8_t leng
     uint8_t error = _wire->endTransmission();
     
     if (mutexTaken && _i2cMutex != NULL) {
-        xSemaphoreGive(_i2cMutex);
+        profiledGive(_i2cMutex, PROFILED_MUTEX_I2C);
     }
     
     if (error != 0) {
@@ -353,10 +370,9 @@ bool RTCManager::setDateTime(uint16_t year, uint8_t month, uint8_t day,
             LOG_WARNING("RTC write verification - failed to read back time");
         }
         
-        // Update cached values
-        _lastReadMillis = millis();
-        
-        // Reconstruct epoch time for cache
+        // Re-anchor the cached clock on the time just written (this is a step,
+        // so the drift measurement starts over)
+        unsigned long writtenAtMillis = millis();
         tmElements_t tm;
         tm.Year = year - 1970;
         tm.Month = month;
@@ -364,7 +380,7 @@ bool RTCManager::setDateTime(uint16_t year, uint8_t month, uint8_t day,
         tm.Hour = hour;
         tm.Minute = minute;
         tm.Second = second;
-        _lastReadTime = makeTime(tm);
+        anchorCache(makeTime(tm), writtenAtMillis);
     } else {
         LOG_ERROR("Failed to set RTC time");
     }
@@ -440,68 +456,201 @@ time_t RTCManager::getDateTime() {
     // NOTE: Removed LOG_WARNING here to prevent infinite recursion
     // The caller can log warnings if needed
     
-    // Cache the reading
-    _lastReadTime = epochTime;
-    _lastReadMillis = millis();
+    // NOTE: This is a raw chip read; the cached clock is only moved by resync()
+    // so that its sub-second phase survives reads that land inside the same second
     
     return epochTime;
 }
 
-String RTCManager::getTimestamp() {
-    time_t currentTime = getDateTime();
+uint64_t RTCManager::interpolateMs(unsigned long nowMillis) const {
+    // Unsigned subtraction handles millis() overflow
+    int64_t elapsed = (int64_t)(unsigned long)(nowMillis - _lastReadMillis);
+    elapsed -= elapsed * _driftPpm / 1000000;
+    return (uint64_t)_lastReadTime * 1000ULL + (uint64_t)elapsed;
+}
+
+void RTCManager::anchorCache(time_t epochTime, unsigned long atMillis) {
+    portENTER_CRITICAL(&rtcCacheLock);
+    _lastReadTime = epochTime;
+    _lastReadMillis = atMillis;
+    _lastResyncMillis = atMillis;
+    _driftBaseTime = epochTime;
+    _driftBaseMillis = atMillis;
+    _lastServedMs = 0;
+    portEXIT_CRITICAL(&rtcCacheLock);
+}
+
+bool RTCManager::resync() {
+    // No logging in here: getTimestamp() may be called from logging paths
+    time_t chipTime = getDateTime();
+    unsigned long readMillis = millis();
+    
+    if (chipTime == 0) {
+        // Keep serving the interpolated clock; retry after the next interval
+        _lastResyncMillis = readMillis;
+        return false;
+    }
     
-    if (currentTime == 0) {
-        return "RTC Error";
+    if (_lastReadTime == 0) {
+        anchorCache(chipTime, readMillis);
+        return true;
     }
     
-    // Convert to time structure
-    tmElements_t tm;
-    breakTime(currentTime, tm);
+    portENTER_CRITICAL(&rtcCacheLock);
+    _lastResyncMillis = readMillis;
     
-    // Format as ISO 8601: "2024-10-29T15:30:45Z"
-    char timestamp[25];
-    sprintf(timestamp, "%04d-%02d-%02dT%02d:%02d:%02dZ",
-            tm.Year + 1970, tm.Month, tm.Day,
-            tm.Hour, tm.Minute, tm.Second);
+    // The chip has one second resolution: as long as the interpolated clock is
+    // still inside the second the chip shows, keep the anchor (and its phase)
+    long errorSeconds = (long)((time_t)(interpolateMs(readMillis) / 1000ULL) - chipTime);
+    if (errorSeconds != 0) {
+        bool step = errorSeconds > STEP_THRESHOLD_S || errorSeconds < -STEP_THRESHOLD_S;
+        _lastReadTime = chipTime;
+        _lastReadMillis = readMillis;
+        if (step) {
+            // Clock was set (or the chip was swapped): restart the drift span and
+            // allow timestamps to go backwards once
+            _driftBaseTime = chipTime;
+            _driftBaseMillis = readMillis;
+            _lastServedMs = 0;
+        }
+    }
     
-    return String(timestamp);
+    // Drift of millis() against the RTC over the measurement span
+    int64_t spanRtcMs = (int64_t)(chipTime - _driftBaseTime) * 1000;
+    int64_t spanMillis = (int64_t)(unsigned long)(readMillis - _driftBaseMillis);
+    if (spanRtcMs >= (int64_t)DRIFT_MIN_SPAN_MS) {
+        _driftPpm = (int32_t)((spanMillis - spanRtcMs) * 1000000 / spanRtcMs);
+    }
+    if (spanMillis >= (int64_t)DRIFT_MAX_SPAN_MS) {
+        _driftBaseTime = chipTime;
+        _driftBaseMillis = readMillis;
+    }
+    portEXIT_CRITICAL(&rtcCacheLock);
+    return true;
 }
 
-String RTCManager::getTimestampWithMillis() {
-    time_t currentTime = getDateTime();
+time_t RTCManager::getCachedDateTime(uint16_t* milliseconds) {
+    if (_resyncIntervalMs == 0 || _lastReadTime == 0 ||
+        (unsigned long)(millis() - _lastResyncMillis) >= _resyncIntervalMs) {
+        resync();
+    }
     
-    if (currentTime == 0) {
-        LOG_WARNING("RTC getDateTime() returned 0 - RTC read failed");
-        return "RTC Error";
+    portENTER_CRITICAL(&rtcCacheLock);
+    if (_lastReadTime == 0) {
+        portEXIT_CRITICAL(&rtcCacheLock);
+        return 0;
+    }
+    uint64_t nowMs = interpolateMs(millis());
+    // A resync that moved the clock back must not make timestamps go backwards
+    if (nowMs < _lastServedMs) {
+        nowMs = _lastServedMs;
+    } else {
+        _lastServedMs = nowMs;
     }
+    portEXIT_CRITICAL(&rtcCacheLock);
     
-    // Log if time is invalid (for debugging)
-    if (!isTimeValid()) {
-        LOG_WARNING("RTC time is invalid (epoch: %lu) but still returning timestamp", (unsigned long)currentTime);
+    if (milliseconds != NULL) {
+        *milliseconds = (uint16_t)(nowMs % 1000ULL);
+    }
+    return (time_t)(nowMs / 1000ULL);
+}
+
+// Write value as exactly `digits` decimal digits (zero padded)
+static inline char* putDigits(char* out, uint32_t value, uint8_t digits) {
+    for (uint8_t i = digits; i > 0; i--) {
+        out[i - 1] = (char)('0' + value % 10);
+        value /= 10;
+    }
+    return out + digits;
+}
+
+size_t RTCManager::formatIso8601(time_t epochTime, int milliseconds, char* buffer, size_t size) {
+    size_t length = milliseconds >= 0 ? 24 : 20;
+    if (buffer == NULL || size <= length) {
+        if (buffer != NULL && size > 0) buffer[0] = '\0';
+        return 0;
     }
     
-    // Calculate milliseconds since last RTC read
-    unsigned long currentMillis = millis();
-    unsigned long millisOffset = currentMillis - _lastReadMillis;
+    // Civil date from days since 1970-01-01 (era-based, no loops; valid for
+    // any date the DS1340 can hold)
+    uint32_t secondsOfDay = (uint32_t)(epochTime % 86400);
+    int32_t days = (int32_t)(epochTime / 86400) + 719468;
+    int32_t era = days / 146097;
+    uint32_t dayOfEra = (uint32_t)(days - era * 146097);
+    uint32_t yearOfEra = (dayOfEra - dayOfEra / 1460 + dayOfEra / 36524 - dayOfEra / 146096) / 365;
+    uint32_t dayOfYear = dayOfEra - (365 * yearOfEra + yearOfEra / 4 - yearOfEra / 100);
+    uint32_t monthPrime = (5 * dayOfYear + 2) / 153;
+    uint32_t day = dayOfYear - (153 * monthPrime + 2) / 5 + 1;
+    uint32_t month = monthPrime < 10 ? monthPrime + 3 : monthPrime - 9;
+    uint32_t year = yearOfEra + era * 400 + (month <= 2 ? 1 : 0);
+    
+    char* out = buffer;
+    out = putDigits(out, year, 4);
+    *out++ = '-';
+    out = putDigits(out, month, 2);
+    *out++ = '-';
+    out = putDigits(out, day, 2);
+    *out++ = 'T';
+    out = putDigits(out, secondsOfDay / 3600, 2);
+    *out++ = ':';
+    out = putDigits(out, (secondsOfDay / 60) % 60, 2);
+    *out++ = ':';
+    out = putDigits(out, secondsOfDay % 60, 2);
+    if (milliseconds >= 0) {
+        *out++ = '.';
+        out = putDigits(out, (uint32_t)milliseconds % 1000, 3);
+    }
+    *out++ = 'Z';
+    *out = '\0';
+    return length;
+}
+
+size_t RTCManager::formatTimestamp(char* buffer, size_t size) {
+    time_t currentTime = getCachedDateTime();
     
-    // Adjust time if more than 1 second has passed
-    time_t adjustedTime = currentTime;
-    int milliseconds = millisOffset % 1000;
+    if (currentTime == 0) {
+        if (buffer != NULL && size > 0) buffer[0] = '\0';
+        return 0;
+    }
+    
+    // Format as ISO 8601: "2024-10-29T15:30:45Z"
+    return formatIso8601(currentTime, -1, buffer, size);
+}
+
+size_t RTCManager::formatTimestampWithMillis(char* buffer, size_t size) {
+    uint16_t milliseconds = 0;
+    time_t currentTime = getCachedDateTime(&milliseconds);
     
-    if (millisOffset >= 1000) {
-        adjustedTime += millisOffset / 1000;
+    if (currentTime == 0) {
+        LOG_WARNING("RTC getDateTime() returned 0 - RTC read failed");
+        if (buffer != NULL && size > 0) buffer[0] = '\0';
+        return 0;
     }
     
-    // Convert to time structure
-    tmElements_t tm;
-    breakTime(adjustedTime, tm);
+    // Log if time is invalid (for debugging). Range check only: isTimeValid()
+    // would cost two more I2C transactions per timestamp
+    int64_t epoch = (int64_t)currentTime;
+    if (epoch < 1577836800LL || epoch > 4102444800LL) {
+        LOG_WARNING("RTC time is invalid (epoch: %lu) but still returning timestamp", (unsigned long)currentTime);
+    }
     
     // Format as ISO 8601 with milliseconds: "2024-10-29T15:30:45.123Z"
-    char timestamp[30];
-    sprintf(timestamp, "%04d-%02d-%02dT%02d:%02d:%02d.%03dZ",
-            tm.Year + 1970, tm.Month, tm.Day,
-            tm.Hour, tm.Minute, tm.Second, milliseconds);
-    
+    return formatIso8601(currentTime, milliseconds, buffer, size);
+}
+
+String RTCManager::getTimestamp() {
+    char timestamp[ISO_TIMESTAMP_SIZE];
+    if (formatTimestamp(timestamp, sizeof(timestamp)) == 0) {
+        return "RTC Error";
+    }
+    return String(timestamp);
+}
+
+String RTCManager::getTimestampWithMillis() {
+    char timestamp[ISO_TIMESTAMP_SIZE];
+    if (formatTimestampWithMillis(timestamp, sizeof(timestamp)) == 0) {
+        return "RTC Error";
+    }
     return String(timestamp);
 }
 
@@ -518,8 +667,12 @@ void RTCManager::printDebugInfo() {
     time_t currentTime = getDateTime();
     if (currentTime > 0) {
         LOG_DEBUG("Current Time (epoch): %lu", (unsigned long)currentTime);
-        LOG_DEBUG("Current Time (ISO): %s", getTimestamp().c_str());
-        LOG_DEBUG("With Millis: %s", getTimestampWithMillis().c_str());
+        char timestamp[ISO_TIMESTAMP_SIZE];
+        formatTimestamp(timestamp, sizeof(timestamp));
+        LOG_DEBUG("Current Time (ISO): %s", timestamp);
+        formatTimestampWithMillis(timestamp, sizeof(timestamp));
+        LOG_DEBUG("With Millis: %s", timestamp);
+        LOG_DEBUG("Cached clock drift: %ld ppm (resync every %lu ms)", (long)_driftPpm, _resyncIntervalMs);
     } else {
         LOG_DEBUG("Failed to read current time");
     }
@@ -0,0 +1,144 @@
+#include "trace.h"
+#include "constants.h"
+#include <esp_system.h>
+
+TraceRecord* Trace::ring = NULL;
+uint32_t Trace::capacity = 0;
+volatile uint32_t Trace::head = 0;
+
+// Guards head and the slot being written (held for a 12-byte copy)
+static portMUX_TYPE traceLock = portMUX_INITIALIZER_UNLOCKED;
+
+static void putU16(uint8_t* out, uint16_t value) {
+    out[0] = (uint8_t)value;
+    out[1] = (uint8_t)(value >> 8);
+}
+
+static void putU32(uint8_t* out, uint32_t value) {
+    putU16(out, (uint16_t)value);
+    putU16(out + 2, (uint16_t)(value >> 16));
+}
+
+bool Trace::begin() {
+    if (ring != NULL) {
+        return true;
+    }
+
+    bool inPsram = psramFound();
+    uint32_t records = inPsram ? TRACE_RING_RECORDS_PSRAM : TRACE_RING_RECORDS_INTERNAL;
+    size_t bytes = records * sizeof(TraceRecord);
+    TraceRecord* buffer = static_cast<TraceRecord*>(inPsram ? ps_malloc(bytes) : malloc(bytes));
+    if (buffer == NULL) {
+        LOG_ERROR("Trace: failed to allocate %u byte ring", (unsigned int)bytes);
+        return false;
+    }
+    memset(buffer, 0, bytes);
+
+    portENTER_CRITICAL(&traceLock);
+    capacity = records;
+    ring = buffer;
+    portEXIT_CRITICAL(&traceLock);
+
+    record(TRACE_BOOT, 0, 0, (uint32_t)esp_reset_reason());
+    LOG_INFO("Trace ring ready: %u records (%u bytes) in %s",
+             (unsigned int)records, (unsigned int)bytes, inPsram ? "PSRAM" : "internal RAM");
+    return true;
+}
+
+void Trace::recordAt(uint32_t timestampMicros, TraceEvent event, uint8_t a8, uint16_t a16, uint32_t a32) {
+    if (ring == NULL) {
+        return;
+    }
+    portENTER_CRITICAL(&traceLock);
+    TraceRecord& slot = ring[head & (capacity - 1)];
+    slot.micros = timestampMicros;
+    slot.event = event;
+    slot.a8 = a8;
+    slot.a16 = a16;
+    slot.a32 = a32;
+    head = head + 1;
+    portEXIT_CRITICAL(&traceLock);
+}
+
+void Trace::startDump(TraceCursor& cursor, uint32_t maxRecords) {
+    portENTER_CRITICAL(&traceLock);
+    uint32_t end = head;
+    uint32_t available = end < capacity ? end : capacity;
+    portEXIT_CRITICAL(&traceLock);
+
+    if (maxRecords == 0 || maxRecords > available) {
+        maxRecords = available;
+    }
+    cursor.next = end - maxRecords;
+    cursor.end = end;
+    cursor.lost = 0;
+    cursor.headerSent = false;
+    cursor.active = true;
+}
+
+size_t Trace::readDump(TraceCursor& cursor, uint8_t* buffer, size_t size, uint8_t maxRecords) {
+    if (!cursor.active) {
+        return 0;
+    }
+
+    if (!cursor.headerSent) {
+        if (size < HEADER_SIZE) {
+            return 0;
+        }
+        memcpy(buffer, "FWTR", 4);
+        buffer[4] = VERSION;
+        buffer[5] = (uint8_t)sizeof(TraceRecord);
+        putU16(buffer + 6, (uint16_t)capacity);
+        putU32(buffer + 8, cursor.next);
+        putU32(buffer + 12, cursor.end);
+        cursor.headerSent = true;
+        return HEADER_SIZE;
+    }
+
+    if (size < BLOCK_HEADER_SIZE) {
+        return 0;
+    }
+    size_t fit = (size - BLOCK_HEADER_SIZE) / sizeof(TraceRecord);
+    if (fit > maxRecords) {
+        fit = maxRecords;
+    }
+
+    uint32_t count = 0;
+    uint8_t* records = buffer + BLOCK_HEADER_SIZE;
+    portENTER_CRITICAL(&traceLock);
+    if (ring != NULL) {
+        // Skip whatever the writer lapped since the dump started; once it
+        // lapped past the end there is nothing left to send
+        uint32_t oldest = head > capacity ? head - capacity : 0;
+        if ((int32_t)(cursor.next - oldest) < 0) {
+            uint32_t skipTo = (int32_t)(cursor.end - oldest) < 0 ? cursor.end : oldest;
+            cursor.lost += skipTo - cursor.next;
+            cursor.next = skipTo;
+        }
+        if ((int32_t)(cursor.end - cursor.next) > 0) {
+            count = cursor.end - cursor.next;
+            if (count > fit) {
+                count = fit;
+            }
+        }
+        for (uint32_t i = 0; i < count; i++) {
+            memcpy(records + i * sizeof(TraceRecord), &ring[(cursor.next + i) & (capacity - 1)],
+                   sizeof(TraceRecord));
+        }
+    }
+    portEXIT_CRITICAL(&traceLock);
+
+    putU32(buffer, count > 0 ? cursor.next : cursor.end);
+    buffer[4] = (uint8_t)count;
+    buffer[5] = buffer[6] = buffer[7] = 0;
+    if (count == 0) {
+        // End block, with the number of records lost to overwrites
+        uint32_t lost = cursor.lost < 0xFFFFFFu ? cursor.lost : 0xFFFFFFu;
+        buffer[5] = (uint8_t)lost;
+        putU16(buffer + 6, (uint16_t)(lost >> 8));
+        cursor.active = false;
+        return BLOCK_HEADER_SIZE;
+    }
+    cursor.next += count;
+    return BLOCK_HEADER_SIZE + count * sizeof(TraceRecord);
+}
@@ -0,0 +1,99 @@
+#include "wire_format.h"
+#include "ble_config_manager.h"
+#include "logger.h"
+#include <Preferences.h>
+#include <strings.h>
+
+#define PREFS_WIRE_FORMAT "wire_fmt_"  // + environment, e.g. "wire_fmt_prod"
+
+static WireFormat currentWireFormat = WIRE_FORMAT_JSON;
+static String currentWireEnvironment = "prod";
+
+WireFormat getWireFormat() {
+    return currentWireFormat;
+}
+
+void loadWireFormat(const String& environment) {
+    currentWireEnvironment = environment;
+
+    Preferences prefs;
+    prefs.begin(PREFS_NAMESPACE, true); // Read-only mode
+    String key = String(PREFS_WIRE_FORMAT) + environment;
+    currentWireFormat = (WireFormat)prefs.getUChar(key.c_str(), WIRE_FORMAT_JSON);
+    prefs.end();
+
+    if (currentWireFormat != WIRE_FORMAT_JSON && currentWireFormat != WIRE_FORMAT_MSGPACK) {
+        currentWireFormat = WIRE_FORMAT_JSON;
+    }
+    LOG_INFO("Wire format for environment %s: %s", environment.c_str(), wireFormatName(currentWireFormat));
+}
+
+void setWireFormat(WireFormat format) {
+    if (format == currentWireFormat) {
+        return;
+    }
+    currentWireFormat = format;
+
+    Preferences prefs;
+    prefs.begin(PREFS_NAMESPACE, false); // Read-write mode
+    String key = String(PREFS_WIRE_FORMAT) + currentWireEnvironment;
+    prefs.putUChar(key.c_str(), (uint8_t)format);
+    prefs.end();
+
+    LOG_INFO("Wire format for environment %s set to %s", currentWireEnvironment.c_str(), wireFormatName(format));
+}
+
+WireFormat parseWireFormat(const char* name, WireFormat fallback) {
+    if (name == NULL) {
+        return fallback;
+    }
+    if (strcasecmp(name, "msgpack") == 0) {
+        return WIRE_FORMAT_MSGPACK;
+    }
+    if (strcasecmp(name, "json") == 0) {
+        return WIRE_FORMAT_JSON;
+    }
+    LOG_WARNING("Unknown wire format '%s', keeping %s", name, wireFormatName(fallback));
+    return fallback;
+}
+
+const char* wireFormatName(WireFormat format) {
+    return format == WIRE_FORMAT_MSGPACK ? "msgpack" : "json";
+}
+
+size_t encodePayload(const JsonDocument& doc, uint8_t* out, size_t size) {
+    return encodePayload(doc, currentWireFormat, out, size);
+}
+
+size_t encodePayload(const JsonDocument& doc, WireFormat format, uint8_t* out, size_t size) {
+    if (out == NULL || size == 0) {
+        return 0;
+    }
+
+    size_t needed = (format == WIRE_FORMAT_MSGPACK) ? measureMsgPack(doc) : measureJson(doc);
+    if (needed >= size) {
+        LOG_WARNING("Encoded payload too large (%u bytes, buffer %u)", (unsigned int)needed, (unsigned int)size);
+        return 0;
+    }
+
+    if (format == WIRE_FORMAT_MSGPACK) {
+        return serializeMsgPack(doc, out, size);
+    }
+    return serializeJson(doc, reinterpret_cast<char*>(out), size);
+}
+
+bool isMsgPackPayload(const uint8_t* payload, size_t length) {
+    if (payload == NULL || length == 0) {
+        return false;
+    }
+    // Every message we exchange is an object: fixmap (0x80-0x8F), map16 or map32
+    uint8_t first = payload[0];
+    return (first >= 0x80 && first <= 0x8F) || first == 0xDE || first == 0xDF;
+}
+
+DeserializationError decodePayload(JsonDocument& doc, const uint8_t* payload, size_t length) {
+    if (isMsgPackPayload(payload, length)) {
+        return deserializeMsgPack(doc, payload, length);
+    }
+    return deserializeJson(doc, payload, length);
+}
@@ -0,0 +1,120 @@
+#ifndef NATIVE_ARDUINO_H
+#define NATIVE_ARDUINO_H
+
+// Host-side stand-in for the parts of the ESP32 Arduino core the controller
+// uses. Time comes from the simulator's virtual clock (native_sim.h), GPIO
+// reads return levels set by the test, Serial writes to stdout.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <ctype.h>
+#include <math.h>
+#include <algorithm>
+#include "WString.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "freertos/queue.h"
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define HIGH 1
+#define LOW 0
+#define INPUT 0x01
+#define OUTPUT 0x03
+#define INPUT_PULLUP 0x05
+#define RISING 0x01
+#define FALLING 0x02
+#define CHANGE 0x03
+#define ONLOW 0x04
+#define SERIAL_8N1 0x800001c
+#define IRAM_ATTR
+#define DRAM_ATTR
+
+typedef int esp_err_t;
+#define ESP_OK 0
+#define ESP_FAIL -1
+
+const char* esp_err_to_name(esp_err_t code);
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+int64_t esp_timer_get_time();
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t value);
+int digitalRead(uint8_t pin);
+int digitalPinToInterrupt(int pin);
+void attachInterrupt(uint8_t pin, void (*handler)(void), int mode);
+void attachInterruptArg(uint8_t pin, void (*handler)(void*), void* arg, int mode);
+void detachInterrupt(uint8_t pin);
+
+void* ps_malloc(size_t size);
+bool psramFound();
+
+using std::min;
+using std::max;
+
+class Print {
+public:
+    virtual ~Print() {}
+    virtual size_t write(uint8_t c);
+    virtual size_t write(const uint8_t* buffer, size_t size);
+    size_t write(const char* text) { return write(reinterpret_cast<const uint8_t*>(text), strlen(text)); }
+    size_t print(const char* text) { return write(text); }
+    size_t print(const String& text) { return write(text.c_str()); }
+    size_t print(int value);
+    size_t println(const char* text = "");
+    size_t println(const String& text) { return println(text.c_str()); }
+    size_t println(int value);
+    size_t printf(const char* format, ...) __attribute__((format(printf, 2, 3)));
+    virtual void flush() {}
+};
+
+class Stream : public Print {
+public:
+    virtual int available() { return 0; }
+    virtual int read() { return -1; }
+    virtual int peek() { return -1; }
+    void setTimeout(unsigned long timeout) { (void)timeout; }
+};
+
+// Output goes to stdout unless the simulator muted it (sim::setSerialEcho)
+class HardwareSerial : public Stream {
+public:
+    void begin(unsigned long baud, uint32_t config = SERIAL_8N1, int8_t rxPin = -1, int8_t txPin = -1);
+    void end() {}
+    void updateBaudRate(unsigned long baud) { (void)baud; }
+    size_t availableForWrite() { return 128; }
+    size_t write(uint8_t c) override;
+    size_t write(const uint8_t* buffer, size_t size) override;
+    using Print::write;
+    operator bool() const { return true; }
+};
+
+extern HardwareSerial Serial;
+extern HardwareSerial Serial1;
+extern HardwareSerial Serial2;
+
+class EspClass {
+public:
+    uint32_t getFreeHeap() { return 200000; }
+    uint32_t getMinFreeHeap() { return 180000; }
+    uint32_t getHeapSize() { return 320000; }
+    uint32_t getMaxAllocHeap() { return 110000; }
+    uint32_t getPsramSize() { return 0; }
+    uint32_t getFreePsram() { return 0; }
+    uint32_t getCycleCount() { return (uint32_t)micros() * 240; }
+    void restart();
+};
+
+extern EspClass ESP;
+
+#endif // NATIVE_ARDUINO_H
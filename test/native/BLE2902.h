@@ -0,0 +1,12 @@
+#ifndef NATIVE_BLE2902_H
+#define NATIVE_BLE2902_H
+
+#include "BLEDevice.h"
+
+// Client Characteristic Configuration descriptor
+class BLE2902 : public BLEDescriptor {
+public:
+    BLE2902() : BLEDescriptor(BLEUUID((uint16_t)0x2902)) {}
+};
+
+#endif // NATIVE_BLE2902_H
@@ -0,0 +1,150 @@
+// GATT server model behind the BLE shims; see BLEDevice.h
+
+#include "native_sim.h"
+#include "BLEDevice.h"
+
+static BLEServer* server = NULL;
+static BLEAdvertising advertising;
+static std::string deviceName;
+static uint16_t localMtu = 23;
+
+BLEUUID::BLEUUID(uint16_t uuid) {
+    // 16-bit UUIDs print in their Bluetooth base UUID form, as on the ESP32
+    char text[37];
+    snprintf(text, sizeof(text), "0000%04x-0000-1000-8000-00805f9b34fb", uuid);
+    _value = text;
+}
+
+BLECharacteristic::~BLECharacteristic() {
+    for (size_t i = 0; i < _descriptors.size(); i++) delete _descriptors[i];
+}
+
+BLEService::~BLEService() {
+    for (size_t i = 0; i < _characteristics.size(); i++) delete _characteristics[i];
+}
+
+BLECharacteristic* BLEService::createCharacteristic(const char* uuid, uint32_t properties) {
+    BLECharacteristic* characteristic = new BLECharacteristic(uuid, properties);
+    _characteristics.push_back(characteristic);
+    return characteristic;
+}
+
+BLECharacteristic* BLEService::getCharacteristic(const char* uuid) {
+    for (size_t i = 0; i < _characteristics.size(); i++) {
+        if (_characteristics[i]->getUUID().toString() == uuid) return _characteristics[i];
+    }
+    return NULL;
+}
+
+BLEServer::~BLEServer() {
+    for (size_t i = 0; i < _services.size(); i++) delete _services[i];
+}
+
+BLEService* BLEServer::createService(const char* uuid) {
+    BLEService* service = new BLEService(uuid);
+    _services.push_back(service);
+    return service;
+}
+
+BLEAdvertising* BLEServer::getAdvertising() { return &advertising; }
+
+void BLEServer::updateConnParams(esp_bd_addr_t remoteBda, uint16_t minInterval, uint16_t maxInterval,
+                                 uint16_t latency, uint16_t timeout) {
+    (void)remoteBda;
+    (void)minInterval;
+    (void)latency;
+    (void)timeout;
+    _maxInterval = maxInterval;
+}
+
+BLECharacteristic* BLEServer::findCharacteristic(const char* uuid) {
+    for (size_t i = 0; i < _services.size(); i++) {
+        BLECharacteristic* characteristic = _services[i]->getCharacteristic(uuid);
+        if (characteristic != NULL) return characteristic;
+    }
+    return NULL;
+}
+
+void BLEDevice::init(const std::string& name) { deviceName = name; }
+
+void BLEDevice::setMTU(uint16_t mtu) { localMtu = mtu; }
+
+BLEServer* BLEDevice::createServer() {
+    delete server;
+    server = new BLEServer();
+    return server;
+}
+
+BLEAdvertising* BLEDevice::getAdvertising() { return &advertising; }
+
+void BLEDevice::startAdvertising() { advertising.start(); }
+
+void BLEDevice::deinit(bool releaseMemory) {
+    (void)releaseMemory;
+    advertising.stop();
+    delete server;
+    server = NULL;
+}
+
+namespace sim {
+
+void resetBle() { BLEDevice::deinit(true); }
+
+bool bleConnect(uint16_t mtu) {
+    if (server == NULL || !advertising.isAdvertising()) return false;
+    advertising.stop();
+    esp_ble_gatts_cb_param_t param;
+    memset(&param, 0, sizeof(param));
+    static const esp_bd_addr_t PHONE = {0x02, 0x11, 0x22, 0x33, 0x44, 0x55};
+    memcpy(param.connect.remote_bda, PHONE, sizeof(PHONE));
+    server->setConnected(true, 23);
+    if (server->getCallbacks() != NULL) {
+        server->getCallbacks()->onConnect(server);
+        server->getCallbacks()->onConnect(server, &param);
+    }
+
+    // The phone starts the MTU exchange; both sides settle on the smaller one
+    uint16_t agreed = mtu < localMtu ? mtu : localMtu;
+    if (agreed > 23) {
+        server->setConnected(true, agreed);
+        memset(&param, 0, sizeof(param));
+        param.mtu.mtu = agreed;
+        if (server->getCallbacks() != NULL) server->getCallbacks()->onMtuChanged(server, &param);
+    }
+    return true;
+}
+
+void bleDisconnect() {
+    if (server == NULL || server->getConnectedCount() == 0) return;
+    server->setConnected(false, 23);
+    if (server->getCallbacks() != NULL) server->getCallbacks()->onDisconnect(server);
+}
+
+bool bleWrite(const char* uuid, const char* value) {
+    if (server == NULL || server->getConnectedCount() == 0) return false;
+    BLECharacteristic* characteristic = server->findCharacteristic(uuid);
+    if (characteristic == NULL || !(characteristic->getProperties() & BLECharacteristic::PROPERTY_WRITE)) {
+        return false;
+    }
+    characteristic->setValue(std::string(value));
+    if (characteristic->getCallbacks() != NULL) characteristic->getCallbacks()->onWrite(characteristic);
+    return true;
+}
+
+std::string getBleValue(const char* uuid) {
+    BLECharacteristic* characteristic = server != NULL ? server->findCharacteristic(uuid) : NULL;
+    return characteristic != NULL ? characteristic->getValue() : std::string();
+}
+
+uint32_t getBleNotifications(const char* uuid) {
+    BLECharacteristic* characteristic = server != NULL ? server->findCharacteristic(uuid) : NULL;
+    return characteristic != NULL ? characteristic->getNotificationCount() : 0;
+}
+
+bool isBleAdvertising() { return advertising.isAdvertising(); }
+
+const char* getBleDeviceName() { return deviceName.c_str(); }
+
+uint16_t getBleRequestedMaxInterval() { return server != NULL ? server->getRequestedMaxInterval() : 0; }
+
+}  // namespace sim
@@ -0,0 +1,189 @@
+#ifndef NATIVE_BLE_DEVICE_H
+#define NATIVE_BLE_DEVICE_H
+
+// In-memory GATT server with the ESP32 BLE library's API: one server, its
+// services and characteristics. Characteristics keep the last value set and
+// count notifications; the test plays the phone through sim::bleConnect()/
+// bleWrite() (native_sim.h), which run the registered callbacks the way the
+// BLE task would.
+
+#include "Arduino.h"
+#include <string>
+#include <vector>
+
+typedef uint8_t esp_bd_addr_t[6];
+
+typedef union {
+    struct {
+        uint16_t conn_id;
+        esp_bd_addr_t remote_bda;
+    } connect;
+    struct {
+        uint16_t conn_id;
+        uint16_t mtu;
+    } mtu;
+} esp_ble_gatts_cb_param_t;
+
+class BLEServer;
+class BLEService;
+class BLECharacteristic;
+class BLEAdvertising;
+
+class BLEUUID {
+public:
+    BLEUUID() {}
+    explicit BLEUUID(const char* uuid) : _value(uuid) {}
+    explicit BLEUUID(uint16_t uuid);
+    std::string toString() const { return _value; }
+
+private:
+    std::string _value;
+};
+
+class BLEServerCallbacks {
+public:
+    virtual ~BLEServerCallbacks() {}
+    virtual void onConnect(BLEServer* server) { (void)server; }
+    virtual void onConnect(BLEServer* server, esp_ble_gatts_cb_param_t* param) {
+        (void)server;
+        (void)param;
+    }
+    virtual void onDisconnect(BLEServer* server) { (void)server; }
+    virtual void onMtuChanged(BLEServer* server, esp_ble_gatts_cb_param_t* param) {
+        (void)server;
+        (void)param;
+    }
+};
+
+class BLECharacteristicCallbacks {
+public:
+    virtual ~BLECharacteristicCallbacks() {}
+    virtual void onWrite(BLECharacteristic* characteristic) { (void)characteristic; }
+    virtual void onRead(BLECharacteristic* characteristic) { (void)characteristic; }
+};
+
+class BLEDescriptor {
+public:
+    explicit BLEDescriptor(BLEUUID uuid) : _uuid(uuid) {}
+    virtual ~BLEDescriptor() {}
+    void setValue(const std::string& value) { _value = value; }
+    BLEUUID getUUID() const { return _uuid; }
+    std::string getValue() const { return _value; }
+
+private:
+    BLEUUID _uuid;
+    std::string _value;
+};
+
+class BLECharacteristic {
+public:
+    static const uint32_t PROPERTY_READ = 1 << 0;
+    static const uint32_t PROPERTY_WRITE = 1 << 1;
+    static const uint32_t PROPERTY_NOTIFY = 1 << 2;
+    static const uint32_t PROPERTY_BROADCAST = 1 << 3;
+    static const uint32_t PROPERTY_INDICATE = 1 << 4;
+    static const uint32_t PROPERTY_WRITE_NR = 1 << 5;
+
+    BLECharacteristic(const char* uuid, uint32_t properties)
+        : _uuid(uuid), _properties(properties), _callbacks(NULL), _notifications(0) {}
+    ~BLECharacteristic();
+
+    void setCallbacks(BLECharacteristicCallbacks* callbacks) { _callbacks = callbacks; }
+    void setValue(const std::string& value) { _value = value; }
+    void setValue(uint8_t* data, size_t length) { _value.assign(reinterpret_cast<const char*>(data), length); }
+    std::string getValue() const { return _value; }
+    BLEUUID getUUID() const { return _uuid; }
+    void addDescriptor(BLEDescriptor* descriptor) { _descriptors.push_back(descriptor); }
+    void notify() { _notifications++; }
+
+    // Simulator side
+    uint32_t getProperties() const { return _properties; }
+    BLECharacteristicCallbacks* getCallbacks() const { return _callbacks; }
+    uint32_t getNotificationCount() const { return _notifications; }
+
+private:
+    BLEUUID _uuid;
+    uint32_t _properties;
+    BLECharacteristicCallbacks* _callbacks;
+    std::string _value;
+    std::vector<BLEDescriptor*> _descriptors;
+    uint32_t _notifications;
+};
+
+class BLEService {
+public:
+    explicit BLEService(const char* uuid) : _uuid(uuid), _started(false) {}
+    ~BLEService();
+
+    BLECharacteristic* createCharacteristic(const char* uuid, uint32_t properties);
+    BLECharacteristic* getCharacteristic(const char* uuid);
+    void start() { _started = true; }
+    BLEUUID getUUID() const { return _uuid; }
+
+private:
+    BLEUUID _uuid;
+    bool _started;
+    std::vector<BLECharacteristic*> _characteristics;
+};
+
+class BLEAdvertising {
+public:
+    BLEAdvertising() : _advertising(false) {}
+    void addServiceUUID(const char* uuid) { (void)uuid; }
+    void setScanResponse(bool enabled) { (void)enabled; }
+    void setMinPreferred(uint16_t interval) { (void)interval; }
+    void start() { _advertising = true; }
+    void stop() { _advertising = false; }
+
+    // Simulator side
+    bool isAdvertising() const { return _advertising; }
+
+private:
+    bool _advertising;
+};
+
+class BLEServer {
+public:
+    BLEServer() : _callbacks(NULL), _connected(false), _peerMtu(23), _maxInterval(0) {}
+    ~BLEServer();
+
+    void setCallbacks(BLEServerCallbacks* callbacks) { _callbacks = callbacks; }
+    BLEService* createService(const char* uuid);
+    BLEAdvertising* getAdvertising();
+    void updateConnParams(esp_bd_addr_t remoteBda, uint16_t minInterval, uint16_t maxInterval, uint16_t latency,
+                          uint16_t timeout);
+    uint16_t getPeerMTU(uint16_t connId) const {
+        (void)connId;
+        return _peerMtu;
+    }
+    uint16_t getConnId() const { return 0; }
+    uint32_t getConnectedCount() const { return _connected ? 1 : 0; }
+
+    // Simulator side
+    BLEServerCallbacks* getCallbacks() const { return _callbacks; }
+    BLECharacteristic* findCharacteristic(const char* uuid);
+    void setConnected(bool connected, uint16_t mtu) {
+        _connected = connected;
+        _peerMtu = mtu;
+    }
+    uint16_t getRequestedMaxInterval() const { return _maxInterval; }
+
+private:
+    BLEServerCallbacks* _callbacks;
+    std::vector<BLEService*> _services;
+    bool _connected;
+    uint16_t _peerMtu;
+    uint16_t _maxInterval;
+};
+
+class BLEDevice {
+public:
+    static void init(const std::string& deviceName);
+    static void setMTU(uint16_t mtu);
+    static BLEServer* createServer();
+    static BLEAdvertising* getAdvertising();
+    static void startAdvertising();
+    static void deinit(bool releaseMemory = false);
+};
+
+#endif // NATIVE_BLE_DEVICE_H
@@ -0,0 +1,34 @@
+#ifndef NATIVE_CLIENT_H
+#define NATIVE_CLIENT_H
+
+#include "Arduino.h"
+
+class IPAddress {
+public:
+    IPAddress(uint8_t a = 0, uint8_t b = 0, uint8_t c = 0, uint8_t d = 0) : _bytes{a, b, c, d} {}
+    String toString() const;
+
+private:
+    uint8_t _bytes[4];
+};
+
+// Declarations only: the modem and TLS stack are not simulated, so nothing
+// in the native build may construct a Client
+class Client : public Stream {
+public:
+    virtual int connect(IPAddress ip, uint16_t port) = 0;
+    virtual int connect(const char* host, uint16_t port) = 0;
+    size_t write(uint8_t b) override = 0;
+    size_t write(const uint8_t* buf, size_t size) override = 0;
+    using Print::write;
+    int available() override = 0;
+    int read() override = 0;
+    virtual int read(uint8_t* buf, size_t size) = 0;
+    int peek() override = 0;
+    void flush() override = 0;
+    virtual void stop() = 0;
+    virtual uint8_t connected() = 0;
+    virtual operator bool() = 0;
+};
+
+#endif // NATIVE_CLIENT_H
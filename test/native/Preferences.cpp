@@ -0,0 +1,106 @@
+// In-memory NVS (see Preferences.h)
+
+#include "Preferences.h"
+#include "native_sim.h"
+#include <map>
+#include <string>
+#include <vector>
+
+namespace {
+
+typedef std::map<std::string, std::vector<uint8_t>> Namespace;
+
+std::map<std::string, Namespace>& storage() {
+    static std::map<std::string, Namespace> namespaces;
+    return namespaces;
+}
+
+}  // namespace
+
+namespace sim {
+
+void resetPreferences() { storage().clear(); }
+
+}  // namespace sim
+
+bool Preferences::begin(const char* name, bool readOnly) {
+    _namespace = name;
+    _open = true;
+    _readOnly = readOnly;
+    return true;
+}
+
+void Preferences::end() { _open = false; }
+
+bool Preferences::clear() {
+    if (!_open || _readOnly) return false;
+    storage()[_namespace.c_str()].clear();
+    return true;
+}
+
+bool Preferences::remove(const char* key) {
+    if (!_open || _readOnly) return false;
+    return storage()[_namespace.c_str()].erase(key) > 0;
+}
+
+bool Preferences::isKey(const char* key) {
+    if (!_open) return false;
+    Namespace& entries = storage()[_namespace.c_str()];
+    return entries.find(key) != entries.end();
+}
+
+size_t Preferences::putBytes(const char* key, const void* value, size_t length) {
+    if (!_open || _readOnly) return 0;
+    const uint8_t* bytes = static_cast<const uint8_t*>(value);
+    storage()[_namespace.c_str()][key].assign(bytes, bytes + length);
+    return length;
+}
+
+size_t Preferences::getBytesLength(const char* key) {
+    if (!isKey(key)) return 0;
+    return storage()[_namespace.c_str()][key].size();
+}
+
+size_t Preferences::getBytes(const char* key, void* buffer, size_t maxLength) {
+    size_t length = getBytesLength(key);
+    if (length == 0 || length > maxLength) return 0;
+    memcpy(buffer, storage()[_namespace.c_str()][key].data(), length);
+    return length;
+}
+
+String Preferences::getString(const char* key, const String& defaultValue) {
+    if (!isKey(key)) return defaultValue;
+    const std::vector<uint8_t>& value = storage()[_namespace.c_str()][key];
+    return String(std::string(value.begin(), value.end()).c_str());
+}
+
+size_t Preferences::putString(const char* key, const String& value) {
+    return putBytes(key, value.c_str(), value.length());
+}
+
+// Integers are stored little-endian in their own width
+
+uint8_t Preferences::getUChar(const char* key, uint8_t defaultValue) {
+    uint8_t value;
+    return getBytes(key, &value, sizeof(value)) == sizeof(value) ? value : defaultValue;
+}
+
+size_t Preferences::putUChar(const char* key, uint8_t value) { return putBytes(key, &value, sizeof(value)); }
+
+bool Preferences::getBool(const char* key, bool defaultValue) { return getUChar(key, defaultValue ? 1 : 0) != 0; }
+
+size_t Preferences::putBool(const char* key, bool value) { return putUChar(key, value ? 1 : 0); }
+
+int32_t Preferences::getInt(const char* key, int32_t defaultValue) {
+    int32_t value;
+    return getBytes(key, &value, sizeof(value)) == sizeof(value) ? value : defaultValue;
+}
+
+size_t Preferences::putInt(const char* key, int32_t value) { return putBytes(key, &value, sizeof(value)); }
+
+uint32_t Preferences::getUInt(const char* key, uint32_t defaultValue) {
+    uint32_t value;
+    return getBytes(key, &value, sizeof(value)) == sizeof(value) ? value : defaultValue;
+}
+
+size_t Preferences::putUInt(const char* key, uint32_t value) { return putBytes(key, &value, sizeof(value)); }
@@ -0,0 +1,38 @@
+#ifndef NATIVE_PREFERENCES_H
+#define NATIVE_PREFERENCES_H
+
+// NVS stand-in: one in-memory key/value map per namespace, kept for the
+// lifetime of the process (sim::resetPreferences() clears it)
+
+#include "Arduino.h"
+
+class Preferences {
+public:
+    bool begin(const char* name, bool readOnly = false);
+    void end();
+    bool clear();
+    bool remove(const char* key);
+    bool isKey(const char* key);
+
+    String getString(const char* key, const String& defaultValue = String());
+    size_t putString(const char* key, const String& value);
+    size_t putString(const char* key, const char* value) { return putString(key, String(value)); }
+    uint8_t getUChar(const char* key, uint8_t defaultValue = 0);
+    size_t putUChar(const char* key, uint8_t value);
+    bool getBool(const char* key, bool defaultValue = false);
+    size_t putBool(const char* key, bool value);
+    int32_t getInt(const char* key, int32_t defaultValue = 0);
+    size_t putInt(const char* key, int32_t value);
+    uint32_t getUInt(const char* key, uint32_t defaultValue = 0);
+    size_t putUInt(const char* key, uint32_t value);
+    size_t getBytesLength(const char* key);
+    size_t getBytes(const char* key, void* buffer, size_t maxLength);
+    size_t putBytes(const char* key, const void* value, size_t length);
+
+private:
+    String _namespace;
+    bool _open = false;
+    bool _readOnly = false;
+};
+
+#endif // NATIVE_PREFERENCES_H
@@ -0,0 +1,10 @@
+#ifndef NATIVE_PUBSUB_CLIENT_H
+#define NATIVE_PUBSUB_CLIENT_H
+
+// Declarations only (see Client.h)
+
+#include "Client.h"
+
+class PubSubClient;
+
+#endif // NATIVE_PUBSUB_CLIENT_H
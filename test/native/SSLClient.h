@@ -0,0 +1,10 @@
+#ifndef NATIVE_SSL_CLIENT_H
+#define NATIVE_SSL_CLIENT_H
+
+// Declarations only (see Client.h)
+
+#include "Client.h"
+
+class SSLClient;
+
+#endif // NATIVE_SSL_CLIENT_H
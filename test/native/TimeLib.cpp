@@ -0,0 +1,59 @@
+// Calendar conversion from PaulStoffregen/Time (see TimeLib.h)
+
+#include "TimeLib.h"
+
+static const uint8_t monthDays[] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+
+#define LEAP_YEAR(Y) (((1970 + (Y)) > 0) && !((1970 + (Y)) % 4) && (((1970 + (Y)) % 100) || !((1970 + (Y)) % 400)))
+
+void breakTime(time_t timeInput, tmElements_t& tm) {
+    uint32_t time = (uint32_t)timeInput;
+    tm.Second = time % 60;
+    time /= 60;
+    tm.Minute = time % 60;
+    time /= 60;
+    tm.Hour = time % 24;
+    time /= 24;
+    tm.Wday = ((time + 4) % 7) + 1;  // 1970-01-01 was a Thursday
+
+    uint8_t year = 0;
+    unsigned long days = 0;
+    while ((unsigned)(days += (LEAP_YEAR(year) ? 366 : 365)) <= time) {
+        year++;
+    }
+    tm.Year = year;
+
+    days -= LEAP_YEAR(year) ? 366 : 365;
+    time -= days;
+
+    uint8_t month;
+    for (month = 0; month < 12; month++) {
+        uint8_t length = (month == 1 && LEAP_YEAR(year)) ? 29 : monthDays[month];
+        if (time >= length) {
+            time -= length;
+        } else {
+            break;
+        }
+    }
+    tm.Month = month + 1;
+    tm.Day = time + 1;
+}
+
+time_t makeTime(const tmElements_t& tm) {
+    uint32_t seconds = tm.Year * (365UL * 86400UL);
+    for (int i = 0; i < tm.Year; i++) {
+        if (LEAP_YEAR(i)) seconds += 86400UL;
+    }
+    for (int i = 1; i < tm.Month; i++) {
+        if (i == 2 && LEAP_YEAR(tm.Year)) {
+            seconds += 86400UL * 29;
+        } else {
+            seconds += 86400UL * monthDays[i - 1];
+        }
+    }
+    seconds += (tm.Day - 1) * 86400UL;
+    seconds += tm.Hour * 3600UL;
+    seconds += tm.Minute * 60UL;
+    seconds += tm.Second;
+    return (time_t)seconds;
+}
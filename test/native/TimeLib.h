@@ -0,0 +1,26 @@
+#ifndef NATIVE_TIMELIB_H
+#define NATIVE_TIMELIB_H
+
+// The calendar part of PaulStoffregen/Time used by RTCManager
+// (Year is an offset from 1970, as in the library)
+
+#include <stdint.h>
+#include <time.h>
+
+typedef struct {
+    uint8_t Second;
+    uint8_t Minute;
+    uint8_t Hour;
+    uint8_t Wday;  // Day of week, Sunday is day 1
+    uint8_t Day;
+    uint8_t Month;
+    uint8_t Year;  // Offset from 1970
+} tmElements_t;
+
+#define tmYearToCalendar(Y) ((Y) + 1970)
+#define CalendarYrToTm(Y) ((Y) - 1970)
+
+void breakTime(time_t time, tmElements_t& tm);
+time_t makeTime(const tmElements_t& tm);
+
+#endif // NATIVE_TIMELIB_H
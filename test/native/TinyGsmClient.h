@@ -0,0 +1,11 @@
+#ifndef NATIVE_TINY_GSM_CLIENT_H
+#define NATIVE_TINY_GSM_CLIENT_H
+
+// Declarations only (see Client.h)
+
+#include "Client.h"
+
+class TinyGsm;
+class TinyGsmClient;
+
+#endif // NATIVE_TINY_GSM_CLIENT_H
@@ -0,0 +1,172 @@
+#ifndef NATIVE_WSTRING_H
+#define NATIVE_WSTRING_H
+
+// Arduino String over std::string; every growth goes through the global
+// allocator, so the simulator's allocation counts include String churn.
+
+#include <string>
+#include <utility>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+
+class String {
+public:
+    String(const char* text = "") : s(text != NULL ? text : "") {}
+    explicit String(char c) : s(1, c) {}
+    explicit String(int value) : s(std::to_string(value)) {}
+    explicit String(unsigned int value) : s(std::to_string(value)) {}
+    explicit String(long value) : s(std::to_string(value)) {}
+    explicit String(unsigned long value) : s(std::to_string(value)) {}
+    explicit String(float value, unsigned int decimals = 2) : s(format(value, decimals)) {}
+    explicit String(double value, unsigned int decimals = 2) : s(format(value, decimals)) {}
+
+    String& operator=(const char* text) {
+        s = text != NULL ? text : "";
+        return *this;
+    }
+
+    const char* c_str() const { return s.c_str(); }
+    unsigned int length() const { return (unsigned int)s.size(); }
+    bool isEmpty() const { return s.empty(); }
+    bool reserve(unsigned int size) {
+        s.reserve(size);
+        return true;
+    }
+
+    char operator[](unsigned int index) const { return index < s.size() ? s[index] : '\0'; }
+    char& operator[](unsigned int index) { return s[index]; }
+    char charAt(unsigned int index) const { return (*this)[index]; }
+
+    bool equals(const String& other) const { return s == other.s; }
+    bool equalsIgnoreCase(const String& other) const { return strcasecmp(s.c_str(), other.s.c_str()) == 0; }
+    bool operator==(const String& other) const { return s == other.s; }
+    bool operator==(const char* other) const { return s == (other != NULL ? other : ""); }
+    bool operator!=(const String& other) const { return s != other.s; }
+    bool operator!=(const char* other) const { return !(*this == other); }
+    bool operator<(const String& other) const { return s < other.s; }
+
+    bool concat(const char* text) {
+        s += text != NULL ? text : "";
+        return true;
+    }
+    bool concat(const String& text) {
+        s += text.s;
+        return true;
+    }
+    String& operator+=(const String& text) {
+        s += text.s;
+        return *this;
+    }
+    String& operator+=(const char* text) {
+        concat(text);
+        return *this;
+    }
+    String& operator+=(char c) {
+        s += c;
+        return *this;
+    }
+    String& operator+=(int value) {
+        s += std::to_string(value);
+        return *this;
+    }
+    String& operator+=(unsigned int value) {
+        s += std::to_string(value);
+        return *this;
+    }
+    String& operator+=(long value) {
+        s += std::to_string(value);
+        return *this;
+    }
+    String& operator+=(unsigned long value) {
+        s += std::to_string(value);
+        return *this;
+    }
+
+    friend String operator+(const String& a, const String& b) {
+        String result(a);
+        result += b;
+        return result;
+    }
+    friend String operator+(const String& a, const char* b) {
+        String result(a);
+        result += b;
+        return result;
+    }
+    friend String operator+(const char* a, const String& b) {
+        String result(a);
+        result += b;
+        return result;
+    }
+    friend String operator+(const String& a, char b) {
+        String result(a);
+        result += b;
+        return result;
+    }
+
+    int indexOf(char c, unsigned int from = 0) const {
+        size_t at = s.find(c, from);
+        return at == std::string::npos ? -1 : (int)at;
+    }
+    int indexOf(const char* text, unsigned int from = 0) const {
+        size_t at = s.find(text, from);
+        return at == std::string::npos ? -1 : (int)at;
+    }
+    int indexOf(const String& text, unsigned int from = 0) const { return indexOf(text.c_str(), from); }
+    int lastIndexOf(char c) const {
+        size_t at = s.rfind(c);
+        return at == std::string::npos ? -1 : (int)at;
+    }
+    String substring(unsigned int from) const { return substring(from, length()); }
+    String substring(unsigned int from, unsigned int to) const {
+        if (from > to) std::swap(from, to);
+        if (from >= s.size()) return String();
+        return String(s.substr(from, to - from).c_str());
+    }
+    bool startsWith(const char* prefix) const { return s.compare(0, strlen(prefix), prefix) == 0; }
+    bool startsWith(const String& prefix) const { return startsWith(prefix.c_str()); }
+    bool endsWith(const char* suffix) const {
+        size_t n = strlen(suffix);
+        return s.size() >= n && s.compare(s.size() - n, n, suffix) == 0;
+    }
+
+    long toInt() const { return strtol(s.c_str(), NULL, 10); }
+    float toFloat() const { return strtof(s.c_str(), NULL); }
+
+    void trim() {
+        size_t first = 0;
+        while (first < s.size() && isspace((unsigned char)s[first])) first++;
+        size_t last = s.size();
+        while (last > first && isspace((unsigned char)s[last - 1])) last--;
+        s = s.substr(first, last - first);
+    }
+    void toUpperCase() {
+        for (size_t i = 0; i < s.size(); i++) s[i] = (char)toupper((unsigned char)s[i]);
+    }
+    void toLowerCase() {
+        for (size_t i = 0; i < s.size(); i++) s[i] = (char)tolower((unsigned char)s[i]);
+    }
+    void remove(unsigned int index, unsigned int count = 1) {
+        if (index < s.size()) s.erase(index, count);
+    }
+    void replace(const char* find, const char* with) {
+        size_t n = strlen(find);
+        if (n == 0) return;
+        for (size_t at = s.find(find); at != std::string::npos; at = s.find(find, at + strlen(with))) {
+            s.replace(at, n, with);
+        }
+    }
+
+private:
+    static std::string format(double value, unsigned int decimals) {
+        char buffer[48];
+        snprintf(buffer, sizeof(buffer), "%.*f", (int)decimals, value);
+        return buffer;
+    }
+
+    std::string s;
+};
+
+#endif // NATIVE_WSTRING_H
@@ -0,0 +1,123 @@
+// Fake I2C bus with a TCA9535 register model on every address (see Wire.h)
+
+#include "Wire.h"
+#include "native_sim.h"
+
+namespace {
+
+// TCA9535 register map: INPUT0/1, OUTPUT0/1, POLARITY0/1, CONFIG0/1
+const uint8_t REGISTER_COUNT = 8;
+const uint8_t POWER_ON[REGISTER_COUNT] = {0xFF, 0xFF, 0xFF, 0xFF, 0x00, 0x00, 0xFF, 0xFF};
+
+struct Expander {
+    uint8_t registers[REGISTER_COUNT];
+    uint8_t pointer;
+    bool missing;
+    uint32_t writes[REGISTER_COUNT];
+};
+
+Expander expanders[128];
+bool expandersReady = false;
+uint32_t transactions = 0;
+
+Expander& expanderAt(uint8_t address) {
+    if (!expandersReady) sim::resetI2c();
+    return expanders[address & 0x7F];
+}
+
+}  // namespace
+
+TwoWire Wire(0);
+TwoWire Wire1(1);
+
+namespace sim {
+
+void resetI2c() {
+    for (size_t i = 0; i < sizeof(expanders) / sizeof(expanders[0]); i++) {
+        memcpy(expanders[i].registers, POWER_ON, REGISTER_COUNT);
+        expanders[i].pointer = 0;
+        expanders[i].missing = false;
+        memset(expanders[i].writes, 0, sizeof(expanders[i].writes));
+    }
+    expandersReady = true;
+    transactions = 0;
+}
+
+void setExpanderInput(uint8_t address, uint8_t port, uint8_t value) {
+    expanderAt(address).registers[port != 0 ? 1 : 0] = value;
+}
+
+uint8_t getExpanderRegister(uint8_t address, uint8_t reg) {
+    return reg < REGISTER_COUNT ? expanderAt(address).registers[reg] : 0;
+}
+
+void setI2cDeviceMissing(uint8_t address, bool missing) { expanderAt(address).missing = missing; }
+
+uint32_t getI2cTransactions() { return transactions; }
+
+uint32_t getI2cWrites(uint8_t address, uint8_t reg) {
+    return reg < REGISTER_COUNT ? expanderAt(address).writes[reg] : 0;
+}
+
+}  // namespace sim
+
+bool TwoWire::begin(int sda, int scl, uint32_t frequency) {
+    (void)sda;
+    (void)scl;
+    (void)frequency;
+    return true;
+}
+
+void TwoWire::beginTransmission(uint8_t address) {
+    _txAddress = address;
+    _txLength = 0;
+}
+
+uint8_t TwoWire::endTransmission(bool sendStop) {
+    (void)sendStop;
+    transactions++;
+    Expander& device = expanderAt(_txAddress);
+    if (device.missing) return 2;  // NACK on address
+
+    // First byte sets the register pointer, the rest auto-increment within a
+    // port pair, as on the TCA9535
+    if (_txLength > 0) device.pointer = _txBuffer[0] % REGISTER_COUNT;
+    for (size_t i = 1; i < _txLength; i++) {
+        uint8_t reg = device.pointer;
+        if (reg >= 2) {  // Input ports are read-only
+            device.registers[reg] = _txBuffer[i];
+            device.writes[reg]++;
+        }
+        device.pointer = (reg & ~1) | ((reg + 1) & 1);
+    }
+    _txLength = 0;
+    return 0;
+}
+
+uint8_t TwoWire::requestFrom(uint8_t address, uint8_t quantity, bool sendStop) {
+    (void)sendStop;
+    transactions++;
+    _rxIndex = 0;
+    _rxLength = 0;
+    Expander& device = expanderAt(address);
+    if (device.missing) return 0;
+
+    while (_rxLength < quantity && _rxLength < BUFFER_LENGTH) {
+        uint8_t reg = device.pointer;
+        _rxBuffer[_rxLength++] = device.registers[reg];
+        device.pointer = (reg & ~1) | ((reg + 1) & 1);
+    }
+    return (uint8_t)_rxLength;
+}
+
+size_t TwoWire::write(uint8_t data) {
+    if (_txLength >= BUFFER_LENGTH) return 0;
+    _txBuffer[_txLength++] = data;
+    return 1;
+}
+
+size_t TwoWire::write(const uint8_t* data, size_t quantity) {
+    size_t written = 0;
+    while (written < quantity && write(data[written]) == 1) written++;
+    return written;
+}
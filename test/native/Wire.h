@@ -0,0 +1,49 @@
+#ifndef NATIVE_WIRE_H
+#define NATIVE_WIRE_H
+
+// Fake I2C bus. Every device address answers with a TCA9535 register file
+// (the simulator can change the input ports, see native_sim.h); each
+// endTransmission()/requestFrom() counts as one bus transaction.
+
+#include "Arduino.h"
+
+class TwoWire : public Stream {
+public:
+    explicit TwoWire(uint8_t busNum) : _busNum(busNum) {}
+
+    bool begin(int sda = -1, int scl = -1, uint32_t frequency = 0);
+    bool end() { return true; }
+    bool setClock(uint32_t frequency) {
+        (void)frequency;
+        return true;
+    }
+
+    void beginTransmission(uint8_t address);
+    void beginTransmission(int address) { beginTransmission((uint8_t)address); }
+    uint8_t endTransmission(bool sendStop = true);
+    uint8_t requestFrom(uint8_t address, uint8_t quantity, bool sendStop = true);
+    uint8_t requestFrom(int address, int quantity) { return requestFrom((uint8_t)address, (uint8_t)quantity); }
+
+    size_t write(uint8_t data) override;
+    size_t write(const uint8_t* data, size_t quantity) override;
+    using Print::write;
+    int available() override { return (int)(_rxLength - _rxIndex); }
+    int read() override { return _rxIndex < _rxLength ? _rxBuffer[_rxIndex++] : -1; }
+    int peek() override { return _rxIndex < _rxLength ? _rxBuffer[_rxIndex] : -1; }
+
+private:
+    static const size_t BUFFER_LENGTH = 32;
+
+    uint8_t _busNum;
+    uint8_t _txAddress = 0;
+    uint8_t _txBuffer[BUFFER_LENGTH];
+    size_t _txLength = 0;
+    uint8_t _rxBuffer[BUFFER_LENGTH];
+    size_t _rxLength = 0;
+    size_t _rxIndex = 0;
+};
+
+extern TwoWire Wire;
+extern TwoWire Wire1;
+
+#endif // NATIVE_WIRE_H
@@ -0,0 +1,148 @@
+// CH453 model on the display's bit-banged bus (DISPLAY_SDA_PIN/DISPLAY_SCL_PIN).
+// Both lines are open drain: a pin pulls its line low only while it is an
+// OUTPUT latched LOW, otherwise the pull-up wins. The model decodes
+// START/bits/STOP from the line edges, ACKs every byte and applies two-byte
+// frames to its digit registers; a display marked missing does neither.
+
+#include "native_sim.h"
+#include "Arduino.h"
+#include "utilities.h"
+
+struct Ch453Pin {
+    uint8_t mode;
+    uint8_t latch;
+};
+
+struct Ch453Bus {
+    Ch453Pin sda;
+    Ch453Pin scl;
+    bool sdaLevel;
+    bool sclLevel;
+    bool acking;          // Device holds SDA low for the 9th clock
+    bool missing;
+    bool inFrame;
+    uint8_t bits;         // Bits of the current byte clocked in (8 = ACK clock pending)
+    bool ackClocked;
+    uint8_t shift;
+    uint8_t bytes[2];
+    uint8_t byteCount;
+    uint32_t frames;
+    uint8_t digits[16];
+    uint8_t systemParam;
+};
+
+static Ch453Bus bus = {{INPUT_PULLUP, HIGH}, {INPUT_PULLUP, HIGH}, true, true};
+
+static bool pullsLow(const Ch453Pin& pin) { return pin.mode == OUTPUT && pin.latch == LOW; }
+
+static void applyFrame() {
+    bus.frames++;
+    if (bus.missing) return;
+    uint8_t command = bus.bytes[0];
+    if (command == 0x48) {
+        bus.systemParam = bus.bytes[1];
+    } else if ((command & 0xE1) == 0x60) {
+        bus.digits[(command >> 1) & 0x0F] = bus.bytes[1];
+    }
+}
+
+static void onSclRising() {
+    if (!bus.inFrame) return;
+    if (bus.bits < 8) {
+        bus.shift = (uint8_t)((bus.shift << 1) | (bus.sdaLevel ? 1 : 0));
+        bus.bits++;
+    } else {
+        bus.ackClocked = true;
+    }
+}
+
+static void onSclFalling() {
+    if (!bus.inFrame || bus.bits < 8) return;
+    if (!bus.ackClocked) {
+        bus.acking = !bus.missing;  // After the 8th bit
+        return;
+    }
+    bus.acking = false;  // After the ACK clock
+    if (bus.byteCount < sizeof(bus.bytes)) bus.bytes[bus.byteCount] = bus.shift;
+    bus.byteCount++;
+    bus.bits = 0;
+    bus.ackClocked = false;
+    bus.shift = 0;
+}
+
+// Settle both lines after a pin change and act on the edges
+static void update() {
+    for (;;) {
+        bool scl = !pullsLow(bus.scl);
+        bool sda = !(pullsLow(bus.sda) || bus.acking);
+        if (scl != bus.sclLevel) {
+            bus.sclLevel = scl;
+            if (scl) {
+                onSclRising();
+            } else {
+                onSclFalling();  // May change the ACK, so settle again
+            }
+            continue;
+        }
+        if (sda != bus.sdaLevel) {
+            bus.sdaLevel = sda;
+            if (bus.sclLevel && !sda) {
+                // START
+                bus.inFrame = true;
+                bus.bits = 0;
+                bus.ackClocked = false;
+                bus.shift = 0;
+                bus.byteCount = 0;
+            } else if (bus.sclLevel && sda && bus.inFrame) {
+                // STOP
+                bus.inFrame = false;
+                if (bus.byteCount == 2) applyFrame();
+            }
+            continue;
+        }
+        return;
+    }
+}
+
+static Ch453Pin* busPin(uint8_t pin) {
+    if (pin == DISPLAY_SDA_PIN) return &bus.sda;
+    if (pin == DISPLAY_SCL_PIN) return &bus.scl;
+    return NULL;
+}
+
+// Hooks for the GPIO functions in native_sim.cpp
+bool ch453OwnsPin(uint8_t pin) { return busPin(pin) != NULL; }
+
+void ch453PinMode(uint8_t pin, uint8_t mode) {
+    busPin(pin)->mode = mode;
+    update();
+}
+
+void ch453DigitalWrite(uint8_t pin, uint8_t value) {
+    busPin(pin)->latch = value;
+    update();
+}
+
+int ch453DigitalRead(uint8_t pin) { return (pin == DISPLAY_SDA_PIN ? bus.sdaLevel : bus.sclLevel) ? HIGH : LOW; }
+
+namespace sim {
+
+void resetDisplay() {
+    Ch453Pin sda = bus.sda;
+    Ch453Pin scl = bus.scl;
+    bus = Ch453Bus();
+    bus.sda = sda;
+    bus.scl = scl;
+    bus.sdaLevel = !pullsLow(sda);
+    bus.sclLevel = !pullsLow(scl);
+}
+
+void setDisplayMissing(bool missing) { bus.missing = missing; }
+
+uint32_t getDisplayFrames() { return bus.frames; }
+
+uint8_t getDisplayDigit(uint8_t digit) { return digit < 16 ? bus.digits[digit] : 0; }
+
+uint8_t getDisplaySystemParam() { return bus.systemParam; }
+
+}  // namespace sim
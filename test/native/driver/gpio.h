@@ -0,0 +1,24 @@
+#ifndef NATIVE_DRIVER_GPIO_H
+#define NATIVE_DRIVER_GPIO_H
+
+#include "../Arduino.h"
+
+typedef int gpio_num_t;
+
+typedef enum {
+    GPIO_INTR_DISABLE,
+    GPIO_INTR_POSEDGE,
+    GPIO_INTR_NEGEDGE,
+    GPIO_INTR_ANYEDGE,
+    GPIO_INTR_LOW_LEVEL,
+    GPIO_INTR_HIGH_LEVEL
+} gpio_int_type_t;
+
+// Level set with sim::setPinLevel() or driven by sim::pulsePin()
+int gpio_get_level(gpio_num_t gpio);
+esp_err_t gpio_intr_enable(gpio_num_t gpio);
+esp_err_t gpio_intr_disable(gpio_num_t gpio);
+esp_err_t gpio_wakeup_enable(gpio_num_t gpio, gpio_int_type_t type);
+esp_err_t gpio_wakeup_disable(gpio_num_t gpio);
+
+#endif // NATIVE_DRIVER_GPIO_H
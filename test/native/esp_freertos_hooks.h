@@ -0,0 +1,11 @@
+#ifndef NATIVE_ESP_FREERTOS_HOOKS_H
+#define NATIVE_ESP_FREERTOS_HOOKS_H
+
+#include "Arduino.h"
+#include "freertos/FreeRTOS.h"
+
+// Nothing idles in the simulator: hooks are accepted and never called
+typedef bool (*esp_freertos_idle_cb_t)(void);
+esp_err_t esp_register_freertos_idle_hook_for_cpu(esp_freertos_idle_cb_t newIdleCb, UBaseType_t cpuid);
+
+#endif // NATIVE_ESP_FREERTOS_HOOKS_H
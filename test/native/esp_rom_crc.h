@@ -0,0 +1,9 @@
+#ifndef NATIVE_ESP_ROM_CRC_H
+#define NATIVE_ESP_ROM_CRC_H
+
+#include <stdint.h>
+
+// CRC-32 (IEEE 802.3, reflected) with the ROM's pre/post inversion
+uint32_t esp_rom_crc32_le(uint32_t crc, const uint8_t* buf, uint32_t len);
+
+#endif // NATIVE_ESP_ROM_CRC_H
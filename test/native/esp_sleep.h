@@ -0,0 +1,11 @@
+#ifndef NATIVE_ESP_SLEEP_H
+#define NATIVE_ESP_SLEEP_H
+
+#include "Arduino.h"
+
+// Light sleep is not simulated; these only record nothing and succeed
+esp_err_t esp_sleep_enable_gpio_wakeup(void);
+esp_err_t esp_sleep_enable_timer_wakeup(uint64_t timeUs);
+esp_err_t esp_light_sleep_start(void);
+
+#endif // NATIVE_ESP_SLEEP_H
@@ -0,0 +1,7 @@
+#ifndef NATIVE_ESP_TIMER_H
+#define NATIVE_ESP_TIMER_H
+
+// esp_timer_get_time() is declared with the Arduino shims (virtual clock)
+#include "Arduino.h"
+
+#endif // NATIVE_ESP_TIMER_H
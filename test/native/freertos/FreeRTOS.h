@@ -0,0 +1,44 @@
+#ifndef NATIVE_FREERTOS_H
+#define NATIVE_FREERTOS_H
+
+// Single-threaded FreeRTOS stand-in: nothing is scheduled. Tasks are created
+// but never run (tests call the code under test directly), queues and
+// semaphores never block, and one tick is one millisecond of virtual time.
+
+#include <stdint.h>
+#include <stddef.h>
+
+typedef uint32_t TickType_t;
+typedef long BaseType_t;
+typedef unsigned long UBaseType_t;
+
+#define pdTRUE 1
+#define pdFALSE 0
+#define pdPASS 1
+#define pdFAIL 0
+#define errQUEUE_FULL 0
+#define portMAX_DELAY 0xffffffffUL
+#define portTICK_PERIOD_MS 1
+#define configTICK_RATE_HZ 1000
+#define configMAX_PRIORITIES 25
+#define tskNO_AFFINITY 0x7FFFFFFF
+#define portNUM_PROCESSORS 2
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms))
+#define pdTICKS_TO_MS(ticks) ((uint32_t)(ticks))
+#define portYIELD_FROM_ISR(...) do { } while (0)
+
+typedef struct {
+    int depth;
+} portMUX_TYPE;
+#define portMUX_INITIALIZER_UNLOCKED {0}
+
+static inline void portENTER_CRITICAL(portMUX_TYPE* mux) { mux->depth++; }
+static inline void portEXIT_CRITICAL(portMUX_TYPE* mux) { mux->depth--; }
+static inline void portENTER_CRITICAL_ISR(portMUX_TYPE* mux) { mux->depth++; }
+static inline void portEXIT_CRITICAL_ISR(portMUX_TYPE* mux) { mux->depth--; }
+static inline void portENTER_CRITICAL_SAFE(portMUX_TYPE* mux) { mux->depth++; }
+static inline void portEXIT_CRITICAL_SAFE(portMUX_TYPE* mux) { mux->depth--; }
+
+BaseType_t xPortGetCoreID();
+
+#endif // NATIVE_FREERTOS_H
@@ -0,0 +1,17 @@
+#ifndef NATIVE_FREERTOS_EVENT_GROUPS_H
+#define NATIVE_FREERTOS_EVENT_GROUPS_H
+
+#include "FreeRTOS.h"
+
+typedef void* EventGroupHandle_t;
+typedef uint32_t EventBits_t;
+
+EventGroupHandle_t xEventGroupCreate();
+EventBits_t xEventGroupSetBits(EventGroupHandle_t group, EventBits_t bits);
+EventBits_t xEventGroupClearBits(EventGroupHandle_t group, EventBits_t bits);
+EventBits_t xEventGroupGetBits(EventGroupHandle_t group);
+// Returns the current bits without waiting
+EventBits_t xEventGroupWaitBits(EventGroupHandle_t group, EventBits_t bits, BaseType_t clearOnExit,
+                                BaseType_t waitForAll, TickType_t timeout);
+
+#endif // NATIVE_FREERTOS_EVENT_GROUPS_H
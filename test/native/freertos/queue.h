@@ -0,0 +1,23 @@
+#ifndef NATIVE_FREERTOS_QUEUE_H
+#define NATIVE_FREERTOS_QUEUE_H
+
+#include "FreeRTOS.h"
+
+typedef void* QueueHandle_t;
+
+// Bounded FIFO of fixed-size items; send fails at once when full, receive
+// fails at once when empty (timeouts are ignored)
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t itemSize);
+void vQueueDelete(QueueHandle_t queue);
+BaseType_t xQueueSend(QueueHandle_t queue, const void* item, TickType_t timeout);
+BaseType_t xQueueSendToBack(QueueHandle_t queue, const void* item, TickType_t timeout);
+BaseType_t xQueueSendToFront(QueueHandle_t queue, const void* item, TickType_t timeout);
+BaseType_t xQueueSendFromISR(QueueHandle_t queue, const void* item, BaseType_t* higherPriorityTaskWoken);
+BaseType_t xQueueOverwrite(QueueHandle_t queue, const void* item);
+BaseType_t xQueueReceive(QueueHandle_t queue, void* item, TickType_t timeout);
+BaseType_t xQueuePeek(QueueHandle_t queue, void* item, TickType_t timeout);
+BaseType_t xQueueReset(QueueHandle_t queue);
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue);
+UBaseType_t uxQueueSpacesAvailable(QueueHandle_t queue);
+
+#endif // NATIVE_FREERTOS_QUEUE_H
@@ -0,0 +1,337 @@
+// Single-threaded FreeRTOS stand-in (see freertos/FreeRTOS.h)
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/event_groups.h"
+#include "esp_freertos_hooks.h"
+#include "native_sim.h"
+#include <string.h>
+#include <stdlib.h>
+
+namespace {
+
+struct SimTask {
+    const char* name;
+    uint32_t stackSize;
+    UBaseType_t priority;
+    BaseType_t core;
+    eTaskState state;
+    uint32_t notifyValue;
+    UBaseType_t number;
+};
+
+struct SimQueue {
+    uint8_t* storage;
+    UBaseType_t length;
+    UBaseType_t itemSize;
+    UBaseType_t head;
+    UBaseType_t count;
+};
+
+struct SimSemaphore {
+    UBaseType_t count;
+    UBaseType_t max;
+    UBaseType_t recursion;
+};
+
+struct SimEventGroup {
+    EventBits_t bits;
+};
+
+const UBaseType_t MAX_TASKS = 32;
+
+// The test body runs as the Arduino loop task
+SimTask loopTask = {"loopTask", 8192, 1, 1, eRunning, 0, 1};
+SimTask* tasks[MAX_TASKS] = {&loopTask};
+UBaseType_t taskCount = 1;
+
+SimTask* taskOf(TaskHandle_t handle) {
+    return handle != NULL ? static_cast<SimTask*>(handle) : &loopTask;
+}
+
+}  // namespace
+
+BaseType_t xPortGetCoreID() { return 1; }
+
+// Tasks
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t task, const char* name, uint32_t stackSize, void* parameter,
+                                   UBaseType_t priority, TaskHandle_t* handle, BaseType_t core) {
+    (void)task;
+    (void)parameter;
+    if (taskCount >= MAX_TASKS) return pdFAIL;
+    SimTask* created = new SimTask{name, stackSize, priority, core, eBlocked, 0, taskCount + 1};
+    tasks[taskCount++] = created;
+    if (handle != NULL) *handle = created;
+    return pdPASS;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t task, const char* name, uint32_t stackSize, void* parameter,
+                       UBaseType_t priority, TaskHandle_t* handle) {
+    return xTaskCreatePinnedToCore(task, name, stackSize, parameter, priority, handle, tskNO_AFFINITY);
+}
+
+void vTaskDelete(TaskHandle_t task) { taskOf(task)->state = eDeleted; }
+void vTaskSuspend(TaskHandle_t task) { taskOf(task)->state = eSuspended; }
+void vTaskResume(TaskHandle_t task) { taskOf(task)->state = eBlocked; }
+
+void vTaskDelay(TickType_t ticks) { sim::advanceMillis(ticks); }
+
+void vTaskDelayUntil(TickType_t* previousWake, TickType_t period) {
+    TickType_t wake = *previousWake + period;
+    TickType_t now = xTaskGetTickCount();
+    if ((int32_t)(wake - now) > 0) sim::advanceMillis(wake - now);
+    *previousWake = wake;
+}
+
+TickType_t xTaskGetTickCount() { return (TickType_t)(sim::nowMicros() / 1000); }
+TickType_t xTaskGetTickCountFromISR() { return xTaskGetTickCount(); }
+
+TaskHandle_t xTaskGetCurrentTaskHandle() { return &loopTask; }
+const char* pcTaskGetName(TaskHandle_t task) { return taskOf(task)->name; }
+eTaskState eTaskGetState(TaskHandle_t task) { return taskOf(task)->state; }
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task) { return taskOf(task)->stackSize / 2; }
+UBaseType_t uxTaskGetNumberOfTasks() { return taskCount; }
+
+UBaseType_t uxTaskGetSystemState(TaskStatus_t* status, UBaseType_t count, uint32_t* totalRunTime) {
+    UBaseType_t filled = 0;
+    for (UBaseType_t i = 0; i < taskCount && filled < count; i++) {
+        SimTask* task = tasks[i];
+        TaskStatus_t& entry = status[filled++];
+        memset(&entry, 0, sizeof(entry));
+        entry.xHandle = task;
+        entry.pcTaskName = task->name;
+        entry.xTaskNumber = task->number;
+        entry.eCurrentState = task->state;
+        entry.uxCurrentPriority = task->priority;
+        entry.uxBasePriority = task->priority;
+        entry.usStackHighWaterMark = task->stackSize / 2;
+        entry.xCoreID = task->core;
+    }
+    if (totalRunTime != NULL) *totalRunTime = (uint32_t)sim::nowMicros();
+    return filled;
+}
+
+// Notifications
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task) {
+    taskOf(task)->notifyValue++;
+    return pdPASS;
+}
+
+void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t* higherPriorityTaskWoken) {
+    xTaskNotifyGive(task);
+    if (higherPriorityTaskWoken != NULL) *higherPriorityTaskWoken = pdFALSE;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clearOnExit, TickType_t timeout) {
+    (void)timeout;
+    uint32_t value = loopTask.notifyValue;
+    if (value > 0) loopTask.notifyValue = clearOnExit ? 0 : value - 1;
+    return value;
+}
+
+BaseType_t xTaskNotify(TaskHandle_t task, uint32_t value, eNotifyAction action) {
+    SimTask* target = taskOf(task);
+    switch (action) {
+        case eSetBits: target->notifyValue |= value; break;
+        case eIncrement: target->notifyValue++; break;
+        case eSetValueWithOverwrite: target->notifyValue = value; break;
+        case eSetValueWithoutOverwrite:
+            if (target->notifyValue != 0) return pdFAIL;
+            target->notifyValue = value;
+            break;
+        default: break;
+    }
+    return pdPASS;
+}
+
+BaseType_t xTaskNotifyFromISR(TaskHandle_t task, uint32_t value, eNotifyAction action,
+                              BaseType_t* higherPriorityTaskWoken) {
+    if (higherPriorityTaskWoken != NULL) *higherPriorityTaskWoken = pdFALSE;
+    return xTaskNotify(task, value, action);
+}
+
+BaseType_t xTaskNotifyWait(uint32_t clearOnEntry, uint32_t clearOnExit, uint32_t* value, TickType_t timeout) {
+    (void)timeout;
+    loopTask.notifyValue &= ~clearOnEntry;
+    if (value != NULL) *value = loopTask.notifyValue;
+    bool pending = loopTask.notifyValue != 0;
+    loopTask.notifyValue &= ~clearOnExit;
+    return pending ? pdTRUE : pdFALSE;
+}
+
+// Queues
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t itemSize) {
+    if (length == 0) return NULL;
+    SimQueue* queue = new SimQueue{NULL, length, itemSize, 0, 0};
+    queue->storage = static_cast<uint8_t*>(calloc(length, itemSize != 0 ? itemSize : 1));
+    return queue;
+}
+
+void vQueueDelete(QueueHandle_t handle) {
+    SimQueue* queue = static_cast<SimQueue*>(handle);
+    if (queue == NULL) return;
+    free(queue->storage);
+    delete queue;
+}
+
+static uint8_t* slotOf(SimQueue* queue, UBaseType_t index) {
+    return queue->storage + ((queue->head + index) % queue->length) * queue->itemSize;
+}
+
+BaseType_t xQueueSendToBack(QueueHandle_t handle, const void* item, TickType_t timeout) {
+    (void)timeout;
+    SimQueue* queue = static_cast<SimQueue*>(handle);
+    if (queue == NULL || queue->count >= queue->length) return errQUEUE_FULL;
+    memcpy(slotOf(queue, queue->count), item, queue->itemSize);
+    queue->count++;
+    return pdPASS;
+}
+
+BaseType_t xQueueSend(QueueHandle_t handle, const void* item, TickType_t timeout) {
+    return xQueueSendToBack(handle, item, timeout);
+}
+
+BaseType_t xQueueSendToFront(QueueHandle_t handle, const void* item, TickType_t timeout) {
+    (void)timeout;
+    SimQueue* queue = static_cast<SimQueue*>(handle);
+    if (queue == NULL || queue->count >= queue->length) return errQUEUE_FULL;
+    queue->head = (queue->head + queue->length - 1) % queue->length;
+    memcpy(slotOf(queue, 0), item, queue->itemSize);
+    queue->count++;
+    return pdPASS;
+}
+
+BaseType_t xQueueSendFromISR(QueueHandle_t handle, const void* item, BaseType_t* higherPriorityTaskWoken) {
+    if (higherPriorityTaskWoken != NULL) *higherPriorityTaskWoken = pdFALSE;
+    return xQueueSendToBack(handle, item, 0);
+}
+
+BaseType_t xQueueOverwrite(QueueHandle_t handle, const void* item) {
+    SimQueue* queue = static_cast<SimQueue*>(handle);
+    if (queue == NULL) return pdFAIL;
+    // Only meant for length-1 mailboxes, as in FreeRTOS
+    queue->head = 0;
+    queue->count = 1;
+    memcpy(queue->storage, item, queue->itemSize);
+    return pdPASS;
+}
+
+BaseType_t xQueuePeek(QueueHandle_t handle, void* item, TickType_t timeout) {
+    (void)timeout;
+    SimQueue* queue = static_cast<SimQueue*>(handle);
+    if (queue == NULL || queue->count == 0) return pdFALSE;
+    memcpy(item, slotOf(queue, 0), queue->itemSize);
+    return pdTRUE;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t handle, void* item, TickType_t timeout) {
+    if (xQueuePeek(handle, item, timeout) != pdTRUE) return pdFALSE;
+    SimQueue* queue = static_cast<SimQueue*>(handle);
+    queue->head = (queue->head + 1) % queue->length;
+    queue->count--;
+    return pdTRUE;
+}
+
+BaseType_t xQueueReset(QueueHandle_t handle) {
+    SimQueue* queue = static_cast<SimQueue*>(handle);
+    if (queue == NULL) return pdFAIL;
+    queue->head = 0;
+    queue->count = 0;
+    return pdPASS;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t handle) {
+    SimQueue* queue = static_cast<SimQueue*>(handle);
+    return queue != NULL ? queue->count : 0;
+}
+
+UBaseType_t uxQueueSpacesAvailable(QueueHandle_t handle) {
+    SimQueue* queue = static_cast<SimQueue*>(handle);
+    return queue != NULL ? queue->length - queue->count : 0;
+}
+
+// Semaphores
+
+static SemaphoreHandle_t createSemaphore(UBaseType_t initial, UBaseType_t max) {
+    return new SimSemaphore{initial, max, 0};
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex() { return createSemaphore(1, 1); }
+SemaphoreHandle_t xSemaphoreCreateRecursiveMutex() { return createSemaphore(1, 1); }
+SemaphoreHandle_t xSemaphoreCreateBinary() { return createSemaphore(0, 1); }
+void vSemaphoreDelete(SemaphoreHandle_t semaphore) { delete static_cast<SimSemaphore*>(semaphore); }
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t handle, TickType_t timeout) {
+    (void)timeout;
+    SimSemaphore* semaphore = static_cast<SimSemaphore*>(handle);
+    if (semaphore == NULL || semaphore->count == 0) return pdFALSE;
+    semaphore->count--;
+    return pdTRUE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t handle) {
+    SimSemaphore* semaphore = static_cast<SimSemaphore*>(handle);
+    if (semaphore == NULL || semaphore->count >= semaphore->max) return pdFALSE;
+    semaphore->count++;
+    return pdTRUE;
+}
+
+// There is only one task, so the owner is always the caller
+BaseType_t xSemaphoreTakeRecursive(SemaphoreHandle_t handle, TickType_t timeout) {
+    (void)timeout;
+    SimSemaphore* semaphore = static_cast<SimSemaphore*>(handle);
+    if (semaphore == NULL) return pdFALSE;
+    semaphore->recursion++;
+    semaphore->count = 0;
+    return pdTRUE;
+}
+
+BaseType_t xSemaphoreGiveRecursive(SemaphoreHandle_t handle) {
+    SimSemaphore* semaphore = static_cast<SimSemaphore*>(handle);
+    if (semaphore == NULL || semaphore->recursion == 0) return pdFALSE;
+    if (--semaphore->recursion == 0) semaphore->count = 1;
+    return pdTRUE;
+}
+
+BaseType_t xSemaphoreGiveFromISR(SemaphoreHandle_t semaphore, BaseType_t* higherPriorityTaskWoken) {
+    if (higherPriorityTaskWoken != NULL) *higherPriorityTaskWoken = pdFALSE;
+    return xSemaphoreGive(semaphore);
+}
+
+// Event groups
+
+EventGroupHandle_t xEventGroupCreate() { return new SimEventGroup{0}; }
+
+EventBits_t xEventGroupSetBits(EventGroupHandle_t group, EventBits_t bits) {
+    SimEventGroup* events = static_cast<SimEventGroup*>(group);
+    events->bits |= bits;
+    return events->bits;
+}
+
+EventBits_t xEventGroupClearBits(EventGroupHandle_t group, EventBits_t bits) {
+    SimEventGroup* events = static_cast<SimEventGroup*>(group);
+    EventBits_t before = events->bits;
+    events->bits &= ~bits;
+    return before;
+}
+
+EventBits_t xEventGroupGetBits(EventGroupHandle_t group) { return static_cast<SimEventGroup*>(group)->bits; }
+
+EventBits_t xEventGroupWaitBits(EventGroupHandle_t group, EventBits_t bits, BaseType_t clearOnExit,
+                                BaseType_t waitForAll, TickType_t timeout) {
+    (void)timeout;
+    SimEventGroup* events = static_cast<SimEventGroup*>(group);
+    EventBits_t current = events->bits;
+    bool met = waitForAll ? (current & bits) == bits : (current & bits) != 0;
+    if (met && clearOnExit) events->bits &= ~bits;
+    return current;
+}
+
+esp_err_t esp_register_freertos_idle_hook_for_cpu(esp_freertos_idle_cb_t newIdleCb, UBaseType_t cpuid) {
+    return newIdleCb != NULL && cpuid < portNUM_PROCESSORS ? ESP_OK : ESP_FAIL;
+}
@@ -0,0 +1,11 @@
+#ifndef NATIVE_HAL_GPIO_LL_H
+#define NATIVE_HAL_GPIO_LL_H
+
+#include "../soc/gpio_struct.h"
+#include "../driver/gpio.h"
+
+static inline void gpio_ll_intr_disable(gpio_dev_t* hw, gpio_num_t gpio) {
+    hw->pin[gpio].int_ena = 0;
+}
+
+#endif // NATIVE_HAL_GPIO_LL_H
@@ -0,0 +1,25 @@
+#ifndef NATIVE_MBEDTLS_SHA256_H
+#define NATIVE_MBEDTLS_SHA256_H
+
+// Software SHA-256 with the mbedtls 2.x API the ESP32 core ships (the _ret
+// functions); contexts are plain state, so clone() is a copy
+
+#include <stdint.h>
+#include <stddef.h>
+
+typedef struct {
+    uint32_t total[2];
+    uint32_t state[8];
+    unsigned char buffer[64];
+    int is224;
+} mbedtls_sha256_context;
+
+void mbedtls_sha256_init(mbedtls_sha256_context* ctx);
+void mbedtls_sha256_free(mbedtls_sha256_context* ctx);
+void mbedtls_sha256_clone(mbedtls_sha256_context* dst, const mbedtls_sha256_context* src);
+int mbedtls_sha256_starts_ret(mbedtls_sha256_context* ctx, int is224);
+int mbedtls_sha256_update_ret(mbedtls_sha256_context* ctx, const unsigned char* input, size_t ilen);
+int mbedtls_sha256_finish_ret(mbedtls_sha256_context* ctx, unsigned char output[32]);
+int mbedtls_sha256_ret(const unsigned char* input, size_t ilen, unsigned char output[32], int is224);
+
+#endif // NATIVE_MBEDTLS_SHA256_H
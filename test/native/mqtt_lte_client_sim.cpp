@@ -0,0 +1,11 @@
+// The controller only keeps a reference to the MQTT client; the modem is not
+// simulated, so the native build provides just the constructor
+
+#include "mqtt_lte_client.h"
+
+MqttLteClient::MqttLteClient(HardwareSerial& modemSerial, int pwrKeyPin, int dtrPin, int flightPin, int txPin,
+                             int rxPin)
+    : _modemSerial(modemSerial), _pwrKeyPin(pwrKeyPin), _dtrPin(dtrPin), _flightPin(flightPin), _txPin(txPin),
+      _rxPin(rxPin), _apn(""), _user(""), _pass(""), _pin(""), _broker(""), _port(0), _clientId(""),
+      _callback(NULL), _modem(NULL), _gsmClient(NULL), _sslClient(NULL), _batchClient(NULL), _mqttClient(NULL),
+      _mutex(NULL), _initialized(false), _networkConnected(false), _mqttConnected(false) {}
@@ -0,0 +1,33 @@
+#ifndef NATIVE_HARNESS_H
+#define NATIVE_HARNESS_H
+
+// Helpers shared by the native test suites (test_replay, test_coin_pcnt):
+// drive a controller the way loop() does and bring up a bay's IO expander
+// the way main.cpp does. Header-only; include after unity.h.
+
+#include <Arduino.h>
+#include <unity.h>
+#include "native_sim.h"
+#include "car_wash_controller.h"
+#include "io_expander.h"
+
+static const unsigned long TICK_MS = 10;  // loop() wake period while events are pending
+static const unsigned long START_MS = 1000;  // Past COIN_STARTUP_DELAY
+
+// Advance the virtual clock in loop() wakes until untilMs
+static inline void tick(CarWashController& controller, unsigned long untilMs) {
+    while (millis() < untilMs) {
+        sim::advanceMillis(TICK_MS);
+        controller.update();
+    }
+}
+
+// Mirrors startBayIo() in main.cpp
+static inline void startIo(IoExpander& io) {
+    TEST_ASSERT_TRUE(io.begin());
+    io.configurePortAsInput(0, 0xFF);
+    io.configurePortAsOutput(1, 0xFF);
+    io.writeRegister(OUTPUT_PORT1, 0x00);
+}
+
+#endif // NATIVE_HARNESS_H
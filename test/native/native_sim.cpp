@@ -0,0 +1,302 @@
+// Virtual clock, Arduino core, GPIO and allocation counting for env:native
+
+#include "native_sim.h"
+#include "Arduino.h"
+#include "esp_system.h"
+#include "esp_sleep.h"
+#include "driver/gpio.h"
+#include "soc/gpio_struct.h"
+#include "Client.h"
+#include <new>
+
+static uint64_t simMicros = 0;
+static bool serialEcho = true;
+static int pinLevels[64];
+static bool pinLevelsSet = false;
+
+// Handlers registered with attachInterrupt()/attachInterruptArg()
+struct PinInterrupt {
+    void (*handler)(void);
+    void (*handlerArg)(void*);
+    void* arg;
+    int mode;
+};
+static PinInterrupt pinInterrupts[64];
+
+// PCNT model (pcnt_sim.cpp)
+void pcntPinEdge(uint8_t pin, bool rising);
+
+static void firePinInterrupt(uint8_t pin, int edge) {
+    if (pin >= sizeof(pinInterrupts) / sizeof(pinInterrupts[0])) return;
+    const PinInterrupt& interrupt = pinInterrupts[pin];
+    if ((interrupt.mode & edge) == 0) return;
+    if (interrupt.handlerArg != NULL) {
+        interrupt.handlerArg(interrupt.arg);
+    } else if (interrupt.handler != NULL) {
+        interrupt.handler();
+    }
+}
+
+// Plain zero-initialised counters: allocations made during static
+// initialisation (String globals, topic tables) are counted too
+static uint64_t allocationCount = 0;
+static uint64_t allocatedBytes = 0;
+
+HardwareSerial Serial;
+HardwareSerial Serial1;
+HardwareSerial Serial2;
+EspClass ESP;
+gpio_dev_t GPIO;
+
+namespace sim {
+
+uint64_t nowMicros() { return simMicros; }
+void advanceMicros(uint64_t us) { simMicros += us; }
+void advanceMillis(uint32_t ms) { simMicros += (uint64_t)ms * 1000; }
+void setMicros(uint64_t us) { simMicros = us; }
+
+uint64_t getAllocationCount() { return allocationCount; }
+uint64_t getAllocatedBytes() { return allocatedBytes; }
+
+bool mallocIsCounted() {
+#if defined(__GLIBC__)
+    return true;
+#else
+    return false;
+#endif
+}
+
+void setSerialEcho(bool enabled) { serialEcho = enabled; }
+
+void setPinLevel(uint8_t pin, int level) {
+    if (!pinLevelsSet) {
+        for (size_t i = 0; i < sizeof(pinLevels) / sizeof(pinLevels[0]); i++) pinLevels[i] = HIGH;
+        pinLevelsSet = true;
+    }
+    if (pin < sizeof(pinLevels) / sizeof(pinLevels[0])) pinLevels[pin] = level;
+}
+
+void pulsePin(uint8_t pin, uint32_t lowUs) {
+    setPinLevel(pin, LOW);
+    pcntPinEdge(pin, false);
+    firePinInterrupt(pin, FALLING);
+    advanceMicros(lowUs);
+    setPinLevel(pin, HIGH);
+    pcntPinEdge(pin, true);
+    firePinInterrupt(pin, RISING);
+}
+
+}  // namespace sim
+
+// Allocation counting
+
+#if defined(__GLIBC__)
+extern "C" {
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t count, size_t size);
+void* __libc_realloc(void* ptr, size_t size);
+void __libc_free(void* ptr);
+
+void* malloc(size_t size) {
+    allocationCount++;
+    allocatedBytes += size;
+    return __libc_malloc(size);
+}
+
+void* calloc(size_t count, size_t size) {
+    allocationCount++;
+    allocatedBytes += count * size;
+    return __libc_calloc(count, size);
+}
+
+void* realloc(void* ptr, size_t size) {
+    allocationCount++;
+    allocatedBytes += size;
+    return __libc_realloc(ptr, size);
+}
+
+void free(void* ptr) { __libc_free(ptr); }
+}
+
+// operator new ends up in the counted malloc
+void* operator new(size_t size) {
+    void* ptr = malloc(size != 0 ? size : 1);
+    if (ptr == NULL) throw std::bad_alloc();
+    return ptr;
+}
+#else
+void* operator new(size_t size) {
+    allocationCount++;
+    allocatedBytes += size;
+    void* ptr = malloc(size != 0 ? size : 1);
+    if (ptr == NULL) throw std::bad_alloc();
+    return ptr;
+}
+#endif
+
+void* operator new[](size_t size) { return operator new(size); }
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+    try {
+        return operator new(size);
+    } catch (...) {
+        return NULL;
+    }
+}
+void* operator new[](size_t size, const std::nothrow_t& tag) noexcept { return operator new(size, tag); }
+void operator delete(void* ptr) noexcept { free(ptr); }
+void operator delete[](void* ptr) noexcept { free(ptr); }
+void operator delete(void* ptr, size_t) noexcept { free(ptr); }
+void operator delete[](void* ptr, size_t) noexcept { free(ptr); }
+
+// Arduino core
+
+unsigned long millis() { return (unsigned long)(simMicros / 1000); }
+unsigned long micros() { return (unsigned long)simMicros; }
+void delay(unsigned long ms) { sim::advanceMillis(ms); }
+void delayMicroseconds(unsigned int us) { sim::advanceMicros(us); }
+int64_t esp_timer_get_time() { return (int64_t)simMicros; }
+
+// Display bus model (ch453_sim.cpp)
+bool ch453OwnsPin(uint8_t pin);
+void ch453PinMode(uint8_t pin, uint8_t mode);
+void ch453DigitalWrite(uint8_t pin, uint8_t value);
+int ch453DigitalRead(uint8_t pin);
+
+void pinMode(uint8_t pin, uint8_t mode) {
+    if (ch453OwnsPin(pin)) ch453PinMode(pin, mode);
+}
+
+void digitalWrite(uint8_t pin, uint8_t value) {
+    if (ch453OwnsPin(pin)) {
+        ch453DigitalWrite(pin, value);
+        return;
+    }
+    sim::setPinLevel(pin, value);
+}
+
+int digitalRead(uint8_t pin) {
+    if (ch453OwnsPin(pin)) return ch453DigitalRead(pin);
+    if (!pinLevelsSet || pin >= sizeof(pinLevels) / sizeof(pinLevels[0])) return HIGH;
+    return pinLevels[pin];
+}
+
+int digitalPinToInterrupt(int pin) { return pin; }
+
+// Interrupts only fire on sim::pulsePin(); other tests post input events directly
+void attachInterrupt(uint8_t pin, void (*handler)(void), int mode) {
+    if (pin >= sizeof(pinInterrupts) / sizeof(pinInterrupts[0])) return;
+    pinInterrupts[pin] = PinInterrupt{handler, NULL, NULL, mode};
+}
+
+void attachInterruptArg(uint8_t pin, void (*handler)(void*), void* arg, int mode) {
+    if (pin >= sizeof(pinInterrupts) / sizeof(pinInterrupts[0])) return;
+    pinInterrupts[pin] = PinInterrupt{NULL, handler, arg, mode};
+}
+
+void detachInterrupt(uint8_t pin) {
+    if (pin >= sizeof(pinInterrupts) / sizeof(pinInterrupts[0])) return;
+    pinInterrupts[pin] = PinInterrupt{NULL, NULL, NULL, 0};
+}
+
+void* ps_malloc(size_t size) { return malloc(size); }
+bool psramFound() { return false; }
+
+size_t Print::write(uint8_t c) { return write(&c, 1); }
+
+size_t Print::write(const uint8_t* buffer, size_t size) {
+    (void)buffer;
+    return size;
+}
+
+size_t Print::print(int value) {
+    char text[12];
+    snprintf(text, sizeof(text), "%d", value);
+    return write(text);
+}
+
+size_t Print::println(const char* text) {
+    size_t n = write(text);
+    return n + write("\r\n");
+}
+
+size_t Print::println(int value) {
+    size_t n = print(value);
+    return n + write("\r\n");
+}
+
+size_t Print::printf(const char* format, ...) {
+    char text[512];
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(text, sizeof(text), format, args);
+    va_end(args);
+    if (length < 0) return 0;
+    return write(reinterpret_cast<const uint8_t*>(text), std::min((size_t)length, sizeof(text) - 1));
+}
+
+void HardwareSerial::begin(unsigned long baud, uint32_t config, int8_t rxPin, int8_t txPin) {
+    (void)baud;
+    (void)config;
+    (void)rxPin;
+    (void)txPin;
+}
+
+size_t HardwareSerial::write(uint8_t c) { return write(&c, 1); }
+
+size_t HardwareSerial::write(const uint8_t* buffer, size_t size) {
+    if (serialEcho && this == &Serial) {
+        fwrite(buffer, 1, size, stdout);
+    }
+    return size;
+}
+
+void EspClass::restart() {
+    fprintf(stderr, "ESP.restart() called\n");
+    abort();
+}
+
+// ESP-IDF
+
+const char* esp_err_to_name(esp_err_t code) { return code == ESP_OK ? "ESP_OK" : "ESP_FAIL"; }
+
+esp_reset_reason_t esp_reset_reason(void) { return ESP_RST_POWERON; }
+
+esp_err_t esp_sleep_enable_gpio_wakeup(void) { return ESP_OK; }
+
+esp_err_t esp_sleep_enable_timer_wakeup(uint64_t timeUs) {
+    (void)timeUs;
+    return ESP_OK;
+}
+
+esp_err_t esp_light_sleep_start(void) { return ESP_OK; }
+
+int gpio_get_level(gpio_num_t gpio) {
+    return gpio >= 0 && gpio < 40 ? digitalRead((uint8_t)gpio) : 0;
+}
+
+esp_err_t gpio_intr_enable(gpio_num_t gpio) {
+    if (gpio >= 0 && gpio < 40) GPIO.pin[gpio].int_ena = 1;
+    return ESP_OK;
+}
+
+esp_err_t gpio_intr_disable(gpio_num_t gpio) {
+    if (gpio >= 0 && gpio < 40) GPIO.pin[gpio].int_ena = 0;
+    return ESP_OK;
+}
+
+esp_err_t gpio_wakeup_enable(gpio_num_t gpio, gpio_int_type_t type) {
+    (void)gpio;
+    (void)type;
+    return ESP_OK;
+}
+
+esp_err_t gpio_wakeup_disable(gpio_num_t gpio) {
+    (void)gpio;
+    return ESP_OK;
+}
+
+String IPAddress::toString() const {
+    char text[16];
+    snprintf(text, sizeof(text), "%u.%u.%u.%u", _bytes[0], _bytes[1], _bytes[2], _bytes[3]);
+    return String(text);
+}
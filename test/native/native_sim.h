@@ -0,0 +1,86 @@
+#ifndef NATIVE_SIM_H
+#define NATIVE_SIM_H
+
+// Control surface of the host simulator behind the native shims (env:native).
+//
+// - Time is virtual: millis()/micros() only move when the test advances the
+//   clock, or through delay()/vTaskDelay(). Code under test runs in zero
+//   virtual time, so handling latency has to be measured on the host clock.
+// - Every I2C address answers as a TCA9535; register writes land in the
+//   model, INPUT_PORT0/1 return what the test set.
+// - The display pins (DISPLAY_SDA_PIN/DISPLAY_SCL_PIN) are an open-drain
+//   bus with a CH453 on it: the bit-banged frames the driver clocks out are
+//   decoded into the chip's digit registers.
+// - Heap allocations made through operator new are counted (and malloc/
+//   calloc/realloc on glibc, which covers ArduinoJson's default allocator).
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+
+namespace sim {
+
+// Virtual clock
+uint64_t nowMicros();
+void advanceMicros(uint64_t us);
+void advanceMillis(uint32_t ms);
+void setMicros(uint64_t us);
+
+// TCA9535 model. resetI2c() restores power-on values on every address
+// (inputs high, outputs high, all pins inputs) and clears the counters.
+void resetI2c();
+void setExpanderInput(uint8_t address, uint8_t port, uint8_t value);
+uint8_t getExpanderRegister(uint8_t address, uint8_t reg);
+void setI2cDeviceMissing(uint8_t address, bool missing);  // NACK on that address
+
+// One transaction = one START..STOP: endTransmission() or requestFrom()
+uint32_t getI2cTransactions();
+uint32_t getI2cWrites(uint8_t address, uint8_t reg);  // Register writes to reg since resetI2c()
+
+// Heap allocations since the process started (compare before/after)
+uint64_t getAllocationCount();
+uint64_t getAllocatedBytes();
+bool mallocIsCounted();  // false where only operator new can be counted
+
+// Serial output to stdout (on by default; benchmarks turn it off)
+void setSerialEcho(bool enabled);
+
+// Drop everything stored through Preferences
+void resetPreferences();
+
+// Flash partitions (esp_partition.h): setPartition() creates or resizes an
+// erased data partition; its contents survive until the next setPartition()
+void setPartition(const char* label, size_t size);
+void removePartition(const char* label);
+
+// GPIO levels read back by digitalRead() (not the display bus pins)
+void setPinLevel(uint8_t pin, int level);
+
+// One active-LOW pulse: the pin goes LOW, the clock advances by lowUs, and the
+// pin goes HIGH again. Both edges reach the interrupt attached to the pin and
+// any PCNT unit counting it; nothing else fires interrupts.
+void pulsePin(uint8_t pin, uint32_t lowUs);
+
+// CH453 model. resetDisplay() blanks the digit registers and clears the
+// counters; a missing display NACKs every byte and latches nothing.
+void resetDisplay();
+void setDisplayMissing(bool missing);
+uint32_t getDisplayFrames();  // Two-byte START..STOP frames since resetDisplay()
+uint8_t getDisplayDigit(uint8_t digit);  // Segment pattern in DIG0-DIG15
+uint8_t getDisplaySystemParam();  // Last byte sent with the 0x48 command
+
+// BLE stack model (BLEDevice.h); the test is the phone. resetBle() drops the
+// server the way BLEDevice::deinit() does.
+void resetBle();
+bool bleConnect(uint16_t mtu = 185);  // false unless advertising; runs onConnect and onMtuChanged
+void bleDisconnect();
+bool bleWrite(const char* uuid, const char* value);  // Sets the value and runs onWrite
+std::string getBleValue(const char* uuid);
+uint32_t getBleNotifications(const char* uuid);
+bool isBleAdvertising();
+const char* getBleDeviceName();
+uint16_t getBleRequestedMaxInterval();  // Last connection parameter update
+
+}  // namespace sim
+
+#endif // NATIVE_SIM_H
@@ -0,0 +1,110 @@
+// Flash partition model (esp_partition.h) and the ROM CRC: partitions live in
+// RAM and keep their contents across MqttOutbox instances, which is how the
+// tests simulate a reboot
+
+#include "native_sim.h"
+#include "esp_partition.h"
+#include "esp_rom_crc.h"
+#include <string.h>
+#include <vector>
+
+static const size_t FLASH_SECTOR_SIZE = 4096;
+static const size_t MAX_PARTITIONS = 4;
+
+struct SimPartition {
+    bool used;
+    esp_partition_t info;
+    std::vector<uint8_t> data;
+};
+
+static SimPartition partitions[MAX_PARTITIONS];
+
+static SimPartition* findPartition(const esp_partition_t* partition) {
+    for (size_t i = 0; i < MAX_PARTITIONS; i++) {
+        if (partitions[i].used && &partitions[i].info == partition) return &partitions[i];
+    }
+    return NULL;
+}
+
+namespace sim {
+
+void setPartition(const char* label, size_t size) {
+    SimPartition* slot = NULL;
+    for (size_t i = 0; i < MAX_PARTITIONS && slot == NULL; i++) {
+        if (partitions[i].used && strcmp(partitions[i].info.label, label) == 0) slot = &partitions[i];
+    }
+    for (size_t i = 0; i < MAX_PARTITIONS && slot == NULL; i++) {
+        if (!partitions[i].used) slot = &partitions[i];
+    }
+    if (slot == NULL) return;
+    slot->used = true;
+    slot->info.type = ESP_PARTITION_TYPE_DATA;
+    slot->info.subtype = ESP_PARTITION_SUBTYPE_ANY;
+    slot->info.address = 0;
+    slot->info.size = (uint32_t)size;
+    strncpy(slot->info.label, label, sizeof(slot->info.label) - 1);
+    slot->info.label[sizeof(slot->info.label) - 1] = '\0';
+    slot->data.assign(size, 0xFF);
+}
+
+void removePartition(const char* label) {
+    for (size_t i = 0; i < MAX_PARTITIONS; i++) {
+        if (partitions[i].used && strcmp(partitions[i].info.label, label) == 0) {
+            partitions[i].used = false;
+            partitions[i].data.clear();
+        }
+    }
+}
+
+}  // namespace sim
+
+const esp_partition_t* esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t subtype,
+                                                const char* label) {
+    for (size_t i = 0; i < MAX_PARTITIONS; i++) {
+        const SimPartition& partition = partitions[i];
+        if (!partition.used || partition.info.type != type) continue;
+        if (subtype != ESP_PARTITION_SUBTYPE_ANY && partition.info.subtype != subtype) continue;
+        if (label != NULL && strcmp(partition.info.label, label) != 0) continue;
+        return &partition.info;
+    }
+    return NULL;
+}
+
+esp_err_t esp_partition_read(const esp_partition_t* partition, size_t srcOffset, void* dst, size_t size) {
+    SimPartition* sim = findPartition(partition);
+    if (sim == NULL || dst == NULL || srcOffset + size > sim->data.size()) return ESP_FAIL;
+    memcpy(dst, sim->data.data() + srcOffset, size);
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_write(const esp_partition_t* partition, size_t dstOffset, const void* src, size_t size) {
+    SimPartition* sim = findPartition(partition);
+    if (sim == NULL || src == NULL || dstOffset + size > sim->data.size()) return ESP_FAIL;
+    // Programming only clears bits
+    const uint8_t* bytes = static_cast<const uint8_t*>(src);
+    for (size_t i = 0; i < size; i++) {
+        sim->data[dstOffset + i] &= bytes[i];
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_erase_range(const esp_partition_t* partition, size_t offset, size_t size) {
+    SimPartition* sim = findPartition(partition);
+    if (sim == NULL || offset % FLASH_SECTOR_SIZE != 0 || size % FLASH_SECTOR_SIZE != 0 ||
+        offset + size > sim->data.size()) {
+        return ESP_FAIL;
+    }
+    memset(sim->data.data() + offset, 0xFF, size);
+    return ESP_OK;
+}
+
+uint32_t esp_rom_crc32_le(uint32_t crc, const uint8_t* buf, uint32_t len) {
+    crc = ~crc;
+    for (uint32_t i = 0; i < len; i++) {
+        crc ^= buf[i];
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc >> 1) ^ (0xEDB88320UL & (0 - (crc & 1)));
+        }
+    }
+    return ~crc;
+}
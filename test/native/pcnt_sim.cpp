@@ -0,0 +1,72 @@
+// PCNT peripheral model for env:native_pcnt: counts up to counter_h_lim and
+// wraps to 0 like the hardware; edges only arrive through sim::pulsePin()
+
+#include "native_sim.h"
+#include "driver/pcnt.h"
+
+struct PcntUnit {
+    bool configured;
+    bool paused;
+    int pin;
+    pcnt_count_mode_t posMode;
+    pcnt_count_mode_t negMode;
+    int16_t count;
+    int16_t highLimit;
+};
+
+static PcntUnit units[PCNT_UNIT_MAX];
+
+// Called by sim::pulsePin() on every edge (native_sim.cpp)
+void pcntPinEdge(uint8_t pin, bool rising) {
+    for (int unit = 0; unit < PCNT_UNIT_MAX; unit++) {
+        PcntUnit& state = units[unit];
+        if (!state.configured || state.paused || state.pin != pin) continue;
+        if ((rising ? state.posMode : state.negMode) != PCNT_COUNT_INC) continue;
+        state.count++;
+        if (state.count >= state.highLimit) state.count = 0;
+    }
+}
+
+esp_err_t pcnt_unit_config(const pcnt_config_t* config) {
+    if (config == NULL || config->unit >= PCNT_UNIT_MAX || config->counter_h_lim <= 0) return ESP_FAIL;
+    PcntUnit& state = units[config->unit];
+    state.configured = true;
+    state.paused = false;
+    state.pin = config->pulse_gpio_num;
+    state.posMode = config->pos_mode;
+    state.negMode = config->neg_mode;
+    state.count = 0;
+    state.highLimit = config->counter_h_lim;
+    return ESP_OK;
+}
+
+esp_err_t pcnt_set_filter_value(pcnt_unit_t unit, uint16_t value) {
+    (void)value;
+    return unit < PCNT_UNIT_MAX ? ESP_OK : ESP_FAIL;
+}
+
+esp_err_t pcnt_filter_enable(pcnt_unit_t unit) { return unit < PCNT_UNIT_MAX ? ESP_OK : ESP_FAIL; }
+
+esp_err_t pcnt_counter_pause(pcnt_unit_t unit) {
+    if (unit >= PCNT_UNIT_MAX) return ESP_FAIL;
+    units[unit].paused = true;
+    return ESP_OK;
+}
+
+esp_err_t pcnt_counter_resume(pcnt_unit_t unit) {
+    if (unit >= PCNT_UNIT_MAX) return ESP_FAIL;
+    units[unit].paused = false;
+    return ESP_OK;
+}
+
+esp_err_t pcnt_counter_clear(pcnt_unit_t unit) {
+    if (unit >= PCNT_UNIT_MAX) return ESP_FAIL;
+    units[unit].count = 0;
+    return ESP_OK;
+}
+
+esp_err_t pcnt_get_counter_value(pcnt_unit_t unit, int16_t* count) {
+    if (unit >= PCNT_UNIT_MAX || !units[unit].configured || count == NULL) return ESP_FAIL;
+    *count = units[unit].count;
+    return ESP_OK;
+}
@@ -0,0 +1,15 @@
+#ifndef NATIVE_SOC_GPIO_STRUCT_H
+#define NATIVE_SOC_GPIO_STRUCT_H
+
+#include <stdint.h>
+
+// Only the per-pin interrupt enable bit the INT ISR clears
+typedef struct {
+    struct {
+        uint32_t int_ena;
+    } pin[40];
+} gpio_dev_t;
+
+extern gpio_dev_t GPIO;
+
+#endif // NATIVE_SOC_GPIO_STRUCT_H
@@ -0,0 +1,161 @@
+// Host tests for the PCNT coin path (env:native_pcnt, built with COIN_PCNT_PIN)
+//
+//   pio test -e native_pcnt
+//
+// Pulses are driven on COIN_PCNT_PIN with sim::pulsePin(), timed by the
+// counter's edge interrupt and picked up by bay 0's CarWashController::update(),
+// the way loop() reads the counter.
+
+#include <Arduino.h>
+#include <unity.h>
+#include <vector>
+#include "native_sim.h"
+#include "native_harness.h"
+#include "car_wash_controller.h"
+#include "coin_counter.h"
+#include "io_expander.h"
+#include "mqtt_message_pool.h"
+#include "profiler.h"
+#include "trace.h"
+#include "logger.h"
+
+// Owned by main.cpp in the firmware
+SemaphoreHandle_t xIoExpanderMutex = NULL;
+QueueHandle_t xMqttPublishQueue = NULL;
+CoinPulseCounter coinCounter(COIN_PCNT_PIN);
+
+static const uint32_t COIN_PULSE_US = 50000;  // Acceptor pulse
+static const uint32_t GLITCH_US = 2000;  // Relay transient, far above the PCNT filter
+
+// a32 of the TRACE_COIN records written since the trace held `since` records
+static std::vector<uint32_t> coinRecordsSince(uint32_t since) {
+    std::vector<uint32_t> totals;
+    TraceCursor cursor;
+    Trace::startDump(cursor, Trace::getRecorded() - since);
+    uint8_t buffer[512];
+    size_t n;
+    bool header = true;
+    while ((n = Trace::readDump(cursor, buffer, sizeof(buffer))) > 0) {
+        size_t pos = header ? Trace::HEADER_SIZE : Trace::BLOCK_HEADER_SIZE;
+        header = false;
+        for (; pos + sizeof(TraceRecord) <= n; pos += sizeof(TraceRecord)) {
+            TraceRecord record;
+            memcpy(&record, buffer + pos, sizeof(record));
+            if (record.event == TRACE_COIN) totals.push_back(record.a32);
+        }
+    }
+    return totals;
+}
+
+void setUp() {
+    sim::resetI2c();
+    sim::setMicros((uint64_t)START_MS * 1000);
+    TEST_ASSERT_TRUE(coinCounter.begin());
+}
+
+void tearDown() {}
+
+void test_single_pulse_credits_one_coin() {
+    MqttLteClient client(Serial1, MODEM_PWRKEY, MODEM_DTR, MODEM_FLIGHT, MODEM_TX, MODEM_RX);
+    IoExpander io(TCA9535_ADDR, I2C_SDA_PIN, I2C_SCL_PIN, INT_PIN);
+    startIo(io);
+    CarWashController controller(client, 0, io, NULL);
+    tick(controller, millis() + TICK_MS);
+
+    uint32_t since = Trace::getRecorded();
+    sim::pulsePin(COIN_PCNT_PIN, COIN_PULSE_US);
+    tick(controller, millis() + TICK_MS);
+    TEST_ASSERT_EQUAL(STATE_IDLE, controller.getCurrentState());
+    TEST_ASSERT_EQUAL(1, controller.getTokensLeft());
+
+    // The next coin is credited even though it lands within COIN_COOLDOWN_MS
+    // of when the first one was read
+    tick(controller, millis() + COIN_COOLDOWN_MS / 2);
+    sim::pulsePin(COIN_PCNT_PIN, COIN_PULSE_US);
+    tick(controller, millis() + TICK_MS);
+    TEST_ASSERT_EQUAL(2, controller.getTokensLeft());
+    TEST_ASSERT_EQUAL_UINT32(2, coinRecordsSince(since).size());
+    TEST_ASSERT_EQUAL_UINT32(2, coinCounter.getEdgeCount());
+}
+
+void test_multi_pulse_delta_after_long_gap_credits_every_coin() {
+    MqttLteClient client(Serial1, MODEM_PWRKEY, MODEM_DTR, MODEM_FLIGHT, MODEM_TX, MODEM_RX);
+    IoExpander io(TCA9535_ADDR, I2C_SDA_PIN, I2C_SCL_PIN, INT_PIN);
+    startIo(io);
+    CarWashController controller(client, 0, io, NULL);
+    tick(controller, millis() + TICK_MS);
+
+    // Three coins while the loop sat in a 3 s wait: one read sees all of them
+    uint32_t since = Trace::getRecorded();
+    for (int i = 0; i < 3; i++) {
+        sim::pulsePin(COIN_PCNT_PIN, COIN_PULSE_US);
+        sim::advanceMillis(COIN_COOLDOWN_MS);
+    }
+    controller.update();
+
+    TEST_ASSERT_EQUAL(STATE_IDLE, controller.getCurrentState());
+    TEST_ASSERT_EQUAL(3, controller.getTokensLeft());
+    std::vector<uint32_t> totals = coinRecordsSince(since);
+    TEST_ASSERT_EQUAL_UINT32(3, totals.size());
+    for (size_t i = 0; i < totals.size(); i++) {
+        TEST_ASSERT_EQUAL_UINT32(i + 1, totals[i]);
+    }
+}
+
+void test_short_pulses_are_rejected() {
+    MqttLteClient client(Serial1, MODEM_PWRKEY, MODEM_DTR, MODEM_FLIGHT, MODEM_TX, MODEM_RX);
+    IoExpander io(TCA9535_ADDR, I2C_SDA_PIN, I2C_SCL_PIN, INT_PIN);
+    startIo(io);
+    CarWashController controller(client, 0, io, NULL);
+    tick(controller, millis() + TICK_MS);
+
+    // A relay transient: four short pulses inside one tick, then one just
+    // under the minimum width. PCNT counts them all; none is a coin
+    uint32_t since = Trace::getRecorded();
+    for (int i = 0; i < 4; i++) {
+        sim::pulsePin(COIN_PCNT_PIN, GLITCH_US);
+    }
+    sim::pulsePin(COIN_PCNT_PIN, COIN_MIN_PULSE_WIDTH_MS * 1000 - 1);
+    tick(controller, millis() + TICK_MS);
+
+    TEST_ASSERT_FALSE(controller.isMachineLoaded());
+    TEST_ASSERT_EQUAL_UINT32(5, coinCounter.getRejectedCount());
+    TEST_ASSERT_EQUAL_UINT32(5, coinCounter.getEdgeCount());
+
+    // A bounce on the leading edge restarts the measurement; the coin still
+    // counts once, and a pulse of exactly the minimum width is a coin
+    sim::pulsePin(COIN_PCNT_PIN, GLITCH_US);
+    sim::pulsePin(COIN_PCNT_PIN, COIN_PULSE_US);
+    tick(controller, millis() + COIN_COOLDOWN_MS);
+    sim::pulsePin(COIN_PCNT_PIN, COIN_MIN_PULSE_WIDTH_MS * 1000);
+    tick(controller, millis() + TICK_MS);
+
+    TEST_ASSERT_EQUAL(2, controller.getTokensLeft());
+    std::vector<uint32_t> totals = coinRecordsSince(since);
+    TEST_ASSERT_EQUAL_UINT32(2, totals.size());
+    TEST_ASSERT_EQUAL_UINT32(1, totals[0]);
+    TEST_ASSERT_EQUAL_UINT32(2, totals[1]);
+    TEST_ASSERT_EQUAL_UINT32(6, coinCounter.getRejectedCount());
+}
+
+int main(int argc, char** argv) {
+    (void)argc;
+    (void)argv;
+
+    // Set up the way setup() in main.cpp does, on a configured machine
+    sim::setSerialEcho(getenv("FULLWASH_REPLAY_VERBOSE") != NULL);
+    Logger::init(DEFAULT_LOG_LEVEL, 115200);
+    Profiler::begin();
+    Profiler::setEventTask(xTaskGetCurrentTaskHandle());
+    Trace::begin();
+    mqttMessagePool.begin();
+    updateMQTTTopics("42", "prod");
+    xIoExpanderMutex = xSemaphoreCreateMutex();
+    xMqttPublishQueue = xQueueCreate(MQTT_QUEUE_SIZE, sizeof(MqttMessageHandle));
+
+    UNITY_BEGIN();
+    RUN_TEST(test_single_pulse_credits_one_coin);
+    RUN_TEST(test_multi_pulse_delta_after_long_gap_credits_every_coin);
+    RUN_TEST(test_short_pulses_are_rejected);
+    return UNITY_END();
+}
@@ -0,0 +1,807 @@
+// Host replay tests for the controller, the input event queue, the display,
+// the BLE loader and inbound MQTT handling (env:native).
+//
+//   pio test -e native
+//   FULLWASH_REPLAY_TRACE=dump.bin pio test -e native   # replay a captured trace
+//
+// The benchmark replays bay 0's coin and button records through
+// IoExpander::postCoinEvent/postButtonPress and CarWashController::update(),
+// ticking the virtual clock every 10 ms the way loop() wakes, and reports per
+// event: host handling time, heap allocations and I2C transactions, plus the
+// controller's I2C transactions per virtual second. Without a capture it
+// replays the built-in session below. Traces are read from a binary BLE/MQTT
+// dump (see tools/README.md); serial "#TRACE" logs have to be converted first.
+//
+// The other replays: display snapshots rendered onto the CH453 model (frames
+// and bus time per refresh), a phone loading bay 0 over the BLE shims, and
+// inbound payloads routed through classifyTopic()/handleMqttMessage(), and
+// critical outbound messages stored in and replayed from the flash outbox.
+
+#include <Arduino.h>
+#include <unity.h>
+#include <chrono>
+#include <vector>
+#include "native_sim.h"
+#include "native_harness.h"
+#include "car_wash_controller.h"
+#include "display_manager.h"
+#include "ble_machine_loader.h"
+#include "io_expander.h"
+#include "input_event_queue.h"
+#include "mqtt_message_pool.h"
+#include "mqtt_inbound.h"
+#include "mqtt_outbox.h"
+#include "profiler.h"
+#include "trace.h"
+#include "logger.h"
+
+// Owned by main.cpp in the firmware
+SemaphoreHandle_t xIoExpanderMutex = NULL;
+QueueHandle_t xMqttPublishQueue = NULL;
+
+// Bus budget per event or deadline: one relay port write, plus the old
+// relay on a function switch
+static const uint32_t MAX_I2C_PER_EVENT = 2;
+
+// Replay step: a coin or button press on bay 0 at a trace timestamp
+struct ReplayStep {
+    uint32_t micros;
+    InputEventType type;
+    uint8_t button;
+};
+
+// Built-in session: two coins, start, switch, pause/resume, stop, a coin
+// while paused, then run until the tokens expire
+static const TraceRecord BUILTIN_TRACE[] = {
+    {1000000, TRACE_COIN, 0, 1, 1},
+    {1900000, TRACE_COIN, 0, 1, 2},
+    {3000000, TRACE_BUTTON, 0, 1, 0},
+    {3100000, TRACE_BUTTON, 0, 1, 0},    // Same press bouncing: ignored
+    {20000000, TRACE_BUTTON, 2, 1, 0},   // Switch function
+    {40000000, TRACE_BUTTON, 2, 1, 0},   // Pause
+    {41000000, TRACE_BUTTON, 2, 1, 0},   // Resume
+    {60000000, TRACE_BUTTON, 5, 1, 0},   // Stop button pauses
+    {62000000, TRACE_COIN, 0, 1, 3},
+    {65000000, TRACE_BUTTON, 1, 1, 0},   // Switch and resume
+    {300000000, TRACE_BUTTON, 0, 1, 0},
+    {400000000, TRACE_NONE, 0, 0, 0},    // End of session
+};
+
+// Bay 0's coin and button presses; other records (and other bays) are skipped
+static void appendSteps(const TraceRecord* records, size_t count, uint8_t version, std::vector<ReplayStep>& steps,
+                        uint32_t& endMicros) {
+    for (size_t i = 0; i < count; i++) {
+        const TraceRecord& record = records[i];
+        endMicros = record.micros;
+        uint8_t bay = version >= 2 ? record.a8 >> Trace::BAY_SHIFT : 0;
+        if (bay != 0) continue;
+        if (record.event == TRACE_COIN) {
+            steps.push_back({record.micros, INPUT_EVENT_COIN, 0});
+        } else if (record.event == TRACE_BUTTON && record.a16 == 1) {
+            uint8_t button = version >= 2 ? record.a8 & ((1 << Trace::BAY_SHIFT) - 1) : record.a8;
+            steps.push_back({record.micros, INPUT_EVENT_BUTTON_PRESS, button});
+        }
+    }
+}
+
+// FWTR dump stream (see trace.h); false if the file is missing or malformed
+static bool loadTraceDump(const char* path, std::vector<ReplayStep>& steps, uint32_t& endMicros) {
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) return false;
+    std::vector<uint8_t> data;
+    uint8_t buffer[4096];
+    size_t n;
+    while ((n = fread(buffer, 1, sizeof(buffer), file)) > 0) data.insert(data.end(), buffer, buffer + n);
+    fclose(file);
+
+    if (data.size() < Trace::HEADER_SIZE || memcmp(data.data(), "FWTR", 4) != 0 || data[5] != sizeof(TraceRecord)) {
+        return false;
+    }
+    uint8_t version = data[4];
+    size_t pos = Trace::HEADER_SIZE;
+    while (pos + Trace::BLOCK_HEADER_SIZE <= data.size()) {
+        uint8_t count = data[pos + 4];
+        pos += Trace::BLOCK_HEADER_SIZE;
+        if (count == 0) break;  // End block
+        if (pos + count * sizeof(TraceRecord) > data.size()) return false;
+        std::vector<TraceRecord> records(count);
+        memcpy(records.data(), data.data() + pos, count * sizeof(TraceRecord));
+        appendSteps(records.data(), count, version, steps, endMicros);
+        pos += count * sizeof(TraceRecord);
+    }
+    if (steps.empty()) return false;
+
+    // Start a second before the first input (timestamps are since boot and
+    // wrap every 71 minutes, so rebase with unsigned differences)
+    uint32_t first = steps[0].micros;
+    for (size_t i = 0; i < steps.size(); i++) steps[i].micros = steps[i].micros - first + 1000000;
+    endMicros = endMicros - first + 1000000;
+    return true;
+}
+
+void setUp() {
+    sim::resetI2c();
+    sim::setMicros((uint64_t)START_MS * 1000);
+}
+
+void tearDown() {}
+
+void test_event_queue_keeps_order_and_counts_drops() {
+    InputEventQueue queue;
+    for (uint32_t i = 0; i < InputEventQueue::CAPACITY + 8; i++) {
+        InputEvent event = {INPUT_EVENT_BUTTON_PRESS, (uint8_t)(i % NUM_BUTTONS), i};
+        TEST_ASSERT_EQUAL(i < InputEventQueue::CAPACITY, queue.push(event));
+    }
+    TEST_ASSERT_EQUAL_UINT32(InputEventQueue::CAPACITY, queue.size());
+    TEST_ASSERT_EQUAL_UINT32(8, queue.getDroppedCount());
+
+    InputEvent event;
+    for (uint32_t i = 0; i < InputEventQueue::CAPACITY; i++) {
+        TEST_ASSERT_TRUE(queue.pop(event));
+        TEST_ASSERT_EQUAL_UINT32(i, event.timestamp);
+    }
+    TEST_ASSERT_FALSE(queue.pop(event));
+}
+
+void test_coin_session_drives_relays() {
+    MqttLteClient client(Serial1, MODEM_PWRKEY, MODEM_DTR, MODEM_FLIGHT, MODEM_TX, MODEM_RX);
+    IoExpander io(TCA9535_ADDR, I2C_SDA_PIN, I2C_SCL_PIN, INT_PIN);
+    startIo(io);
+    QueueHandle_t mailbox = xQueueCreate(1, sizeof(DisplaySnapshot));
+    CarWashController controller(client, 0, io, mailbox);
+    uint8_t relayBit = 1 << RELAY_INDICES[0];
+
+    // The controller ignores coins within COIN_COOLDOWN_MS of its start
+    tick(controller, millis() + COIN_COOLDOWN_MS + TICK_MS);
+    io.postCoinEvent(millis());
+    tick(controller, millis() + TICK_MS);
+    TEST_ASSERT_EQUAL(STATE_IDLE, controller.getCurrentState());
+    TEST_ASSERT_EQUAL(1, controller.getTokensLeft());
+
+    tick(controller, millis() + 100);
+    io.postButtonPress(0, millis());
+    tick(controller, millis() + TICK_MS);
+    TEST_ASSERT_EQUAL(STATE_RUNNING, controller.getCurrentState());
+    TEST_ASSERT_EQUAL_HEX8(relayBit, sim::getExpanderRegister(TCA9535_ADDR, OUTPUT_PORT1));
+
+    DisplaySnapshot snapshot;
+    TEST_ASSERT_TRUE(xQueueReceive(mailbox, &snapshot, 0) == pdTRUE);
+    TEST_ASSERT_EQUAL(STATE_RUNNING, snapshot.state);
+
+    tick(controller, millis() + 1000);
+    io.postButtonPress(0, millis());
+    tick(controller, millis() + TICK_MS);
+    TEST_ASSERT_EQUAL(STATE_PAUSED, controller.getCurrentState());
+    TEST_ASSERT_EQUAL_HEX8(0, sim::getExpanderRegister(TCA9535_ADDR, OUTPUT_PORT1) & relayBit);
+
+    vQueueDelete(mailbox);
+}
+
+void test_init_message_loads_session() {
+    MqttLteClient client(Serial1, MODEM_PWRKEY, MODEM_DTR, MODEM_FLIGHT, MODEM_TX, MODEM_RX);
+    IoExpander io(TCA9535_ADDR, I2C_SDA_PIN, I2C_SCL_PIN, INT_PIN);
+    startIo(io);
+    CarWashController controller(client, 0, io, NULL);
+
+    const char* init = "{\"session_id\":\"s-1\",\"user_id\":\"u-1\",\"user_name\":\"alice\",\"tokens\":3,"
+                       "\"timestamp\":\"2026-01-01T10:00:00Z\"}";
+    controller.handleMqttMessage(TOPIC_INIT, reinterpret_cast<const uint8_t*>(init), strlen(init));
+    tick(controller, millis() + TICK_MS);
+
+    TEST_ASSERT_TRUE(controller.isMachineLoaded());
+    TEST_ASSERT_EQUAL(STATE_IDLE, controller.getCurrentState());
+    TEST_ASSERT_EQUAL(3, controller.getTokensLeft());
+    TEST_ASSERT_EQUAL_STRING("alice", controller.getUserName());
+
+    // Grace period runs out without a button press
+    tick(controller, millis() + GRACE_PERIOD_TIMEOUT + 1000);
+    TEST_ASSERT_EQUAL(2, controller.getTokensLeft());
+}
+
+void test_topic_table_rebuild_keeps_old_pointers() {
+    const char* before = mqttTopic(TOPIC_STATE);
+    const char* beforeId = bayMachineId(0);
+    TEST_ASSERT_EQUAL_STRING("machines/42/state", before);
+
+    updateMQTTTopics("7", "local");
+    TEST_ASSERT_EQUAL_STRING("local/7/state", mqttTopic(TOPIC_STATE));
+    TEST_ASSERT_EQUAL_UINT32(strlen("local/7/state"), mqttTopicLength(TOPIC_STATE));
+    TEST_ASSERT_EQUAL_STRING("7", bayMachineId(0));
+    TEST_ASSERT_EQUAL(TOPIC_GET_STATE, classifyTopic("local/7/get_state"));
+    TEST_ASSERT_EQUAL(TOPIC_UNKNOWN, classifyTopic("machines/42/get_state"));
+    // A reader that fetched its strings before the swap still sees them whole
+    TEST_ASSERT_EQUAL_STRING("machines/42/state", before);
+    TEST_ASSERT_EQUAL_STRING("42", beforeId);
+
+    updateMQTTTopics("42", "prod");
+    TEST_ASSERT_EQUAL(TOPIC_INIT, classifyTopic("machines/42/init"));
+}
+
+void test_replay_benchmark() {
+    std::vector<ReplayStep> steps;
+    uint32_t endMicros = 0;
+    const char* path = getenv("FULLWASH_REPLAY_TRACE");
+    if (path != NULL && *path != '\0') {
+        TEST_ASSERT_TRUE_MESSAGE(loadTraceDump(path, steps, endMicros), "FULLWASH_REPLAY_TRACE is not a trace dump");
+    } else {
+        appendSteps(BUILTIN_TRACE, sizeof(BUILTIN_TRACE) / sizeof(BUILTIN_TRACE[0]), Trace::VERSION, steps,
+                    endMicros);
+    }
+
+    MqttLteClient client(Serial1, MODEM_PWRKEY, MODEM_DTR, MODEM_FLIGHT, MODEM_TX, MODEM_RX);
+    IoExpander io(TCA9535_ADDR, I2C_SDA_PIN, I2C_SCL_PIN, INT_PIN);
+    startIo(io);
+    QueueHandle_t mailbox = xQueueCreate(1, sizeof(DisplaySnapshot));
+    CarWashController controller(client, 0, io, mailbox);
+
+    // Trace time 0 is START_MS on the virtual clock
+    Profiler::resetLatencyStats();
+    unsigned long base = millis();
+    uint32_t busStart = sim::getI2cTransactions();
+    uint64_t allocationsStart = sim::getAllocationCount();
+    uint64_t eventAllocations = 0;
+    uint32_t totalEventI2c = 0;
+    uint32_t maxEventI2c = 0;
+    uint32_t idleTicks = 0;
+    uint32_t maxTickI2c = 0;
+    double totalUs = 0;
+    double maxUs = 0;
+    size_t events = 0;
+
+    for (size_t i = 0; i <= steps.size(); i++) {
+        unsigned long due = base + (i < steps.size() ? steps[i].micros : endMicros) / 1000;
+
+        // Ticks up to the event only run deadlines (token expiry switches relays)
+        while (millis() + TICK_MS <= due) {
+            uint32_t before = sim::getI2cTransactions();
+            sim::advanceMillis(TICK_MS);
+            controller.update();
+            maxTickI2c = std::max(maxTickI2c, sim::getI2cTransactions() - before);
+            idleTicks++;
+        }
+        if (i == steps.size()) break;
+        sim::setMicros((uint64_t)due * 1000);
+
+        bool posted = steps[i].type == INPUT_EVENT_COIN ? io.postCoinEvent(millis())
+                                                        : io.postButtonPress(steps[i].button, millis());
+        if (!posted) continue;  // Debounced
+
+        uint32_t i2cBefore = sim::getI2cTransactions();
+        uint64_t allocationsBefore = sim::getAllocationCount();
+        auto start = std::chrono::steady_clock::now();
+        controller.update();
+        double us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+        uint32_t eventI2c = sim::getI2cTransactions() - i2cBefore;
+
+        eventAllocations += sim::getAllocationCount() - allocationsBefore;
+        totalEventI2c += eventI2c;
+        maxEventI2c = std::max(maxEventI2c, eventI2c);
+        totalUs += us;
+        maxUs = std::max(maxUs, us);
+        events++;
+    }
+
+    double seconds = (millis() - base) / 1000.0;
+    uint32_t busTotal = sim::getI2cTransactions() - busStart;
+    uint64_t allocations = sim::getAllocationCount() - allocationsStart;
+    Profiler::EventStats coins = Profiler::getEventStats(PROFILED_EVENT_COIN);
+    Profiler::EventStats buttons = Profiler::getEventStats(PROFILED_EVENT_BUTTON);
+
+    printf("\nReplay: %u events over %.1f s (%s), %u idle ticks\n", (unsigned int)events, seconds,
+           path != NULL && *path != '\0' ? path : "built-in session", (unsigned int)idleTicks);
+    printf("  handling (host)    mean %.1f us, max %.1f us\n", events ? totalUs / events : 0.0, maxUs);
+    // State messages go out from later ticks, so the second figure includes them
+    printf("  allocations/event  %.2f in its update(), %.2f over the replay%s\n",
+           events ? (double)eventAllocations / events : 0.0, events ? (double)allocations / events : 0.0,
+           sim::mallocIsCounted() ? "" : " (operator new only)");
+    printf("  I2C/event          mean %.2f, max %u\n", events ? (double)totalEventI2c / events : 0.0,
+           (unsigned int)maxEventI2c);
+    printf("  I2C/s              %.2f (controller only, no input polling)\n", seconds > 0 ? busTotal / seconds : 0.0);
+    printf("  profiler           coins %u (bus reads %u), buttons %u (bus reads %u)\n", (unsigned int)coins.handling.count,
+           (unsigned int)coins.busOps, (unsigned int)buttons.handling.count, (unsigned int)buttons.busOps);
+
+    TEST_ASSERT_TRUE(events > 0);
+    TEST_ASSERT_LESS_OR_EQUAL_UINT32(MAX_I2C_PER_EVENT, maxEventI2c);
+    TEST_ASSERT_LESS_OR_EQUAL_UINT32(MAX_I2C_PER_EVENT, maxTickI2c);
+    TEST_ASSERT_EQUAL_UINT32(0, io.getDroppedInputEvents());
+    // Events and state messages run on fixed buffers
+    TEST_ASSERT_EQUAL_UINT32(0, (uint32_t)allocations);
+
+    vQueueDelete(mailbox);
+}
+
+// ---- Display: DisplayManager rendering onto the CH453 model ----
+
+static void readDisplayDigits(uint8_t* digits) {
+    for (uint8_t i = 0; i < 8; i++) digits[i] = sim::getDisplayDigit(i);
+}
+
+static uint32_t changedDisplayDigits(const uint8_t* before) {
+    uint32_t changed = 0;
+    for (uint8_t i = 0; i < 8; i++) changed += before[i] != sim::getDisplayDigit(i);
+    return changed;
+}
+
+// Frames one render() clocks out (checked against the digits it changed)
+static uint32_t renderFrames(DisplayManager& display, const DisplaySnapshot& snapshot) {
+    uint8_t before[8];
+    readDisplayDigits(before);
+    uint32_t frames = sim::getDisplayFrames();
+    display.render(snapshot);
+    frames = sim::getDisplayFrames() - frames;
+    TEST_ASSERT_EQUAL_UINT32(changedDisplayDigits(before), frames);
+    return frames;
+}
+
+void test_display_renders_snapshots() {
+    sim::resetDisplay();
+    DisplayManager display(DISPLAY_SDA_PIN, DISPLAY_SCL_PIN);
+    // begin(10): system parameters (2/4 duty, display on), a test pattern
+    // and a clear of all 16 digit registers, then dashes on the 8 wired ones
+    TEST_ASSERT_EQUAL_UINT32(1 + 16 + 16 + 8, sim::getDisplayFrames());
+    TEST_ASSERT_EQUAL_HEX8(0x41, sim::getDisplaySystemParam());
+    for (uint8_t i = 0; i < 8; i++) TEST_ASSERT_EQUAL_HEX8(0x40, sim::getDisplayDigit(i));
+
+    // "01.00" on top, " 2.00" at the bottom
+    DisplaySnapshot snapshot = {STATE_IDLE, 120, 100};
+    TEST_ASSERT_EQUAL_UINT32(8, renderFrames(display, snapshot));
+    const uint8_t idle[8] = {0x3F, 0x86, 0x3F, 0x3F, 0x00, 0xDB, 0x3F, 0x3F};
+    for (uint8_t i = 0; i < 8; i++) TEST_ASSERT_EQUAL_HEX8(idle[i], sim::getDisplayDigit(i));
+
+    // "00.99" / " 1.59": three digits on each display
+    snapshot = {STATE_RUNNING, 119, 99};
+    TEST_ASSERT_EQUAL_UINT32(6, renderFrames(display, snapshot));
+    TEST_ASSERT_EQUAL_UINT32(0, renderFrames(display, snapshot));
+    snapshot.secondsLeft = 118;
+    TEST_ASSERT_EQUAL_UINT32(1, renderFrames(display, snapshot));
+    TEST_ASSERT_EQUAL_HEX8(0x7F, sim::getDisplayDigit(7));
+
+    snapshot = {STATE_FREE, 0, 0};
+    TEST_ASSERT_EQUAL_UINT32(8, renderFrames(display, snapshot));
+
+    // A NACKed frame reports failure, and rendering the same snapshot again
+    // (the display task's retry while nothing new is pushed) rewrites it
+    sim::setDisplayMissing(true);
+    snapshot = {STATE_IDLE, 120, 100};
+    TEST_ASSERT_FALSE(display.render(snapshot));
+    TEST_ASSERT_EQUAL_HEX8(0x40, sim::getDisplayDigit(0));
+    TEST_ASSERT_FALSE(display.render(snapshot));
+    sim::setDisplayMissing(false);
+    TEST_ASSERT_TRUE(display.render(snapshot));
+    for (uint8_t i = 0; i < 8; i++) TEST_ASSERT_EQUAL_HEX8(idle[i], sim::getDisplayDigit(i));
+    TEST_ASSERT_EQUAL_UINT32(0, renderFrames(display, snapshot));
+
+    // Same for a failed FREE frame
+    sim::setDisplayMissing(true);
+    snapshot = {STATE_FREE, 0, 0};
+    TEST_ASSERT_FALSE(display.render(snapshot));
+    sim::setDisplayMissing(false);
+    TEST_ASSERT_TRUE(display.render(snapshot));
+    for (uint8_t i = 0; i < 8; i++) TEST_ASSERT_EQUAL_HEX8(0x40, sim::getDisplayDigit(i));
+}
+
+// The display task's loop: render every snapshot bay 0 pushes to the
+// mailbox during a session, and report the bus traffic per refresh
+void test_display_refresh_follows_session() {
+    sim::resetDisplay();
+    DisplayManager display(DISPLAY_SDA_PIN, DISPLAY_SCL_PIN);
+    MqttLteClient client(Serial1, MODEM_PWRKEY, MODEM_DTR, MODEM_FLIGHT, MODEM_TX, MODEM_RX);
+    IoExpander io(TCA9535_ADDR, I2C_SDA_PIN, I2C_SCL_PIN, INT_PIN);
+    startIo(io);
+    QueueHandle_t mailbox = xQueueCreate(1, sizeof(DisplaySnapshot));
+    CarWashController controller(client, 0, io, mailbox);
+
+    const char* init = "{\"session_id\":\"s-2\",\"user_id\":\"u-2\",\"user_name\":\"bob\",\"tokens\":2}";
+    controller.handleMqttMessage(TOPIC_INIT, reinterpret_cast<const uint8_t*>(init), strlen(init));
+
+    uint32_t refreshes = 0;
+    uint32_t totalFrames = 0;
+    uint32_t maxFrames = 0;
+    uint64_t busMicros = 0;
+    unsigned long pressAt = millis() + 2000;
+    unsigned long end = millis() + 65000;
+    bool pressed = false;
+    while (millis() < end) {
+        sim::advanceMillis(TICK_MS);
+        if (!pressed && millis() >= pressAt) {
+            io.postButtonPress(0, millis());
+            pressed = true;
+        }
+        controller.update();
+
+        DisplaySnapshot snapshot;
+        if (xQueueReceive(mailbox, &snapshot, 0) != pdTRUE) continue;
+        uint64_t start = sim::nowMicros();
+        uint32_t frames = renderFrames(display, snapshot);
+        busMicros += sim::nowMicros() - start;
+        totalFrames += frames;
+        maxFrames = std::max(maxFrames, frames);
+        refreshes++;
+    }
+
+    printf("\nDisplay: %u refreshes over a 65 s session\n", (unsigned int)refreshes);
+    printf("  frames/refresh     mean %.2f, max %u (one CH453 frame per changed digit)\n",
+           refreshes ? (double)totalFrames / refreshes : 0.0, (unsigned int)maxFrames);
+    printf("  bus time/refresh   %.0f us (bit-banged, virtual clock)\n", refreshes ? (double)busMicros / refreshes : 0.0);
+
+    TEST_ASSERT_EQUAL(STATE_RUNNING, controller.getCurrentState());
+    // About one refresh per second of countdown, each only the digits that changed
+    TEST_ASSERT_TRUE(refreshes >= 60);
+    TEST_ASSERT_LESS_OR_EQUAL_UINT32(8, maxFrames);
+    TEST_ASSERT_TRUE(totalFrames < refreshes * 4);
+
+    vQueueDelete(mailbox);
+}
+
+// ---- BLE: a phone loading a bay through BLEMachineLoader ----
+
+// userId|machineId|tokens|timestamp|hex HMAC-SHA256, as the backend issues it
+static std::string signLoadToken(const char* userId, const char* machineId, int tokens) {
+    char payload[128];
+    snprintf(payload, sizeof(payload), "%s|%s|%d|1767261600", userId, machineId, tokens);
+
+    uint8_t key[64];
+    memset(key, 0, sizeof(key));
+    memcpy(key, BLE_AUTH_SECRET, strlen(BLE_AUTH_SECRET));
+    uint8_t pad[64];
+    uint8_t digest[32];
+    mbedtls_sha256_context ctx;
+    for (int pass = 0; pass < 2; pass++) {
+        for (size_t i = 0; i < sizeof(pad); i++) pad[i] = key[i] ^ (pass == 0 ? 0x36 : 0x5c);
+        mbedtls_sha256_init(&ctx);
+        mbedtls_sha256_starts_ret(&ctx, 0);
+        mbedtls_sha256_update_ret(&ctx, pad, sizeof(pad));
+        if (pass == 0) {
+            mbedtls_sha256_update_ret(&ctx, reinterpret_cast<const uint8_t*>(payload), strlen(payload));
+        } else {
+            mbedtls_sha256_update_ret(&ctx, digest, sizeof(digest));
+        }
+        mbedtls_sha256_finish_ret(&ctx, digest);
+        mbedtls_sha256_free(&ctx);
+    }
+
+    std::string token(payload);
+    token += '|';
+    for (size_t i = 0; i < sizeof(digest); i++) {
+        char hex[3];
+        snprintf(hex, sizeof(hex), "%02x", digest[i]);
+        token += hex;
+    }
+    return token;
+}
+
+static void writeLoadData(const char* userId, const char* userName, const char* tokens) {
+    TEST_ASSERT_TRUE(sim::bleWrite(USER_ID_CHAR_UUID, userId));
+    TEST_ASSERT_TRUE(sim::bleWrite(USER_NAME_CHAR_UUID, userName));
+    TEST_ASSERT_TRUE(sim::bleWrite(TOKENS_CHAR_UUID, tokens));
+}
+
+void test_sha256_matches_reference() {
+    // FIPS 180-2 test vector, and one spanning two blocks
+    uint8_t digest[32];
+    mbedtls_sha256_ret(reinterpret_cast<const uint8_t*>("abc"), 3, digest, 0);
+    TEST_ASSERT_EQUAL_HEX8(0xba, digest[0]);
+    TEST_ASSERT_EQUAL_HEX8(0x78, digest[1]);
+    TEST_ASSERT_EQUAL_HEX8(0xad, digest[31]);
+    const char* two = "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq";
+    mbedtls_sha256_ret(reinterpret_cast<const uint8_t*>(two), strlen(two), digest, 0);
+    TEST_ASSERT_EQUAL_HEX8(0x24, digest[0]);
+    TEST_ASSERT_EQUAL_HEX8(0x8d, digest[1]);
+    TEST_ASSERT_EQUAL_HEX8(0xc1, digest[31]);
+}
+
+void test_ble_load_replay() {
+    sim::resetBle();
+    MqttLteClient client(Serial1, MODEM_PWRKEY, MODEM_DTR, MODEM_FLIGHT, MODEM_TX, MODEM_RX);
+    IoExpander io(TCA9535_ADDR, I2C_SDA_PIN, I2C_SCL_PIN, INT_PIN);
+    startIo(io);
+    // Bay 0 gets the display mailbox, which the packed status is built from
+    QueueHandle_t mailbox = xQueueCreate(1, sizeof(DisplaySnapshot));
+    CarWashController controller(client, 0, io, mailbox);
+    tick(controller, millis() + TICK_MS);
+
+    CarWashController* controllers[1] = {&controller};
+    BLEMachineLoader loader;
+    TEST_ASSERT_TRUE(loader.begin(bayMachineId(0), controllers, 1));
+    TEST_ASSERT_EQUAL_STRING("FullWash-42", sim::getBleDeviceName());
+    TEST_ASSERT_TRUE(sim::isBleAdvertising());
+
+    TEST_ASSERT_TRUE(sim::bleConnect());
+    TEST_ASSERT_TRUE(loader.isConnected());
+    TEST_ASSERT_EQUAL(BLE_FAST_CONN_MAX_INTERVAL, sim::getBleRequestedMaxInterval());
+
+    writeLoadData("u-7", "carol", "2");
+    TEST_ASSERT_EQUAL_STRING("Tokens received", sim::getBleValue(LOAD_STATUS_CHAR_UUID).c_str());
+    std::string command = "LOAD|" + signLoadToken("u-7", "42", 2);
+
+    uint64_t allocationsBefore = sim::getAllocationCount();
+    auto start = std::chrono::steady_clock::now();
+    TEST_ASSERT_TRUE(sim::bleWrite(LOAD_COMMAND_CHAR_UUID, command.c_str()));
+    double us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+    uint64_t allocations = sim::getAllocationCount() - allocationsBefore;
+
+    TEST_ASSERT_EQUAL_STRING("Success: Machine loaded", sim::getBleValue(LOAD_STATUS_CHAR_UUID).c_str());
+    TEST_ASSERT_TRUE(loader.isLoadComplete());
+    TEST_ASSERT_EQUAL(STATE_IDLE, controller.getCurrentState());
+    TEST_ASSERT_EQUAL(2, controller.getTokensLeft());
+    TEST_ASSERT_EQUAL_STRING("carol", controller.getUserName());
+    // Nothing left to load on a one-bay machine
+    TEST_ASSERT_FALSE(sim::isBleAdvertising());
+
+    // The status the app polls follows the controller update
+    tick(controller, millis() + TICK_MS);
+    loader.publishStatus();
+    std::string value = sim::getBleValue(MACHINE_STATUS_CHAR_UUID);
+    TEST_ASSERT_EQUAL_UINT32(sizeof(BleMachineStatus), value.size());
+    BleMachineStatus status;
+    memcpy(&status, value.data(), sizeof(status));
+    TEST_ASSERT_EQUAL(BLE_STATUS_VERSION, status.version);
+    TEST_ASSERT_EQUAL(STATE_IDLE, status.state);
+    TEST_ASSERT_EQUAL(BLE_LOAD_SUCCESS, status.loadStatus);
+    TEST_ASSERT_EQUAL(2, status.tokens);
+    uint32_t notified = sim::getBleNotifications(MACHINE_STATUS_CHAR_UUID);
+    loader.publishStatus();
+    TEST_ASSERT_EQUAL_UINT32(notified, sim::getBleNotifications(MACHINE_STATUS_CHAR_UUID));
+
+    printf("\nBLE load: LOAD command %.1f us (host, HMAC included), %u allocations%s, %u status notifications\n", us,
+           (unsigned int)allocations, sim::mallocIsCounted() ? "" : " (operator new only)",
+           (unsigned int)sim::getBleNotifications(LOAD_STATUS_CHAR_UUID));
+
+    sim::bleDisconnect();
+    TEST_ASSERT_FALSE(loader.isConnected());
+    vQueueDelete(mailbox);
+}
+
+void test_ble_load_rejects_bad_commands() {
+    sim::resetBle();
+    MqttLteClient client(Serial1, MODEM_PWRKEY, MODEM_DTR, MODEM_FLIGHT, MODEM_TX, MODEM_RX);
+    IoExpander io(TCA9535_ADDR, I2C_SDA_PIN, I2C_SCL_PIN, INT_PIN);
+    startIo(io);
+    CarWashController controller(client, 0, io, NULL);
+    tick(controller, millis() + TICK_MS);
+
+    CarWashController* controllers[1] = {&controller};
+    BLEMachineLoader loader;
+    TEST_ASSERT_TRUE(loader.begin(bayMachineId(0), controllers, 1));
+    TEST_ASSERT_TRUE(sim::bleConnect());
+    writeLoadData("u-8", "dave", "3");
+
+    // Signature over different bytes
+    std::string token = signLoadToken("u-8", "42", 3);
+    token[token.size() - 1] = token[token.size() - 1] == '0' ? '1' : '0';
+    TEST_ASSERT_TRUE(sim::bleWrite(LOAD_COMMAND_CHAR_UUID, ("LOAD|" + token).c_str()));
+    TEST_ASSERT_EQUAL_STRING("Error: Invalid or expired authorization token",
+                             sim::getBleValue(LOAD_STATUS_CHAR_UUID).c_str());
+
+    // Signed for another machine, or for more tokens than were written
+    TEST_ASSERT_TRUE(sim::bleWrite(LOAD_COMMAND_CHAR_UUID, ("LOAD|" + signLoadToken("u-8", "43", 3)).c_str()));
+    TEST_ASSERT_EQUAL_STRING("Error: Invalid or expired authorization token",
+                             sim::getBleValue(LOAD_STATUS_CHAR_UUID).c_str());
+    TEST_ASSERT_TRUE(sim::bleWrite(LOAD_COMMAND_CHAR_UUID, ("LOAD|" + signLoadToken("u-8", "42", 9)).c_str()));
+    TEST_ASSERT_EQUAL_STRING("Error: Invalid or expired authorization token",
+                             sim::getBleValue(LOAD_STATUS_CHAR_UUID).c_str());
+
+    // Bay 1 does not exist on this loader
+    TEST_ASSERT_TRUE(sim::bleWrite(LOAD_COMMAND_CHAR_UUID, ("LOAD1|" + signLoadToken("u-8", "42", 3)).c_str()));
+    TEST_ASSERT_EQUAL_STRING("Error: Unknown bay", sim::getBleValue(LOAD_STATUS_CHAR_UUID).c_str());
+    TEST_ASSERT_TRUE(sim::bleWrite(LOAD_COMMAND_CHAR_UUID, "LOAD|"));
+    TEST_ASSERT_EQUAL_STRING("Error: Load command must include auth token (LOAD|token)",
+                             sim::getBleValue(LOAD_STATUS_CHAR_UUID).c_str());
+
+    TEST_ASSERT_EQUAL(STATE_FREE, controller.getCurrentState());
+    TEST_ASSERT_FALSE(loader.isLoadComplete());
+    TEST_ASSERT_TRUE(loader.isAnyBayFree());
+}
+
+// ---- MQTT: inbound messages routed the way mqtt_callback() does ----
+
+struct InboundMessage {
+    const char* topic;
+    const char* payload;
+};
+
+void test_mqtt_inbound_replay() {
+    MqttLteClient client(Serial1, MODEM_PWRKEY, MODEM_DTR, MODEM_FLIGHT, MODEM_TX, MODEM_RX);
+    IoExpander io(TCA9535_ADDR, I2C_SDA_PIN, I2C_SCL_PIN, INT_PIN);
+    startIo(io);
+    CarWashController controller(client, 0, io, NULL);
+    tick(controller, millis() + TICK_MS);
+
+    std::string oversize = "{\"command\":\"stats\",\"pad\":\"" + std::string(MqttInboundDocument::MAX_PAYLOAD, 'x') + "\"}";
+    const InboundMessage messages[] = {
+        {"machines/42/get_state", ""},
+        {"machines/42/config", "{\"timestamp\":\"2026-01-01T09:59:00Z\"}"},
+        {"machines/42/command", "{\"command\":\"stats\"}"},
+        {"machines/42/command", "{\"command\":\"set_log_level\",\"level\":\"INFO\"}"},
+        {"machines/42/command", "{\"level\":\"INFO\"}"},
+        {"machines/42/init", "{\"session_id\":\"s-3\",\"user_id\":\"u-3\",\"user_name\":\"erin\",\"tokens\":"},
+        {"machines/42/init", oversize.c_str()},
+        {"machines/7/init", "{\"session_id\":\"s-x\",\"user_id\":\"u-x\",\"user_name\":\"x\",\"tokens\":5}"},
+        {"machines/42/init", "{\"session_id\":\"s-3\",\"user_id\":\"u-3\",\"user_name\":\"erin\",\"tokens\":4,"
+                             "\"timestamp\":\"2026-01-01T10:00:00Z\"}"},
+        {"machines/42/get_state", ""},
+    };
+    const size_t count = sizeof(messages) / sizeof(messages[0]);
+
+    uint32_t routed = 0;
+    uint32_t commands = 0;
+    uint32_t rejected = 0;
+    double totalUs = 0;
+    double maxUs = 0;
+    uint64_t allocationsBefore = sim::getAllocationCount();
+    for (size_t i = 0; i < count; i++) {
+        const uint8_t* payload = reinterpret_cast<const uint8_t*>(messages[i].payload);
+        unsigned len = strlen(messages[i].payload);
+        auto start = std::chrono::steady_clock::now();
+
+        uint8_t bay = 0;
+        MqttTopicId topic = classifyTopic(messages[i].topic, &bay);
+        if (topic == TOPIC_UNKNOWN) {
+            rejected++;
+        } else if (topic == TOPIC_COMMAND) {
+            // Device-wide commands are handled in main.cpp; only the decode is replayed
+            if (mqttInbound.parse(payload, len) &&
+                parseMqttCommand(mqttInbound.doc()["command"] | (const char*)NULL) != MQTT_COMMAND_UNKNOWN) {
+                commands++;
+            } else {
+                rejected++;
+            }
+        } else {
+            TEST_ASSERT_EQUAL(0, bay);
+            controller.handleMqttMessage(topic, payload, len);
+            routed++;
+        }
+
+        double us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+        totalUs += us;
+        maxUs = std::max(maxUs, us);
+    }
+    uint64_t allocations = sim::getAllocationCount() - allocationsBefore;
+    tick(controller, millis() + TICK_MS);
+
+    printf("\nMQTT inbound: %u messages (%u to the controller, %u commands, %u rejected)\n", (unsigned int)count,
+           (unsigned int)routed, (unsigned int)commands, (unsigned int)rejected);
+    printf("  handling (host)    mean %.1f us, max %.1f us\n", totalUs / count, maxUs);
+    printf("  allocations        %u%s, arena peak %u of %u bytes\n", (unsigned int)allocations,
+           sim::mallocIsCounted() ? "" : " (operator new only)", (unsigned int)mqttInbound.getArenaPeak(),
+           (unsigned int)MqttInboundDocument::ARENA_SIZE);
+
+    TEST_ASSERT_EQUAL_UINT32(2, commands);
+    TEST_ASSERT_EQUAL_UINT32(2, rejected);  // Foreign topic, command without a name
+    // The truncated and oversize INITs are dropped; the last one loads
+    TEST_ASSERT_TRUE(controller.isMachineLoaded());
+    TEST_ASSERT_EQUAL(4, controller.getTokensLeft());
+    TEST_ASSERT_EQUAL_STRING("erin", controller.getUserName());
+    // Payloads are parsed into the inbound arena and copied into inline strings
+    TEST_ASSERT_EQUAL_UINT32(0, (uint32_t)allocations);
+    TEST_ASSERT_LESS_OR_EQUAL_UINT32(MqttInboundDocument::ARENA_SIZE, mqttInbound.getArenaPeak());
+}
+
+// ---- MQTT: outbound messages through the pool and publish queue ----
+
+void test_mqtt_publish_queue() {
+    MqttLteClient client(Serial1, MODEM_PWRKEY, MODEM_DTR, MODEM_FLIGHT, MODEM_TX, MODEM_RX);
+    IoExpander io(TCA9535_ADDR, I2C_SDA_PIN, I2C_SCL_PIN, INT_PIN);
+    startIo(io);
+    CarWashController controller(client, 0, io, NULL);
+    xQueueReset(xMqttPublishQueue);
+
+    const uint8_t payload[] = {0x81, 0x00, 0x7f};
+    bool queued = controller.queueMqttPayload(TOPIC_ACTION, payload, sizeof(payload), QOS0_AT_MOST_ONCE, true);
+#if ENABLE_MQTT
+    TEST_ASSERT_TRUE(queued);
+    MqttMessageHandle handle = MQTT_INVALID_HANDLE;
+    TEST_ASSERT_EQUAL(pdTRUE, xQueueReceive(xMqttPublishQueue, &handle, 0));
+    MqttMessage* message = mqttMessagePool.get(handle);
+    TEST_ASSERT_NOT_NULL(message);
+    TEST_ASSERT_EQUAL(TOPIC_ACTION, message->topicId);
+    TEST_ASSERT_EQUAL(0, message->bay);
+    TEST_ASSERT_TRUE(message->isCritical);
+    TEST_ASSERT_EQUAL_UINT16(sizeof(payload), message->payloadLength);
+    TEST_ASSERT_EQUAL_MEMORY(payload, message->payload(), sizeof(payload));
+    TEST_ASSERT_EQUAL_STRING("machines/42/action", message->topic());
+    mqttMessagePool.release(handle);
+#else
+    // BLE only build: nothing is pooled or queued
+    TEST_ASSERT_FALSE(queued);
+#endif
+    TEST_ASSERT_EQUAL(0, uxQueueMessagesWaiting(xMqttPublishQueue));
+    TEST_ASSERT_EQUAL_UINT16(0, mqttMessagePool.getInUse());
+}
+
+#if ENABLE_MQTT
+// ---- MQTT: critical messages through the flash outbox ----
+
+static std::vector<std::string> replayedMessages;
+
+static bool collectReplayed(const char* topic, const uint8_t* payload, size_t length, uint8_t qos, void* context) {
+    (void)qos;
+    (void)context;
+    replayedMessages.push_back(std::string(topic) + " " + std::string((const char*)payload, length));
+    return true;
+}
+
+// Runs last: once begun, the outbox takes every critical message
+void test_mqtt_outbox_replay() {
+    MqttLteClient client(Serial1, MODEM_PWRKEY, MODEM_DTR, MODEM_FLIGHT, MODEM_TX, MODEM_RX);
+    IoExpander io(TCA9535_ADDR, I2C_SDA_PIN, I2C_SCL_PIN, INT_PIN);
+    startIo(io);
+    CarWashController controller(client, 0, io, NULL);
+    xQueueReset(xMqttPublishQueue);
+    sim::setPartition("outbox", 4 * MqttOutbox::SECTOR_SIZE);
+    TEST_ASSERT_TRUE(mqttOutbox.begin());
+
+    // Stored in the outbox when queued, not pooled
+    const char start[] = "{\"action\":\"START\"}";
+    TEST_ASSERT_TRUE(controller.queueMqttPayload(TOPIC_ACTION, (const uint8_t*)start, strlen(start),
+                                                 QOS1_AT_LEAST_ONCE, true));
+    TEST_ASSERT_EQUAL(0, uxQueueMessagesWaiting(xMqttPublishQueue));
+    TEST_ASSERT_EQUAL_UINT16(0, mqttMessagePool.getInUse());
+    TEST_ASSERT_EQUAL_UINT32(1, mqttOutbox.getPendingCount());
+
+    replayedMessages.clear();
+    TEST_ASSERT_EQUAL(1, mqttOutbox.replay(collectReplayed, NULL, MQTT_OUTBOX_REPLAY_BATCH));
+    TEST_ASSERT_EQUAL(1, replayedMessages.size());
+    TEST_ASSERT_EQUAL_STRING("machines/42/action {\"action\":\"START\"}", replayedMessages[0].c_str());
+    TEST_ASSERT_EQUAL_UINT32(0, mqttOutbox.getPendingCount());
+
+    // Non-critical messages still go through the pool and queue
+    TEST_ASSERT_TRUE(controller.queueMqttPayload(TOPIC_STATE, (const uint8_t*)start, strlen(start),
+                                                 QOS0_AT_MOST_ONCE, false));
+    TEST_ASSERT_EQUAL(1, uxQueueMessagesWaiting(xMqttPublishQueue));
+    MqttMessageHandle handle = MQTT_INVALID_HANDLE;
+    xQueueReceive(xMqttPublishQueue, &handle, 0);
+    mqttMessagePool.release(handle);
+
+    // Reboot before the publisher ran: the staged message was flushed, the
+    // acknowledged one is not replayed again
+    const char stop[] = "{\"action\":\"STOP\"}";
+    TEST_ASSERT_TRUE(controller.queueMqttPayload(TOPIC_ACTION, (const uint8_t*)stop, strlen(stop),
+                                                 QOS1_AT_LEAST_ONCE, true));
+    TEST_ASSERT_TRUE(mqttOutbox.flush());
+    MqttOutbox rebooted;
+    TEST_ASSERT_TRUE(rebooted.begin());
+    TEST_ASSERT_EQUAL_UINT32(1, rebooted.getPendingCount());
+    replayedMessages.clear();
+    TEST_ASSERT_EQUAL(1, rebooted.replay(collectReplayed, NULL, MQTT_OUTBOX_REPLAY_BATCH));
+    TEST_ASSERT_EQUAL_STRING("machines/42/action {\"action\":\"STOP\"}", replayedMessages[0].c_str());
+
+    MqttOutbox rebootedAgain;
+    TEST_ASSERT_TRUE(rebootedAgain.begin());
+    TEST_ASSERT_EQUAL_UINT32(0, rebootedAgain.getPendingCount());
+}
+#endif // ENABLE_MQTT
+
+int main(int argc, char** argv) {
+    (void)argc;
+    (void)argv;
+
+    // Set up the way setup() in main.cpp does, on a configured machine
+    sim::setSerialEcho(getenv("FULLWASH_REPLAY_VERBOSE") != NULL);
+    Logger::init(DEFAULT_LOG_LEVEL, 115200);
+    Profiler::begin();
+    Profiler::setEventTask(xTaskGetCurrentTaskHandle());
+    Trace::begin();
+    mqttMessagePool.begin();
+    updateMQTTTopics("42", "prod");
+    xIoExpanderMutex = xSemaphoreCreateMutex();
+    xMqttPublishQueue = xQueueCreate(MQTT_QUEUE_SIZE, sizeof(MqttMessageHandle));
+
+    UNITY_BEGIN();
+    RUN_TEST(test_event_queue_keeps_order_and_counts_drops);
+    RUN_TEST(test_coin_session_drives_relays);
+    RUN_TEST(test_init_message_loads_session);
+    RUN_TEST(test_topic_table_rebuild_keeps_old_pointers);
+    RUN_TEST(test_replay_benchmark);
+    RUN_TEST(test_display_renders_snapshots);
+    RUN_TEST(test_display_refresh_follows_session);
+    RUN_TEST(test_sha256_matches_reference);
+    RUN_TEST(test_ble_load_replay);
+    RUN_TEST(test_ble_load_rejects_bad_commands);
+    RUN_TEST(test_mqtt_inbound_replay);
+    RUN_TEST(test_mqtt_publish_queue);
+#if ENABLE_MQTT
+    RUN_TEST(test_mqtt_outbox_replay);
+#endif
+    return UNITY_END();
+}
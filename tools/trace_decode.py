@@ -0,0 +1,170 @@
+#!/usr/bin/env python3
+"""
+FullWash Machine Trace Decoder
+
+Decodes the binary event trace dumped by the firmware (see include/trace.h).
+
+Input can be:
+    - a serial log captured while running the "trace" / "trace all" console
+      command (the "#TRACE <hex>" lines are picked out, other lines ignored)
+    - the raw stream: trace topic MQTT payloads or Trace Dump BLE
+      notifications concatenated in the order received
+
+Usage:
+    python trace_decode.py serial.log              # Human-readable timeline
+    python trace_decode.py dump.bin --csv          # CSV for spreadsheets
+    cat serial.log | python trace_decode.py -      # Read from stdin
+"""
+
+import argparse
+import struct
+import sys
+
+MAGIC = b"FWTR"
+HEADER = struct.Struct("<4sBBHII")
+BLOCK = struct.Struct("<IBBH")
+RECORD = struct.Struct("<IBBHI")
+VERSIONS = (1, 2)
+BAY_SHIFT = 6  # Version 2: bay in the top bits of a8 (BUTTON, STATE, RELAY)
+
+# Must match the enums in the firmware
+EVENTS = {
+    1: "BOOT",
+    2: "BUTTON",
+    3: "COIN",
+    4: "STATE",
+    5: "RELAY",
+    6: "MQTT_ENQUEUE",
+    7: "MQTT_PUBLISH",
+    8: "MQTT_DROP",
+}
+STATES = ["FREE", "IDLE", "RUNNING", "PAUSED"]
+TOPICS = ["init", "config", "action", "state", "command", "get_state", "stats", "trace"]
+DROP_REASONS = {1: "pool full", 2: "queue full", 3: "retries exhausted", 4: "disconnected"}
+RESET_REASONS = ["unknown", "power-on", "external", "software", "panic", "int watchdog",
+                 "task watchdog", "watchdog", "deep sleep", "brownout", "sdio"]
+
+
+def name(table, index):
+    if isinstance(table, dict):
+        return table.get(index, str(index))
+    return table[index] if 0 <= index < len(table) else str(index)
+
+
+def split_bay(version, event, a8):
+    """Return (bay, a8 without the bay); version 1 traces had a single bay."""
+    if version < 2 or event not in (2, 3, 4, 5):
+        return 0, a8
+    if event == 3:
+        return a8, 0
+    return a8 >> BAY_SHIFT, a8 & ((1 << BAY_SHIFT) - 1)
+
+
+def describe(event, a8, a16, a32, bay=0):
+    prefix = "bay %d: " % bay if event in (2, 3, 4, 5) else ""
+    if event == 1:
+        return "reset reason: %s" % name(RESET_REASONS, a32)
+    if event == 2:
+        return prefix + "button %d %s" % (a8 + 1, "pressed" if a16 else "released")
+    if event == 3:
+        return prefix + "coin #%d%s" % (a32, " (PCNT)" if a16 else "")
+    if event == 4:
+        return prefix + "%s -> %s, %d tokens" % (name(STATES, a8), name(STATES, a16), a32)
+    if event == 5:
+        return prefix + "relay %d %s (port 0x%02X)" % (a8, "ON" if a16 else "OFF", a32 & 0xFF)
+    if event == 6:
+        return "%s, %d bytes, handle 0x%04X" % (name(TOPICS, a8), a16, a32)
+    if event == 7:
+        return "%s, %d bytes, queued %d ms" % (name(TOPICS, a8), a16, a32)
+    if event == 8:
+        return "%s, %d bytes, %s" % (name(TOPICS, a8), a16, name(DROP_REASONS, a32))
+    return "a8=%d a16=%d a32=%d" % (a8, a16, a32)
+
+
+def read_stream(path):
+    """Return the raw dump bytes from a serial log or a binary capture."""
+    data = sys.stdin.buffer.read() if path == "-" else open(path, "rb").read()
+    if data.startswith(MAGIC):
+        return data
+    stream = bytearray()
+    for line in data.decode("utf-8", errors="replace").splitlines():
+        marker = line.find("#TRACE ")
+        if marker >= 0:
+            stream += bytes.fromhex(line[marker + 7:].strip())
+    return bytes(stream)
+
+
+def parse(stream):
+    """Return (version, records); records yields (sequence, timestamp_us, event,
+    a8, a16, a32) and warns about gaps."""
+    offset = stream.find(MAGIC)
+    if offset < 0:
+        raise ValueError("no trace header found")
+    version, record_size = HEADER.unpack_from(stream, offset)[1:3]
+    if version not in VERSIONS or record_size != RECORD.size:
+        raise ValueError("unsupported trace version %d (record size %d)" % (version, record_size))
+    return version, parse_records(stream, offset)
+
+
+def parse_records(stream, offset):
+    magic, version, record_size, capacity, first, end = HEADER.unpack_from(stream, offset)
+    offset += HEADER.size
+    print("Trace: %d records requested (ring holds %d)" % (end - first, capacity), file=sys.stderr)
+
+    expected = first
+    while offset + BLOCK.size <= len(stream):
+        sequence, count, lost_low, lost_high = BLOCK.unpack_from(stream, offset)
+        offset += BLOCK.size
+        if count == 0:
+            lost = lost_low | (lost_high << 8)
+            if lost:
+                print("Warning: %d records overwritten in total" % lost, file=sys.stderr)
+            return
+        if sequence != expected:
+            print("Warning: %d records overwritten during the dump" % (sequence - expected), file=sys.stderr)
+        if offset + count * RECORD.size > len(stream):
+            break
+        for i in range(count):
+            yield (sequence + i,) + RECORD.unpack_from(stream, offset)
+            offset += RECORD.size
+        expected = sequence + count
+    print("Warning: dump is truncated (no end block)", file=sys.stderr)
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Decode a FullWash event trace dump")
+    parser.add_argument("input", help="serial log or raw dump file ('-' for stdin)")
+    parser.add_argument("--csv", action="store_true", help="print CSV instead of a timeline")
+    args = parser.parse_args()
+
+    try:
+        version, records = parse(read_stream(args.input))
+        records = list(records)
+    except (OSError, ValueError) as e:
+        print("Error: %s" % e, file=sys.stderr)
+        return 1
+
+    if args.csv:
+        print("sequence,time_us,delta_us,event,bay,a8,a16,a32,description")
+
+    # micros() wraps every ~71 minutes; unwrap to a timeline from the first record
+    previous = None
+    elapsed = 0
+    for sequence, micros, event, a8, a16, a32 in records:
+        delta = 0 if previous is None else (micros - previous) & 0xFFFFFFFF
+        elapsed += delta
+        previous = micros
+        event_name = name(EVENTS, event)
+        bay, a8 = split_bay(version, event, a8)
+        text = describe(event, a8, a16, a32, bay)
+        if args.csv:
+            print('%d,%d,%d,%s,%d,%d,%d,%d,"%s"' % (sequence, elapsed, delta, event_name, bay, a8, a16, a32,
+                                                   text))
+        else:
+            print("%8d  %12.6f s  +%9.3f ms  %-12s %s" % (sequence, elapsed / 1e6, delta / 1e3,
+                                                       event_name, text))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())